@@ -0,0 +1,560 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Copyright (c) 2018 Stanford University
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Author: Stephen Ibanez <sibanez@stanford.edu>
+ */
+
+#ifndef PIEO_ENGINE_H
+#define PIEO_ENGINE_H
+
+#include "ns3/assert.h"
+#include "ns3/pifo-engine.h"
+#include <algorithm>
+#include <limits>
+#include <vector>
+#include <stdint.h>
+
+namespace ns3 {
+
+/**
+ * \ingroup queue
+ * \brief An item stored in a PIEO engine along with its scheduling key and
+ *        its eligibility time
+ */
+template <typename T>
+struct PieoEntry
+{
+  uint64_t rank;      //!< the rank of the item (see PifoRankBefore)
+  uint64_t eligible;  //!< the time from which the item may be dequeued
+  uint64_t seq;       //!< the enqueue sequence number, breaks ties in FIFO order
+  T item;             //!< the item
+};
+
+/**
+ * \ingroup queue
+ * \brief Push-in, extract-out queue (Shrivastav, "Fast, Scalable, and
+ *        Programmable Packet Scheduler in Hardware", SIGCOMM 2019)
+ *
+ * Entries are pushed at the position given by their rank, as in a PIFO,
+ * but are extracted in rank order among the entries whose eligibility time
+ * has passed, which expresses non work-conserving policies (shaping,
+ * pacing) in the same structure as the scheduling policy.
+ *
+ * The entries are kept in rank order (FIFO among equal ranks), split into
+ * consecutive blocks of less than twice the block size. The blocks are the
+ * nodes of a treap ordered by rank, and each node holds the minimum
+ * eligibility time of its block and of its subtree. Both summaries are
+ * maintained incrementally on the path from the changed block to the root,
+ * so that every operation, including the splits, merges and removals of
+ * blocks, takes O(log n + block size) expected time.
+ */
+template <typename T>
+class PieoEngine
+{
+public:
+  typedef PieoEntry<T> Entry;  //!< The entries stored by the engine
+
+  /// Eligibility time of the empty subtrees, never reached
+  static const uint64_t NEVER = std::numeric_limits<uint64_t>::max ();
+
+  /**
+   * \brief Constructor
+   * \param blockSize the number of entries a block is split at twice of
+   */
+  explicit PieoEngine (uint32_t blockSize = 32)
+    : m_blockSize (std::max<uint32_t> (blockSize, 1)),
+      m_root (NIL),
+      m_size (0),
+      m_rng (2463534242u)
+  {
+  }
+
+  /**
+   * \brief Preallocate room for a number of entries
+   * \param n the number of entries
+   */
+  void Reserve (uint32_t n)
+  {
+    m_nodes.reserve (n / m_blockSize + 1);
+  }
+
+  /**
+   * \brief Insert an entry. The sequence numbers must increase
+   * \param entry the entry
+   */
+  void Push (const Entry &entry)
+  {
+    m_size++;
+    if (m_root == NIL)
+      {
+        m_root = NewNode ();
+        m_nodes[m_root].block.push_back (entry);
+        m_nodes[m_root].blockMin = entry.eligible;
+        Pull (m_root);
+        return;
+      }
+
+    // the last block whose first entry ranks before the new one, if any, or
+    // the first block
+    uint32_t target = NIL;
+    for (uint32_t x = m_root; x != NIL; )
+      {
+        if (Before (entry, m_nodes[x].block.front ()))
+          {
+            x = m_nodes[x].left;
+          }
+        else
+          {
+            target = x;
+            x = m_nodes[x].right;
+          }
+      }
+    if (target == NIL)
+      {
+        target = Leftmost (m_root);
+      }
+
+    Block &block = m_nodes[target].block;
+    block.insert (std::upper_bound (block.begin (), block.end (), entry, &PieoEngine::Before), entry);
+    m_nodes[target].blockMin = std::min (m_nodes[target].blockMin, entry.eligible);
+
+    if (block.size () >= 2 * m_blockSize)
+      {
+        // NewNode may reallocate the pool, do not hold references across it
+        uint32_t upper = NewNode ();
+        Block &lower = m_nodes[target].block;
+        m_nodes[upper].block.assign (lower.begin () + m_blockSize, lower.end ());
+        lower.resize (m_blockSize);
+        m_nodes[target].blockMin = MinEligible (lower);
+        m_nodes[upper].blockMin = MinEligible (m_nodes[upper].block);
+        UpdatePath (target);
+        InsertAfter (target, upper);
+        return;
+      }
+    UpdatePath (target);
+  }
+
+  /**
+   * \brief Get the eligible entry of lowest rank
+   * \param now the current time
+   * \return the entry, or a null pointer if no entry is eligible
+   */
+  const Entry *PeekEligible (uint64_t now) const
+  {
+    uint32_t x;
+    uint32_t i;
+    if (!Find (now, x, i))
+      {
+        return 0;
+      }
+    return &m_nodes[x].block[i];
+  }
+
+  /**
+   * \brief Remove the eligible entry of lowest rank. An entry must be eligible
+   * \param now the current time
+   * \return the entry
+   */
+  Entry PopEligible (uint64_t now)
+  {
+    uint32_t x;
+    uint32_t i;
+    bool found = Find (now, x, i);
+    NS_ASSERT (found);
+    return Extract (x, i);
+  }
+
+  /**
+   * \brief Get the entry of lowest rank, eligible or not
+   * \return the entry
+   */
+  const Entry &Top (void) const
+  {
+    NS_ASSERT (m_size > 0);
+    return m_nodes[Leftmost (m_root)].block.front ();
+  }
+
+  /**
+   * \brief Remove the entry of lowest rank, eligible or not
+   * \return the entry
+   */
+  Entry Pop (void)
+  {
+    NS_ASSERT (m_size > 0);
+    return Extract (Leftmost (m_root), 0);
+  }
+
+  /**
+   * \brief Get the earliest eligibility time of the entries
+   * \return the time, or NEVER if the engine is empty
+   */
+  uint64_t GetMinEligible (void) const
+  {
+    return SubtreeMin (m_root);
+  }
+
+  /**
+   * \return the number of entries
+   */
+  uint32_t Size (void) const
+  {
+    return m_size;
+  }
+
+  /**
+   * \return true if the engine holds no entry
+   */
+  bool Empty (void) const
+  {
+    return m_size == 0;
+  }
+
+private:
+  /// Consecutive entries, in rank order
+  typedef std::vector<Entry> Block;
+
+  /// Index of no node
+  static const uint32_t NIL = std::numeric_limits<uint32_t>::max ();
+
+  /// A block and its position in the treap
+  struct Node
+  {
+    Block block;           //!< the entries of the block, in rank order
+    uint64_t blockMin;     //!< the earliest eligibility time in the block
+    uint64_t subtreeMin;   //!< the earliest eligibility time in the subtree
+    uint32_t priority;     //!< the heap priority of the node
+    uint32_t parent;       //!< the parent node, or NIL for the root
+    uint32_t left;         //!< the blocks ranked before, or NIL
+    uint32_t right;        //!< the blocks ranked after, or NIL
+  };
+
+  /**
+   * \param lhs the first entry
+   * \param rhs the second entry
+   * \return true if \p lhs ranks before \p rhs
+   */
+  static bool Before (const Entry &lhs, const Entry &rhs)
+  {
+    return PifoRankBefore (lhs.rank, rhs.rank) || (lhs.rank == rhs.rank && lhs.seq < rhs.seq);
+  }
+
+  /**
+   * \param block a block
+   * \return the earliest eligibility time of the entries of the block
+   */
+  static uint64_t MinEligible (const Block &block)
+  {
+    uint64_t min = NEVER;
+    for (const Entry &entry : block)
+      {
+        min = std::min (min, entry.eligible);
+      }
+    return min;
+  }
+
+  /**
+   * \param x a node, or NIL
+   * \return the earliest eligibility time in the subtree of \p x
+   */
+  uint64_t SubtreeMin (uint32_t x) const
+  {
+    return (x == NIL ? NEVER : m_nodes[x].subtreeMin);
+  }
+
+  /**
+   * \param x a node
+   * \return the first node of the subtree of \p x
+   */
+  uint32_t Leftmost (uint32_t x) const
+  {
+    while (m_nodes[x].left != NIL)
+      {
+        x = m_nodes[x].left;
+      }
+    return x;
+  }
+
+  /**
+   * \param x a node
+   * \return the node following \p x in rank order, or NIL
+   */
+  uint32_t Successor (uint32_t x) const
+  {
+    if (m_nodes[x].right != NIL)
+      {
+        return Leftmost (m_nodes[x].right);
+      }
+    uint32_t p = m_nodes[x].parent;
+    while (p != NIL && m_nodes[p].right == x)
+      {
+        x = p;
+        p = m_nodes[p].parent;
+      }
+    return p;
+  }
+
+  /**
+   * \brief Recompute the subtree summary of a node from its children
+   * \param x the node
+   */
+  void Pull (uint32_t x)
+  {
+    Node &node = m_nodes[x];
+    node.subtreeMin = std::min (node.blockMin, std::min (SubtreeMin (node.left), SubtreeMin (node.right)));
+  }
+
+  /**
+   * \brief Recompute the subtree summaries from a node up to the root
+   * \param x the node
+   */
+  void UpdatePath (uint32_t x)
+  {
+    for (; x != NIL; x = m_nodes[x].parent)
+      {
+        Pull (x);
+      }
+  }
+
+  /**
+   * \brief Allocate a node holding an empty block
+   * \return the node
+   */
+  uint32_t NewNode (void)
+  {
+    uint32_t x;
+    if (!m_free.empty ())
+      {
+        x = m_free.back ();
+        m_free.pop_back ();
+      }
+    else
+      {
+        x = m_nodes.size ();
+        m_nodes.push_back (Node ());
+      }
+    // xorshift32
+    m_rng ^= m_rng << 13;
+    m_rng ^= m_rng >> 17;
+    m_rng ^= m_rng << 5;
+
+    Node &node = m_nodes[x];
+    node.block.clear ();
+    node.blockMin = NEVER;
+    node.subtreeMin = NEVER;
+    node.priority = m_rng;
+    node.parent = NIL;
+    node.left = NIL;
+    node.right = NIL;
+    return x;
+  }
+
+  /**
+   * \brief Replace the child of a node, or the root
+   * \param p the parent, or NIL to replace the root
+   * \param from the current child
+   * \param to the new child, or NIL
+   */
+  void ReplaceChild (uint32_t p, uint32_t from, uint32_t to)
+  {
+    if (p == NIL)
+      {
+        m_root = to;
+      }
+    else if (m_nodes[p].left == from)
+      {
+        m_nodes[p].left = to;
+      }
+    else
+      {
+        m_nodes[p].right = to;
+      }
+    if (to != NIL)
+      {
+        m_nodes[to].parent = p;
+      }
+  }
+
+  /**
+   * \brief Rotate a node above its parent, preserving the rank order
+   * \param x the node, which must not be the root
+   */
+  void RotateUp (uint32_t x)
+  {
+    uint32_t p = m_nodes[x].parent;
+    ReplaceChild (m_nodes[p].parent, p, x);
+    if (m_nodes[p].left == x)
+      {
+        uint32_t moved = m_nodes[x].right;
+        m_nodes[p].left = moved;
+        m_nodes[x].right = p;
+        if (moved != NIL)
+          {
+            m_nodes[moved].parent = p;
+          }
+      }
+    else
+      {
+        uint32_t moved = m_nodes[x].left;
+        m_nodes[p].right = moved;
+        m_nodes[x].left = p;
+        if (moved != NIL)
+          {
+            m_nodes[moved].parent = p;
+          }
+      }
+    m_nodes[p].parent = x;
+    Pull (p);
+    Pull (x);
+  }
+
+  /**
+   * \brief Link a detached node right after another one in rank order
+   * \param x the node to follow
+   * \param y the detached node
+   */
+  void InsertAfter (uint32_t x, uint32_t y)
+  {
+    if (m_nodes[x].right == NIL)
+      {
+        m_nodes[x].right = y;
+        m_nodes[y].parent = x;
+      }
+    else
+      {
+        uint32_t next = Leftmost (m_nodes[x].right);
+        m_nodes[next].left = y;
+        m_nodes[y].parent = next;
+      }
+    UpdatePath (y);
+    // rotations keep the summaries of the rotated subtree unchanged
+    while (m_nodes[y].parent != NIL && m_nodes[y].priority > m_nodes[m_nodes[y].parent].priority)
+      {
+        RotateUp (y);
+      }
+  }
+
+  /**
+   * \brief Unlink a node from the treap and release it
+   * \param x the node
+   */
+  void EraseNode (uint32_t x)
+  {
+    // rotate the node down to a leaf
+    while (m_nodes[x].left != NIL || m_nodes[x].right != NIL)
+      {
+        uint32_t l = m_nodes[x].left;
+        uint32_t r = m_nodes[x].right;
+        RotateUp ((r == NIL || (l != NIL && m_nodes[l].priority > m_nodes[r].priority)) ? l : r);
+      }
+    uint32_t p = m_nodes[x].parent;
+    ReplaceChild (p, x, NIL);
+    UpdatePath (p);
+    m_nodes[x].block.clear ();
+    m_free.push_back (x);
+  }
+
+  /**
+   * \brief Locate the eligible entry of lowest rank
+   * \param now the current time
+   * \param x set to the node of the block of the entry
+   * \param i set to the index of the entry in its block
+   * \return false if no entry is eligible
+   */
+  bool Find (uint64_t now, uint32_t &x, uint32_t &i) const
+  {
+    if (SubtreeMin (m_root) > now)
+      {
+        return false;
+      }
+    // descend to the first block holding an eligible entry
+    x = m_root;
+    while (true)
+      {
+        const Node &node = m_nodes[x];
+        if (SubtreeMin (node.left) <= now)
+          {
+            x = node.left;
+          }
+        else if (node.blockMin <= now)
+          {
+            break;
+          }
+        else
+          {
+            x = node.right;
+          }
+      }
+    const Block &block = m_nodes[x].block;
+    for (i = 0; block[i].eligible > now; i++)
+      {
+        NS_ASSERT (i + 1 < block.size ());
+      }
+    return true;
+  }
+
+  /**
+   * \brief Remove an entry and update the summaries
+   * \param x the node of the block of the entry
+   * \param i the index of the entry in its block
+   * \return the entry
+   */
+  Entry Extract (uint32_t x, uint32_t i)
+  {
+    Block &block = m_nodes[x].block;
+    Entry entry = block[i];
+    block.erase (block.begin () + i);
+    m_size--;
+
+    if (block.empty ())
+      {
+        EraseNode (x);
+        return entry;
+      }
+    uint32_t next = Successor (x);
+    if (next != NIL && block.size () + m_nodes[next].block.size () <= m_blockSize)
+      {
+        // keep the blocks large enough for the treap to stay shallow
+        Block &nextBlock = m_nodes[next].block;
+        block.insert (block.end (), nextBlock.begin (), nextBlock.end ());
+        m_nodes[x].blockMin = std::min (m_nodes[x].blockMin, m_nodes[next].blockMin);
+        EraseNode (next);
+      }
+    if (entry.eligible == m_nodes[x].blockMin)
+      {
+        m_nodes[x].blockMin = MinEligible (m_nodes[x].block);
+      }
+    UpdatePath (x);
+    return entry;
+  }
+
+  uint32_t m_blockSize;            //!< Half the number of entries a block is split at
+  std::vector<Node> m_nodes;       //!< The pool of nodes
+  std::vector<uint32_t> m_free;    //!< The released nodes of the pool
+  uint32_t m_root;                 //!< The root of the treap, or NIL if empty
+  uint32_t m_size;                 //!< Number of entries
+  uint32_t m_rng;                  //!< State of the generator of the node priorities
+};
+
+template <typename T>
+const uint64_t PieoEngine<T>::NEVER;
+
+template <typename T>
+const uint32_t PieoEngine<T>::NIL;
+
+} // namespace ns3
+
+#endif /* PIEO_ENGINE_H */
@@ -0,0 +1,243 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Copyright (c) 2018 Stanford University
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Author: Stephen Ibanez <sibanez@stanford.edu>
+ */
+
+#ifndef PIEO_QUEUE_H
+#define PIEO_QUEUE_H
+
+#include "ns3/queue.h"
+#include "ns3/log.h"
+#include "ns3/nstime.h"
+#include "ns3/simulator.h"
+#include "ns3/pieo-engine.h"
+#include <iterator>
+
+namespace ns3 {
+
+/**
+ * \ingroup queue
+ * \brief Template class for push-in, extract-out (PIEO) packet queues
+ *
+ * Every item is enqueued with a rank (see QueueDiscItem::GetRank, read once
+ * at enqueue)
+ * and an eligibility time. Items are dequeued in increasing order of rank,
+ * and in FIFO order among items with the same rank, but only among the
+ * items whose eligibility time has passed: Dequeue and Peek return 0 when
+ * the queue holds no eligible item, and GetNextEligibleTime tells when the
+ * next item becomes eligible (see PieoEngine).
+ *
+ * The items are stored in the list of the Queue base class, hence the
+ * traces and the statistics are the ones of a Queue; the engine orders
+ * iterators into the list.
+ */
+template <typename Item>
+class PieoQueue : public Queue<Item>
+{
+public:
+  /**
+   * \brief Get the type ID.
+   * \return the object TypeId
+   */
+  static TypeId GetTypeId (void);
+
+  PieoQueue ();
+  virtual ~PieoQueue ();
+
+  /**
+   * Place an item into the PieoQueue, eligible from now on
+   * \param item item to enqueue
+   * \return True if the operation was successful; false otherwise
+   */
+  virtual bool Enqueue (Ptr<Item> item);
+
+  /**
+   * Place an item into the PieoQueue
+   * \param item item to enqueue
+   * \param eligible the time from which the item may be dequeued
+   * \return True if the operation was successful; false otherwise
+   */
+  bool Enqueue (Ptr<Item> item, Time eligible);
+
+  /**
+   * Remove the eligible item of lowest rank, counting it as dequeued
+   * \return 0 if no item is eligible; the item otherwise.
+   */
+  virtual Ptr<Item> Dequeue (void);
+
+  /**
+   * Remove the eligible item of lowest rank or, if no item is eligible, the
+   * item of lowest rank, counting it as dropped
+   * \return 0 if the PieoQueue is empty; the item otherwise.
+   */
+  virtual Ptr<Item> Remove (void);
+
+  /**
+   * Get a copy of the eligible item of lowest rank without removing it
+   * \return 0 if no item is eligible; the item otherwise.
+   */
+  virtual Ptr<const Item> Peek (void) const;
+
+  /**
+   * Get the earliest eligibility time of the queued items
+   * \return the time, or Time::Max () if the PieoQueue is empty
+   */
+  Time GetNextEligibleTime (void) const;
+
+private:
+  using Queue<Item>::Head;
+  using Queue<Item>::Tail;
+  using Queue<Item>::DoEnqueue;
+  using Queue<Item>::DoDequeue;
+  using Queue<Item>::DoRemove;
+  using Queue<Item>::DoPeek;
+
+  /// Type of the engine ordering the positions of the items in the list
+  typedef PieoEngine<typename Queue<Item>::ConstIterator> Engine;
+
+  Engine m_engine;               //!< the positions of the items, in rank order
+  uint64_t m_seq;                //!< sequence number of the next enqueued item
+  NS_LOG_TEMPLATE_DECLARE;       //!< redefinition of the log component
+};
+
+
+/**
+ * Implementation of the templates declared above.
+ */
+
+template <typename Item>
+TypeId
+PieoQueue<Item>::GetTypeId (void)
+{
+  static TypeId tid = TypeId (("ns3::PieoQueue<" + GetTypeParamName<PieoQueue<Item> > () + ">").c_str ())
+    .SetParent<Queue<Item> > ()
+    .SetGroupName ("Network")
+    .template AddConstructor<PieoQueue<Item> > ()
+  ;
+  return tid;
+}
+
+template <typename Item>
+PieoQueue<Item>::PieoQueue ()
+  : m_seq (0),
+    NS_LOG_TEMPLATE_DEFINE ("PieoQueue")
+{
+  NS_LOG_FUNCTION (this);
+}
+
+template <typename Item>
+PieoQueue<Item>::~PieoQueue ()
+{
+  NS_LOG_FUNCTION (this);
+}
+
+template <typename Item>
+bool
+PieoQueue<Item>::Enqueue (Ptr<Item> item)
+{
+  NS_LOG_FUNCTION (this << item);
+  return Enqueue (item, Simulator::Now ());
+}
+
+template <typename Item>
+bool
+PieoQueue<Item>::Enqueue (Ptr<Item> item, Time eligible)
+{
+  NS_LOG_FUNCTION (this << item << eligible);
+
+  if (!DoEnqueue (Tail (), item))
+    {
+      return false;
+    }
+
+  uint64_t ts = (eligible.IsStrictlyPositive () ? eligible.GetTimeStep () : 0);
+  m_engine.Push ({item->GetRank (), ts, m_seq++, std::prev (Tail ())});
+  return true;
+}
+
+template <typename Item>
+Ptr<Item>
+PieoQueue<Item>::Dequeue (void)
+{
+  NS_LOG_FUNCTION (this);
+
+  uint64_t now = Simulator::Now ().GetTimeStep ();
+  if (m_engine.PeekEligible (now) == 0)
+    {
+      NS_LOG_LOGIC ("No eligible item");
+      return 0;
+    }
+
+  Ptr<Item> item = DoDequeue (m_engine.PopEligible (now).item);
+
+  NS_LOG_LOGIC ("Popped " << item);
+
+  return item;
+}
+
+template <typename Item>
+Ptr<Item>
+PieoQueue<Item>::Remove (void)
+{
+  NS_LOG_FUNCTION (this);
+
+  if (m_engine.Empty ())
+    {
+      NS_LOG_LOGIC ("Queue empty");
+      return 0;
+    }
+
+  uint64_t now = Simulator::Now ().GetTimeStep ();
+  Ptr<Item> item = DoRemove (m_engine.PeekEligible (now) ? m_engine.PopEligible (now).item
+                                                          : m_engine.Pop ().item);
+
+  NS_LOG_LOGIC ("Removed " << item);
+
+  return item;
+}
+
+template <typename Item>
+Ptr<const Item>
+PieoQueue<Item>::Peek (void) const
+{
+  NS_LOG_FUNCTION (this);
+
+  const typename Engine::Entry *entry = m_engine.PeekEligible (Simulator::Now ().GetTimeStep ());
+  if (entry == 0)
+    {
+      NS_LOG_LOGIC ("No eligible item");
+      return 0;
+    }
+
+  return DoPeek (entry->item);
+}
+
+template <typename Item>
+Time
+PieoQueue<Item>::GetNextEligibleTime (void) const
+{
+  if (m_engine.Empty ())
+    {
+      return Time::Max ();
+    }
+  return TimeStep (m_engine.GetMinEligible ());
+}
+
+} // namespace ns3
+
+#endif /* PIEO_QUEUE_H */
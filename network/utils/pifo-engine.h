@@ -0,0 +1,2179 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Copyright (c) 2018 Stanford University
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Author: Stephen Ibanez <sibanez@stanford.edu>
+ */
+
+#ifndef PIFO_ENGINE_H
+#define PIFO_ENGINE_H
+
+#include "ns3/abort.h"
+#include "ns3/assert.h"
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <queue>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <stdint.h>
+
+// GCC and clang vector extensions are lowered to the widest SIMD
+// instructions enabled (e.g., AVX2, SSE2, NEON)
+#if defined(__GNUC__) || defined(__clang__)
+#define PIFO_ENGINE_SIMD
+#endif
+
+#ifdef __AVX2__
+#define PIFO_SIMD_LANES 4
+#else
+#define PIFO_SIMD_LANES 2
+#endif
+
+namespace ns3 {
+
+/**
+ * \ingroup queue
+ * \brief The data structures a PrioQueue can be built on
+ */
+enum PifoEngineType
+{
+  HEAP_ENGINE,         /**< Binary heap, exact, O(log n) */
+  DARY_HEAP_ENGINE,    /**< Preallocated 4-ary heap, exact, O(log n) */
+  MIN_MAX_HEAP_ENGINE, /**< Min-max heap, exact, O(log n) access to both ends */
+  SORTED_ARRAY_ENGINE, /**< Flat sorted array with SIMD search, exact, O(n) */
+  CALENDAR_ENGINE,     /**< Bucketed calendar queue with a find-first-set bitmap, O(1) */
+  SP_PIFO_ENGINE,      /**< Strict-priority FIFOs with adaptive bounds, approximate, O(1) */
+  AIFO_ENGINE,         /**< Single FIFO with rank-quantile admission, approximate, O(1) */
+  FLOW_ENGINE,         /**< Per-flow FIFOs with a heap of the flow heads, exact if ranks increase within flows, O(log flows) */
+  INDEXED_ENGINE       /**< Indexed min and max heaps with per-flow lists, exact, O(log n) removal by flow or from both ends */
+};
+
+/**
+ * \ingroup queue
+ * \brief Parameters of the PIFO engines, see CreatePifoEngine
+ */
+struct PifoEngineParams
+{
+  PifoEngineParams ()
+    : calendarBuckets (4096),
+      calendarGranularity (1),
+      spPifoQueues (8),
+      aifoWindow (64),
+      aifoHeadroom (0.1)
+  {
+  }
+
+  uint32_t calendarBuckets;      //!< Number of buckets of a calendar engine
+  uint32_t calendarGranularity;  //!< Number of ranks per bucket of a calendar engine
+  uint32_t spPifoQueues;         //!< Number of FIFOs of an SP-PIFO engine
+  uint32_t aifoWindow;           //!< Number of recent ranks an AIFO engine compares with
+  double aifoHeadroom;           //!< Burst headroom of an AIFO engine, in [0, 1)
+};
+
+/**
+ * \ingroup queue
+ * \brief Wraparound-safe comparison of two ranks
+ *
+ * Ranks are 64-bit serial numbers (RFC 1982): \p lhs is lower than \p rhs
+ * if the distance from \p rhs to \p lhs, modulo 2^64, is negative. The
+ * order is consistent as long as the ranks queued at the same time span
+ * less than 2^63, which lets ranks derived from wrapping counters (and
+ * negative ranks) be used.
+ *
+ * \param lhs the first rank
+ * \param rhs the second rank
+ * \return true if \p lhs is lower than \p rhs
+ */
+inline bool
+PifoRankBefore (uint64_t lhs, uint64_t rhs)
+{
+  return static_cast<int64_t> (lhs - rhs) < 0;
+}
+
+/**
+ * \ingroup queue
+ * \brief An item stored in a PIFO engine along with its scheduling key
+ */
+template <typename T>
+struct PifoEntry
+{
+  uint64_t rank;  //!< the rank of the item (lower is dequeued first, see PifoRankBefore)
+  uint64_t seq;   //!< the enqueue sequence number, breaks ties in FIFO order
+  T item;         //!< the item
+};
+
+/**
+ * \ingroup queue
+ * \brief Strict weak ordering of the PIFO entries
+ * \param lhs the first entry
+ * \param rhs the second entry
+ * \return true if \p lhs must be dequeued before \p rhs
+ */
+template <typename T>
+inline bool
+PifoBefore (const PifoEntry<T> &lhs, const PifoEntry<T> &rhs)
+{
+  return PifoRankBefore (lhs.rank, rhs.rank) || (lhs.rank == rhs.rank && lhs.seq < rhs.seq);
+}
+
+/**
+ * \ingroup queue
+ * \brief Count the ranks not above a bound, without branches
+ *
+ * Compares PIFO_SIMD_LANES ranks at a time with SIMD instructions if \p Simd
+ * and PIFO_ENGINE_SIMD are defined, one at a time otherwise. Ranks are
+ * compared as serial numbers (see PifoRankBefore).
+ *
+ * \param ranks the ranks
+ * \param n the number of ranks
+ * \param bound the bound
+ * \return the number of ranks lower than or equal to \p bound
+ */
+template <bool Simd>
+inline uint32_t
+PifoCountNotAbove (const uint64_t *ranks, uint32_t n, uint64_t bound)
+{
+  uint32_t i = 0;
+  uint32_t count = 0;
+#ifdef PIFO_ENGINE_SIMD
+  if (Simd)
+    {
+      typedef uint64_t Vec __attribute__ ((vector_size (PIFO_SIMD_LANES * sizeof (uint64_t))));
+      typedef int64_t SVec __attribute__ ((vector_size (PIFO_SIMD_LANES * sizeof (int64_t))));
+      Vec key;
+      SVec acc;
+      for (uint32_t l = 0; l < PIFO_SIMD_LANES; l++)
+        {
+          key[l] = bound;
+          acc[l] = 0;
+        }
+      for (; i + PIFO_SIMD_LANES <= n; i += PIFO_SIMD_LANES)
+        {
+          Vec v;
+          std::memcpy (&v, &ranks[i], sizeof (v));
+          // the distance to the bound, as a signed number, is not positive
+          // in the lanes to count, which the comparison sets to -1
+          SVec zero = {};
+          acc -= ((SVec) (v - key) <= zero);
+        }
+      for (uint32_t l = 0; l < PIFO_SIMD_LANES; l++)
+        {
+          count += acc[l];
+        }
+    }
+#endif
+  for (; i < n; i++)
+    {
+      count += !PifoRankBefore (bound, ranks[i]);
+    }
+  return count;
+}
+
+/**
+ * \ingroup queue
+ * \brief Interface of the data structures holding the items of a PrioQueue
+ *
+ * An engine only orders the entries; capacity checks and statistics are
+ * left to the PrioQueue.
+ */
+template <typename T>
+class PifoEngine
+{
+public:
+  /// The entries stored by the engine
+  typedef PifoEntry<T> Entry;
+
+  virtual ~PifoEngine ()
+  {
+  }
+
+  /**
+   * \brief Preallocate storage
+   * \param n the expected maximum number of entries
+   */
+  virtual void Reserve (uint32_t n)
+  {
+  }
+
+  /**
+   * \brief Insert an entry
+   * \param entry the entry
+   */
+  virtual void Push (const Entry &entry) = 0;
+
+  /**
+   * \brief Get the entry to dequeue next. The engine must not be empty
+   * \return the entry
+   */
+  virtual const Entry &Top (void) const = 0;
+
+  /**
+   * \brief Remove the entry returned by Top
+   */
+  virtual void Pop (void) = 0;
+
+  /**
+   * \brief Whether the engine provides access to the entry to dequeue last
+   * \return true if Worst and PopWorst are supported
+   */
+  virtual bool HasWorst (void) const
+  {
+    return false;
+  }
+
+  /**
+   * \brief Get the entry to dequeue last. The engine must not be empty
+   * \return the entry
+   */
+  virtual const Entry &Worst (void) const
+  {
+    NS_ABORT_MSG ("This PIFO engine does not provide access to the worst entry");
+    return Top ();
+  }
+
+  /**
+   * \brief Remove the entry returned by Worst
+   */
+  virtual void PopWorst (void)
+  {
+    NS_ABORT_MSG ("This PIFO engine does not provide access to the worst entry");
+  }
+
+  /**
+   * \brief Put back the last entry removed by PopWorst, which ranks after
+   *        all the entries (e.g., to undo an eviction)
+   * \param entry the entry
+   */
+  virtual void PushWorst (const Entry &entry)
+  {
+    Push (entry);
+  }
+
+  /**
+   * \brief Whether the engine keeps track of the entries of each flow (see
+   *        PifoFlowOf)
+   * \return true if FlowHead and PopFlowHead are supported
+   */
+  virtual bool HasFlows (void) const
+  {
+    return false;
+  }
+
+  /**
+   * \brief Get the oldest entry of a flow
+   * \param flow the flow hash
+   * \return the entry, or a null pointer if the flow has no entry
+   */
+  virtual const Entry *FlowHead (uint32_t flow) const
+  {
+    NS_ABORT_MSG ("This PIFO engine does not keep track of the flows");
+    return 0;
+  }
+
+  /**
+   * \brief Remove the entry returned by FlowHead, which must not be null
+   * \param flow the flow hash
+   */
+  virtual void PopFlowHead (uint32_t flow)
+  {
+    NS_ABORT_MSG ("This PIFO engine does not keep track of the flows");
+  }
+
+  /**
+   * \brief Get the number of entries
+   * \return the number of entries
+   */
+  virtual uint32_t Size (void) const = 0;
+
+  /**
+   * \brief Whether the engine holds no entry
+   * \return true if empty
+   */
+  bool Empty (void) const
+  {
+    return Size () == 0;
+  }
+
+  /**
+   * \brief Decide whether to admit an entry, before it is pushed. Only
+   *        approximate engines drop entries
+   * \param rank the rank of the entry
+   * \return true if the entry may be pushed
+   */
+  virtual bool Admit (uint64_t rank)
+  {
+    return true;
+  }
+
+  /**
+   * \brief Get the number of entries popped while an entry of lower rank
+   *        was queued. Always zero for exact engines
+   * \return the number of rank inversions
+   */
+  uint64_t GetNInversions (void) const
+  {
+    return m_nInversions;
+  }
+
+  /**
+   * \brief Get the sum, over the rank inversions, of the difference between
+   *        the popped rank and the lowest queued rank
+   * \return the total magnitude of the rank inversions
+   */
+  uint64_t GetInversionMagnitude (void) const
+  {
+    return m_inversionMagnitude;
+  }
+
+  /**
+   * \brief Get the number of entries pushed against the assumption an
+   *        engine makes on the ranks (see FlowPifoEngine). Always zero for
+   *        the other engines
+   * \return the number of violations
+   */
+  uint64_t GetNViolations (void) const
+  {
+    return m_nViolations;
+  }
+
+protected:
+  PifoEngine ()
+    : m_nInversions (0),
+      m_inversionMagnitude (0),
+      m_nViolations (0)
+  {
+  }
+
+  /**
+   * \brief Record a push against the assumption of the engine on the ranks
+   */
+  void CountViolation (void)
+  {
+    m_nViolations++;
+  }
+
+  /**
+   * \brief Record a pop
+   * \param rank the popped rank
+   * \param minRank the lowest rank queued before the pop
+   */
+  void CountPop (uint64_t rank, uint64_t minRank)
+  {
+    if (PifoRankBefore (minRank, rank))
+      {
+        m_nInversions++;
+        m_inversionMagnitude += rank - minRank;
+      }
+  }
+
+private:
+  uint64_t m_nInversions;         //!< Number of rank inversions
+  uint64_t m_inversionMagnitude;  //!< Total magnitude of the rank inversions
+  uint64_t m_nViolations;         //!< Number of pushes violating the assumption of the engine
+};
+
+/**
+ * \ingroup queue
+ * \brief Exact PIFO engine based on std::priority_queue
+ */
+template <typename T>
+class HeapPifoEngine : public PifoEngine<T>
+{
+public:
+  typedef PifoEntry<T> Entry;  //!< The entries stored by the engine
+
+  virtual void Push (const Entry &entry)
+  {
+    m_heap.push (entry);
+  }
+
+  virtual const Entry &Top (void) const
+  {
+    return m_heap.top ();
+  }
+
+  virtual void Pop (void)
+  {
+    m_heap.pop ();
+  }
+
+  virtual uint32_t Size (void) const
+  {
+    return m_heap.size ();
+  }
+
+private:
+  /**
+   * \brief Puts the entry to dequeue first at the top of the heap
+   */
+  struct EntryComp
+  {
+    bool operator() (const Entry &lhs, const Entry &rhs) const
+    {
+      return PifoBefore (rhs, lhs);
+    }
+  };
+
+  std::priority_queue<Entry, std::deque<Entry>, EntryComp> m_heap;  //!< The heap
+};
+
+/**
+ * \ingroup queue
+ * \brief Exact PIFO engine based on a d-ary heap stored in a contiguous array
+ *
+ * The entries, including their (rank, seq) key, are stored inline in a
+ * vector that is reserved up front, so that sifting does not chase
+ * pointers nor reallocate. Sifting moves a hole rather than swapping
+ * entries. A 4-ary heap has half the depth of a binary heap and the
+ * children of a node share a cache line or two.
+ */
+template <typename T, unsigned D = 4>
+class DaryHeapPifoEngine : public PifoEngine<T>
+{
+public:
+  typedef PifoEntry<T> Entry;  //!< The entries stored by the engine
+
+  virtual void Reserve (uint32_t n)
+  {
+    m_heap.reserve (n);
+  }
+
+  virtual void Push (const Entry &entry)
+  {
+    // sift the hole left at the end up to the position of the new entry
+    uint32_t hole = m_heap.size ();
+    m_heap.push_back (entry);
+    while (hole > 0)
+      {
+        uint32_t parent = (hole - 1) / D;
+        if (!PifoBefore (entry, m_heap[parent]))
+          {
+            break;
+          }
+        m_heap[hole] = m_heap[parent];
+        hole = parent;
+      }
+    m_heap[hole] = entry;
+  }
+
+  virtual const Entry &Top (void) const
+  {
+    return m_heap.front ();
+  }
+
+  virtual void Pop (void)
+  {
+    NS_ASSERT (!m_heap.empty ());
+    uint32_t n = m_heap.size () - 1;
+    if (n == 0)
+      {
+        m_heap.pop_back ();
+        return;
+      }
+
+    // sift the hole left at the root down to the position of the last entry
+    const Entry &last = m_heap[n];
+    uint32_t hole = 0;
+    while (true)
+      {
+        uint32_t first = hole * D + 1;
+        if (first >= n)
+          {
+            break;
+          }
+        uint32_t end = (first + D < n ? first + D : n);
+        uint32_t best = first;
+        for (uint32_t c = first + 1; c < end; c++)
+          {
+            if (PifoBefore (m_heap[c], m_heap[best]))
+              {
+                best = c;
+              }
+          }
+        if (!PifoBefore (m_heap[best], last))
+          {
+            break;
+          }
+        m_heap[hole] = m_heap[best];
+        hole = best;
+      }
+    m_heap[hole] = last;
+    m_heap.pop_back ();
+  }
+
+  virtual uint32_t Size (void) const
+  {
+    return m_heap.size ();
+  }
+
+private:
+  std::vector<Entry> m_heap;  //!< The heap, root first
+};
+
+/**
+ * \ingroup queue
+ * \brief Exact PIFO engine based on a min-max heap
+ *
+ * A binary heap whose even levels (starting with the root) are ordered as
+ * a min-heap and whose odd levels are ordered as a max-heap (Atkinson et
+ * al., 1986), so that both the entry to dequeue first (the root) and the
+ * entry to dequeue last (one of the children of the root) are found in
+ * constant time and removed in O(log n). Used to evict the worst-ranked
+ * entry when a PIFO overflows.
+ */
+template <typename T>
+class MinMaxHeapPifoEngine : public PifoEngine<T>
+{
+public:
+  typedef PifoEntry<T> Entry;  //!< The entries stored by the engine
+
+  virtual void Reserve (uint32_t n)
+  {
+    m_heap.reserve (n);
+  }
+
+  virtual void Push (const Entry &entry)
+  {
+    uint32_t i = m_heap.size ();
+    m_heap.push_back (entry);
+    if (i == 0)
+      {
+        return;
+      }
+    uint32_t parent = (i - 1) / 2;
+    bool max = IsMaxLevel (i);
+    // if the new entry is out of order with respect to its parent, which is
+    // on a level of the other kind, it belongs to the levels of its parent
+    if (Before (m_heap[parent], m_heap[i], max))
+      {
+        std::swap (m_heap[i], m_heap[parent]);
+        BubbleUp (parent, !max);
+      }
+    else
+      {
+        BubbleUp (i, max);
+      }
+  }
+
+  virtual const Entry &Top (void) const
+  {
+    NS_ASSERT (!m_heap.empty ());
+    return m_heap[0];
+  }
+
+  virtual void Pop (void)
+  {
+    NS_ASSERT (!m_heap.empty ());
+    Remove (0);
+  }
+
+  virtual bool HasWorst (void) const
+  {
+    return true;
+  }
+
+  virtual const Entry &Worst (void) const
+  {
+    NS_ASSERT (!m_heap.empty ());
+    return m_heap[WorstIndex ()];
+  }
+
+  virtual void PopWorst (void)
+  {
+    NS_ASSERT (!m_heap.empty ());
+    Remove (WorstIndex ());
+  }
+
+  virtual uint32_t Size (void) const
+  {
+    return m_heap.size ();
+  }
+
+private:
+  /**
+   * \brief Order the entries of a min level or of a max level
+   * \param lhs the first entry
+   * \param rhs the second entry
+   * \param max whether the order is the one of a max level
+   * \return true if \p lhs is closer to the root than \p rhs
+   */
+  static bool Before (const Entry &lhs, const Entry &rhs, bool max)
+  {
+    return max ? PifoBefore (rhs, lhs) : PifoBefore (lhs, rhs);
+  }
+
+  /**
+   * \brief Whether a node is on a max level
+   * \param i the index of the node
+   * \return true if the depth of the node is odd
+   */
+  static bool IsMaxLevel (uint32_t i)
+  {
+    uint32_t depth = 0;
+    for (uint32_t n = i + 1; n > 1; n >>= 1)
+      {
+        depth++;
+      }
+    return depth % 2 == 1;
+  }
+
+  /**
+   * \brief Get the index of the entry to dequeue last
+   * \return the index
+   */
+  uint32_t WorstIndex (void) const
+  {
+    if (m_heap.size () <= 2)
+      {
+        return m_heap.size () - 1;
+      }
+    return PifoBefore (m_heap[1], m_heap[2]) ? 2 : 1;
+  }
+
+  /**
+   * \brief Move an entry up through the levels of its kind
+   * \param i the index of the entry
+   * \param max whether the entry is on a max level
+   */
+  void BubbleUp (uint32_t i, bool max)
+  {
+    while (i > 2)
+      {
+        uint32_t grandparent = ((i - 1) / 2 - 1) / 2;
+        if (!Before (m_heap[i], m_heap[grandparent], max))
+          {
+            break;
+          }
+        std::swap (m_heap[i], m_heap[grandparent]);
+        i = grandparent;
+      }
+  }
+
+  /**
+   * \brief Move an entry down through the levels of its kind
+   * \param i the index of the entry
+   * \param max whether the entry is on a max level
+   */
+  void TrickleDown (uint32_t i, bool max)
+  {
+    uint32_t n = m_heap.size ();
+    while (2 * i + 1 < n)
+      {
+        // find the first entry, in the order of the level, among the
+        // children and the grandchildren
+        uint32_t m = 2 * i + 1;
+        uint32_t candidates[] = {2 * i + 2, 4 * i + 3, 4 * i + 4, 4 * i + 5, 4 * i + 6};
+        for (uint32_t c : candidates)
+          {
+            if (c < n && Before (m_heap[c], m_heap[m], max))
+              {
+                m = c;
+              }
+          }
+        if (!Before (m_heap[m], m_heap[i], max))
+          {
+            break;
+          }
+        std::swap (m_heap[m], m_heap[i]);
+        if (m <= 2 * i + 2)
+          {
+            // a child is on a level of the other kind, whose order holds
+            break;
+          }
+        // the entry moved to the grandchild may be out of order with
+        // respect to its parent, which is on a level of the other kind
+        uint32_t parent = (m - 1) / 2;
+        if (Before (m_heap[parent], m_heap[m], max))
+          {
+            std::swap (m_heap[parent], m_heap[m]);
+          }
+        i = m;
+      }
+  }
+
+  /**
+   * \brief Remove an entry which is the first or the last of its level
+   *        kind, i.e., the root or the worst entry
+   * \param i the index of the entry
+   */
+  void Remove (uint32_t i)
+  {
+    uint32_t last = m_heap.size () - 1;
+    if (i != last)
+      {
+        m_heap[i] = m_heap[last];
+      }
+    m_heap.pop_back ();
+    if (i < m_heap.size ())
+      {
+        TrickleDown (i, IsMaxLevel (i));
+      }
+  }
+
+  std::vector<Entry> m_heap;  //!< The heap, root first
+};
+
+/**
+ * \ingroup queue
+ * \brief Exact PIFO engine based on a flat sorted array
+ *
+ * Models a hardware PIFO block, which compares the rank of an arriving
+ * entry with the ranks of the stored entries in parallel and shifts the
+ * entries behind the insertion point. Suited to PIFOs of the size of
+ * hardware blocks (1-2K entries): insertion is O(n) in the worst case but
+ * streams through contiguous memory.
+ *
+ * The entries are kept in increasing (rank, seq) order in the slots
+ * [m_head, m_tail) of three parallel arrays (ranks, sequence numbers and
+ * items), so that dequeues just advance m_head. Since PrioQueue pushes
+ * entries in increasing seq order, a new entry goes after all the entries
+ * with a lower or equal rank, whose number is counted without branches by
+ * comparing several ranks at a time with SIMD instructions (see
+ * PifoCountNotAbove). The entries
+ * after the insertion position are then shifted with memmove. When the tail
+ * hits the end of the arrays, the entries are moved back to the beginning.
+ */
+template <typename T, bool Simd = true>
+class SortedArrayPifoEngine : public PifoEngine<T>
+{
+  static_assert (std::is_trivially_copyable<T>::value, "Items must be movable with memmove");
+
+public:
+  typedef PifoEntry<T> Entry;  //!< The entries stored by the engine
+
+  SortedArrayPifoEngine ()
+    : m_head (0),
+      m_tail (0),
+      m_maxSeq (0)
+  {
+  }
+
+  virtual void Reserve (uint32_t n)
+  {
+    // twice the capacity, so that the entries are moved back at most once
+    // every n dequeues
+    if (2 * n <= m_ranks.size ())
+      {
+        return;
+      }
+    Compact ();
+    m_ranks.resize (2 * n);
+    m_seqs.resize (2 * n);
+    m_items.resize (2 * n);
+  }
+
+  virtual void Push (const Entry &entry)
+  {
+    NS_ASSERT_MSG (m_tail == m_head || entry.seq > m_maxSeq,
+                   "Entries must be pushed in increasing seq order");
+    m_maxSeq = entry.seq;
+    if (m_tail == m_ranks.size ())
+      {
+        if (m_head == 0)
+          {
+            Reserve (m_tail == 0 ? 32 : m_tail);
+          }
+        else
+          {
+            Compact ();
+          }
+      }
+
+    uint32_t pos = Search (entry.rank);
+    uint32_t tail = m_tail - pos;
+    std::memmove (&m_ranks[pos + 1], &m_ranks[pos], tail * sizeof (uint64_t));
+    std::memmove (&m_seqs[pos + 1], &m_seqs[pos], tail * sizeof (uint64_t));
+    std::memmove (&m_items[pos + 1], &m_items[pos], tail * sizeof (T));
+    m_ranks[pos] = entry.rank;
+    m_seqs[pos] = entry.seq;
+    m_items[pos] = entry.item;
+    m_tail++;
+  }
+
+  virtual const Entry &Top (void) const
+  {
+    NS_ASSERT (m_tail > m_head);
+    m_top.rank = m_ranks[m_head];
+    m_top.seq = m_seqs[m_head];
+    m_top.item = m_items[m_head];
+    return m_top;
+  }
+
+  virtual void Pop (void)
+  {
+    NS_ASSERT (m_tail > m_head);
+    m_head++;
+    if (m_head == m_tail)
+      {
+        m_head = m_tail = 0;
+      }
+  }
+
+  virtual bool HasWorst (void) const
+  {
+    return true;
+  }
+
+  virtual const Entry &Worst (void) const
+  {
+    NS_ASSERT (m_tail > m_head);
+    m_top.rank = m_ranks[m_tail - 1];
+    m_top.seq = m_seqs[m_tail - 1];
+    m_top.item = m_items[m_tail - 1];
+    return m_top;
+  }
+
+  virtual void PopWorst (void)
+  {
+    NS_ASSERT (m_tail > m_head);
+    m_tail--;
+    if (m_head == m_tail)
+      {
+        m_head = m_tail = 0;
+      }
+  }
+
+  virtual void PushWorst (const Entry &entry)
+  {
+    // the slot freed by PopWorst, its seq is older than m_maxSeq
+    NS_ASSERT (m_tail < m_ranks.size ());
+    m_ranks[m_tail] = entry.rank;
+    m_seqs[m_tail] = entry.seq;
+    m_items[m_tail] = entry.item;
+    m_tail++;
+  }
+
+  virtual uint32_t Size (void) const
+  {
+    return m_tail - m_head;
+  }
+
+private:
+
+  /**
+   * \brief Search the insertion position of a rank
+   * \param rank the rank
+   * \return the index of the first slot holding a rank greater than \p rank,
+   *         or m_tail if there is none
+   */
+  uint32_t Search (uint64_t rank) const
+  {
+    return m_head + PifoCountNotAbove<Simd> (&m_ranks[m_head], m_tail - m_head, rank);
+  }
+
+  /**
+   * \brief Move the entries to the beginning of the arrays
+   */
+  void Compact (void)
+  {
+    uint32_t size = m_tail - m_head;
+    if (m_head > 0 && size > 0)
+      {
+        std::memmove (&m_ranks[0], &m_ranks[m_head], size * sizeof (uint64_t));
+        std::memmove (&m_seqs[0], &m_seqs[m_head], size * sizeof (uint64_t));
+        std::memmove (&m_items[0], &m_items[m_head], size * sizeof (T));
+      }
+    m_head = 0;
+    m_tail = size;
+  }
+
+  uint32_t m_head;               //!< Slot of the top entry
+  uint32_t m_tail;               //!< Slot after the last entry
+  uint64_t m_maxSeq;             //!< Sequence number of the last pushed entry
+  std::vector<uint64_t> m_ranks; //!< Ranks, in increasing order
+  std::vector<uint64_t> m_seqs;  //!< Sequence numbers
+  std::vector<T> m_items;        //!< Items
+  mutable Entry m_top;           //!< Copy of the entry returned by Top or Worst
+};
+
+/**
+ * \ingroup queue
+ * \brief Hierarchical bitmap with find-first-set search
+ *
+ * Every level has one bit per 64-bit word of the level below, set if the
+ * word is not zero, so that the next set bit is found with one ctz per level.
+ */
+class FfsBitmap
+{
+public:
+  FfsBitmap ()
+    : m_size (0)
+  {
+  }
+
+  /**
+   * \brief Resize the bitmap and clear all the bits
+   * \param size the number of bits
+   */
+  void Resize (uint32_t size)
+  {
+    m_size = size;
+    m_levels.clear ();
+    uint32_t words = (size + 63) / 64;
+    do
+      {
+        m_levels.insert (m_levels.begin (), std::vector<uint64_t> (words, 0));
+        words = (words + 63) / 64;
+      }
+    while (m_levels.front ().size () > 1);
+  }
+
+  /**
+   * \brief Set a bit
+   * \param i the index of the bit
+   */
+  void Set (uint32_t i)
+  {
+    NS_ASSERT (i < m_size);
+    for (int l = m_levels.size () - 1; l >= 0; l--)
+      {
+        uint64_t &word = m_levels[l][i >> 6];
+        bool wasZero = (word == 0);
+        word |= (uint64_t) 1 << (i & 63);
+        if (!wasZero)
+          {
+            break;
+          }
+        i >>= 6;
+      }
+  }
+
+  /**
+   * \brief Clear a bit
+   * \param i the index of the bit
+   */
+  void Clear (uint32_t i)
+  {
+    NS_ASSERT (i < m_size);
+    for (int l = m_levels.size () - 1; l >= 0; l--)
+      {
+        uint64_t &word = m_levels[l][i >> 6];
+        word &= ~((uint64_t) 1 << (i & 63));
+        if (word != 0)
+          {
+            break;
+          }
+        i >>= 6;
+      }
+  }
+
+  /**
+   * \brief Find the first set bit at or after a position
+   * \param pos the position to start from
+   * \return the index of the bit, or -1 if there is none
+   */
+  int64_t FindNext (uint32_t pos) const
+  {
+    if (pos >= m_size)
+      {
+        return -1;
+      }
+    // climb until a set bit at or after the position is found
+    int l = m_levels.size () - 1;
+    uint64_t idx = pos;
+    while (true)
+      {
+        uint64_t w = idx >> 6;
+        if (w >= m_levels[l].size ())
+          {
+            return -1;
+          }
+        uint64_t bits = m_levels[l][w] & (~(uint64_t) 0 << (idx & 63));
+        if (bits != 0)
+          {
+            idx = (w << 6) + __builtin_ctzll (bits);
+            break;
+          }
+        if (l == 0)
+          {
+            return -1;
+          }
+        idx = w + 1;
+        l--;
+      }
+    // then descend to the first set bit of the lower levels
+    for (l++; l < (int) m_levels.size (); l++)
+      {
+        idx = (idx << 6) + __builtin_ctzll (m_levels[l][idx]);
+      }
+    return idx;
+  }
+
+private:
+  uint32_t m_size;                               //!< Number of bits
+  std::vector<std::vector<uint64_t> > m_levels;  //!< Levels, top (a single word) first
+};
+
+/**
+ * \ingroup queue
+ * \brief Calendar queue PIFO engine for bounded integer ranks
+ *
+ * In the style of Eiffel (Saeed et al., NSDI'19): the entries are kept in
+ * per-bucket FIFOs and the non-empty buckets are tracked by a hierarchical
+ * find-first-set bitmap, hence enqueue and dequeue are O(1). Each bucket
+ * covers \p granularity consecutive ranks. The buckets form a circular
+ * window starting at the bucket of the last dequeued rank, which moves
+ * forward as packets are dequeued, so that monotonically increasing ranks
+ * (e.g., virtual times) can be used without bound.
+ *
+ * The order is exact when the granularity is 1 and the queued ranks span
+ * less than the window. Otherwise entries are ordered FIFO within a bucket,
+ * ranks beyond the window are clamped into its last bucket and ranks lower
+ * than the window start are clamped into its first bucket.
+ */
+template <typename T>
+class CalendarPifoEngine : public PifoEngine<T>
+{
+public:
+  typedef PifoEntry<T> Entry;  //!< The entries stored by the engine
+
+  /**
+   * \brief Constructor
+   * \param nBuckets the number of buckets, rounded up to a power of 2
+   * \param granularity the number of ranks covered by each bucket
+   */
+  CalendarPifoEngine (uint32_t nBuckets, uint32_t granularity)
+    : m_nBuckets (1),
+      m_granularity (granularity > 0 ? granularity : 1),
+      m_head (0),
+      m_top (0),
+      m_baseRank (0),
+      m_size (0),
+      m_free (NIL)
+  {
+    while (m_nBuckets < nBuckets)
+      {
+        m_nBuckets <<= 1;
+      }
+    m_buckets.assign (m_nBuckets, Bucket {NIL, NIL});
+    m_bitmap.Resize (m_nBuckets);
+  }
+
+  virtual void Reserve (uint32_t n)
+  {
+    m_nodes.reserve (n);
+  }
+
+  virtual void Push (const Entry &entry)
+  {
+    if (m_size == 0)
+      {
+        // restart the window at the bucket of the new rank if the rank
+        // falls out of the current window
+        if (PifoRankBefore (entry.rank, m_baseRank)
+            || entry.rank - m_baseRank >= (uint64_t) m_nBuckets * m_granularity)
+          {
+            m_baseRank = entry.rank - entry.rank % m_granularity;
+          }
+      }
+
+    uint64_t offset = 0;
+    if (!PifoRankBefore (entry.rank, m_baseRank))
+      {
+        offset = (entry.rank - m_baseRank) / m_granularity;
+        if (offset >= m_nBuckets)
+          {
+            offset = m_nBuckets - 1;
+          }
+      }
+    uint32_t b = (m_head + offset) & (m_nBuckets - 1);
+    if (m_size == 0 || offset < ((m_top - m_head) & (m_nBuckets - 1)))
+      {
+        m_top = b;
+      }
+
+    uint32_t n = AllocNode (entry);
+    Bucket &bucket = m_buckets[b];
+    if (bucket.head == NIL)
+      {
+        bucket.head = n;
+        m_bitmap.Set (b);
+      }
+    else
+      {
+        m_nodes[bucket.tail].next = n;
+      }
+    bucket.tail = n;
+    m_size++;
+  }
+
+  virtual const Entry &Top (void) const
+  {
+    NS_ASSERT (m_size > 0);
+    return m_nodes[m_buckets[m_top].head].entry;
+  }
+
+  virtual void Pop (void)
+  {
+    NS_ASSERT (m_size > 0);
+    // move the window to the bucket being dequeued from
+    m_baseRank += (uint64_t) ((m_top - m_head) & (m_nBuckets - 1)) * m_granularity;
+    m_head = m_top;
+
+    Bucket &bucket = m_buckets[m_top];
+    uint32_t n = bucket.head;
+    bucket.head = m_nodes[n].next;
+    if (bucket.head == NIL)
+      {
+        bucket.tail = NIL;
+        m_bitmap.Clear (m_top);
+      }
+    FreeNode (n);
+    m_size--;
+
+    if (m_size > 0 && bucket.head == NIL)
+      {
+        // find the next non-empty bucket of the window
+        int64_t next = m_bitmap.FindNext (m_head);
+        if (next < 0)
+          {
+            next = m_bitmap.FindNext (0);
+          }
+        NS_ASSERT (next >= 0);
+        m_top = next;
+      }
+  }
+
+  virtual uint32_t Size (void) const
+  {
+    return m_size;
+  }
+
+private:
+  static const uint32_t NIL = 0xffffffff;  //!< Null node index
+
+  /**
+   * \brief A node of the bucket lists
+   */
+  struct Node
+  {
+    Entry entry;    //!< The entry
+    uint32_t next;  //!< Index of the next node in the bucket, or NIL
+  };
+
+  /**
+   * \brief A FIFO of nodes
+   */
+  struct Bucket
+  {
+    uint32_t head;  //!< Index of the first node, or NIL
+    uint32_t tail;  //!< Index of the last node, or NIL
+  };
+
+  /**
+   * \brief Get a node from the free list, or a new one
+   * \param entry the entry to store in the node
+   * \return the index of the node
+   */
+  uint32_t AllocNode (const Entry &entry)
+  {
+    uint32_t n;
+    if (m_free != NIL)
+      {
+        n = m_free;
+        m_free = m_nodes[n].next;
+        m_nodes[n].entry = entry;
+      }
+    else
+      {
+        n = m_nodes.size ();
+        m_nodes.push_back (Node {entry, NIL});
+      }
+    m_nodes[n].next = NIL;
+    return n;
+  }
+
+  /**
+   * \brief Return a node to the free list
+   * \param n the index of the node
+   */
+  void FreeNode (uint32_t n)
+  {
+    m_nodes[n].entry = Entry ();
+    m_nodes[n].next = m_free;
+    m_free = n;
+  }
+
+  uint32_t m_nBuckets;           //!< Number of buckets (a power of 2)
+  uint32_t m_granularity;        //!< Number of ranks per bucket
+  uint32_t m_head;               //!< Bucket of the last dequeued rank (window start)
+  uint32_t m_top;                //!< First non-empty bucket of the window
+  uint64_t m_baseRank;           //!< First rank of the head bucket
+  uint32_t m_size;               //!< Number of entries
+  uint32_t m_free;               //!< Head of the free node list
+  std::vector<Node> m_nodes;     //!< Node pool
+  std::vector<Bucket> m_buckets; //!< Bucket FIFOs
+  FfsBitmap m_bitmap;            //!< Non-empty buckets
+};
+
+/**
+ * \ingroup queue
+ * \brief FIFO of PIFO entries which tracks the lowest queued rank
+ *
+ * The lowest rank is the front of a monotonic deque of the ranks, which
+ * makes all the operations amortized O(1).
+ */
+template <typename T>
+class PifoRankFifo
+{
+public:
+  typedef PifoEntry<T> Entry;  //!< The entries stored by the FIFO
+
+  /**
+   * \brief Append an entry
+   * \param entry the entry
+   */
+  void Push (const Entry &entry)
+  {
+    m_entries.push_back (entry);
+    while (!m_mins.empty () && PifoRankBefore (entry.rank, m_mins.back ()))
+      {
+        m_mins.pop_back ();
+      }
+    m_mins.push_back (entry.rank);
+  }
+
+  /**
+   * \brief Get the oldest entry. The FIFO must not be empty
+   * \return the entry
+   */
+  const Entry &Front (void) const
+  {
+    return m_entries.front ();
+  }
+
+  /**
+   * \brief Remove the oldest entry
+   */
+  void Pop (void)
+  {
+    if (m_mins.front () == m_entries.front ().rank)
+      {
+        m_mins.pop_front ();
+      }
+    m_entries.pop_front ();
+  }
+
+  /**
+   * \brief Get the lowest queued rank. The FIFO must not be empty
+   * \return the lowest queued rank
+   */
+  uint64_t MinRank (void) const
+  {
+    return m_mins.front ();
+  }
+
+  /**
+   * \brief Get the number of entries
+   * \return the number of entries
+   */
+  uint32_t Size (void) const
+  {
+    return m_entries.size ();
+  }
+
+private:
+  std::deque<Entry> m_entries;  //!< The entries, oldest first
+  std::deque<uint64_t> m_mins;  //!< Increasing candidates for the lowest rank
+};
+
+/**
+ * \ingroup queue
+ * \brief Approximate PIFO engine based on strict-priority FIFOs (SP-PIFO)
+ *
+ * Implements SP-PIFO (Alcoz et al., NSDI 2020): entries are mapped onto N
+ * FIFOs served in strict priority (FIFO 0 first). Each FIFO has a rank
+ * bound. An entry goes to the lowest-priority FIFO whose bound does not
+ * exceed its rank, and the bound of that FIFO becomes the rank (push-up).
+ * If the rank is below the bound of FIFO 0, the entry goes to FIFO 0 and
+ * all the bounds are lowered by the difference (push-down). The cost per
+ * entry is O(N) with N at most 64, i.e., constant. Rank inversions happen
+ * when a FIFO holds entries of different ranks, and are counted at pop.
+ */
+template <typename T>
+class SpPifoEngine : public PifoEngine<T>
+{
+public:
+  typedef PifoEntry<T> Entry;  //!< The entries stored by the engine
+
+  /**
+   * \brief Constructor
+   * \param nQueues the number of FIFOs (1 to 64)
+   */
+  SpPifoEngine (uint32_t nQueues)
+    : m_fifos (nQueues),
+      m_bounds (nQueues, 0),
+      m_nonEmpty (0),
+      m_size (0)
+  {
+    NS_ABORT_MSG_IF (nQueues == 0 || nQueues > 64, "SP-PIFO supports 1 to 64 FIFOs");
+  }
+
+  virtual void Push (const Entry &entry)
+  {
+    uint32_t i = m_bounds.size () - 1;
+    while (i > 0 && PifoRankBefore (entry.rank, m_bounds[i]))
+      {
+        i--;
+      }
+    if (PifoRankBefore (entry.rank, m_bounds[0]))
+      {
+        // push-down
+        uint64_t cost = m_bounds[0] - entry.rank;
+        for (uint64_t &bound : m_bounds)
+          {
+            bound -= cost;
+          }
+      }
+    // push-up
+    m_bounds[i] = entry.rank;
+    m_fifos[i].Push (entry);
+    m_nonEmpty |= (uint64_t (1) << i);
+    m_size++;
+  }
+
+  virtual const Entry &Top (void) const
+  {
+    NS_ASSERT (m_size > 0);
+    return m_fifos[__builtin_ctzll (m_nonEmpty)].Front ();
+  }
+
+  virtual void Pop (void)
+  {
+    NS_ASSERT (m_size > 0);
+    uint32_t i = __builtin_ctzll (m_nonEmpty);
+    uint64_t minRank = m_fifos[i].MinRank ();
+    for (uint64_t bits = m_nonEmpty & (m_nonEmpty - 1); bits != 0; bits &= bits - 1)
+      {
+        uint64_t rank = m_fifos[__builtin_ctzll (bits)].MinRank ();
+        minRank = (PifoRankBefore (rank, minRank) ? rank : minRank);
+      }
+
+    this->CountPop (m_fifos[i].Front ().rank, minRank);
+    m_fifos[i].Pop ();
+    if (m_fifos[i].Size () == 0)
+      {
+        m_nonEmpty &= ~(uint64_t (1) << i);
+      }
+    m_size--;
+  }
+
+  virtual uint32_t Size (void) const
+  {
+    return m_size;
+  }
+
+private:
+  std::vector<PifoRankFifo<T> > m_fifos;  //!< The FIFOs, highest priority first
+  std::vector<uint64_t> m_bounds;         //!< Rank bound of each FIFO
+  uint64_t m_nonEmpty;                    //!< Bit i is set if FIFO i is not empty
+  uint32_t m_size;                        //!< Number of entries
+};
+
+/**
+ * \ingroup queue
+ * \brief Approximate PIFO engine based on a single FIFO with admission
+ *        control (AIFO)
+ *
+ * Implements AIFO (Yu et al., SIGCOMM 2021): entries are served in FIFO
+ * order, and PIFO behavior is approximated by admitting fewer high-rank
+ * entries as the FIFO fills up. An entry is admitted if the fraction of the
+ * last W ranks offered to Admit that are lower than its rank does not exceed
+ * (C - c) / ((1 - k) C), where c is the number of queued entries, C the
+ * capacity given to Reserve and k the burst headroom. Without a capacity,
+ * every entry is admitted. The ranks are counted with PifoCountNotAbove, in
+ * O(W) with a small fixed W. Rank inversions are counted at pop.
+ */
+template <typename T>
+class AifoEngine : public PifoEngine<T>
+{
+public:
+  typedef PifoEntry<T> Entry;  //!< The entries stored by the engine
+
+  /**
+   * \brief Constructor
+   * \param window the number of recent ranks to compare with
+   * \param headroom the burst headroom, in [0, 1)
+   */
+  AifoEngine (uint32_t window, double headroom)
+    : m_window (window, 0),
+      m_next (0),
+      m_filled (0),
+      m_headroom (headroom),
+      m_capacity (0)
+  {
+    NS_ABORT_MSG_IF (window == 0, "The AIFO window cannot be empty");
+    NS_ABORT_MSG_IF (headroom < 0 || headroom >= 1, "The AIFO headroom must be in [0, 1)");
+  }
+
+  virtual void Reserve (uint32_t n)
+  {
+    m_capacity = n;
+  }
+
+  virtual bool Admit (uint64_t rank)
+  {
+    // the ranks lower than rank are the ranks not above rank - 1, also
+    // across the wraparound
+    uint32_t lower = PifoCountNotAbove<true> (&m_window[0], m_filled, rank - 1);
+    bool admit = true;
+    if (m_capacity > 0 && m_filled > 0)
+      {
+        double quantile = static_cast<double> (lower) / m_filled;
+        double free = static_cast<double> (m_capacity - std::min (Size (), m_capacity)) / m_capacity;
+        admit = (quantile <= free / (1 - m_headroom));
+      }
+
+    m_window[m_next] = rank;
+    m_next = (m_next + 1 == m_window.size () ? 0 : m_next + 1);
+    m_filled = std::max<uint32_t> (m_filled, m_next == 0 ? m_window.size () : m_next);
+    return admit;
+  }
+
+  virtual void Push (const Entry &entry)
+  {
+    m_fifo.Push (entry);
+  }
+
+  virtual const Entry &Top (void) const
+  {
+    NS_ASSERT (m_fifo.Size () > 0);
+    return m_fifo.Front ();
+  }
+
+  virtual void Pop (void)
+  {
+    NS_ASSERT (m_fifo.Size () > 0);
+    this->CountPop (m_fifo.Front ().rank, m_fifo.MinRank ());
+    m_fifo.Pop ();
+  }
+
+  virtual uint32_t Size (void) const
+  {
+    return m_fifo.Size ();
+  }
+
+private:
+  PifoRankFifo<T> m_fifo;         //!< The queued entries
+  std::vector<uint64_t> m_window; //!< The last ranks offered to Admit
+  uint32_t m_next;                //!< Slot of the window to overwrite next
+  uint32_t m_filled;              //!< Number of valid slots of the window
+  double m_headroom;              //!< Burst headroom
+  uint32_t m_capacity;            //!< Capacity of the queue, 0 if unknown
+};
+
+/**
+ * \ingroup queue
+ * \brief Flow of the items of a FlowPifoEngine
+ *
+ * Items that are pointers belong to the flow whose hash is cached in the
+ * object they point to (see QueueDiscItem::GetFlowHash). Other items carry
+ * no flow, and cannot be held by a FlowPifoEngine.
+ */
+template <typename T>
+struct PifoFlowOf
+{
+  static const bool defined = false;  //!< Whether the items carry a flow
+
+  /**
+   * \param item an item
+   * \return the flow hash of the item
+   */
+  static uint32_t Get (const T &item)
+  {
+    return 0;
+  }
+};
+
+/**
+ * \ingroup queue
+ * \brief Flow of the items of a FlowPifoEngine that are pointers
+ */
+template <typename T>
+struct PifoFlowOf<T *>
+{
+  static const bool defined = true;  //!< Whether the items carry a flow
+
+  /**
+   * \param item an item
+   * \return the flow hash of the item
+   */
+  static uint32_t Get (T *item)
+  {
+    return item->GetFlowHash ();
+  }
+};
+
+/**
+ * \ingroup queue
+ * \brief Exact PIFO engine for ranks that do not decrease within a flow
+ *
+ * When the ranks of the entries of a flow do not decrease (e.g., virtual
+ * start or finish times of fair queueing), the entry to dequeue next is the
+ * head of one of the flows. The entries of each active flow are kept in a
+ * FIFO, and only the flow heads in a DaryHeapPifoEngine, which shrinks the
+ * heap from the number of entries to the number of active flows. The flows
+ * are told apart by PifoFlowOf, and a flow leaves the engine when its FIFO
+ * empties. The FIFOs are linked lists of nodes of a shared pool.
+ *
+ * An entry whose rank is lower than the rank of the previous entry of its
+ * flow is a violation (see GetNViolations): it is still appended to the
+ * FIFO of its flow, hence it is popped after entries of higher rank. These
+ * rank inversions are counted at pop, as for the approximate engines; the
+ * lowest rank of the flows that had a violation is tracked for that
+ * purpose, which is O(1) per pop when no flow had one.
+ */
+template <typename T>
+class FlowPifoEngine : public PifoEngine<T>
+{
+public:
+  typedef PifoEntry<T> Entry;  //!< The entries stored by the engine
+
+  FlowPifoEngine ()
+    : m_size (0),
+      m_freeNode (NIL),
+      m_freeFlow (NIL)
+  {
+    NS_ABORT_MSG_IF (!PifoFlowOf<T>::defined, "The flow engine needs items carrying a flow hash");
+  }
+
+  virtual void Reserve (uint32_t n)
+  {
+    m_nodes.reserve (n);
+    m_flows.reserve (n);
+    m_index.reserve (n);
+    m_heads.Reserve (n);
+  }
+
+  virtual void Push (const Entry &entry)
+  {
+    uint32_t hash = PifoFlowOf<T>::Get (entry.item);
+    uint32_t node = AllocNode (entry);
+    m_size++;
+
+    typename std::unordered_map<uint32_t, uint32_t>::iterator it = m_index.find (hash);
+    if (it == m_index.end ())
+      {
+        uint32_t f = AllocFlow (hash, node, entry.rank);
+        m_index.emplace (hash, f);
+        m_heads.Push ({entry.rank, entry.seq, f});
+        return;
+      }
+
+    Flow &flow = m_flows[it->second];
+    if (PifoRankBefore (entry.rank, flow.tailRank))
+      {
+        this->CountViolation ();
+        if (!flow.disordered)
+          {
+            flow.disordered = true;
+            flow.minRank = m_nodes[flow.head].entry.rank;
+            m_disordered.push_back (it->second);
+          }
+        if (PifoRankBefore (entry.rank, flow.minRank))
+          {
+            flow.minRank = entry.rank;
+          }
+      }
+    m_nodes[flow.tail].next = node;
+    flow.tail = node;
+    flow.tailRank = entry.rank;
+  }
+
+  virtual const Entry &Top (void) const
+  {
+    NS_ASSERT (m_size > 0);
+    return m_nodes[m_flows[m_heads.Top ().item].head].entry;
+  }
+
+  virtual void Pop (void)
+  {
+    NS_ASSERT (m_size > 0);
+    uint32_t f = m_heads.Top ().item;
+    m_heads.Pop ();
+    Flow &flow = m_flows[f];
+    uint32_t node = flow.head;
+    uint64_t rank = m_nodes[node].entry.rank;
+
+    // the heads are in order, only the flows that had a violation may hold
+    // an entry of lower rank
+    uint64_t minRank = rank;
+    for (uint32_t d : m_disordered)
+      {
+        minRank = (PifoRankBefore (m_flows[d].minRank, minRank) ? m_flows[d].minRank : minRank);
+      }
+    this->CountPop (rank, minRank);
+
+    flow.head = m_nodes[node].next;
+    FreeNode (node);
+    m_size--;
+
+    if (flow.head == NIL)
+      {
+        if (flow.disordered)
+          {
+            m_disordered.erase (std::find (m_disordered.begin (), m_disordered.end (), f));
+          }
+        m_index.erase (flow.hash);
+        FreeFlow (f);
+        return;
+      }
+
+    const Entry &head = m_nodes[flow.head].entry;
+    if (flow.disordered && flow.minRank == rank)
+      {
+        flow.minRank = head.rank;
+        for (uint32_t n = m_nodes[flow.head].next; n != NIL; n = m_nodes[n].next)
+          {
+            if (PifoRankBefore (m_nodes[n].entry.rank, flow.minRank))
+              {
+                flow.minRank = m_nodes[n].entry.rank;
+              }
+          }
+      }
+    m_heads.Push ({head.rank, head.seq, f});
+  }
+
+  virtual uint32_t Size (void) const
+  {
+    return m_size;
+  }
+
+  /**
+   * \brief Get the number of active flows, i.e., the size of the heap
+   * \return the number of flows with queued entries
+   */
+  uint32_t GetNFlows (void) const
+  {
+    return m_heads.Size ();
+  }
+
+private:
+  static const uint32_t NIL = 0xffffffff;  //!< Null node or flow index
+
+  /**
+   * \brief A node of the flow FIFOs
+   */
+  struct Node
+  {
+    Entry entry;    //!< The entry
+    uint32_t next;  //!< Index of the next node of the flow, or NIL
+  };
+
+  /**
+   * \brief An active flow
+   */
+  struct Flow
+  {
+    uint32_t hash;     //!< Flow hash
+    uint32_t head;     //!< Index of the first node, or of the next free flow
+    uint32_t tail;     //!< Index of the last node
+    bool disordered;   //!< Whether an entry of the flow was a violation
+    uint64_t tailRank; //!< Rank of the last entry
+    uint64_t minRank;  //!< Lowest queued rank, if disordered
+  };
+
+  /**
+   * \brief Get a node from the free list, or a new one
+   * \param entry the entry to store in the node
+   * \return the index of the node
+   */
+  uint32_t AllocNode (const Entry &entry)
+  {
+    uint32_t n;
+    if (m_freeNode != NIL)
+      {
+        n = m_freeNode;
+        m_freeNode = m_nodes[n].next;
+        m_nodes[n].entry = entry;
+      }
+    else
+      {
+        n = m_nodes.size ();
+        m_nodes.push_back (Node {entry, NIL});
+      }
+    m_nodes[n].next = NIL;
+    return n;
+  }
+
+  /**
+   * \brief Return a node to the free list
+   * \param n the index of the node
+   */
+  void FreeNode (uint32_t n)
+  {
+    m_nodes[n].entry = Entry ();
+    m_nodes[n].next = m_freeNode;
+    m_freeNode = n;
+  }
+
+  /**
+   * \brief Get a flow from the free list, or a new one
+   * \param hash the flow hash
+   * \param node the index of the node of the first entry
+   * \param rank the rank of the first entry
+   * \return the index of the flow
+   */
+  uint32_t AllocFlow (uint32_t hash, uint32_t node, uint64_t rank)
+  {
+    uint32_t f;
+    if (m_freeFlow != NIL)
+      {
+        f = m_freeFlow;
+        m_freeFlow = m_flows[f].head;
+      }
+    else
+      {
+        f = m_flows.size ();
+        m_flows.push_back (Flow ());
+      }
+    m_flows[f] = Flow {hash, node, node, false, rank, rank};
+    return f;
+  }
+
+  /**
+   * \brief Return a flow to the free list
+   * \param f the index of the flow
+   */
+  void FreeFlow (uint32_t f)
+  {
+    m_flows[f].head = m_freeFlow;
+    m_freeFlow = f;
+  }
+
+  uint32_t m_size;                                //!< Number of entries
+  uint32_t m_freeNode;                            //!< Head of the free node list
+  uint32_t m_freeFlow;                            //!< Head of the free flow list
+  std::vector<Node> m_nodes;                      //!< Node pool
+  std::vector<Flow> m_flows;                      //!< Flow pool
+  std::unordered_map<uint32_t, uint32_t> m_index; //!< Index of the active flows, by hash
+  DaryHeapPifoEngine<uint32_t> m_heads;           //!< Heads of the active flows, keyed by their entry
+  std::vector<uint32_t> m_disordered;             //!< Active flows that had a violation
+};
+
+/**
+ * \ingroup queue
+ * \brief Exact PIFO engine supporting the removal of any entry, by flow or
+ *        from both ends
+ *
+ * The entries are stored in a pool of nodes and indexed by a binary
+ * min-heap, whose root is the entry to dequeue first, and a binary
+ * max-heap, whose root is the entry to dequeue last. The heap slots hold
+ * the key of the entry inline, and each node records its position in both
+ * heaps, so that any entry is removed in O(log n) by replacing it with the
+ * last slot of each heap. The nodes of each flow (see PifoFlowOf) are
+ * linked in enqueue order, which gives the oldest entry of a flow in O(1).
+ * Maintaining two heaps costs about twice as much per push and pop as a
+ * MinMaxHeapPifoEngine, in exchange for removal in the middle.
+ */
+template <typename T>
+class IndexedPifoEngine : public PifoEngine<T>
+{
+public:
+  typedef PifoEntry<T> Entry;  //!< The entries stored by the engine
+
+  IndexedPifoEngine ()
+    : m_freeNode (NIL),
+      m_freeFlow (NIL)
+  {
+    NS_ABORT_MSG_IF (!PifoFlowOf<T>::defined, "The indexed engine needs items carrying a flow hash");
+  }
+
+  virtual void Reserve (uint32_t n)
+  {
+    m_nodes.reserve (n);
+    m_heaps[0].reserve (n);
+    m_heaps[1].reserve (n);
+    m_flows.reserve (n);
+    m_index.reserve (n);
+  }
+
+  virtual void Push (const Entry &entry)
+  {
+    uint32_t hash = PifoFlowOf<T>::Get (entry.item);
+    uint32_t n = AllocNode (entry);
+
+    typename std::unordered_map<uint32_t, uint32_t>::iterator it = m_index.find (hash);
+    uint32_t f;
+    if (it == m_index.end ())
+      {
+        f = AllocFlow (hash);
+        m_index.emplace (hash, f);
+      }
+    else
+      {
+        f = it->second;
+      }
+
+    // append the node to the list of its flow
+    Node &node = m_nodes[n];
+    node.flow = f;
+    node.prev = m_flows[f].tail;
+    node.next = NIL;
+    if (node.prev == NIL)
+      {
+        m_flows[f].head = n;
+      }
+    else
+      {
+        m_nodes[node.prev].next = n;
+      }
+    m_flows[f].tail = n;
+
+    for (uint32_t h = 0; h < 2; h++)
+      {
+        m_heaps[h].push_back ({entry.rank, entry.seq, n});
+        SiftUp (h, m_heaps[h].size () - 1);
+      }
+  }
+
+  virtual const Entry &Top (void) const
+  {
+    NS_ASSERT (!m_heaps[0].empty ());
+    return m_nodes[m_heaps[0][0].node].entry;
+  }
+
+  virtual void Pop (void)
+  {
+    NS_ASSERT (!m_heaps[0].empty ());
+    RemoveNode (m_heaps[0][0].node);
+  }
+
+  virtual bool HasWorst (void) const
+  {
+    return true;
+  }
+
+  virtual const Entry &Worst (void) const
+  {
+    NS_ASSERT (!m_heaps[1].empty ());
+    return m_nodes[m_heaps[1][0].node].entry;
+  }
+
+  virtual void PopWorst (void)
+  {
+    NS_ASSERT (!m_heaps[1].empty ());
+    RemoveNode (m_heaps[1][0].node);
+  }
+
+  virtual bool HasFlows (void) const
+  {
+    return true;
+  }
+
+  virtual const Entry *FlowHead (uint32_t flow) const
+  {
+    typename std::unordered_map<uint32_t, uint32_t>::const_iterator it = m_index.find (flow);
+    if (it == m_index.end ())
+      {
+        return 0;
+      }
+    return &m_nodes[m_flows[it->second].head].entry;
+  }
+
+  virtual void PopFlowHead (uint32_t flow)
+  {
+    typename std::unordered_map<uint32_t, uint32_t>::const_iterator it = m_index.find (flow);
+    NS_ASSERT (it != m_index.end ());
+    RemoveNode (m_flows[it->second].head);
+  }
+
+  virtual uint32_t Size (void) const
+  {
+    return m_heaps[0].size ();
+  }
+
+private:
+  static const uint32_t NIL = 0xffffffff;  //!< Null node or flow index
+
+  /**
+   * \brief A node holding an entry
+   */
+  struct Node
+  {
+    Entry entry;      //!< The entry
+    uint32_t pos[2];  //!< Position of the node in the min-heap and in the max-heap
+    uint32_t prev;    //!< Previous node of the flow, or NIL
+    uint32_t next;    //!< Next node of the flow, or next free node, or NIL
+    uint32_t flow;    //!< Index of the flow
+  };
+
+  /**
+   * \brief A slot of the heaps
+   */
+  struct Slot
+  {
+    uint64_t rank;  //!< The rank of the entry
+    uint64_t seq;   //!< The sequence number of the entry
+    uint32_t node;  //!< The index of the node of the entry
+  };
+
+  /**
+   * \brief An active flow
+   */
+  struct Flow
+  {
+    uint32_t hash;  //!< Flow hash
+    uint32_t head;  //!< Oldest node, or next free flow
+    uint32_t tail;  //!< Newest node
+  };
+
+  /**
+   * \brief Order the slots of a heap
+   * \param h 0 for the min-heap, 1 for the max-heap
+   * \param lhs the first slot
+   * \param rhs the second slot
+   * \return true if \p lhs is closer to the root than \p rhs
+   */
+  static bool Before (uint32_t h, const Slot &lhs, const Slot &rhs)
+  {
+    const Slot &a = (h == 0 ? lhs : rhs);
+    const Slot &b = (h == 0 ? rhs : lhs);
+    return PifoRankBefore (a.rank, b.rank) || (a.rank == b.rank && a.seq < b.seq);
+  }
+
+  /**
+   * \brief Store a slot at a position of a heap, updating the node
+   * \param h the heap
+   * \param i the position
+   * \param slot the slot
+   */
+  void Place (uint32_t h, uint32_t i, const Slot &slot)
+  {
+    m_heaps[h][i] = slot;
+    m_nodes[slot.node].pos[h] = i;
+  }
+
+  /**
+   * \brief Move a slot up to its position in a heap
+   * \param h the heap
+   * \param i the position of the slot
+   */
+  void SiftUp (uint32_t h, uint32_t i)
+  {
+    std::vector<Slot> &heap = m_heaps[h];
+    Slot slot = heap[i];
+    while (i > 0)
+      {
+        uint32_t parent = (i - 1) / 2;
+        if (!Before (h, slot, heap[parent]))
+          {
+            break;
+          }
+        Place (h, i, heap[parent]);
+        i = parent;
+      }
+    Place (h, i, slot);
+  }
+
+  /**
+   * \brief Move a slot down to its position in a heap
+   * \param h the heap
+   * \param i the position of the slot
+   */
+  void SiftDown (uint32_t h, uint32_t i)
+  {
+    std::vector<Slot> &heap = m_heaps[h];
+    uint32_t n = heap.size ();
+    Slot slot = heap[i];
+    while (2 * i + 1 < n)
+      {
+        uint32_t child = 2 * i + 1;
+        if (child + 1 < n && Before (h, heap[child + 1], heap[child]))
+          {
+            child++;
+          }
+        if (!Before (h, heap[child], slot))
+          {
+            break;
+          }
+        Place (h, i, heap[child]);
+        i = child;
+      }
+    Place (h, i, slot);
+  }
+
+  /**
+   * \brief Remove a node from both heaps and from its flow, and free it
+   * \param n the index of the node
+   */
+  void RemoveNode (uint32_t n)
+  {
+    for (uint32_t h = 0; h < 2; h++)
+      {
+        std::vector<Slot> &heap = m_heaps[h];
+        uint32_t i = m_nodes[n].pos[h];
+        uint32_t last = heap.size () - 1;
+        if (i != last)
+          {
+            // the last slot fills the hole, then moves up or down
+            Place (h, i, heap[last]);
+            heap.pop_back ();
+            if (i > 0 && Before (h, heap[i], heap[(i - 1) / 2]))
+              {
+                SiftUp (h, i);
+              }
+            else
+              {
+                SiftDown (h, i);
+              }
+          }
+        else
+          {
+            heap.pop_back ();
+          }
+      }
+
+    Node &node = m_nodes[n];
+    Flow &flow = m_flows[node.flow];
+    if (node.prev == NIL)
+      {
+        flow.head = node.next;
+      }
+    else
+      {
+        m_nodes[node.prev].next = node.next;
+      }
+    if (node.next == NIL)
+      {
+        flow.tail = node.prev;
+      }
+    else
+      {
+        m_nodes[node.next].prev = node.prev;
+      }
+    if (flow.head == NIL)
+      {
+        m_index.erase (flow.hash);
+        FreeFlow (node.flow);
+      }
+    FreeNode (n);
+  }
+
+  /**
+   * \brief Get a node from the free list, or a new one
+   * \param entry the entry to store in the node
+   * \return the index of the node
+   */
+  uint32_t AllocNode (const Entry &entry)
+  {
+    uint32_t n;
+    if (m_freeNode != NIL)
+      {
+        n = m_freeNode;
+        m_freeNode = m_nodes[n].next;
+      }
+    else
+      {
+        n = m_nodes.size ();
+        m_nodes.push_back (Node ());
+      }
+    m_nodes[n].entry = entry;
+    return n;
+  }
+
+  /**
+   * \brief Return a node to the free list
+   * \param n the index of the node
+   */
+  void FreeNode (uint32_t n)
+  {
+    m_nodes[n].entry = Entry ();
+    m_nodes[n].next = m_freeNode;
+    m_freeNode = n;
+  }
+
+  /**
+   * \brief Get an empty flow from the free list, or a new one
+   * \param hash the flow hash
+   * \return the index of the flow
+   */
+  uint32_t AllocFlow (uint32_t hash)
+  {
+    uint32_t f;
+    if (m_freeFlow != NIL)
+      {
+        f = m_freeFlow;
+        m_freeFlow = m_flows[f].head;
+      }
+    else
+      {
+        f = m_flows.size ();
+        m_flows.push_back (Flow ());
+      }
+    m_flows[f] = Flow {hash, NIL, NIL};
+    return f;
+  }
+
+  /**
+   * \brief Return a flow to the free list
+   * \param f the index of the flow
+   */
+  void FreeFlow (uint32_t f)
+  {
+    m_flows[f].head = m_freeFlow;
+    m_freeFlow = f;
+  }
+
+  uint32_t m_freeNode;                            //!< Head of the free node list
+  uint32_t m_freeFlow;                            //!< Head of the free flow list
+  std::vector<Node> m_nodes;                      //!< Node pool
+  std::vector<Slot> m_heaps[2];                   //!< The min-heap and the max-heap
+  std::vector<Flow> m_flows;                      //!< Flow pool
+  std::unordered_map<uint32_t, uint32_t> m_index; //!< Index of the active flows, by hash
+};
+
+/**
+ * \ingroup queue
+ * \brief Create a PIFO engine
+ * \param type the type of engine
+ * \param params the parameters of the engine
+ * \return the engine, owned by the caller
+ */
+template <typename T>
+PifoEngine<T> *
+CreatePifoEngine (PifoEngineType type, const PifoEngineParams &params)
+{
+  switch (type)
+    {
+    case HEAP_ENGINE:
+      return new HeapPifoEngine<T> ();
+    case MIN_MAX_HEAP_ENGINE:
+      return new MinMaxHeapPifoEngine<T> ();
+    case SORTED_ARRAY_ENGINE:
+      return new SortedArrayPifoEngine<T> ();
+    case CALENDAR_ENGINE:
+      return new CalendarPifoEngine<T> (params.calendarBuckets, params.calendarGranularity);
+    case SP_PIFO_ENGINE:
+      return new SpPifoEngine<T> (params.spPifoQueues);
+    case AIFO_ENGINE:
+      return new AifoEngine<T> (params.aifoWindow, params.aifoHeadroom);
+    case FLOW_ENGINE:
+      return new FlowPifoEngine<T> ();
+    case INDEXED_ENGINE:
+      return new IndexedPifoEngine<T> ();
+    case DARY_HEAP_ENGINE:
+    default:
+      return new DaryHeapPifoEngine<T> ();
+    }
+}
+
+} // namespace ns3
+
+#endif /* PIFO_ENGINE_H */
@@ -29,10 +29,15 @@
 #include "ns3/log.h"
 #include "ns3/queue-size.h"
 #include "ns3/queue.h"
+#include "ns3/enum.h"
+#include "ns3/uinteger.h"
+#include "ns3/double.h"
+#include "ns3/pifo-engine.h"
+#include <memory>
 #include <string>
 #include <sstream>
 #include <list>
-#include <queue>
+#include <vector>
 
 namespace ns3 {
 
@@ -47,9 +52,34 @@ namespace ns3 {
  *
  * PrioQueue is a template class. The type of the objects stored within the priority
  * queue is specified by the type parameter, which can be any class providing a
- * GetSize () method and a GetPriority() method (e.g. QueueDiscItem).
+ * GetSize () method and a GetRank() method (e.g. QueueDiscItem).
  *
- * TODO: evaluate performance overhead of using std::priority_queue rather than std::list
+ * Items are dequeued in increasing order of rank and, among items with the
+ * same rank, in FIFO order. Ranks are 64-bit and compared with serial
+ * number arithmetic (see PifoRankBefore), hence they may wrap around. The
+ * rank is read once at enqueue and is stored along with an enqueue sequence
+ * number next to the item pointer, so that comparisons do not dereference
+ * the items.
+ *
+ * The items are held by a PifoEngine selected by the Engine attribute, which
+ * must be set before the first enqueue: an exact d-ary heap (the default),
+ * binary heap, min-max heap or sorted array (for small queues, see
+ * SortedArrayPifoEngine), or a calendar queue for bounded integer ranks (see
+ * CalendarPifoEngine). The min-max heap and sorted array engines also give
+ * access to the item to dequeue last (see PeekWorst and DequeueWorst). The
+ * SP-PIFO and AIFO engines approximate the PIFO order in O(1) (see
+ * SpPifoEngine and AifoEngine); AIFO also rejects items (see Admit), and
+ * the rank inversions they cause are counted. The flow engine only heaps
+ * the oldest item of each flow (see FlowPifoEngine), which is exact as long
+ * as the priorities do not decrease within a flow; the items breaking this
+ * assumption are counted (see GetNRankViolations). The indexed engine
+ * keeps a min-heap, a max-heap and the list of the items of each flow, so
+ * that the oldest item of a flow, all the items of a flow or all the items
+ * ranking after a threshold can be removed in O(log n) each (see
+ * DequeueFlowHead, DequeueFlow and DequeueAbove). The engine stores raw
+ * item pointers, holding the reference taken at enqueue until the item
+ * leaves the queue, so that the engine can move entries around without
+ * touching reference counts.
  *
  * Users of the PrioQueue template class usually hold a queue through a smart pointer,
  * hence forward declaration is recommended to avoid pulling the implementation
@@ -88,6 +118,17 @@ public:
    */
   Ptr<Item> Dequeue (void);
 
+  /**
+   * Remove items from the PrioQueue in dequeue order, counting each of them
+   * as dequeued, until either the given number of items or at least the
+   * given number of bytes have been removed or the PrioQueue is empty
+   * \param maxPackets the maximum number of items to remove
+   * \param maxBytes the number of bytes after which no more item is removed
+   * \param items the vector the removed items are appended to
+   * \return the number of items removed
+   */
+  uint32_t DequeueBatch (uint32_t maxPackets, uint32_t maxBytes, std::vector<Ptr<Item> > &items);
+
   /**
    * Remove an item from the PrioQueue, counting it as dropped
    * \return 0 if the operation was not successful; the item otherwise.
@@ -100,6 +141,101 @@ public:
    */
   Ptr<const Item> Peek (void) const;
 
+  /**
+   * Run the admission control of the engine on an item about to be
+   * enqueued. Only approximate engines (e.g., AIFO) reject items
+   * \param item the item
+   * \return true if the item may be enqueued
+   */
+  bool Admit (Ptr<const Item> item);
+
+  /**
+   * Get the number of items dequeued while an item of lower priority was
+   * queued. Always zero for exact engines
+   * \return the number of rank inversions
+   */
+  uint64_t GetNRankInversions (void) const;
+
+  /**
+   * Get the sum, over the rank inversions, of the difference between the
+   * priority of the dequeued item and the lowest queued priority
+   * \return the total magnitude of the rank inversions
+   */
+  uint64_t GetRankInversionMagnitude (void) const;
+
+  /**
+   * Get the number of items enqueued against the assumption the engine
+   * makes on the priorities, e.g., with a priority lower than the previous
+   * item of their flow for the flow engine. Always zero for the other engines
+   * \return the number of violations
+   */
+  uint64_t GetNRankViolations (void) const;
+
+  /**
+   * Whether the engine gives access to the item to dequeue last
+   * \return true if PeekWorst and DequeueWorst can be used
+   */
+  bool HasWorst (void);
+
+  /**
+   * Get a copy of the item to dequeue last without removing it
+   * \return 0 if the PrioQueue is empty; the item otherwise.
+   */
+  Ptr<const Item> PeekWorst (void) const;
+
+  /**
+   * Remove the item to dequeue last from the PrioQueue, counting it as
+   * dequeued (e.g., to let a queue disc evict it)
+   * \return 0 if the PrioQueue is empty; the item otherwise.
+   */
+  Ptr<Item> DequeueWorst (void);
+
+  /**
+   * Remove the items to dequeue last, counting them as dequeued, until an
+   * item fits within a limit (e.g., to let a queue disc evict enough bytes
+   * for an arriving packet). Only the items ranking after the given item
+   * are removed, and no item is removed if that does not free enough room.
+   * Needs an engine giving access to the item to dequeue last
+   * \param item the item to make room for
+   * \param limit the number of packets or bytes the items of the PrioQueue
+   *        and the given item must fit into, at most the size of the PrioQueue
+   * \param evicted the removed items, from the last to dequeue
+   * \return true if the item fits within the limit
+   */
+  bool MakeRoom (Ptr<const Item> item, QueueSize limit, std::vector<Ptr<Item> > &evicted);
+
+  /**
+   * Whether the engine keeps track of the items of each flow
+   * \return true if DequeueFlowHead and DequeueFlow can be used
+   */
+  bool HasFlows (void);
+
+  /**
+   * Remove the oldest item of a flow, counting it as dequeued (e.g., to let
+   * a queue disc drop it). Needs an engine keeping track of the flows
+   * \param flowHash the flow hash of the item (see QueueDiscItem::GetFlowHash)
+   * \return 0 if the PrioQueue holds no item of the flow; the item otherwise.
+   */
+  Ptr<Item> DequeueFlowHead (uint32_t flowHash);
+
+  /**
+   * Remove all the items of a flow, counting them as dequeued. Needs an
+   * engine keeping track of the flows
+   * \param flowHash the flow hash of the items
+   * \param items the removed items, from the oldest
+   * \return the number of removed items
+   */
+  uint32_t DequeueFlow (uint32_t flowHash, std::vector<Ptr<Item> > &items);
+
+  /**
+   * Remove all the items ranking after a given rank, counting them as
+   * dequeued. Needs an engine giving access to the item to dequeue last
+   * \param rank the rank
+   * \param items the removed items, from the last to dequeue
+   * \return the number of removed items
+   */
+  uint32_t DequeueAbove (uint64_t rank, std::vector<Ptr<Item> > &items);
+
   /**
    * Flush the PrioQueue.
    */
@@ -128,19 +264,38 @@ protected:
   void DropAfterDequeue (Ptr<Item> item);
 
 private:
+  /// Type of the engine holding the items
+  typedef PifoEngine<Item *> Engine;
+
   /**
-   * \brief The functor used to compare queue elements based on priority.
+   * \brief Get the engine, creating it according to the attributes on the
+   *        first call
+   * \return the engine
    */
-  struct ItemComp {
-    bool operator()(const Ptr<Item> &lhs, const Ptr<Item> &rhs) const {
-      return lhs->GetPriority() >= rhs->GetPriority();
-    }
-  };
+  Engine *GetEngine (void);
 
-  // Type of the priority queue
-  using MyPrioQueue = std::priority_queue<Ptr<Item>, std::deque<Ptr<Item>>, ItemComp >;
+  /**
+   * \brief Pop the top entry of the engine
+   * \return the item of the top entry
+   */
+  Ptr<Item> PopTop (void);
 
-  MyPrioQueue m_items;                 //!< the items in the PrioQueue
+  /**
+   * \brief Account for an item removed from the engine, counting it as
+   *        dequeued
+   * \param item the item
+   */
+  void NotifyRemoved (Ptr<Item> item);
+
+  std::unique_ptr<Engine> m_items;     //!< the items in the PrioQueue
+  PifoEngineType m_engineType;         //!< the type of engine
+  uint32_t m_calendarBuckets;          //!< number of buckets of the calendar engine
+  uint32_t m_calendarGranularity;      //!< number of ranks per bucket of the calendar engine
+  uint32_t m_reservedItems;            //!< number of items the engine reserves room for, 0 for MaxSize
+  uint32_t m_spPifoQueues;             //!< number of FIFOs of the SP-PIFO engine
+  uint32_t m_aifoWindow;               //!< number of ranks in the window of the AIFO engine
+  double m_aifoHeadroom;               //!< burst headroom of the AIFO engine
+  uint64_t m_seq;                      //!< sequence number of the next enqueued item
   NS_LOG_TEMPLATE_DECLARE;             //!< the log component
 
   /// Traced callback: fired when a packet is enqueued
@@ -184,13 +339,57 @@ PrioQueue<Item>::GetTypeId (void)
                      MakeTraceSourceAccessor (&PrioQueue<Item>::m_traceDropAfterDequeue),
                      "ns3::" + name + "::TracedCallback")
     .template AddConstructor<PrioQueue<Item> > ()
+    .AddAttribute ("Engine",
+                   "The data structure holding the items",
+                   EnumValue (DARY_HEAP_ENGINE),
+                   MakeEnumAccessor (&PrioQueue<Item>::m_engineType),
+                   MakeEnumChecker (DARY_HEAP_ENGINE, "DaryHeap",
+                                    HEAP_ENGINE, "Heap",
+                                    MIN_MAX_HEAP_ENGINE, "MinMaxHeap",
+                                    SORTED_ARRAY_ENGINE, "SortedArray",
+                                    CALENDAR_ENGINE, "Calendar",
+                                    SP_PIFO_ENGINE, "SpPifo",
+                                    AIFO_ENGINE, "Aifo",
+                                    FLOW_ENGINE, "Flow",
+                                    INDEXED_ENGINE, "Indexed"))
+    .AddAttribute ("CalendarBuckets",
+                   "The number of buckets of the calendar engine (rounded up to a power of 2)",
+                   UintegerValue (4096),
+                   MakeUintegerAccessor (&PrioQueue<Item>::m_calendarBuckets),
+                   MakeUintegerChecker<uint32_t> (1))
+    .AddAttribute ("CalendarGranularity",
+                   "The number of consecutive ranks sharing a bucket of the calendar engine",
+                   UintegerValue (1),
+                   MakeUintegerAccessor (&PrioQueue<Item>::m_calendarGranularity),
+                   MakeUintegerChecker<uint32_t> (1))
+    .AddAttribute ("ReservedItems",
+                   "The number of items the engine reserves room for (0 for MaxSize in packet mode)",
+                   UintegerValue (0),
+                   MakeUintegerAccessor (&PrioQueue<Item>::m_reservedItems),
+                   MakeUintegerChecker<uint32_t> ())
+    .AddAttribute ("SpPifoQueues",
+                   "The number of strict-priority FIFOs of the SP-PIFO engine",
+                   UintegerValue (8),
+                   MakeUintegerAccessor (&PrioQueue<Item>::m_spPifoQueues),
+                   MakeUintegerChecker<uint32_t> (1, 64))
+    .AddAttribute ("AifoWindow",
+                   "The number of recent ranks the AIFO engine compares the arriving rank with",
+                   UintegerValue (64),
+                   MakeUintegerAccessor (&PrioQueue<Item>::m_aifoWindow),
+                   MakeUintegerChecker<uint32_t> (1))
+    .AddAttribute ("AifoHeadroom",
+                   "The burst headroom of the AIFO engine",
+                   DoubleValue (0.1),
+                   MakeDoubleAccessor (&PrioQueue<Item>::m_aifoHeadroom),
+                   MakeDoubleChecker<double> (0, 0.99))
   ;
   return tid;
 }
 
 template <typename Item>
 PrioQueue<Item>::PrioQueue ()
-  : NS_LOG_TEMPLATE_DEFINE ("PrioQueue")
+  : m_seq (0),
+    NS_LOG_TEMPLATE_DEFINE ("PrioQueue")
 {
   NS_LOG_FUNCTION(this);
 }
@@ -199,6 +398,12 @@ template <typename Item>
 PrioQueue<Item>::~PrioQueue ()
 {
   NS_LOG_FUNCTION(this);
+  // release the references held by the engine
+  while (m_items && !m_items->Empty ())
+    {
+      m_items->Top ().item->Unref ();
+      m_items->Pop ();
+    }
 }
 
 template <typename Item>
@@ -214,7 +419,8 @@ PrioQueue<Item>::Enqueue (Ptr<Item> item)
       return false;
     }
 
-  m_items.push(item);
+  item->Ref ();
+  GetEngine ()->Push ({item->GetRank (), m_seq++, PeekPointer (item)});
 
   uint32_t size = item->GetSize ();
   m_nBytes += size;
@@ -241,8 +447,7 @@ PrioQueue<Item>::Dequeue ()
       return 0;
     }
 
-  Ptr<Item> item = m_items.top();
-  m_items.pop();
+  Ptr<Item> item = PopTop ();
 
   if (item != 0)
     {
@@ -258,6 +463,34 @@ PrioQueue<Item>::Dequeue ()
   return item;
 }
 
+template <typename Item>
+uint32_t
+PrioQueue<Item>::DequeueBatch (uint32_t maxPackets, uint32_t maxBytes, std::vector<Ptr<Item> > &items)
+{
+  NS_LOG_FUNCTION (this << maxPackets << maxBytes);
+
+  uint32_t n = 0;
+  uint32_t bytes = 0;
+
+  while (n < maxPackets && bytes < maxBytes && m_nPackets.Get () > 0)
+    {
+      Ptr<Item> item = PopTop ();
+
+      NS_ASSERT (m_nBytes.Get () >= item->GetSize ());
+
+      m_nBytes -= item->GetSize ();
+      m_nPackets--;
+
+      NS_LOG_LOGIC ("m_traceDequeue (p)");
+      m_traceDequeue (item);
+
+      bytes += item->GetSize ();
+      n++;
+      items.push_back (item);
+    }
+  return n;
+}
+
 template <typename Item>
 Ptr<Item>
 PrioQueue<Item>::Remove ()
@@ -270,8 +503,7 @@ PrioQueue<Item>::Remove ()
       return 0;
     }
 
-  Ptr<Item> item = m_items.top();
-  m_items.pop();
+  Ptr<Item> item = PopTop ();
 
   if (item != 0)
     {
@@ -313,7 +545,247 @@ PrioQueue<Item>::Peek () const
       return 0;
     }
 
-  return m_items.top();
+  return m_items->Top ().item;
+}
+
+template <typename Item>
+typename PrioQueue<Item>::Engine *
+PrioQueue<Item>::GetEngine (void)
+{
+  if (!m_items)
+    {
+      PifoEngineParams params;
+      params.calendarBuckets = m_calendarBuckets;
+      params.calendarGranularity = m_calendarGranularity;
+      params.spPifoQueues = m_spPifoQueues;
+      params.aifoWindow = m_aifoWindow;
+      params.aifoHeadroom = m_aifoHeadroom;
+      m_items.reset (CreatePifoEngine<Item *> (m_engineType, params));
+      if (m_reservedItems > 0)
+        {
+          m_items->Reserve (m_reservedItems);
+        }
+      else if (GetMaxSize ().GetUnit () == QueueSizeUnit::PACKETS)
+        {
+          m_items->Reserve (GetMaxSize ().GetValue ());
+        }
+    }
+  return m_items.get ();
+}
+
+template <typename Item>
+Ptr<Item>
+PrioQueue<Item>::PopTop (void)
+{
+  // adopt the reference taken at enqueue
+  Ptr<Item> item = Ptr<Item> (m_items->Top ().item, false);
+  m_items->Pop ();
+  return item;
+}
+
+template <typename Item>
+bool
+PrioQueue<Item>::Admit (Ptr<const Item> item)
+{
+  NS_LOG_FUNCTION (this << item);
+  return GetEngine ()->Admit (item->GetRank ());
+}
+
+template <typename Item>
+uint64_t
+PrioQueue<Item>::GetNRankInversions (void) const
+{
+  return (m_items ? m_items->GetNInversions () : 0);
+}
+
+template <typename Item>
+uint64_t
+PrioQueue<Item>::GetRankInversionMagnitude (void) const
+{
+  return (m_items ? m_items->GetInversionMagnitude () : 0);
+}
+
+template <typename Item>
+uint64_t
+PrioQueue<Item>::GetNRankViolations (void) const
+{
+  return (m_items ? m_items->GetNViolations () : 0);
+}
+
+template <typename Item>
+bool
+PrioQueue<Item>::HasWorst (void)
+{
+  return GetEngine ()->HasWorst ();
+}
+
+template <typename Item>
+Ptr<const Item>
+PrioQueue<Item>::PeekWorst () const
+{
+  NS_LOG_FUNCTION (this);
+
+  if (m_nPackets.Get () == 0)
+    {
+      NS_LOG_LOGIC ("PrioQueue empty");
+      return 0;
+    }
+
+  return m_items->Worst ().item;
+}
+
+template <typename Item>
+Ptr<Item>
+PrioQueue<Item>::DequeueWorst ()
+{
+  NS_LOG_FUNCTION (this);
+
+  if (m_nPackets.Get () == 0)
+    {
+      NS_LOG_LOGIC ("PrioQueue empty");
+      return 0;
+    }
+
+  // adopt the reference taken at enqueue
+  Ptr<Item> item = Ptr<Item> (m_items->Worst ().item, false);
+  m_items->PopWorst ();
+
+  NS_ASSERT (m_nBytes.Get () >= item->GetSize ());
+
+  m_nBytes -= item->GetSize ();
+  m_nPackets--;
+
+  NS_LOG_LOGIC ("m_traceDequeue (p)");
+  m_traceDequeue (item);
+
+  return item;
+}
+
+template <typename Item>
+bool
+PrioQueue<Item>::MakeRoom (Ptr<const Item> item, QueueSize limit, std::vector<Ptr<Item> > &evicted)
+{
+  NS_LOG_FUNCTION (this << item << limit);
+  NS_ASSERT (GetEngine ()->HasWorst ());
+  NS_ASSERT (limit.GetUnit () == GetMaxSize ().GetUnit () && limit <= GetMaxSize ());
+
+  bool bytes = (limit.GetUnit () == QueueSizeUnit::BYTES);
+  uint32_t nPackets = m_nPackets.Get ();
+  uint32_t nBytes = m_nBytes.Get ();
+
+  // pop the worst entries until the item fits, keeping them aside so that
+  // they can be restored if the item ranks after one of them first
+  std::vector<typename Engine::Entry> popped;
+  while ((bytes ? nBytes + item->GetSize () : nPackets + 1) > limit.GetValue ())
+    {
+      if (m_items->Empty () || !PifoRankBefore (item->GetRank (), m_items->Worst ().rank))
+        {
+          NS_LOG_LOGIC ("Not enough room behind the item");
+          while (!popped.empty ())
+            {
+              m_items->PushWorst (popped.back ());
+              popped.pop_back ();
+            }
+          return false;
+        }
+      popped.push_back (m_items->Worst ());
+      m_items->PopWorst ();
+      nPackets--;
+      nBytes -= popped.back ().item->GetSize ();
+    }
+
+  for (const typename Engine::Entry &entry : popped)
+    {
+      // adopt the reference taken at enqueue
+      Ptr<Item> worst = Ptr<Item> (entry.item, false);
+
+      NS_ASSERT (m_nBytes.Get () >= worst->GetSize ());
+
+      m_nBytes -= worst->GetSize ();
+      m_nPackets--;
+
+      NS_LOG_LOGIC ("m_traceDequeue (p)");
+      m_traceDequeue (worst);
+
+      evicted.push_back (worst);
+    }
+  return true;
+}
+
+template <typename Item>
+bool
+PrioQueue<Item>::HasFlows (void)
+{
+  return GetEngine ()->HasFlows ();
+}
+
+template <typename Item>
+Ptr<Item>
+PrioQueue<Item>::DequeueFlowHead (uint32_t flowHash)
+{
+  NS_LOG_FUNCTION (this << flowHash);
+  NS_ASSERT (GetEngine ()->HasFlows ());
+
+  const typename Engine::Entry *entry = m_items->FlowHead (flowHash);
+  if (entry == 0)
+    {
+      NS_LOG_LOGIC ("No item of the flow");
+      return 0;
+    }
+
+  // adopt the reference taken at enqueue
+  Ptr<Item> item = Ptr<Item> (entry->item, false);
+  m_items->PopFlowHead (flowHash);
+  NotifyRemoved (item);
+  return item;
+}
+
+template <typename Item>
+uint32_t
+PrioQueue<Item>::DequeueFlow (uint32_t flowHash, std::vector<Ptr<Item> > &items)
+{
+  NS_LOG_FUNCTION (this << flowHash);
+
+  uint32_t count = 0;
+  for (Ptr<Item> item = DequeueFlowHead (flowHash); item != 0; item = DequeueFlowHead (flowHash))
+    {
+      items.push_back (item);
+      count++;
+    }
+  return count;
+}
+
+template <typename Item>
+uint32_t
+PrioQueue<Item>::DequeueAbove (uint64_t rank, std::vector<Ptr<Item> > &items)
+{
+  NS_LOG_FUNCTION (this << rank);
+  NS_ASSERT (GetEngine ()->HasWorst ());
+
+  uint32_t count = 0;
+  while (!m_items->Empty () && PifoRankBefore (rank, m_items->Worst ().rank))
+    {
+      // adopt the reference taken at enqueue
+      Ptr<Item> item = Ptr<Item> (m_items->Worst ().item, false);
+      m_items->PopWorst ();
+      NotifyRemoved (item);
+      items.push_back (item);
+      count++;
+    }
+  return count;
+}
+
+template <typename Item>
+void
+PrioQueue<Item>::NotifyRemoved (Ptr<Item> item)
+{
+  NS_ASSERT (m_nBytes.Get () >= item->GetSize ());
+
+  m_nBytes -= item->GetSize ();
+  m_nPackets--;
+
+  NS_LOG_LOGIC ("m_traceDequeue (p)");
+  m_traceDequeue (item);
 }
 
 template <typename Item>
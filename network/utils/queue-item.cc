@@ -85,7 +85,10 @@ QueueDiscItem::QueueDiscItem (Ptr<Packet> p, const Address& addr, uint16_t proto
     m_address (addr),
     m_protocol (protocol),
     m_txq (0),
-    m_priority (0)
+    m_priority (0),
+    m_rank (0),
+    m_flowHash (0),
+    m_flowHashValid (false)
 {
   NS_LOG_FUNCTION (this << p << addr << protocol);
 }
@@ -135,6 +138,21 @@ QueueDiscItem::SetPriority (uint32_t priority)
 {
   NS_LOG_FUNCTION (this << (uint32_t) priority);
   m_priority = priority;
+  m_rank = priority;
+}
+
+uint64_t
+QueueDiscItem::GetRank (void) const
+{
+  NS_LOG_FUNCTION (this);
+  return m_rank;
+}
+
+void
+QueueDiscItem::SetRank (uint64_t rank)
+{
+  NS_LOG_FUNCTION (this << rank);
+  m_rank = rank;
 }
 
 Time
@@ -158,7 +176,8 @@ QueueDiscItem::Print (std::ostream& os) const
      << "Dst addr " << m_address << " "
      << "proto " << (uint16_t) m_protocol << " "
      << "txq " << (uint8_t) m_txq << " "
-     << "priority " << (uint32_t) m_priority
+     << "priority " << (uint32_t) m_priority << " "
+     << "rank " << m_rank
   ;
 }
 
@@ -169,4 +188,15 @@ QueueDiscItem::Hash (uint32_t perturbation) const
   return 0;
 }
 
+uint32_t
+QueueDiscItem::GetFlowHash (void) const
+{
+  if (!m_flowHashValid)
+    {
+      m_flowHash = Hash ();
+      m_flowHashValid = true;
+    }
+  return m_flowHash;
+}
+
 } // namespace ns3
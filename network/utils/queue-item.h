@@ -194,11 +194,29 @@ public:
   void SetTxQueueIndex (uint8_t txq);
 
   /**
-   * \brief Set the priority of this item
+   * \brief Set the priority of this item. The rank of the item is set to
+   *        the priority as well
    * \param priority the item's priority
    */
   void SetPriority (uint32_t priority);
 
+  /**
+   * \brief Get the rank of the item, which orders the item in a PIFO
+   *
+   * Ranks are compared with serial number arithmetic (see PifoRankBefore),
+   * hence a monotonically increasing rank such as a virtual time may wrap
+   * around 2^64 as long as the queued ranks span less than 2^63.
+   *
+   * \return the rank of the item
+   */
+  uint64_t GetRank (void) const;
+
+  /**
+   * \brief Set the rank of this item
+   * \param rank the item's rank
+   */
+  void SetRank (uint64_t rank);
+
   /**
    * \brief Get the timestamp included in this item
    * \return the timestamp included in this item.
@@ -244,6 +262,17 @@ public:
    */
   virtual uint32_t Hash (uint32_t perturbation = 0) const;
 
+  /**
+   * \brief Get the hash of the flow of the packet, without perturbation
+   *
+   * The hash is computed by Hash on the first call and cached in the item,
+   * so that the packet filters and queue discs keying per-flow state by the
+   * flow hash parse the headers once per packet.
+   *
+   * \return the flow hash
+   */
+  uint32_t GetFlowHash (void) const;
+
 private:
   /**
    * \brief Default constructor
@@ -269,7 +298,10 @@ private:
   uint16_t m_protocol;    //!< L3 Protocol number
   uint8_t m_txq;          //!< Transmission queue index
   uint32_t m_priority;    //!< priority of the item
+  uint64_t m_rank;        //!< rank of the item
   Time m_tstamp;          //!< timestamp when the packet was enqueued
+  mutable uint32_t m_flowHash;    //!< cached flow hash
+  mutable bool m_flowHashValid;   //!< whether m_flowHash holds the flow hash
 };
 
 } // namespace ns3
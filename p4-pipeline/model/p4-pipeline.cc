@@ -21,19 +21,27 @@
 #include <bm/bm_sim/parser.h>
 #include <bm/bm_sim/tables.h>
 #include <bm/bm_sim/logger.h>
+#include <bm/bm_sim/stateful.h>
 #include <bm/bm_sim/event_logger.h>
 #include <bm/bm_runtime/bm_runtime.h>
 #include <bm/bm_sim/options_parse.h>
+#include <bm/jsoncpp/json.h>
 
 #include <unistd.h>
+#include <algorithm>
+#include <cctype>
 #include <cstdlib>
+#include <fstream>
 #include <iostream>
 #include <memory>
+#include <set>
+#include <stdexcept>
 #include <string>
 #include <chrono>
 #include <thread>
 
 #include "p4-pipeline.h"
+#include "ns3/fatal-error.h"
 
 // NOTE: do not include "ns3/log.h" because of name conflict with LOG_DEBUG
 
@@ -78,9 +86,9 @@ REGISTER_HASH(bmv2_hash);
 // initialize static attributes
 int SimpleP4Pipe::thrift_port = 9090;
 bm::packet_id_t SimpleP4Pipe::packet_id = 0;
-uint8_t SimpleP4Pipe::ns2bm_buf[MAX_PKT_SIZE] = {};
 
 SimpleP4Pipe::SimpleP4Pipe (std::string jsonFile)
+  : json_file(jsonFile)
 {
   // Required fields
   add_required_field("standard_metadata", "qdepth");
@@ -93,6 +101,9 @@ SimpleP4Pipe::SimpleP4Pipe (std::string jsonFile)
   add_required_field("standard_metadata", "avg_deq_rate_bytes");
   add_required_field("standard_metadata", "pkt_len");
   add_required_field("standard_metadata", "pkt_len_bytes");
+  add_required_field("standard_metadata", "gso_segs");
+  add_required_field("standard_metadata", "egress_port");
+  add_required_field("standard_metadata", "shared_qdepth_bytes");
   add_required_field("standard_metadata", "l3_proto");
   add_required_field("standard_metadata", "flow_hash");
   add_required_field("standard_metadata", "ingress_trigger");
@@ -134,6 +145,8 @@ SimpleP4Pipe::SimpleP4Pipe (std::string jsonFile)
   // P4 program outputs
   add_required_field("standard_metadata", "drop");
   add_required_field("standard_metadata", "mark");
+  add_required_field("standard_metadata", "qid");
+  add_required_field("standard_metadata", "rank");
   // P4 program tracedata
   add_required_field("standard_metadata", "trace_var1");
   add_required_field("standard_metadata", "trace_var2");
@@ -192,13 +205,23 @@ SimpleP4Pipe::receive_(port_t port_num, const char *buffer, int len)
 
 Ptr<Packet>
 SimpleP4Pipe::process_pipeline(Ptr<Packet> ns3_packet, std_meta_t &std_meta) {
+  return run_pipeline(ns3_packet, std_meta, this->get_pipeline("ingress"));
+}
+
+Ptr<Packet>
+SimpleP4Pipe::process_egress_pipeline(Ptr<Packet> ns3_packet, std_meta_t &std_meta) {
+  return run_pipeline(ns3_packet, std_meta, this->get_pipeline("egress"));
+}
+
+Ptr<Packet>
+SimpleP4Pipe::run_pipeline(Ptr<Packet> ns3_packet, std_meta_t &std_meta, bm::Pipeline *mau) {
   bm::Parser *parser = this->get_parser("parser");
-  bm::Pipeline *mau = this->get_pipeline("ingress");
   bm::Deparser *deparser = this->get_deparser("deparser");
   bm::PHV *phv;
 
-  int len = ns3_packet->GetSize();
-  auto packet = get_bm_packet(ns3_packet);
+  size_t len = ns3_packet->GetSize();
+  size_t import_len = std::min(len, max_import_size);
+  auto packet = get_bm_packet(ns3_packet, import_len);
 
   BMELOG(packet_in, *packet);
 
@@ -207,9 +230,6 @@ SimpleP4Pipe::process_pipeline(Ptr<Packet> ns3_packet, std_meta_t &std_meta) {
 
   /* Set standard metadata */
 
-  // using packet register 0 to store length, this register will be updated for
-  // each add_header / remove_header primitive call
-  packet->set_register(PACKET_LENGTH_REG_IDX, len);
   phv->get_field("standard_metadata.qdepth").set(std_meta.qdepth);
   phv->get_field("standard_metadata.qdepth_bytes").set(std_meta.qdepth_bytes);
   phv->get_field("standard_metadata.avg_qdepth").set(std_meta.avg_qdepth);
@@ -220,49 +240,72 @@ SimpleP4Pipe::process_pipeline(Ptr<Packet> ns3_packet, std_meta_t &std_meta) {
   phv->get_field("standard_metadata.avg_deq_rate_bytes").set(std_meta.avg_deq_rate_bytes);
   phv->get_field("standard_metadata.pkt_len").set(std_meta.pkt_len);
   phv->get_field("standard_metadata.pkt_len_bytes").set(std_meta.pkt_len_bytes);
+  phv->get_field("standard_metadata.gso_segs").set(std_meta.gso_segs);
+  phv->get_field("standard_metadata.egress_port").set(std_meta.egress_port);
+  phv->get_field("standard_metadata.shared_qdepth_bytes").set(std_meta.shared_qdepth_bytes);
   phv->get_field("standard_metadata.l3_proto").set(std_meta.l3_proto);
   phv->get_field("standard_metadata.flow_hash").set(std_meta.flow_hash);
-  phv->get_field("standard_metadata.ingress_trigger").set(std_meta.ingress_trigger);
-  phv->get_field("standard_metadata.timer_trigger").set(std_meta.timer_trigger);
-  // drop trigger metadata
-  phv->get_field("standard_metadata.drop_trigger").set(std_meta.drop_trigger);
-  phv->get_field("standard_metadata.drop_timestamp").set(std_meta.drop_timestamp);
-  phv->get_field("standard_metadata.drop_qdepth").set(std_meta.drop_qdepth);
-  phv->get_field("standard_metadata.drop_qdepth_bytes").set(std_meta.drop_qdepth_bytes);
-  phv->get_field("standard_metadata.drop_avg_qdepth").set(std_meta.drop_avg_qdepth);
-  phv->get_field("standard_metadata.drop_avg_qdepth_bytes").set(std_meta.drop_avg_qdepth_bytes);
-  phv->get_field("standard_metadata.drop_pkt_len").set(std_meta.drop_pkt_len);
-  phv->get_field("standard_metadata.drop_pkt_len_bytes").set(std_meta.drop_pkt_len_bytes);
-  phv->get_field("standard_metadata.drop_l3_proto").set(std_meta.drop_l3_proto);
-  phv->get_field("standard_metadata.drop_flow_hash").set(std_meta.drop_flow_hash);
-  // enqueue trigger metadata
-  phv->get_field("standard_metadata.enq_trigger").set(std_meta.enq_trigger);
-  phv->get_field("standard_metadata.enq_timestamp").set(std_meta.enq_timestamp);
-  phv->get_field("standard_metadata.enq_qdepth").set(std_meta.enq_qdepth);
-  phv->get_field("standard_metadata.enq_qdepth_bytes").set(std_meta.enq_qdepth_bytes);
-  phv->get_field("standard_metadata.enq_avg_qdepth").set(std_meta.enq_avg_qdepth);
-  phv->get_field("standard_metadata.enq_avg_qdepth_bytes").set(std_meta.enq_avg_qdepth_bytes);
-  phv->get_field("standard_metadata.enq_pkt_len").set(std_meta.enq_pkt_len);
-  phv->get_field("standard_metadata.enq_pkt_len_bytes").set(std_meta.enq_pkt_len_bytes);
-  phv->get_field("standard_metadata.enq_l3_proto").set(std_meta.enq_l3_proto);
-  phv->get_field("standard_metadata.enq_flow_hash").set(std_meta.enq_flow_hash);
-  // dequeue trigger metadata
-  phv->get_field("standard_metadata.deq_trigger").set(std_meta.deq_trigger);
-  phv->get_field("standard_metadata.deq_enq_timestamp").set(std_meta.deq_enq_timestamp);
-  phv->get_field("standard_metadata.deq_qdepth").set(std_meta.deq_qdepth);
-  phv->get_field("standard_metadata.deq_qdepth_bytes").set(std_meta.deq_qdepth_bytes);
-  phv->get_field("standard_metadata.deq_avg_qdepth").set(std_meta.deq_avg_qdepth);
-  phv->get_field("standard_metadata.deq_avg_qdepth_bytes").set(std_meta.deq_avg_qdepth_bytes);
-  phv->get_field("standard_metadata.deq_timestamp").set(std_meta.deq_timestamp);
-  phv->get_field("standard_metadata.deq_pkt_len").set(std_meta.deq_pkt_len);
-  phv->get_field("standard_metadata.deq_pkt_len_bytes").set(std_meta.deq_pkt_len_bytes);
-  phv->get_field("standard_metadata.deq_l3_proto").set(std_meta.deq_l3_proto);
-  phv->get_field("standard_metadata.deq_flow_hash").set(std_meta.deq_flow_hash);
-
-  phv->get_field("standard_metadata.trace_var1").set(std_meta.trace_var1);
-  phv->get_field("standard_metadata.trace_var2").set(std_meta.trace_var2);
-  phv->get_field("standard_metadata.trace_var3").set(std_meta.trace_var3);
-  phv->get_field("standard_metadata.trace_var4").set(std_meta.trace_var4);
+
+  // reset_metadata() zeroed the fields of the inactive triggers, only the
+  // fields of the active trigger need to be set
+  switch (std_meta.trigger) {
+  case TRIGGER_INGRESS:
+    phv->get_field("standard_metadata.ingress_trigger").set(1);
+    break;
+  case TRIGGER_TIMER:
+    phv->get_field("standard_metadata.timer_trigger").set(1);
+    break;
+  case TRIGGER_DROP: {
+    const std_meta_event_t &ev = std_meta.drop_event;
+    phv->get_field("standard_metadata.drop_trigger").set(1);
+    phv->get_field("standard_metadata.drop_timestamp").set(ev.timestamp);
+    phv->get_field("standard_metadata.drop_qdepth").set(ev.qdepth);
+    phv->get_field("standard_metadata.drop_qdepth_bytes").set(ev.qdepth_bytes);
+    phv->get_field("standard_metadata.drop_avg_qdepth").set(ev.avg_qdepth);
+    phv->get_field("standard_metadata.drop_avg_qdepth_bytes").set(ev.avg_qdepth_bytes);
+    phv->get_field("standard_metadata.drop_pkt_len").set(ev.pkt_len);
+    phv->get_field("standard_metadata.drop_pkt_len_bytes").set(ev.pkt_len_bytes);
+    phv->get_field("standard_metadata.drop_l3_proto").set(ev.l3_proto);
+    phv->get_field("standard_metadata.drop_flow_hash").set(ev.flow_hash);
+    break;
+  }
+  case TRIGGER_ENQ: {
+    const std_meta_event_t &ev = std_meta.enq_event;
+    phv->get_field("standard_metadata.enq_trigger").set(1);
+    phv->get_field("standard_metadata.enq_timestamp").set(ev.timestamp);
+    phv->get_field("standard_metadata.enq_qdepth").set(ev.qdepth);
+    phv->get_field("standard_metadata.enq_qdepth_bytes").set(ev.qdepth_bytes);
+    phv->get_field("standard_metadata.enq_avg_qdepth").set(ev.avg_qdepth);
+    phv->get_field("standard_metadata.enq_avg_qdepth_bytes").set(ev.avg_qdepth_bytes);
+    phv->get_field("standard_metadata.enq_pkt_len").set(ev.pkt_len);
+    phv->get_field("standard_metadata.enq_pkt_len_bytes").set(ev.pkt_len_bytes);
+    phv->get_field("standard_metadata.enq_l3_proto").set(ev.l3_proto);
+    phv->get_field("standard_metadata.enq_flow_hash").set(ev.flow_hash);
+    break;
+  }
+  case TRIGGER_DEQ: {
+    const std_meta_deq_t &ev = std_meta.deq_event;
+    phv->get_field("standard_metadata.deq_trigger").set(1);
+    phv->get_field("standard_metadata.deq_enq_timestamp").set(ev.enq_timestamp);
+    phv->get_field("standard_metadata.deq_qdepth").set(ev.qdepth);
+    phv->get_field("standard_metadata.deq_qdepth_bytes").set(ev.qdepth_bytes);
+    phv->get_field("standard_metadata.deq_avg_qdepth").set(ev.avg_qdepth);
+    phv->get_field("standard_metadata.deq_avg_qdepth_bytes").set(ev.avg_qdepth_bytes);
+    phv->get_field("standard_metadata.deq_timestamp").set(ev.timestamp);
+    phv->get_field("standard_metadata.deq_pkt_len").set(ev.pkt_len);
+    phv->get_field("standard_metadata.deq_pkt_len_bytes").set(ev.pkt_len_bytes);
+    phv->get_field("standard_metadata.deq_l3_proto").set(ev.l3_proto);
+    phv->get_field("standard_metadata.deq_flow_hash").set(ev.flow_hash);
+    break;
+  }
+  }
+
+  if (trace_vars_enabled) {
+    phv->get_field("standard_metadata.trace_var1").set(std_meta.trace_var1);
+    phv->get_field("standard_metadata.trace_var2").set(std_meta.trace_var2);
+    phv->get_field("standard_metadata.trace_var3").set(std_meta.trace_var3);
+    phv->get_field("standard_metadata.trace_var4").set(std_meta.trace_var4);
+  }
 
   BMLOG_DEBUG_PKT(*packet, "Processing received packet");
 
@@ -278,10 +321,26 @@ SimpleP4Pipe::process_pipeline(Ptr<Packet> ns3_packet, std_meta_t &std_meta) {
   deparser->deparse(packet.get());
 
   /* Set trace variables */
-  std_meta.trace_var1 = phv->get_field("standard_metadata.trace_var1").get_int();
-  std_meta.trace_var2 = phv->get_field("standard_metadata.trace_var2").get_int();
-  std_meta.trace_var3 = phv->get_field("standard_metadata.trace_var3").get_int();
-  std_meta.trace_var4 = phv->get_field("standard_metadata.trace_var4").get_int();
+  if (trace_vars_enabled) {
+    std_meta.trace_var1 = phv->get_field("standard_metadata.trace_var1").get_int();
+    std_meta.trace_var2 = phv->get_field("standard_metadata.trace_var2").get_int();
+    std_meta.trace_var3 = phv->get_field("standard_metadata.trace_var3").get_int();
+    std_meta.trace_var4 = phv->get_field("standard_metadata.trace_var4").get_int();
+  }
+
+  /* Read back the traced fields */
+  for (size_t i = 0; i < traced_fields.size(); i++) {
+    const traced_field_t &f = traced_fields[i];
+    if (f.reg_handle >= 0) {
+      const register_handle_t &reg = register_handles[f.reg_handle];
+      auto lock = reg.array->unique_lock();
+      traced_values[i] = (*reg.array)[f.reg_index].get_uint64();
+    } else if (f.header_id >= 0) {
+      traced_values[i] = phv->get_header(f.header_id).get_field(f.field_offset).get_uint64();
+    } else {
+      traced_values[i] = 0;
+    }
+  }
 
   /* Set drop and mark fields */
   int drop = phv->get_field("standard_metadata.drop").get_int();
@@ -292,32 +351,412 @@ SimpleP4Pipe::process_pipeline(Ptr<Packet> ns3_packet, std_meta_t &std_meta) {
   BMLOG_DEBUG_PKT(*packet, "Mark field is {}", mark);
   std_meta.mark = (mark != 0);
 
+  /* Set class selection and rank fields */
+  std_meta.qid = phv->get_field("standard_metadata.qid").get_uint();
+  BMLOG_DEBUG_PKT(*packet, "Qid field is {}", std_meta.qid);
+
+  std_meta.rank = phv->get_field("standard_metadata.rank").get_uint();
+  BMLOG_DEBUG_PKT(*packet, "Rank field is {}", std_meta.rank);
+
   BMELOG(packet_out, *packet);
   BMLOG_DEBUG_PKT(*packet, "Transmitting packet");
 
-  return get_ns3_packet(std::move(packet));
+  return get_ns3_packet(std::move(packet), ns3_packet, import_len);
+}
+
+int
+SimpleP4Pipe::get_register_handle(const std::string &name) {
+  for (size_t i = 0; i < register_handles.size(); i++) {
+    if (register_handles[i].name == name)
+      return static_cast<int>(i);
+  }
+
+  // resolve the register array once, so that it is read and written
+  // directly rather than looked up by name on every access
+  bm::RegisterArray *array = nullptr;
+  try {
+    array = this->get_context(0)->get_register_array(name);
+  } catch (const std::out_of_range &) {
+    array = nullptr;
+  }
+  if (array == nullptr || array->size() == 0) {
+    BMLOG_DEBUG("No register array named {}", name);
+    return -1;
+  }
+  register_handles.push_back({name, array->size(), array});
+  return static_cast<int>(register_handles.size() - 1);
+}
+
+size_t
+SimpleP4Pipe::get_register_size(int handle) const {
+  return register_handles.at(handle).size;
+}
+
+const std::string &
+SimpleP4Pipe::get_register_name(int handle) const {
+  return register_handles.at(handle).name;
+}
+
+void
+SimpleP4Pipe::read_register(int handle, std::vector<uint64_t> &values) {
+  const register_handle_t &reg = register_handles.at(handle);
+  auto lock = reg.array->unique_lock();
+
+  values.resize(reg.size);
+  for (size_t i = 0; i < reg.size; i++)
+    values[i] = (*reg.array)[i].get_uint64();
+}
+
+void
+SimpleP4Pipe::write_register(int handle, size_t index, uint64_t value) {
+  const register_handle_t &reg = register_handles.at(handle);
+  if (index >= reg.size)
+    return;
+  auto lock = reg.array->unique_lock();
+  (*reg.array)[index].set(value);
+}
+
+bool
+SimpleP4Pipe::set_traced_fields(const std::vector<std::string> &fields) {
+  traced_fields.clear();
+  // the PHV fields are resolved against the PHV of a dummy packet, all the
+  // packets of the pipeline share the same PHV layout
+  std::unique_ptr<bm::Packet> packet;
+  for (const std::string &name : fields) {
+    traced_field_t f = {name, -1, 0, -1, 0};
+    size_t bracket = name.find('[');
+    if (bracket != std::string::npos) {
+      // register cell: name[index]
+      f.name = name.substr(0, bracket);
+      const char *begin = name.c_str() + bracket + 1;
+      char *end = nullptr;
+      unsigned long index = std::isdigit(static_cast<unsigned char>(*begin))
+                            ? std::strtoul(begin, &end, 10) : 0;
+      if (end == nullptr || end[0] != ']' || end[1] != '\0') {
+        NS_FATAL_ERROR("Invalid traced register cell " << name
+                       << ", expected the name of a register array followed by"
+                       << " a decimal index in brackets (e.g. flow_table[3])");
+      }
+      f.reg_index = index;
+      f.reg_handle = get_register_handle(f.name);
+      if (f.reg_handle < 0 || f.reg_index >= get_register_size(f.reg_handle)) {
+        BMLOG_DEBUG("Invalid traced register cell {}", name);
+        traced_fields.clear();
+        traced_values.clear();
+        return false;
+      }
+    } else {
+      // PHV field: header.field, read back as 0 if there is no such field
+      if (!packet)
+        packet = new_packet_ptr(0, 0, 0, bm::PacketBuffer(PKT_HEADROOM));
+      bm::PHV *phv = packet->get_phv();
+      if (phv->has_field(name)) {
+        size_t dot = name.find('.');
+        const bm::Header &header = phv->get_header(name.substr(0, dot));
+        f.header_id = header.get_id();
+        f.field_offset = header.get_header_type().get_field_offset(name.substr(dot + 1));
+      } else {
+        BMLOG_DEBUG("No PHV field named {}", name);
+      }
+    }
+    traced_fields.push_back(f);
+  }
+  traced_values.assign(traced_fields.size(), 0);
+  return true;
+}
+
+const std::vector<uint64_t> &
+SimpleP4Pipe::get_traced_values() const {
+  return traced_values;
+}
+
+void
+SimpleP4Pipe::set_trace_vars_enabled(bool enable) {
+  trace_vars_enabled = enable;
+}
+
+void
+SimpleP4Pipe::set_max_import_size(size_t size) {
+  max_import_size = size;
+}
+
+namespace {
+
+// primitives that read or write state persisting across invocations
+const char *const stateful_primitives[] = {
+  "register_read", "register_write", "count", "execute_meter",
+  "modify_field_rng_uniform", "modify_field_with_hash_based_offset_rng"
+};
+
+// whether a primitive parameter refers to a packet (non metadata) header
+bool
+is_packet_header_param(const Json::Value &param,
+                       const std::set<std::string> &packet_headers) {
+  const std::string type = param["type"].asString();
+  if (type == "field") {
+    return packet_headers.count(param["value"][0].asString()) > 0;
+  }
+  if (type == "header") {
+    return packet_headers.count(param["value"].asString()) > 0;
+  }
+  return type == "header_stack" || type == "stack_field";
+}
+
+// whether a standard metadata field has the same value for every ingress
+// invocation, or is an output of the program
+bool
+is_ingress_constant_field(const std::string &field) {
+  const char *const outputs[] = {"drop", "mark", "qid", "rank"};
+  for (const char *output : outputs) {
+    if (field == output) {
+      return true;
+    }
+  }
+  const std::string trigger = "_trigger";
+  if (field.size() > trigger.size() &&
+      field.compare(field.size() - trigger.size(), trigger.size(), trigger) == 0) {
+    return true;
+  }
+  // the fields of the drop, enqueue and dequeue events are zero on ingress
+  return field.compare(0, 5, "drop_") == 0 || field.compare(0, 4, "enq_") == 0 ||
+         field.compare(0, 4, "deq_") == 0;
+}
+
+// find a reference to a standard metadata field outside the key, i.e., a
+// ["standard_metadata", <field>] pair anywhere below a JSON value
+bool
+find_unkeyed_field(const Json::Value &value, const std::set<std::string> &key_fields,
+                   std::string &field) {
+  if (value.isArray()) {
+    if (value.size() == 2 && value[0].isString() && value[1].isString() &&
+        value[0].asString() == "standard_metadata") {
+      const std::string name = value[1].asString();
+      if (key_fields.count(name) == 0 && !is_ingress_constant_field(name)) {
+        field = name;
+        return true;
+      }
+      return false;
+    }
+    for (const auto &element : value) {
+      if (find_unkeyed_field(element, key_fields, field)) {
+        return true;
+      }
+    }
+  } else if (value.isObject()) {
+    for (const auto &member : value) {
+      if (find_unkeyed_field(member, key_fields, field)) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+// find a reference to a packet header field, i.e., a [<header>, <field>]
+// pair anywhere below a JSON value
+bool
+find_packet_header_field(const Json::Value &value,
+                         const std::set<std::string> &packet_headers,
+                         std::string &field) {
+  if (value.isArray()) {
+    if (value.size() == 2 && value[0].isString() && value[1].isString() &&
+        packet_headers.count(value[0].asString()) > 0) {
+      field = value[0].asString() + "." + value[1].asString();
+      return true;
+    }
+    for (const auto &element : value) {
+      if (find_packet_header_field(element, packet_headers, field)) {
+        return true;
+      }
+    }
+  } else if (value.isObject()) {
+    for (const auto &member : value) {
+      if (find_packet_header_field(member, packet_headers, field)) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+}  // namespace
+
+bool
+SimpleP4Pipe::is_memoizable(const std::set<std::string> &key_fields,
+                            std::string &reason) const {
+  Json::Value root;
+  std::ifstream fs(json_file);
+  try {
+    fs >> root;
+  } catch (const std::exception &e) {
+    reason = "cannot parse " + json_file;
+    return false;
+  }
+
+  const char *const stateful_objects[] = {
+    "register_arrays", "counter_arrays", "meter_arrays", "action_profiles"
+  };
+  for (const char *objects : stateful_objects) {
+    if (!root[objects].empty()) {
+      reason = std::string(objects) + " " + root[objects][0]["name"].asString();
+      return false;
+    }
+  }
+
+  std::set<std::string> packet_headers;
+  for (const auto &header : root["headers"]) {
+    if (!header["metadata"].asBool()) {
+      packet_headers.insert(header["name"].asString());
+    }
+  }
+
+  for (const auto &action : root["actions"]) {
+    for (const auto &primitive : action["primitives"]) {
+      const std::string op = primitive["op"].asString();
+      for (const char *stateful : stateful_primitives) {
+        if (op == stateful) {
+          reason = "primitive " + op + " in action " + action["name"].asString();
+          return false;
+        }
+      }
+      // the destination of a primitive is its first parameter
+      const Json::Value &params = primitive["parameters"];
+      if (!params.empty() && is_packet_header_param(params[0], packet_headers)) {
+        reason = "header rewrite (" + op + ") in action " + action["name"].asString();
+        return false;
+      }
+    }
+  }
+
+  // the actions, table keys, conditions, parser and calculations must not
+  // read the standard metadata beyond the key; the header definitions list
+  // field names only
+  for (const auto &section : root.getMemberNames()) {
+    if (section == "header_types" || section == "headers") {
+      continue;
+    }
+    std::string field;
+    if (find_unkeyed_field(root[section], key_fields, field)) {
+      reason = "standard_metadata." + field + " is not part of the key (" + section + ")";
+      return false;
+    }
+  }
+
+  // nor read packet header fields, as the key only covers the flow hash and
+  // the L3 protocol (e.g., a branch on the TCP flags or the DSCP). The parser
+  // and the checksums may read them, and so may the calculations of the
+  // checksums
+  std::set<std::string> checksum_calculations;
+  for (const auto &checksum : root["checksums"]) {
+    checksum_calculations.insert(checksum["calculation"].asString());
+  }
+  const char *const reading_sections[] = {"actions", "pipelines", "calculations"};
+  for (const char *section : reading_sections) {
+    for (const auto &object : root[section]) {
+      if (std::string(section) == "calculations" &&
+          checksum_calculations.count(object["name"].asString()) > 0) {
+        continue;
+      }
+      std::string field;
+      if (find_packet_header_field(object, packet_headers, field)) {
+        reason = field + " is not part of the key (" + section + ")";
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+uint64_t
+SimpleP4Pipe::get_table_generation() const {
+  return table_generation.load(std::memory_order_acquire);
+}
+
+bm::MatchErrorCode
+SimpleP4Pipe::mt_add_entry(bm::cxt_id_t cxt_id, const std::string &table_name,
+                           const std::vector<bm::MatchKeyParam> &match_key,
+                           const std::string &action_name,
+                           bm::ActionData action_data,
+                           bm::entry_handle_t *handle, int priority) {
+  bm::MatchErrorCode rc = bm::Switch::mt_add_entry(
+      cxt_id, table_name, match_key, action_name, std::move(action_data),
+      handle, priority);
+  table_generation.fetch_add(1, std::memory_order_release);
+  return rc;
+}
+
+bm::MatchErrorCode
+SimpleP4Pipe::mt_set_default_action(bm::cxt_id_t cxt_id,
+                                    const std::string &table_name,
+                                    const std::string &action_name,
+                                    bm::ActionData action_data) {
+  bm::MatchErrorCode rc = bm::Switch::mt_set_default_action(
+      cxt_id, table_name, action_name, std::move(action_data));
+  table_generation.fetch_add(1, std::memory_order_release);
+  return rc;
+}
+
+bm::MatchErrorCode
+SimpleP4Pipe::mt_delete_entry(bm::cxt_id_t cxt_id,
+                              const std::string &table_name,
+                              bm::entry_handle_t handle) {
+  bm::MatchErrorCode rc = bm::Switch::mt_delete_entry(cxt_id, table_name, handle);
+  table_generation.fetch_add(1, std::memory_order_release);
+  return rc;
+}
+
+bm::MatchErrorCode
+SimpleP4Pipe::mt_modify_entry(bm::cxt_id_t cxt_id,
+                              const std::string &table_name,
+                              bm::entry_handle_t handle,
+                              const std::string &action_name,
+                              bm::ActionData action_data) {
+  bm::MatchErrorCode rc = bm::Switch::mt_modify_entry(
+      cxt_id, table_name, handle, action_name, std::move(action_data));
+  table_generation.fetch_add(1, std::memory_order_release);
+  return rc;
+}
+
+bm::MatchErrorCode
+SimpleP4Pipe::mt_clear_entries(bm::cxt_id_t cxt_id,
+                               const std::string &table_name,
+                               bool reset_default_entry) {
+  bm::MatchErrorCode rc = bm::Switch::mt_clear_entries(
+      cxt_id, table_name, reset_default_entry);
+  table_generation.fetch_add(1, std::memory_order_release);
+  return rc;
 }
 
 std::unique_ptr<bm::Packet>
-SimpleP4Pipe::get_bm_packet(Ptr<Packet> ns3_packet) {
+SimpleP4Pipe::get_bm_packet(Ptr<Packet> ns3_packet, size_t import_len) {
   port_t port_num = 0; // unused
-  int len = ns3_packet->GetSize();
 
-  if (len > MAX_PKT_SIZE)  {
-    BMLOG_DEBUG("Packet length {} exceeds MAX_PKT_SIZE", len);
-    std::exit(1); // TODO(sibanez): set error code
-  }
-  ns3_packet->CopyData(ns2bm_buf, len);
+  if (ns2bm_buf.size() < import_len)
+    ns2bm_buf.resize(import_len);
+  ns3_packet->CopyData(ns2bm_buf.data(), import_len);
+  size_t len = ns3_packet->GetSize();
   auto bm_packet = new_packet_ptr(port_num, packet_id++, len,
-                               bm::PacketBuffer(MAX_PKT_SIZE, (char*)(ns2bm_buf), len));
+                               bm::PacketBuffer(import_len + PKT_HEADROOM,
+                                                (char*)(ns2bm_buf.data()), import_len));
+  // using packet register 0 to store length, this register will be updated for
+  // each add_header / remove_header primitive call. It holds the full length
+  // even if only the first import_len bytes are imported
+  bm_packet->set_register(PACKET_LENGTH_REG_IDX, len);
   return bm_packet;
 }
 
 Ptr<Packet>
-SimpleP4Pipe::get_ns3_packet(std::unique_ptr<bm::Packet> bm_packet) {
+SimpleP4Pipe::get_ns3_packet(std::unique_ptr<bm::Packet> bm_packet,
+                             Ptr<Packet> ns3_packet, size_t import_len) {
   char *bm_buf = bm_packet.get()->data();
   size_t len = bm_packet.get()->get_data_size();
-  return Create<Packet> ((uint8_t*)(bm_buf), len);
+  Ptr<Packet> packet = Create<Packet> ((uint8_t*)(bm_buf), len);
+
+  // header-only import: append the payload that bmv2 did not see
+  size_t total_len = ns3_packet->GetSize();
+  if (import_len < total_len)
+    packet->AddAtEnd(ns3_packet->CreateFragment(import_len, total_len - import_len));
+  return packet;
 }
 
 }
@@ -21,13 +21,20 @@
 #ifndef P4_PIPELINE_H
 #define P4_PIPELINE_H
 
-#define MAX_PKT_SIZE 2048
+// number of leading bytes of a packet imported into bmv2 by default
+#define DEFAULT_MAX_IMPORT_SIZE 2048
+// room left in front of the imported bytes for headers added by the program
+#define PKT_HEADROOM 512
 
 #include <bm/bm_sim/packet.h>
 #include <bm/bm_sim/switch.h>
 
+#include <atomic>
 #include <memory>
+#include <set>
 #include <string>
+#include <type_traits>
+#include <vector>
 
 #include "ns3/pointer.h"
 #include "ns3/packet.h"
@@ -35,60 +42,90 @@
 namespace ns3 {
 
 /**
- * \brief The standard metadata for the P4 pipeline
+ * \brief The event that caused the P4 pipeline to be invoked
+ *
+ * Selects the member of the std_meta_t union that holds the payload of the
+ * trigger. The corresponding *_trigger field of standard_metadata is set
+ * when the metadata is marshalled into the PHV.
+ */
+typedef enum : uint8_t {
+  TRIGGER_INGRESS,              // packet arriving at the queue disc
+  TRIGGER_TIMER,                // periodic timer event
+  TRIGGER_DROP,                 // drop before enqueue event
+  TRIGGER_ENQ,                  // enqueue event
+  TRIGGER_DEQ                   // dequeue event or egress processing
+} std_meta_trigger_t;
+
+/**
+ * \brief The payload of the drop and enqueue triggers
  */
 typedef struct {
+  int64_t  timestamp;
   uint32_t qdepth;
   uint32_t qdepth_bytes;
   uint32_t avg_qdepth;
   uint32_t avg_qdepth_bytes;
-  int64_t timestamp; 
-  int64_t idle_time; 
-  int64_t qlatency; 
-  uint32_t avg_deq_rate_bytes;
   uint32_t pkt_len;
   uint32_t pkt_len_bytes;
-  uint16_t l3_proto;
   uint32_t flow_hash;
-  bool ingress_trigger;
-  bool timer_trigger;
-  // drop trigger metadata
-  bool     drop_trigger;
-  int64_t  drop_timestamp;
-  uint32_t drop_qdepth;
-  uint32_t drop_qdepth_bytes;
-  uint32_t drop_avg_qdepth;
-  uint32_t drop_avg_qdepth_bytes;
-  uint32_t drop_pkt_len;
-  uint32_t drop_pkt_len_bytes;
-  uint16_t drop_l3_proto;
-  uint32_t drop_flow_hash;
-  // enqueue trigger metadata
-  bool     enq_trigger;
+  uint16_t l3_proto;
+} std_meta_event_t;
+
+/**
+ * \brief The payload of the dequeue trigger
+ */
+typedef struct {
   int64_t  enq_timestamp;
-  uint32_t enq_qdepth;
-  uint32_t enq_qdepth_bytes;
-  uint32_t enq_avg_qdepth;
-  uint32_t enq_avg_qdepth_bytes;
-  uint32_t enq_pkt_len;
-  uint32_t enq_pkt_len_bytes;
-  uint16_t enq_l3_proto;
-  uint32_t enq_flow_hash;
-  // dequeue trigger metadata
-  bool     deq_trigger;
-  int64_t  deq_enq_timestamp;
-  uint32_t deq_qdepth;
-  uint32_t deq_qdepth_bytes;
-  uint32_t deq_avg_qdepth;
-  uint32_t deq_avg_qdepth_bytes;
-  int64_t  deq_timestamp;
-  uint32_t deq_pkt_len;
-  uint32_t deq_pkt_len_bytes;
-  uint16_t deq_l3_proto;
-  uint32_t deq_flow_hash;
+  int64_t  timestamp;
+  uint32_t qdepth;
+  uint32_t qdepth_bytes;
+  uint32_t avg_qdepth;
+  uint32_t avg_qdepth_bytes;
+  uint32_t pkt_len;
+  uint32_t pkt_len_bytes;
+  uint32_t flow_hash;
+  uint16_t l3_proto;
+} std_meta_deq_t;
+
+/**
+ * \brief The standard metadata for the P4 pipeline
+ *
+ * The per-trigger fields of standard_metadata (drop_*, enq_*, deq_*) are
+ * mutually exclusive, hence they share storage in a union tagged by the
+ * trigger field. Only the fields of the active trigger are marshalled into
+ * the PHV; all the other fields of standard_metadata read as 0 in the P4
+ * program. The struct is trivial, so a value-initialization (std_meta_t ())
+ * zeroes it at once.
+ */
+typedef struct alignas(64) {
+  // common inputs
+  int64_t timestamp;
+  int64_t idle_time;
+  int64_t qlatency;
+  uint32_t qdepth;
+  uint32_t qdepth_bytes;
+  uint32_t avg_qdepth;
+  uint32_t avg_qdepth_bytes;
+  uint32_t avg_deq_rate_bytes;
+  uint32_t pkt_len;
+  uint32_t pkt_len_bytes;
+  uint32_t gso_segs;            // number of segments in a GSO super-packet
+  uint32_t egress_port;         // index of the device the queue disc is attached to
+  uint32_t shared_qdepth_bytes; // backlog of all the ports sharing the pipeline
+  uint32_t flow_hash;
+  uint16_t l3_proto;
+  std_meta_trigger_t trigger;
+  // trigger payload, selected by trigger
+  union {
+    std_meta_event_t drop_event;
+    std_meta_event_t enq_event;
+    std_meta_deq_t   deq_event;
+  };
   // P4 program outputs
   bool drop;
   bool mark;
+  uint32_t qid;                 // class to enqueue the packet into
+  uint32_t rank;                // rank stamped on the packet for PIFO classes
   // P4 program tracedata
   uint32_t trace_var1;          // input/output
   uint32_t trace_var2;          // input/output
@@ -96,6 +133,8 @@ typedef struct {
   uint32_t trace_var4;          // input/output
 } std_meta_t;
 
+static_assert (std::is_trivial<std_meta_t>::value, "std_meta_t must stay trivial");
+
 /**
  * \ingroup p4-pipeline
  *
@@ -128,21 +167,188 @@ class SimpleP4Pipe : public bm::Switch {
    */
   Ptr<Packet> process_pipeline(Ptr<Packet> ns3_packet, std_meta_t &std_meta);
 
+  /**
+   * \brief Invoke the P4 egress processing pipeline (parser, egress match-action, deparser)
+   */
+  Ptr<Packet> process_egress_pipeline(Ptr<Packet> ns3_packet, std_meta_t &std_meta);
+
+  /**
+   * \brief Get a handle to the register array with the given name
+   *
+   * The handle records the name, size and location of the register array,
+   * so that it can be read repeatedly with read_register without invoking
+   * the pipeline or looking the array up by name. The handles are only
+   * valid for the P4 program loaded when they were obtained.
+   * \return the handle, or -1 if the P4 program has no such register array
+   */
+  int get_register_handle(const std::string &name);
+
+  /**
+   * \brief Get the number of cells of the register array behind \p handle
+   */
+  size_t get_register_size(int handle) const;
+
+  /**
+   * \brief Get the name of the register array behind \p handle
+   */
+  const std::string &get_register_name(int handle) const;
+
+  /**
+   * \brief Read all the cells of the register array behind \p handle
+   * \param values resized to the size of the register array and filled
+   *        with its cells
+   */
+  void read_register(int handle, std::vector<uint64_t> &values);
+
+  /**
+   * \brief Write a cell of the register array behind \p handle
+   */
+  void write_register(int handle, size_t index, uint64_t value);
+
+  /**
+   * \brief Set the fields read back after each invocation of the pipeline
+   * The fields are resolved once, a PHV field missing from the P4 program
+   * is read back as 0. A malformed register cell name is a fatal error.
+   * \param fields full names of PHV fields (e.g. "meta.flow_bytes") or
+   *        register cells (e.g. "flow_table[3]")
+   * \return false if one of the register cells does not exist
+   */
+  bool set_traced_fields(const std::vector<std::string> &fields);
+
+  /**
+   * \brief Get the values of the traced fields after the last invocation,
+   *        in the order given to set_traced_fields
+   */
+  const std::vector<uint64_t> &get_traced_values() const;
+
+  /**
+   * \brief Enable or disable the marshalling of trace_var1..4
+   */
+  void set_trace_vars_enabled(bool enable);
+
+  /**
+   * \brief Set the number of leading bytes of a packet imported into bmv2
+   *
+   * Larger packets (e.g. jumbo frames or GSO super-packets) are processed
+   * header-only: only their first \p size bytes go through the parser,
+   * match-action and deparser, and the rest of the payload is appended back
+   * untouched. The ingress length and the packet_length register of the
+   * bmv2 packet are set to the full length of the packet, as is the
+   * pkt_len_bytes metadata set by P4QueueDisc.
+   */
+  void set_max_import_size(size_t size);
+
+  /**
+   * \brief Check whether the verdict of the ingress control of the P4
+   *        program can be memoized
+   *
+   * The JSON is rejected if the program has state that persists across
+   * invocations (register, counter or meter arrays, action profiles), uses
+   * random numbers, rewrites packet headers, since a memoized verdict would
+   * skip the deparser, references a standard metadata field that is not
+   * part of the memoization key, or reads a packet header field outside the
+   * parser and the checksums (in an action, a table key or a condition),
+   * since no header field is part of the key. The outputs (drop, mark, qid,
+   * rank) and the trigger and event fields, which are the same for every
+   * ingress invocation, are always allowed.
+   * \param key_fields the standard metadata fields the verdicts are keyed by
+   * \param reason set to the first offending construct if rejected
+   * \return true if the program can be memoized
+   */
+  bool is_memoizable(const std::set<std::string> &key_fields,
+                     std::string &reason) const;
+
+  /**
+   * \brief Get the number of table writes done since the pipeline was
+   *        created. Runtime table writes (e.g. through the thrift server)
+   *        increment it, so that memoized verdicts can be invalidated
+   */
+  uint64_t get_table_generation() const;
+
+  bm::MatchErrorCode mt_add_entry(bm::cxt_id_t cxt_id,
+                                  const std::string &table_name,
+                                  const std::vector<bm::MatchKeyParam> &match_key,
+                                  const std::string &action_name,
+                                  bm::ActionData action_data,
+                                  bm::entry_handle_t *handle,
+                                  int priority = -1) override;
+
+  bm::MatchErrorCode mt_set_default_action(bm::cxt_id_t cxt_id,
+                                           const std::string &table_name,
+                                           const std::string &action_name,
+                                           bm::ActionData action_data) override;
+
+  bm::MatchErrorCode mt_delete_entry(bm::cxt_id_t cxt_id,
+                                     const std::string &table_name,
+                                     bm::entry_handle_t handle) override;
+
+  bm::MatchErrorCode mt_modify_entry(bm::cxt_id_t cxt_id,
+                                     const std::string &table_name,
+                                     bm::entry_handle_t handle,
+                                     const std::string &action_name,
+                                     bm::ActionData action_data) override;
+
+  bm::MatchErrorCode mt_clear_entries(bm::cxt_id_t cxt_id,
+                                      const std::string &table_name,
+                                      bool reset_default_entry) override;
+
  private:
   /**
-   * \brief Convert the NS3 packet ptr into a bmv2 pkt ptr
+   * \brief Run the parser, the given match-action pipeline and the deparser
+   */
+  Ptr<Packet> run_pipeline(Ptr<Packet> ns3_packet, std_meta_t &std_meta, bm::Pipeline *mau);
+
+  /**
+   * \brief Convert the first \p import_len bytes of the NS3 packet into a bmv2 pkt ptr
+   *
+   * The ingress length and the packet_length register of the bmv2 packet are
+   * set to the full length of the NS3 packet.
+   */
+  std::unique_ptr<bm::Packet> get_bm_packet(Ptr<Packet> ns3_packet, size_t import_len);
+
+  /**
+   * \brief Convert the bmv2 pkt ptr into an NS3 packet ptr, appending the
+   *        bytes of \p ns3_packet that were not imported
    */
-  std::unique_ptr<bm::Packet> get_bm_packet(Ptr<Packet> ns3_packet);
+  Ptr<Packet> get_ns3_packet(std::unique_ptr<bm::Packet> bm_packet,
+                             Ptr<Packet> ns3_packet, size_t import_len);
 
   /**
-   * \brief Convert the NS3 packet ptr into a bmv2 pkt ptr
+   * \brief A register array resolved by get_register_handle
    */
-  Ptr<Packet> get_ns3_packet(std::unique_ptr<bm::Packet> bm_packet);
+  typedef struct {
+    std::string name;
+    size_t size;
+    bm::RegisterArray *array;
+  } register_handle_t;
+
+  std::vector<register_handle_t> register_handles;
+
+  /**
+   * \brief A field read back after each invocation of the pipeline
+   */
+  typedef struct {
+    std::string name;   // PHV field or register array name
+    int reg_handle;     // register handle, -1 for a PHV field
+    size_t reg_index;   // register cell index
+    int header_id;      // header of the PHV field, -1 if not a PHV field
+    int field_offset;   // offset of the PHV field in its header
+  } traced_field_t;
+
+  std::vector<traced_field_t> traced_fields;
+  std::vector<uint64_t> traced_values;
+  bool trace_vars_enabled{true};
+
+  size_t max_import_size{DEFAULT_MAX_IMPORT_SIZE};
+  std::vector<uint8_t> ns2bm_buf;
+
+  std::string json_file;
+  // written by the thrift server thread
+  std::atomic<uint64_t> table_generation{0};
 
  private:
   static int thrift_port;
   static bm::packet_id_t packet_id;
-  static uint8_t ns2bm_buf[MAX_PKT_SIZE];
 };
 
 }
@@ -0,0 +1,114 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Copyright (c) 2018 Stanford University
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Author: Stephen Ibanez <sibanez@stanford.edu>
+ */
+
+#include "ns3/log.h"
+#include "columnar-dump-writer.h"
+
+namespace ns3 {
+
+NS_LOG_COMPONENT_DEFINE ("ColumnarDumpWriter");
+
+ColumnarDumpWriter::ColumnarDumpWriter ()
+  : m_nextColumn (0)
+{
+  NS_LOG_FUNCTION (this);
+}
+
+ColumnarDumpWriter::~ColumnarDumpWriter ()
+{
+  NS_LOG_FUNCTION (this);
+  Close ();
+}
+
+void
+ColumnarDumpWriter::AddColumn (std::string name, uint32_t nCells)
+{
+  NS_LOG_FUNCTION (this << name << nCells);
+  NS_ASSERT_MSG (!IsOpen (), "Columns must be added before opening the file");
+  m_columns.push_back ({name, nCells});
+}
+
+bool
+ColumnarDumpWriter::Open (std::string fileName)
+{
+  NS_LOG_FUNCTION (this << fileName);
+
+  m_file.open (fileName.c_str (), std::ios::out | std::ios::binary | std::ios::trunc);
+  if (!m_file.is_open ())
+    {
+      NS_LOG_ERROR ("Cannot open " << fileName);
+      return false;
+    }
+
+  m_file.write ("NS3COLS1", 8);
+  uint32_t nColumns = m_columns.size ();
+  m_file.write (reinterpret_cast<const char *> (&nColumns), sizeof (nColumns));
+  for (const Column &c : m_columns)
+    {
+      uint32_t len = c.name.size ();
+      m_file.write (reinterpret_cast<const char *> (&len), sizeof (len));
+      m_file.write (c.name.data (), len);
+      m_file.write (reinterpret_cast<const char *> (&c.nCells), sizeof (c.nCells));
+    }
+  m_nextColumn = m_columns.size ();
+  return true;
+}
+
+bool
+ColumnarDumpWriter::IsOpen (void) const
+{
+  return m_file.is_open ();
+}
+
+void
+ColumnarDumpWriter::BeginSample (Time now)
+{
+  NS_LOG_FUNCTION (this << now);
+  NS_ASSERT_MSG (m_nextColumn == m_columns.size (), "Previous sample is incomplete");
+
+  int64_t ts = now.GetNanoSeconds ();
+  m_file.write (reinterpret_cast<const char *> (&ts), sizeof (ts));
+  m_nextColumn = 0;
+}
+
+void
+ColumnarDumpWriter::WriteColumn (const std::vector<uint64_t> &values)
+{
+  NS_LOG_FUNCTION (this);
+  NS_ASSERT_MSG (m_nextColumn < m_columns.size (), "Too many columns in sample");
+  NS_ASSERT_MSG (values.size () == m_columns[m_nextColumn].nCells,
+                 "Column " << m_columns[m_nextColumn].name << " has " << m_columns[m_nextColumn].nCells
+                 << " cells, got " << values.size ());
+
+  m_file.write (reinterpret_cast<const char *> (values.data ()), values.size () * sizeof (uint64_t));
+  m_nextColumn++;
+}
+
+void
+ColumnarDumpWriter::Close (void)
+{
+  NS_LOG_FUNCTION (this);
+  if (m_file.is_open ())
+    {
+      m_file.close ();
+    }
+}
+
+} // namespace ns3
@@ -0,0 +1,110 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Copyright (c) 2018 Stanford University
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Author: Stephen Ibanez <sibanez@stanford.edu>
+ */
+
+#ifndef COLUMNAR_DUMP_WRITER_H
+#define COLUMNAR_DUMP_WRITER_H
+
+#include "ns3/nstime.h"
+#include <fstream>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+namespace ns3 {
+
+/**
+ * \ingroup traffic-control
+ *
+ * \brief Writer of periodic samples of fixed-size uint64 arrays to a binary file
+ *
+ * The file starts with a header describing the columns, followed by one
+ * record per sample. All the integers are stored in host byte order.
+ *
+ * Header:
+ *   - the magic string "NS3COLS1" (8 bytes)
+ *   - number of columns (uint32)
+ *   - for each column: length of the name (uint32), name (not
+ *     NUL-terminated), number of cells (uint32)
+ *
+ * Sample record:
+ *   - simulation time in nanoseconds (int64)
+ *   - for each column, in header order: its cells (uint64 each)
+ */
+class ColumnarDumpWriter
+{
+public:
+  ColumnarDumpWriter ();
+  ~ColumnarDumpWriter ();
+
+  /**
+   * \brief Add a column. Columns must be added before calling Open
+   * \param name the name of the column
+   * \param nCells the number of cells of the column
+   */
+  void AddColumn (std::string name, uint32_t nCells);
+
+  /**
+   * \brief Create the file and write the header
+   * \param fileName the name of the file
+   * \return false if the file could not be created
+   */
+  bool Open (std::string fileName);
+
+  /**
+   * \brief Whether the file is open
+   * \return true if Open succeeded and Close was not called
+   */
+  bool IsOpen (void) const;
+
+  /**
+   * \brief Start a new sample record
+   * \param now the simulation time of the sample
+   */
+  void BeginSample (Time now);
+
+  /**
+   * \brief Write the cells of the next column of the current sample
+   * \param values the cells, their number must match the one of the column
+   */
+  void WriteColumn (const std::vector<uint64_t> &values);
+
+  /**
+   * \brief Flush and close the file
+   */
+  void Close (void);
+
+private:
+  /**
+   * \brief Description of a column
+   */
+  struct Column
+  {
+    std::string name;  //!< Name of the column
+    uint32_t nCells;   //!< Number of cells
+  };
+
+  std::vector<Column> m_columns;  //!< The columns
+  std::ofstream m_file;           //!< The output file
+  uint32_t m_nextColumn;          //!< Index of the next column of the current sample
+};
+
+} // namespace ns3
+
+#endif /* COLUMNAR_DUMP_WRITER_H */
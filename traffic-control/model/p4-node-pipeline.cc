@@ -0,0 +1,330 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Copyright (c) 2018 Stanford University
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Author: Stephen Ibanez <sibanez@stanford.edu>
+ */
+
+#include "ns3/log.h"
+#include "ns3/string.h"
+#include "ns3/simulator.h"
+#include "p4-node-pipeline.h"
+
+namespace ns3 {
+
+NS_LOG_COMPONENT_DEFINE ("P4NodePipeline");
+
+NS_OBJECT_ENSURE_REGISTERED (P4NodePipeline);
+NS_OBJECT_ENSURE_REGISTERED (P4Ingress);
+NS_OBJECT_ENSURE_REGISTERED (P4Midgress);
+NS_OBJECT_ENSURE_REGISTERED (P4Egress);
+NS_OBJECT_ENSURE_REGISTERED (P4SharedPipeline);
+
+TypeId P4NodePipeline::GetTypeId (void)
+{
+  static TypeId tid = TypeId ("ns3::P4NodePipeline")
+    .SetParent<Object> ()
+    .SetGroupName ("TrafficControl")
+    .AddAttribute ( "JsonFile", "The bmv2 JSON file to use",
+                    StringValue (""), MakeStringAccessor (&P4NodePipeline::GetJsonFile, &P4NodePipeline::SetJsonFile), MakeStringChecker ())
+    .AddAttribute ( "CommandsFile", "A file with CLI commands to run on the P4 pipeline before starting the simulation",
+                    StringValue (""), MakeStringAccessor (&P4NodePipeline::GetCommandsFile, &P4NodePipeline::SetCommandsFile), MakeStringChecker ())
+    .AddTraceSource ("Drop", "A packet was dropped by the P4 program",
+                     MakeTraceSourceAccessor (&P4NodePipeline::m_traceDrop),
+                     "ns3::Packet::TracedCallback")
+  ;
+  return tid;
+}
+
+P4NodePipeline::P4NodePipeline ()
+  : m_p4Pipe (NULL)
+{
+  NS_LOG_FUNCTION (this);
+}
+
+P4NodePipeline::~P4NodePipeline ()
+{
+  NS_LOG_FUNCTION (this);
+  delete m_p4Pipe;
+}
+
+std::string
+P4NodePipeline::GetJsonFile (void) const
+{
+  NS_LOG_FUNCTION (this);
+  return m_jsonFile;
+}
+
+void
+P4NodePipeline::SetJsonFile (std::string jsonFile)
+{
+  NS_LOG_FUNCTION (this << jsonFile);
+  m_jsonFile = jsonFile;
+}
+
+std::string
+P4NodePipeline::GetCommandsFile (void) const
+{
+  NS_LOG_FUNCTION (this);
+  return m_commandsFile;
+}
+
+void
+P4NodePipeline::SetCommandsFile (std::string commandsFile)
+{
+  NS_LOG_FUNCTION (this << commandsFile);
+  m_commandsFile = commandsFile;
+}
+
+void
+P4NodePipeline::DoInitialize (void)
+{
+  NS_LOG_FUNCTION (this);
+  CreatePipeline ();
+  Object::DoInitialize ();
+}
+
+void
+P4NodePipeline::CreatePipeline (void)
+{
+  NS_LOG_FUNCTION (this);
+
+  if (m_p4Pipe != NULL)
+    {
+      return;
+    }
+  if (m_jsonFile == "" || m_commandsFile == "")
+    {
+      NS_FATAL_ERROR ("Node-level P4 program is not configured with a JSON file and a CLI commands file");
+    }
+  m_p4Pipe = new SimpleP4Pipe (m_jsonFile);
+  m_p4Pipe->run_cli (m_commandsFile);
+  m_p4Pipe->set_trace_vars_enabled (false);
+}
+
+bool
+P4NodePipeline::Process (Ptr<NetDevice> device, Ptr<Packet> &packet, uint16_t protocol,
+                         uint32_t qdepthBytes, bool &mark)
+{
+  NS_LOG_FUNCTION (this << device << packet << protocol << qdepthBytes);
+
+  // the node may be initialized after the first packets cross it
+  CreatePipeline ();
+
+  //
+  // Initialize standard metadata
+  //
+  std_meta_t std_meta = std_meta_t ();
+  std_meta.trigger = TRIGGER_INGRESS;
+  std_meta.qdepth_bytes = qdepthBytes;
+  std_meta.timestamp = Simulator::Now ().GetNanoSeconds ();
+  std_meta.pkt_len_bytes = packet->GetSize ();
+  std_meta.gso_segs = 1;
+  std_meta.l3_proto = protocol;
+  if (device != 0)
+    {
+      std_meta.egress_port = device->GetIfIndex ();
+    }
+
+  // perform P4 processing
+  Ptr<Packet> new_packet = RunPipeline (m_p4Pipe, packet, std_meta);
+
+  if (std_meta.drop)
+    {
+      NS_LOG_DEBUG ("Dropping packet because node-level P4 program said to");
+      m_traceDrop (packet);
+      return false;
+    }
+
+  packet = new_packet;
+  mark = std_meta.mark;
+  return true;
+}
+
+TypeId P4Ingress::GetTypeId (void)
+{
+  static TypeId tid = TypeId ("ns3::P4Ingress")
+    .SetParent<P4NodePipeline> ()
+    .SetGroupName ("TrafficControl")
+    .AddConstructor<P4Ingress> ()
+  ;
+  return tid;
+}
+
+Ptr<Packet>
+P4Ingress::RunPipeline (SimpleP4Pipe *pipe, Ptr<Packet> packet, std_meta_t &std_meta)
+{
+  return pipe->process_pipeline (packet, std_meta);
+}
+
+TypeId P4Midgress::GetTypeId (void)
+{
+  static TypeId tid = TypeId ("ns3::P4Midgress")
+    .SetParent<P4NodePipeline> ()
+    .SetGroupName ("TrafficControl")
+    .AddConstructor<P4Midgress> ()
+  ;
+  return tid;
+}
+
+Ptr<Packet>
+P4Midgress::RunPipeline (SimpleP4Pipe *pipe, Ptr<Packet> packet, std_meta_t &std_meta)
+{
+  return pipe->process_pipeline (packet, std_meta);
+}
+
+TypeId P4Egress::GetTypeId (void)
+{
+  static TypeId tid = TypeId ("ns3::P4Egress")
+    .SetParent<P4NodePipeline> ()
+    .SetGroupName ("TrafficControl")
+    .AddConstructor<P4Egress> ()
+  ;
+  return tid;
+}
+
+Ptr<Packet>
+P4Egress::RunPipeline (SimpleP4Pipe *pipe, Ptr<Packet> packet, std_meta_t &std_meta)
+{
+  return pipe->process_egress_pipeline (packet, std_meta);
+}
+
+TypeId P4SharedPipeline::GetTypeId (void)
+{
+  static TypeId tid = TypeId ("ns3::P4SharedPipeline")
+    .SetParent<Object> ()
+    .SetGroupName ("TrafficControl")
+    .AddConstructor<P4SharedPipeline> ()
+  ;
+  return tid;
+}
+
+P4SharedPipeline::P4SharedPipeline ()
+  : m_p4Pipe (NULL),
+    m_configured (false),
+    m_enP4Vars (false),
+    m_maxImportSize (0),
+    m_sharedBacklog (0),
+    m_portQdepthReg (-1),
+    m_portQdepthRegSize (0)
+{
+  NS_LOG_FUNCTION (this);
+}
+
+P4SharedPipeline::~P4SharedPipeline ()
+{
+  NS_LOG_FUNCTION (this);
+  delete m_p4Pipe;
+}
+
+SimpleP4Pipe *
+P4SharedPipeline::GetPipe (std::string jsonFile, std::string commandsFile)
+{
+  NS_LOG_FUNCTION (this << jsonFile << commandsFile);
+
+  if (m_p4Pipe == NULL)
+    {
+      m_jsonFile = jsonFile;
+      m_p4Pipe = new SimpleP4Pipe (jsonFile);
+      m_p4Pipe->run_cli (commandsFile);
+    }
+  else if (jsonFile != m_jsonFile)
+    {
+      NS_FATAL_ERROR ("The queue discs sharing the P4 pipeline of a node must use the same JSON file ("
+                      << m_jsonFile << " vs " << jsonFile << ")");
+    }
+  return m_p4Pipe;
+}
+
+void
+P4SharedPipeline::Configure (bool enP4Vars, uint32_t maxImportSize)
+{
+  NS_LOG_FUNCTION (this << enP4Vars << maxImportSize);
+  NS_ASSERT_MSG (m_p4Pipe != NULL, "The P4 pipeline has not been created yet");
+
+  if (!m_configured)
+    {
+      m_configured = true;
+      m_enP4Vars = enP4Vars;
+      m_maxImportSize = maxImportSize;
+      m_p4Pipe->set_trace_vars_enabled (enP4Vars);
+      m_p4Pipe->set_max_import_size (maxImportSize);
+      return;
+    }
+  if (enP4Vars != m_enP4Vars)
+    {
+      NS_FATAL_ERROR ("The queue discs sharing the P4 pipeline of a node must use the same EnableP4Vars ("
+                      << m_enP4Vars << " vs " << enP4Vars << ")");
+    }
+  if (maxImportSize != m_maxImportSize)
+    {
+      NS_FATAL_ERROR ("The queue discs sharing the P4 pipeline of a node must use the same MaxImportSize ("
+                      << m_maxImportSize << " vs " << maxImportSize << ")");
+    }
+}
+
+void
+P4SharedPipeline::SetPortQueueDepthRegister (std::string name)
+{
+  NS_LOG_FUNCTION (this << name);
+  NS_ASSERT_MSG (m_p4Pipe != NULL, "The P4 pipeline has not been created yet");
+
+  if (name == "")
+    {
+      return;
+    }
+  int handle = m_p4Pipe->get_register_handle (name);
+  if (handle < 0)
+    {
+      NS_FATAL_ERROR ("The P4 program has no register array named " << name);
+    }
+  if (m_portQdepthReg >= 0 && handle != m_portQdepthReg)
+    {
+      NS_FATAL_ERROR ("The queue discs sharing the P4 pipeline of a node must use the same port queue depth register");
+    }
+  m_portQdepthReg = handle;
+  m_portQdepthRegSize = m_p4Pipe->get_register_size (handle);
+}
+
+void
+P4SharedPipeline::SetPortBacklog (uint32_t port, uint32_t bytes)
+{
+  NS_LOG_FUNCTION (this << port << bytes);
+
+  if (port >= m_portBacklogs.size ())
+    {
+      m_portBacklogs.resize (port + 1, 0);
+    }
+  if (m_portBacklogs[port] == bytes)
+    {
+      return;
+    }
+  m_sharedBacklog = m_sharedBacklog - m_portBacklogs[port] + bytes;
+  m_portBacklogs[port] = bytes;
+
+  if (m_portQdepthReg >= 0 && port < m_portQdepthRegSize)
+    {
+      m_p4Pipe->write_register (m_portQdepthReg, port, bytes);
+    }
+}
+
+uint32_t
+P4SharedPipeline::GetSharedBacklog (void) const
+{
+  return m_sharedBacklog;
+}
+
+} // namespace ns3
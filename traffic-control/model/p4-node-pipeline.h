@@ -0,0 +1,266 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Copyright (c) 2018 Stanford University
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Author: Stephen Ibanez <sibanez@stanford.edu>
+ */
+
+#ifndef P4_NODE_PIPELINE_H
+#define P4_NODE_PIPELINE_H
+
+#include "ns3/object.h"
+#include "ns3/net-device.h"
+#include "ns3/packet.h"
+#include "ns3/traced-callback.h"
+#include "ns3/p4-pipeline.h"
+#include <string>
+#include <vector>
+
+namespace ns3 {
+
+/**
+ * \ingroup traffic-control
+ *
+ * Base class of the node-level P4 programs. A node-level P4 program is
+ * aggregated to a Node and runs on the packets crossing the traffic control
+ * layer of the node, whatever the device they are received on or sent to
+ * and whether or not the device has a root queue disc. A single P4 pipeline
+ * is shared by all the devices of the node.
+ *
+ * The P4 program is invoked with the ingress_trigger set. The common fields
+ * of the standard metadata that are not scaled to a queue size are
+ * populated (timestamp, qdepth_bytes, pkt_len_bytes, gso_segs, l3_proto),
+ * as well as egress_port, set to the index of the device the packet was
+ * received on or is sent to; qdepth_bytes is the backlog of the root queue
+ * disc of the device, if any.
+ * The P4 program may rewrite or drop the packet.
+ */
+class P4NodePipeline : public Object {
+public:
+  /**
+   * \brief Get the type ID.
+   * \return the object TypeId
+   */
+  static TypeId GetTypeId (void);
+  /**
+   * \brief P4NodePipeline constructor
+   */
+  P4NodePipeline ();
+
+  virtual ~P4NodePipeline ();
+
+  /// Get the JSON source file
+  std::string GetJsonFile (void) const;
+
+  /// Set the JSON source file
+  void SetJsonFile (std::string jsonFile);
+
+  /// Get the CLI commands file
+  std::string GetCommandsFile (void) const;
+
+  /// Set the CLI commands file
+  void SetCommandsFile (std::string commandsFile);
+
+  /**
+   * \brief Run the P4 program on a packet
+   * \param device the device the packet was received on or is sent to
+   * \param packet the packet, replaced by the one produced by the deparser
+   * \param protocol the L3 protocol number of the packet
+   * \param qdepthBytes the backlog of the root queue disc of the device
+   * \param mark set to true if the P4 program said to mark the packet
+   * \return false if the P4 program said to drop the packet
+   */
+  bool Process (Ptr<NetDevice> device, Ptr<Packet> &packet, uint16_t protocol,
+                uint32_t qdepthBytes, bool &mark);
+
+protected:
+  virtual void DoInitialize (void);
+
+private:
+  /**
+   * \brief Invoke the pipeline of the P4 program this hook runs
+   * \param pipe the P4 pipeline
+   * \param packet the packet
+   * \param std_meta the standard metadata
+   * \return the packet produced by the deparser
+   */
+  virtual Ptr<Packet> RunPipeline (SimpleP4Pipe *pipe, Ptr<Packet> packet, std_meta_t &std_meta) = 0;
+
+  /**
+   * \brief Create the P4 pipeline and populate its tables
+   */
+  void CreatePipeline (void);
+
+  std::string m_jsonFile;      //!< The bmv2 JSON file (generated by the p4c-bm backend)
+  std::string m_commandsFile;  //!< The CLI commands file
+  SimpleP4Pipe *m_p4Pipe;      //!< The P4 pipeline shared by all the devices of the node
+
+  /// Traced callback: fired when the P4 program drops a packet
+  TracedCallback<Ptr<const Packet> > m_traceDrop;
+};
+
+/**
+ * \ingroup traffic-control
+ *
+ * Node-level P4 program run by the ingress control of the P4 program on
+ * every packet received by the node, before it is passed to the upper
+ * layers. As the output device is not known yet, egress_port holds the
+ * index of the device the packet was received on. The mark output is
+ * ignored, since the L3 header has already been parsed.
+ */
+class P4Ingress : public P4NodePipeline {
+public:
+  /**
+   * \brief Get the type ID.
+   * \return the object TypeId
+   */
+  static TypeId GetTypeId (void);
+
+private:
+  virtual Ptr<Packet> RunPipeline (SimpleP4Pipe *pipe, Ptr<Packet> packet, std_meta_t &std_meta);
+};
+
+/**
+ * \ingroup traffic-control
+ *
+ * Node-level P4 program run by the ingress control of the P4 program on
+ * every packet sent by the node, before it is enqueued in the root queue
+ * disc of the device (if any). The L3 header has not been added to the
+ * packet yet; the mark output sets the ECN bits of that header.
+ */
+class P4Midgress : public P4NodePipeline {
+public:
+  /**
+   * \brief Get the type ID.
+   * \return the object TypeId
+   */
+  static TypeId GetTypeId (void);
+
+private:
+  virtual Ptr<Packet> RunPipeline (SimpleP4Pipe *pipe, Ptr<Packet> packet, std_meta_t &std_meta);
+};
+
+/**
+ * \ingroup traffic-control
+ *
+ * Node-level P4 program run by the egress control of the P4 program on
+ * every packet handed to a device of the node, after it left the root
+ * queue disc of the device (if any). The mark output is passed to the Mark
+ * method of the queue disc item, and accounted for by the root queue disc,
+ * if any, with the P4_NODE_EGRESS_MARK reason. Since the L3 header has
+ * already been added to the packet, items that only mark their header
+ * before it is added (e.g., IPv4 and IPv6 ones) are left untouched, and the
+ * program has to rewrite the ECN bits of the header itself. The root queue
+ * discs of the node look the program up when they are initialized, hence
+ * it must be aggregated to the node before.
+ */
+class P4Egress : public P4NodePipeline {
+public:
+  /**
+   * \brief Get the type ID.
+   * \return the object TypeId
+   */
+  static TypeId GetTypeId (void);
+
+  static constexpr const char* P4_NODE_EGRESS_DROP = "P4 node egress drop";  //!< Node-level P4 egress program said to drop packet
+  static constexpr const char* P4_NODE_EGRESS_MARK = "P4 node egress mark";  //!< Node-level P4 egress program said to mark packet
+
+private:
+  virtual Ptr<Packet> RunPipeline (SimpleP4Pipe *pipe, Ptr<Packet> packet, std_meta_t &std_meta);
+};
+
+/**
+ * \ingroup traffic-control
+ *
+ * P4 pipeline shared by all the P4QueueDiscs of a node that have the
+ * SharedPipeline attribute set, as the single pipeline serving all the
+ * egress ports of a switch. It is aggregated to the node by the first of
+ * these queue discs to be initialized, which also creates the pipeline and
+ * populates its tables; the others must use the same JSON file,
+ * EnableP4Vars and MaxImportSize, and their CLI commands file is ignored.
+ * TracedFields cannot be set on these queue discs. Hence the register arrays of the P4 program
+ * are shared by all the ports, and the P4 program can index them with the
+ * egress_port field of the standard metadata.
+ *
+ * The backlog of every port is tracked, so that the P4 program is passed
+ * the total backlog of the node in the shared_qdepth_bytes field. If a
+ * port queue depth register is set, the backlog of every port is also
+ * mirrored into the cell of that register array indexed by the port.
+ */
+class P4SharedPipeline : public Object {
+public:
+  /**
+   * \brief Get the type ID.
+   * \return the object TypeId
+   */
+  static TypeId GetTypeId (void);
+  /**
+   * \brief P4SharedPipeline constructor
+   */
+  P4SharedPipeline ();
+
+  virtual ~P4SharedPipeline ();
+
+  /**
+   * \brief Get the P4 pipeline, creating it on the first call
+   * \param jsonFile the bmv2 JSON file
+   * \param commandsFile the CLI commands file
+   * \return the P4 pipeline
+   */
+  SimpleP4Pipe *GetPipe (std::string jsonFile, std::string commandsFile);
+
+  /**
+   * \brief Apply the settings of the queue discs to the P4 pipeline on the
+   *        first call, and check that the next calls use the same settings
+   * \param enP4Vars whether trace_var1..4 are passed to and from the P4 program
+   * \param maxImportSize the number of leading packet bytes processed by the pipeline
+   */
+  void Configure (bool enP4Vars, uint32_t maxImportSize);
+
+  /**
+   * \brief Set the register array the port backlogs are mirrored into
+   * \param name the name of the register array, empty to disable
+   */
+  void SetPortQueueDepthRegister (std::string name);
+
+  /**
+   * \brief Record the backlog of a port
+   * \param port the index of the device of the port
+   * \param bytes the backlog of the port in bytes
+   */
+  void SetPortBacklog (uint32_t port, uint32_t bytes);
+
+  /**
+   * \brief Get the backlog of all the ports
+   * \return the sum of the latest backlogs of the ports, in bytes
+   */
+  uint32_t GetSharedBacklog (void) const;
+
+private:
+  std::string m_jsonFile;                //!< The bmv2 JSON file of the pipeline
+  SimpleP4Pipe *m_p4Pipe;                //!< The P4 pipeline shared by the ports
+  bool m_configured;                     //!< Whether Configure has been called
+  bool m_enP4Vars;                       //!< EnableP4Vars of the queue discs
+  uint32_t m_maxImportSize;              //!< MaxImportSize of the queue discs
+  std::vector<uint32_t> m_portBacklogs;  //!< Latest backlog of each port, in bytes
+  uint64_t m_sharedBacklog;              //!< Sum of m_portBacklogs
+  int m_portQdepthReg;                   //!< Handle of the port queue depth register, or -1
+  uint32_t m_portQdepthRegSize;          //!< Number of cells of the port queue depth register
+};
+
+} // namespace ns3
+
+#endif /* P4_NODE_PIPELINE_H */
@@ -23,11 +23,16 @@
 #include "ns3/object-factory.h"
 #include "ns3/socket.h"
 #include "ns3/string.h"
+#include "ns3/enum.h"
 #include "ns3/simulator.h"
+#include "ns3/node.h"
 #include "ns3/p4-pipeline.h"
+#include "ns3/pifo-engine.h"
 #include "p4-queue-disc.h"
 #include <algorithm>
 #include <iterator>
+#include <set>
+#include <sstream>
 #include <chrono>
 #include <thread>
 
@@ -61,6 +66,18 @@ TypeId P4QueueDisc::GetTypeId (void)
                    UintegerValue (16),
                    MakeUintegerAccessor (&P4QueueDisc::m_qSizeBits),
                    MakeUintegerChecker<uint32_t> ())
+    .AddAttribute ("MaxImportSize",
+                   "Number of leading bytes of a packet processed by the P4 pipeline; "
+                   "the rest of larger packets is passed through untouched",
+                   UintegerValue (DEFAULT_MAX_IMPORT_SIZE),
+                   MakeUintegerAccessor (&P4QueueDisc::m_maxImportSize),
+                   MakeUintegerChecker<uint32_t> (1))
+    .AddAttribute ("GsoSegmentSize",
+                   "Size in bytes of the segments of a GSO super-packet (gso_segs metadata), "
+                   "0 to treat every packet as a single segment",
+                   UintegerValue (1500),
+                   MakeUintegerAccessor (&P4QueueDisc::m_gsoSegmentSize),
+                   MakeUintegerChecker<uint32_t> ())
     .AddAttribute ("MeanPktSize",
                    "Average of packet size",
                    UintegerValue (500),
@@ -91,6 +108,65 @@ TypeId P4QueueDisc::GetTypeId (void)
                    TimeValue (MilliSeconds (0)), // default disabled
                    MakeTimeAccessor (&P4QueueDisc::m_timeReference),
                    MakeTimeChecker ())
+    .AddAttribute ( "RegisterDumpFile",
+                    "The file the sampled register arrays are written to",
+                    StringValue (""),
+                    MakeStringAccessor (&P4QueueDisc::m_regDumpFile),
+                    MakeStringChecker ())
+    .AddAttribute ( "RegisterDumpNames",
+                    "Comma-separated names of the register arrays to sample",
+                    StringValue (""),
+                    MakeStringAccessor (&P4QueueDisc::m_regDumpNames),
+                    MakeStringChecker ())
+    .AddAttribute ("RegisterDumpInterval",
+                   "The time between register array samples",
+                   TimeValue (MilliSeconds (0)), // default disabled
+                   MakeTimeAccessor (&P4QueueDisc::m_regDumpInterval),
+                   MakeTimeChecker ())
+    .AddAttribute ( "TracedFields",
+                    "Comma-separated PHV fields (e.g. meta.flow_bytes) or register cells "
+                    "(e.g. flow_table[3]) to expose through TraceConnectField",
+                    StringValue (""),
+                    MakeStringAccessor (&P4QueueDisc::m_tracedFieldNames),
+                    MakeStringChecker ())
+    .AddAttribute ( "EnableP4Vars",
+                    "Pass trace_var1..4 to and from the P4 program (P4Var1..4 trace sources)",
+                    BooleanValue (true),
+                    MakeBooleanAccessor (&P4QueueDisc::m_enP4Vars),
+                    MakeBooleanChecker ())
+    .AddAttribute ( "SharedPipeline",
+                    "Bind to the P4 pipeline shared by all the P4 queue discs of the node "
+                    "that have this attribute set",
+                    BooleanValue (false),
+                    MakeBooleanAccessor (&P4QueueDisc::m_sharedPipeline),
+                    MakeBooleanChecker ())
+    .AddAttribute ( "PortQueueDepthRegister",
+                    "Register array of the shared P4 pipeline, indexed by egress port, "
+                    "the backlog in bytes of every port is written to",
+                    StringValue (""),
+                    MakeStringAccessor (&P4QueueDisc::m_portQdepthRegName),
+                    MakeStringChecker ())
+    .AddAttribute ( "EnableVerdictCache",
+                    "Memoize the drop, mark, qid and rank outputs of the ingress control "
+                    "per flow and quantized queue depth",
+                    BooleanValue (false), // default disabled
+                    MakeBooleanAccessor (&P4QueueDisc::m_enVerdictCache),
+                    MakeBooleanChecker ())
+    .AddAttribute ("VerdictCacheSize",
+                   "Number of slots of the verdict cache (a power of 2)",
+                   UintegerValue (4096),
+                   MakeUintegerAccessor (&P4QueueDisc::m_verdictCacheSize),
+                   MakeUintegerChecker<uint32_t> (1))
+    .AddAttribute ("VerdictCacheTtl",
+                   "The lifetime of a memoized verdict",
+                   TimeValue (MilliSeconds (10)),
+                   MakeTimeAccessor (&P4QueueDisc::m_verdictCacheTtl),
+                   MakeTimeChecker ())
+    .AddAttribute ("VerdictCacheQueueBits",
+                   "Number of most significant bits of qdepth in the verdict cache key",
+                   UintegerValue (4),
+                   MakeUintegerAccessor (&P4QueueDisc::m_verdictQueueBits),
+                   MakeUintegerChecker<uint32_t> (0, 32))
     .AddAttribute ( "EnableDropEvents",
                     "Enable drop event triggers in P4 pipeline",
                     BooleanValue (false), // default disabled
@@ -106,6 +182,38 @@ TypeId P4QueueDisc::GetTypeId (void)
                     BooleanValue (false), // default disabled
                     MakeBooleanAccessor (&P4QueueDisc::m_enDeqEvents),
                     MakeBooleanChecker ())
+    .AddAttribute ( "EnableQueueSizeEstimator",
+                    "Maintain the EWMA of the queue size (avg_qdepth metadata)",
+                    BooleanValue (true),
+                    MakeBooleanAccessor (&P4QueueDisc::m_enQueueSizeEst),
+                    MakeBooleanChecker ())
+    .AddAttribute ( "EnableDequeueRateEstimator",
+                    "Measure the dequeue rate (avg_deq_rate_bytes metadata)",
+                    BooleanValue (true),
+                    MakeBooleanAccessor (&P4QueueDisc::m_enDqRateEst),
+                    MakeBooleanChecker ())
+    .AddAttribute ( "EnableSojournTimeEstimator",
+                    "Measure the sojourn time of departing packets (qlatency metadata)",
+                    BooleanValue (true),
+                    MakeBooleanAccessor (&P4QueueDisc::m_enSojournEst),
+                    MakeBooleanChecker ())
+    .AddAttribute ( "EnableEgress",
+                    "Run the egress control of the P4 program on dequeued packets",
+                    BooleanValue (false), // default disabled
+                    MakeBooleanAccessor (&P4QueueDisc::m_enEgress),
+                    MakeBooleanChecker ())
+    .AddAttribute ("SchedulingPolicy",
+                   "The policy used to choose the class to dequeue from",
+                   EnumValue (STRICT_PRIORITY),
+                   MakeEnumAccessor (&P4QueueDisc::m_schedPolicy),
+                   MakeEnumChecker (STRICT_PRIORITY, "StrictPriority",
+                                    DRR, "Drr",
+                                    PIFO, "Pifo"))
+    .AddAttribute ("Quantum",
+                   "The DRR quantum in bytes",
+                   UintegerValue (1500),
+                   MakeUintegerAccessor (&P4QueueDisc::m_quantum),
+                   MakeUintegerChecker<uint32_t> (1))
     .AddTraceSource ("AvgQueueSize",
                      "The computed EWMA of the queue size",
                      MakeTraceSourceAccessor (&P4QueueDisc::m_qAvg),
@@ -139,17 +247,33 @@ TypeId P4QueueDisc::GetTypeId (void)
 }
 
 P4QueueDisc::P4QueueDisc ()
-  : QueueDisc (QueueDiscSizePolicy::SINGLE_CHILD_QUEUE_DISC, QueueSizeUnit::BYTES)
+  : QueueDisc (QueueDiscSizePolicy::MULTIPLE_QUEUES, QueueSizeUnit::BYTES)
 {
   NS_LOG_FUNCTION (this);
   m_p4Pipe = NULL; 
+  m_egressPort = 0;
   m_timerEvent = EventId(); // default initial value
+  m_regDumpEvent = EventId();
 }
 
 P4QueueDisc::~P4QueueDisc ()
 {
   NS_LOG_FUNCTION (this);
-  delete m_p4Pipe;
+  if (m_sharedPipe == 0)
+    {
+      delete m_p4Pipe;
+    }
+}
+
+void
+P4QueueDisc::DoDispose (void)
+{
+  NS_LOG_FUNCTION (this);
+  Simulator::Cancel (m_timerEvent);
+  Simulator::Cancel (m_regDumpEvent);
+  // flush the samples written so far
+  m_regDumpWriter.Close ();
+  QueueDisc::DoDispose ();
 }
 
 std::string
@@ -181,67 +305,166 @@ P4QueueDisc::SetCommandsFile (std::string commandsFile)
 }
 
 void
-P4QueueDisc::InitStdMeta (std_meta_t &std_meta)
+P4QueueDisc::InitStdMeta (std_meta_t &std_meta, std_meta_trigger_t trigger)
 {
   //
   // Initialize standard metadata
   //
-  std_meta.qdepth = 0;
-  std_meta.qdepth_bytes = 0;
-  std_meta.avg_qdepth = 0;
-  std_meta.avg_qdepth_bytes = 0;
-  std_meta.timestamp = 0;
-  std_meta.idle_time = 0;
-  std_meta.qlatency = 0;
-  std_meta.avg_deq_rate_bytes = 0;
-  std_meta.pkt_len = 0;
-  std_meta.pkt_len_bytes = 0;
-  std_meta.l3_proto = 0;
-  std_meta.flow_hash = 0;
-  std_meta.ingress_trigger = false;
-  std_meta.timer_trigger = false;
-  // drop trigger metadata
-  std_meta.drop_trigger = false;
-  std_meta.drop_timestamp = 0;
-  std_meta.drop_qdepth = 0;
-  std_meta.drop_qdepth_bytes = 0;
-  std_meta.drop_avg_qdepth = 0;
-  std_meta.drop_avg_qdepth_bytes = 0;
-  std_meta.drop_pkt_len = 0;
-  std_meta.drop_pkt_len_bytes = 0;
-  std_meta.drop_l3_proto = 0;
-  std_meta.drop_flow_hash = 0;
-  // enqueue trigger metadata
-  std_meta.enq_trigger = false;
-  std_meta.enq_timestamp = 0;
-  std_meta.enq_qdepth = 0;
-  std_meta.enq_qdepth_bytes = 0;
-  std_meta.enq_avg_qdepth = 0;
-  std_meta.enq_avg_qdepth_bytes = 0;
-  std_meta.enq_pkt_len = 0;
-  std_meta.enq_pkt_len_bytes = 0;
-  std_meta.enq_l3_proto = 0;
-  std_meta.enq_flow_hash = 0;
-  // dequeue trigger metadata
-  std_meta.deq_trigger = false;
-  std_meta.deq_enq_timestamp = 0;
-  std_meta.deq_qdepth = 0;
-  std_meta.deq_qdepth_bytes = 0;
-  std_meta.deq_avg_qdepth = 0;
-  std_meta.deq_avg_qdepth_bytes = 0;
-  std_meta.deq_timestamp = 0;
-  std_meta.deq_pkt_len = 0;
-  std_meta.deq_pkt_len_bytes = 0;
-  std_meta.deq_l3_proto = 0;
-  std_meta.deq_flow_hash = 0;
-  // P4 program outputs
-  std_meta.drop = false; 
-  std_meta.mark = false;
+  std_meta = std_meta_t ();
+  std_meta.trigger = trigger;
+  std_meta.egress_port = m_egressPort;
+  std_meta.shared_qdepth_bytes = (m_sharedPipe != 0 ? m_sharedPipe->GetSharedBacklog () : GetNBytes ());
   // P4 program trace data
-  std_meta.trace_var1 = m_p4Var1;
-  std_meta.trace_var2 = m_p4Var2;
-  std_meta.trace_var3 = m_p4Var3;
-  std_meta.trace_var4 = m_p4Var4;
+  if (m_enP4Vars)
+    {
+      std_meta.trace_var1 = m_p4Var1;
+      std_meta.trace_var2 = m_p4Var2;
+      std_meta.trace_var3 = m_p4Var3;
+      std_meta.trace_var4 = m_p4Var4;
+    }
+}
+
+void
+P4QueueDisc::UpdatePortBacklog (void)
+{
+  if (m_sharedPipe != 0)
+    {
+      // the backlog of the queue disc itself is only updated once
+      // DoEnqueue/DoDequeue return
+      m_sharedPipe->SetPortBacklog (m_egressPort, GetClassesNBytes ());
+    }
+}
+
+void
+P4QueueDisc::UpdateTraceVars (const std_meta_t &std_meta)
+{
+  if (m_enP4Vars)
+    {
+      m_p4Var1 = std_meta.trace_var1;
+      m_p4Var2 = std_meta.trace_var2;
+      m_p4Var3 = std_meta.trace_var3;
+      m_p4Var4 = std_meta.trace_var4;
+    }
+
+  if (m_activeTracedFields.empty ())
+    {
+      return;
+    }
+
+  // record all the changes first, then invoke the sinks
+  const std::vector<uint64_t> &values = m_p4Pipe->get_traced_values ();
+  m_changedFields.clear ();
+  for (uint32_t i = 0; i < m_activeTracedFields.size (); i++)
+    {
+      TracedField &f = m_tracedFields[m_activeTracedFields[i]];
+      if (values[i] != f.value)
+        {
+          m_changedFields.push_back (std::make_pair (m_activeTracedFields[i], f.value));
+          f.value = values[i];
+        }
+    }
+  for (auto &change : m_changedFields)
+    {
+      TracedField &f = m_tracedFields[change.first];
+      f.trace (change.second, f.value);
+    }
+}
+
+P4QueueDisc::TracedField *
+P4QueueDisc::GetTracedField (std::string field)
+{
+  NS_LOG_FUNCTION (this << field);
+
+  if (m_tracedFields.empty () && m_tracedFieldNames != "")
+    {
+      std::istringstream names (m_tracedFieldNames);
+      std::string name;
+      while (std::getline (names, name, ','))
+        {
+          if (!name.empty ())
+            {
+              m_tracedFields.push_back (TracedField ());
+              m_tracedFields.back ().name = name;
+              m_tracedFields.back ().value = 0;
+              m_tracedFields.back ().nSinks = 0;
+            }
+        }
+    }
+
+  for (TracedField &f : m_tracedFields)
+    {
+      if (f.name == field)
+        {
+          return &f;
+        }
+    }
+  return 0;
+}
+
+bool
+P4QueueDisc::TraceConnectField (std::string field, Callback<void, uint64_t, uint64_t> cb)
+{
+  NS_LOG_FUNCTION (this << field);
+
+  TracedField *f = GetTracedField (field);
+  if (f == 0)
+    {
+      NS_LOG_ERROR ("Field " << field << " is not listed in TracedFields");
+      return false;
+    }
+  f->trace.ConnectWithoutContext (cb);
+  if (f->nSinks++ == 0)
+    {
+      SyncTracedFields ();
+    }
+  return true;
+}
+
+bool
+P4QueueDisc::TraceDisconnectField (std::string field, Callback<void, uint64_t, uint64_t> cb)
+{
+  NS_LOG_FUNCTION (this << field);
+
+  TracedField *f = GetTracedField (field);
+  if (f == 0 || f->nSinks == 0)
+    {
+      return false;
+    }
+  f->trace.DisconnectWithoutContext (cb);
+  if (--f->nSinks == 0)
+    {
+      SyncTracedFields ();
+    }
+  return true;
+}
+
+void
+P4QueueDisc::SyncTracedFields (void)
+{
+  NS_LOG_FUNCTION (this);
+
+  if (m_p4Pipe == NULL)
+    {
+      // InitializeParams syncs the traced fields once the pipeline exists
+      return;
+    }
+
+  // only the fields with a connected sink are read back from the pipeline
+  std::vector<std::string> names;
+  m_activeTracedFields.clear ();
+  for (uint32_t i = 0; i < m_tracedFields.size (); i++)
+    {
+      if (m_tracedFields[i].nSinks > 0)
+        {
+          names.push_back (m_tracedFields[i].name);
+          m_activeTracedFields.push_back (i);
+        }
+    }
+
+  if (!m_p4Pipe->set_traced_fields (names))
+    {
+      NS_FATAL_ERROR ("TracedFields lists a register cell that does not exist in the P4 program");
+    }
 }
 
 bool
@@ -272,35 +495,49 @@ P4QueueDisc::DoEnqueue (Ptr<QueueDiscItem> item)
       m_idle = 0;
     }
 
-  m_qAvg = Estimator (nQueued, m + 1, m_qAvg, m_qW);
+  if (m_enQueueSizeEst)
+    {
+      m_qAvg = m_qSizeEst.Update (nQueued, m + 1);
+    }
 
   //
   // Initialize standard metadata
   //
   std_meta_t std_meta;
-  InitStdMeta (std_meta);
-  std_meta.qdepth = MapSize ((double) nQueued);
+  InitStdMeta (std_meta, TRIGGER_INGRESS);
+  std_meta.qdepth = MapSize (nQueued);
   std_meta.qdepth_bytes = GetNBytes ();
-  std_meta.avg_qdepth = MapSize (m_qAvg);
-  std_meta.avg_qdepth_bytes = (uint32_t) std::round (m_qAvg);
+  std_meta.avg_qdepth_bytes = m_qSizeEst.GetRoundedAverage ();
+  std_meta.avg_qdepth = MapSize (std_meta.avg_qdepth_bytes);
   std_meta.timestamp = Simulator::Now ().GetNanoSeconds ();
   std_meta.idle_time = m_idleTime.GetNanoSeconds ();
-  std_meta.qlatency = m_qLatency;
-  std_meta.avg_deq_rate_bytes = (uint32_t) std::round(m_avgDqRate);
-  std_meta.pkt_len = MapSize ((double) item->GetSize ());
+  std_meta.qlatency = m_sojournEst.GetLatency ();
+  std_meta.avg_deq_rate_bytes = m_dqRateEst.GetRoundedRate ();
+  std_meta.pkt_len = MapSize (item->GetSize ());
   std_meta.pkt_len_bytes = item->GetSize ();
+  std_meta.gso_segs = GetGsoSegs (item->GetSize ());
   std_meta.l3_proto = item->GetProtocol ();
   std_meta.flow_hash = item->Hash (); //TODO(sibanez): include perturbation?
-  std_meta.ingress_trigger = true;
 
-  // perform P4 processing
-  Ptr<Packet> new_packet = m_p4Pipe->process_pipeline(item->GetPacket(), std_meta);
+  // perform P4 processing, unless the verdict is memoized
+  Ptr<Packet> new_packet;
+  uint32_t slot = 0;
+  if (m_enVerdictCache && LookupVerdict (std_meta, slot))
+    {
+      new_packet = item->GetPacket ();
+    }
+  else
+    {
+      new_packet = m_p4Pipe->process_pipeline(item->GetPacket(), std_meta);
 
-  // update trace variables
-  m_p4Var1 = std_meta.trace_var1;
-  m_p4Var2 = std_meta.trace_var2;
-  m_p4Var3 = std_meta.trace_var3;
-  m_p4Var4 = std_meta.trace_var4;
+      // update trace variables
+      UpdateTraceVars (std_meta);
+
+      if (m_enVerdictCache)
+        {
+          StoreVerdict (std_meta, slot);
+        }
+    }
 
   // replace the QueueDiscItem's packet
   item->SetPacket(new_packet);
@@ -311,25 +548,101 @@ P4QueueDisc::DoEnqueue (Ptr<QueueDiscItem> item)
       DropBeforeEnqueue (item, P4_DROP);
       return false;
     }
+  if (std_meta.qid >= GetNQueueDiscClasses ())
+    {
+      NS_LOG_DEBUG ("Dropping packet because P4 program selected class " << std_meta.qid);
+      DropBeforeEnqueue (item, INVALID_QID_DROP);
+      return false;
+    }
+  // the limits of the classes need not add up to the limit of the queue disc
+  if (GetCurrentSize () + item > GetMaxSize ())
+    {
+      NS_LOG_DEBUG ("Dropping packet because the queue disc limit is exceeded");
+      DropBeforeEnqueue (item, LIMIT_EXCEEDED_DROP);
+      return false;
+    }
   if (std_meta.mark)
     {
       NS_LOG_DEBUG ("Marking packet because P4 program said to");
       item->Mark();
     }
 
-  // set enqueue timestamp
+  // set enqueue timestamp and the rank computed by the P4 program
   item->SetTimeStamp (Simulator::Now());
+  item->SetRank (std_meta.rank);
 
-  bool retval = GetQueueDiscClass (0)->GetQueueDisc ()->Enqueue (item);
+  Ptr<QueueDisc> child = GetQueueDiscClass (std_meta.qid)->GetQueueDisc ();
+  bool retval = child->Enqueue (item);
+  UpdatePortBacklog ();
 
   // If Queue::Enqueue fails, QueueDisc::Drop is called by the child queue disc
   // because QueueDisc::AddQueueDiscClass sets the drop callback
 
-  NS_LOG_LOGIC ("Number packets in queue disc " << GetQueueDiscClass (0)->GetQueueDisc ()->GetNPackets ());
+  if (retval && m_schedPolicy == DRR && !m_drrIsActive[std_meta.qid])
+    {
+      m_drrActive.push_back (std_meta.qid);
+      m_drrIsActive[std_meta.qid] = true;
+      m_deficits[std_meta.qid] = m_quantum;
+    }
+
+  NS_LOG_LOGIC ("Number packets in class " << std_meta.qid << ": " << child->GetNPackets ());
 
   return retval;
 }
 
+bool
+P4QueueDisc::LookupVerdict (std_meta_t &std_meta, uint32_t &slot)
+{
+  NS_LOG_FUNCTION (this);
+
+  uint32_t qBucket = 0;
+  if (m_verdictQueueBits > 0)
+    {
+      qBucket = std_meta.qdepth >> (m_qSizeBits - std::min (m_verdictQueueBits, m_qSizeBits));
+    }
+  slot = (std_meta.flow_hash ^ (qBucket * 0x9e3779b9) ^ std_meta.l3_proto) & (m_verdictCacheSize - 1);
+
+  VerdictCacheEntry &e = m_verdictCache[slot];
+  if (!e.valid || e.flowHash != std_meta.flow_hash || e.qBucket != qBucket
+      || e.l3Proto != std_meta.l3_proto)
+    {
+      // remember the key for StoreVerdict
+      e.valid = false;
+      e.flowHash = std_meta.flow_hash;
+      e.qBucket = qBucket;
+      e.l3Proto = std_meta.l3_proto;
+      return false;
+    }
+  if (e.generation != m_p4Pipe->get_table_generation () || e.expiry <= std_meta.timestamp)
+    {
+      NS_LOG_LOGIC ("Memoized verdict in slot " << slot << " is stale");
+      e.valid = false;
+      return false;
+    }
+
+  NS_LOG_LOGIC ("Memoized verdict hit in slot " << slot);
+  std_meta.drop = e.drop;
+  std_meta.mark = e.mark;
+  std_meta.qid = e.qid;
+  std_meta.rank = e.rank;
+  return true;
+}
+
+void
+P4QueueDisc::StoreVerdict (const std_meta_t &std_meta, uint32_t slot)
+{
+  NS_LOG_FUNCTION (this << slot);
+
+  VerdictCacheEntry &e = m_verdictCache[slot];
+  e.valid = true;
+  e.drop = std_meta.drop;
+  e.mark = std_meta.mark;
+  e.qid = std_meta.qid;
+  e.rank = std_meta.rank;
+  e.generation = m_p4Pipe->get_table_generation ();
+  e.expiry = std_meta.timestamp + m_verdictCacheTtl.GetNanoSeconds ();
+}
+
 void
 P4QueueDisc::RunTimerEvent ()
 {
@@ -342,29 +655,21 @@ P4QueueDisc::RunTimerEvent ()
   // Initialize standard metadata
   //
   std_meta_t std_meta;
-  InitStdMeta (std_meta);
-  std_meta.qdepth = MapSize ((double) nQueued);
+  InitStdMeta (std_meta, TRIGGER_TIMER);
+  std_meta.qdepth = MapSize (nQueued);
   std_meta.qdepth_bytes = GetNBytes ();
-  std_meta.avg_qdepth = MapSize (m_qAvg);
-  std_meta.avg_qdepth_bytes = (uint32_t) std::round (m_qAvg);
+  std_meta.avg_qdepth_bytes = m_qSizeEst.GetRoundedAverage ();
+  std_meta.avg_qdepth = MapSize (std_meta.avg_qdepth_bytes);
   std_meta.timestamp = Simulator::Now ().GetNanoSeconds ();
   std_meta.idle_time = m_idleTime.GetNanoSeconds ();
-  std_meta.qlatency = m_qLatency;
-  std_meta.avg_deq_rate_bytes = (uint32_t) std::round(m_avgDqRate);
-  std_meta.pkt_len = 0;
-  std_meta.pkt_len_bytes = 0;
-  std_meta.l3_proto = 0;
-  std_meta.flow_hash = 0;
-  std_meta.timer_trigger = true;
+  std_meta.qlatency = m_sojournEst.GetLatency ();
+  std_meta.avg_deq_rate_bytes = m_dqRateEst.GetRoundedRate ();
 
   // perform P4 processing
   m_p4Pipe->process_pipeline(default_packet, std_meta);
 
   // update trace variables
-  m_p4Var1 = std_meta.trace_var1;
-  m_p4Var2 = std_meta.trace_var2;
-  m_p4Var3 = std_meta.trace_var3;
-  m_p4Var4 = std_meta.trace_var4;
+  UpdateTraceVars (std_meta);
 
   // Reschedule timer event
   m_timerEvent = Simulator::Schedule (m_timeReference, &P4QueueDisc::RunTimerEvent, this);
@@ -378,27 +683,23 @@ P4QueueDisc::RunDropEvent (Ptr<const QueueDiscItem> item)
   // Initialize standard metadata
   //
   std_meta_t std_meta;
-  InitStdMeta (std_meta);
+  InitStdMeta (std_meta, TRIGGER_DROP);
   // drop trigger metadata
-  std_meta.drop_trigger = true;
-  std_meta.drop_timestamp = Simulator::Now ().GetNanoSeconds ();
-  std_meta.drop_qdepth = MapSize ((double) nQueued);
-  std_meta.drop_qdepth_bytes = GetNBytes ();
-  std_meta.drop_avg_qdepth = MapSize (m_qAvg);
-  std_meta.drop_avg_qdepth_bytes = (uint32_t) std::round (m_qAvg);
-  std_meta.drop_pkt_len = MapSize ((double) item->GetSize ());
-  std_meta.drop_pkt_len_bytes = item->GetSize ();
-  std_meta.drop_l3_proto = item->GetProtocol ();
-  std_meta.drop_flow_hash = item->Hash (); //TODO(sibanez): include perturbation?
+  std_meta.drop_event.timestamp = Simulator::Now ().GetNanoSeconds ();
+  std_meta.drop_event.qdepth = MapSize (nQueued);
+  std_meta.drop_event.qdepth_bytes = GetNBytes ();
+  std_meta.drop_event.avg_qdepth = MapSize (m_qSizeEst.GetRoundedAverage ());
+  std_meta.drop_event.avg_qdepth_bytes = m_qSizeEst.GetRoundedAverage ();
+  std_meta.drop_event.pkt_len = MapSize (item->GetSize ());
+  std_meta.drop_event.pkt_len_bytes = item->GetSize ();
+  std_meta.drop_event.l3_proto = item->GetProtocol ();
+  std_meta.drop_event.flow_hash = item->Hash (); //TODO(sibanez): include perturbation?
   
   // perform P4 processing
   m_p4Pipe->process_pipeline(default_packet, std_meta);
   
   // update trace variables
-  m_p4Var1 = std_meta.trace_var1;
-  m_p4Var2 = std_meta.trace_var2;
-  m_p4Var3 = std_meta.trace_var3;
-  m_p4Var4 = std_meta.trace_var4;
+  UpdateTraceVars (std_meta);
 }
 
 void
@@ -409,27 +710,23 @@ P4QueueDisc::RunEnqEvent (Ptr<const QueueDiscItem> item)
   // Initialize standard metadata
   //
   std_meta_t std_meta;
-  InitStdMeta (std_meta);
+  InitStdMeta (std_meta, TRIGGER_ENQ);
   // enqueue trigger metadata
-  std_meta.enq_trigger = true;
-  std_meta.enq_timestamp = Simulator::Now ().GetNanoSeconds ();
-  std_meta.enq_qdepth = MapSize ((double) nQueued);
-  std_meta.enq_qdepth_bytes = GetNBytes ();
-  std_meta.enq_avg_qdepth = MapSize (m_qAvg);
-  std_meta.enq_avg_qdepth_bytes = (uint32_t) std::round (m_qAvg);
-  std_meta.enq_pkt_len = MapSize ((double) item->GetSize ());
-  std_meta.enq_pkt_len_bytes = item->GetSize ();
-  std_meta.enq_l3_proto = item->GetProtocol ();
-  std_meta.enq_flow_hash = item->Hash (); //TODO(sibanez): include perturbation?
+  std_meta.enq_event.timestamp = Simulator::Now ().GetNanoSeconds ();
+  std_meta.enq_event.qdepth = MapSize (nQueued);
+  std_meta.enq_event.qdepth_bytes = GetNBytes ();
+  std_meta.enq_event.avg_qdepth = MapSize (m_qSizeEst.GetRoundedAverage ());
+  std_meta.enq_event.avg_qdepth_bytes = m_qSizeEst.GetRoundedAverage ();
+  std_meta.enq_event.pkt_len = MapSize (item->GetSize ());
+  std_meta.enq_event.pkt_len_bytes = item->GetSize ();
+  std_meta.enq_event.l3_proto = item->GetProtocol ();
+  std_meta.enq_event.flow_hash = item->Hash (); //TODO(sibanez): include perturbation?
   
   // perform P4 processing
   m_p4Pipe->process_pipeline(default_packet, std_meta);
   
   // update trace variables
-  m_p4Var1 = std_meta.trace_var1;
-  m_p4Var2 = std_meta.trace_var2;
-  m_p4Var3 = std_meta.trace_var3;
-  m_p4Var4 = std_meta.trace_var4;
+  UpdateTraceVars (std_meta);
 }
 
 void
@@ -440,37 +737,89 @@ P4QueueDisc::RunDeqEvent (Ptr<const QueueDiscItem> item)
   // Initialize standard metadata
   //
   std_meta_t std_meta;
-  InitStdMeta (std_meta);
+  InitStdMeta (std_meta, TRIGGER_DEQ);
   // dequeue trigger metadata
-  std_meta.deq_trigger = true;
-  std_meta.deq_enq_timestamp = item->GetTimeStamp().GetNanoSeconds();
-  std_meta.deq_qdepth = MapSize ((double) nQueued);
-  std_meta.deq_qdepth_bytes = GetNBytes ();
-  std_meta.deq_avg_qdepth = MapSize (m_qAvg); //TODO(sibanez): does m_qAvg need to be updated on dequeue too?
-  std_meta.deq_avg_qdepth_bytes = (uint32_t) std::round (m_qAvg);
-  std_meta.deq_timestamp = Simulator::Now ().GetNanoSeconds ();
-  std_meta.deq_pkt_len = MapSize ((double) item->GetSize ());
-  std_meta.deq_pkt_len_bytes = item->GetSize ();
-  std_meta.deq_l3_proto = item->GetProtocol ();
-  std_meta.deq_flow_hash = item->Hash (); //TODO(sibanez): include perturbation?
+  std_meta.deq_event.enq_timestamp = item->GetTimeStamp().GetNanoSeconds();
+  std_meta.deq_event.qdepth = MapSize (nQueued);
+  std_meta.deq_event.qdepth_bytes = GetNBytes ();
+  std_meta.deq_event.avg_qdepth = MapSize (m_qSizeEst.GetRoundedAverage ()); //TODO(sibanez): does m_qAvg need to be updated on dequeue too?
+  std_meta.deq_event.avg_qdepth_bytes = m_qSizeEst.GetRoundedAverage ();
+  std_meta.deq_event.timestamp = Simulator::Now ().GetNanoSeconds ();
+  std_meta.deq_event.pkt_len = MapSize (item->GetSize ());
+  std_meta.deq_event.pkt_len_bytes = item->GetSize ();
+  std_meta.deq_event.l3_proto = item->GetProtocol ();
+  std_meta.deq_event.flow_hash = item->Hash (); //TODO(sibanez): include perturbation?
   
   // perform P4 processing
   m_p4Pipe->process_pipeline(default_packet, std_meta);
   
   // update trace variables
-  m_p4Var1 = std_meta.trace_var1;
-  m_p4Var2 = std_meta.trace_var2;
-  m_p4Var3 = std_meta.trace_var3;
-  m_p4Var4 = std_meta.trace_var4;
+  UpdateTraceVars (std_meta);
+}
+
+void
+P4QueueDisc::RunRegisterDump ()
+{
+  NS_LOG_FUNCTION (this);
+
+  m_regDumpWriter.BeginSample (Simulator::Now ());
+  for (int handle : m_regDumpHandles)
+    {
+      m_p4Pipe->read_register (handle, m_regDumpValues);
+      m_regDumpWriter.WriteColumn (m_regDumpValues);
+    }
+
+  m_regDumpEvent = Simulator::Schedule (m_regDumpInterval, &P4QueueDisc::RunRegisterDump, this);
+}
+
+void
+P4QueueDisc::InitializeRegisterDump (void)
+{
+  NS_LOG_FUNCTION (this);
+
+  std::istringstream names (m_regDumpNames);
+  std::string name;
+  while (std::getline (names, name, ','))
+    {
+      if (name.empty ())
+        {
+          continue;
+        }
+      int handle = m_p4Pipe->get_register_handle (name);
+      if (handle < 0)
+        {
+          NS_FATAL_ERROR ("The P4 program has no register array named " << name);
+        }
+      m_regDumpHandles.push_back (handle);
+      m_regDumpWriter.AddColumn (name, m_p4Pipe->get_register_size (handle));
+    }
+
+  if (!m_regDumpWriter.Open (m_regDumpFile))
+    {
+      NS_FATAL_ERROR ("Cannot open the register dump file " << m_regDumpFile);
+    }
+
+  m_regDumpEvent = Simulator::Schedule (m_regDumpInterval, &P4QueueDisc::RunRegisterDump, this);
 }
 
 uint32_t
-P4QueueDisc::MapSize (double size)
+P4QueueDisc::GetGsoSegs (uint32_t size) const
+{
+  if (m_gsoSegmentSize == 0 || size <= m_gsoSegmentSize)
+    {
+      return 1;
+    }
+  return (size + m_gsoSegmentSize - 1) / m_gsoSegmentSize;
+}
+
+uint32_t
+P4QueueDisc::MapSize (uint64_t size)
 {
   NS_LOG_FUNCTION (this << size);
 
-  uint32_t maxSize = GetMaxSize ().GetValue();
-  uint32_t result = (uint32_t) std::round (( ((double)size)/((double)maxSize) ) * ((1 << m_qSizeBits) - 1));
+  // larger sizes (e.g., a packet longer than a small MaxSize) saturate,
+  // which also bounds the product below 2^32
+  uint32_t result = (uint32_t) MulQ32 (std::min (size, m_mapMaxSize), m_mapScale);
 
   NS_LOG_LOGIC ("Mapped size " << size << " into " << result);
   return result;
@@ -487,25 +836,80 @@ P4QueueDisc::InitializeParams (void)
   m_p4Var3 = 0;
   m_p4Var4 = 0;
 
-  // create and initialize the P4 pipeline
+  if (GetNetDevice () != 0)
+    {
+      m_egressPort = GetNetDevice ()->GetIfIndex ();
+    }
+
+  // create and initialize the P4 pipeline, or bind to the one of the node
   if (m_p4Pipe == NULL && m_jsonFile != "" && m_commandsFile != "")
     {
-      m_p4Pipe = new SimpleP4Pipe(m_jsonFile);
-      m_p4Pipe->run_cli (m_commandsFile);
+      if (m_sharedPipeline)
+        {
+          Ptr<Node> node = GetNetDevice ()->GetNode ();
+          m_sharedPipe = node->GetObject<P4SharedPipeline> ();
+          if (m_sharedPipe == 0)
+            {
+              m_sharedPipe = CreateObject<P4SharedPipeline> ();
+              node->AggregateObject (m_sharedPipe);
+            }
+          m_p4Pipe = m_sharedPipe->GetPipe (m_jsonFile, m_commandsFile);
+          m_sharedPipe->Configure (m_enP4Vars, m_maxImportSize);
+          m_sharedPipe->SetPortQueueDepthRegister (m_portQdepthRegName);
+          m_sharedPipe->SetPortBacklog (m_egressPort, 0);
+        }
+      else
+        {
+          m_p4Pipe = new SimpleP4Pipe(m_jsonFile);
+          m_p4Pipe->run_cli (m_commandsFile);
+          m_p4Pipe->set_trace_vars_enabled (m_enP4Vars);
+          m_p4Pipe->set_max_import_size (m_maxImportSize);
+          SyncTracedFields ();
+        }
+    }
+
+  if (m_p4Pipe != NULL && m_enVerdictCache)
+    {
+      // the quantized qdepth is only part of the key with VerdictCacheQueueBits set
+      std::set<std::string> key = {"flow_hash", "l3_proto"};
+      if (m_verdictQueueBits > 0)
+        {
+          key.insert ("qdepth");
+        }
+      std::string reason;
+      if (!m_p4Pipe->is_memoizable (key, reason))
+        {
+          NS_FATAL_ERROR ("The verdict of the P4 program cannot be memoized: " << reason);
+        }
+      m_verdictCache.assign (m_verdictCacheSize, VerdictCacheEntry ());
+    }
+
+  // sample the register arrays periodically
+  if (m_p4Pipe != NULL && m_regDumpFile != "" && !m_regDumpInterval.IsZero ()
+      && !m_regDumpWriter.IsOpen ())
+    {
+      InitializeRegisterDump ();
     }
 
   m_ptc = m_linkBandwidth.GetBitRate () / (8.0 * m_meanPktSize);
 
+  // DRR state
+  m_drrActive.clear ();
+  m_drrIsActive.assign (GetNQueueDiscClasses (), false);
+  m_deficits.assign (GetNQueueDiscClasses (), 0);
+
   m_qAvg = 0.0;
   m_idle = 1;
   m_idleTime = NanoSeconds (0);
   m_qLatency = 0;
-
-  // dequeue rate measurement vars
-  m_inMeasurement = false;
-  m_dqCount = DQCOUNT_INVALID;
   m_avgDqRate = 0.0;
-  m_dqStart = 0;
+
+  // scale factor used by MapSize, with 32 fractional bits
+  NS_ASSERT_MSG (m_qSizeBits >= 1 && m_qSizeBits <= 32, "QueueSizeBits must be in the range [1, 32]");
+  // below 2^64 since the dividend is below 2^32 and the divisor at least 1
+  m_mapMaxSize = std::max<uint64_t> (GetMaxSize ().GetValue (), 1);
+  m_mapScale = (uint64_t) std::round (std::ldexp ((double) ((((uint64_t) 1) << m_qSizeBits) - 1)
+                                                  / m_mapMaxSize, 32));
 
 /*
  * If m_qW=0, set it to a reasonable value of 1-exp(-1/C)
@@ -539,6 +943,12 @@ P4QueueDisc::InitializeParams (void)
       m_qW = 1.0 - std::exp (-10.0 / m_ptc);
     }
 
+  m_qSizeEst.SetWeight (m_qW);
+  m_qSizeEst.Reset ();
+  m_dqRateEst.SetThreshold (m_dqThreshold);
+  m_dqRateEst.Reset ();
+  m_sojournEst.Reset ();
+
   NS_LOG_DEBUG ("\tm_linkDelay " << m_linkDelay.GetSeconds ()
                 << "; m_linkBandwidth " << m_linkBandwidth.GetBitRate ()
                 << "; m_qW " << m_qW
@@ -546,115 +956,280 @@ P4QueueDisc::InitializeParams (void)
                 );
 }
 
-// Compute the average queue size
-double
-P4QueueDisc::Estimator (uint32_t nQueued, uint32_t m, double qAvg, double qW)
+Ptr<QueueDiscItem>
+P4QueueDisc::DequeueStrictPriority (void)
 {
-  NS_LOG_FUNCTION (this << nQueued << m << qAvg << qW);
+  NS_LOG_FUNCTION (this);
 
-  double newAve = qAvg * std::pow (1.0 - qW, m);
-  newAve += qW * nQueued;
+  Ptr<QueueDiscItem> item;
 
-  return newAve;
+  for (uint32_t i = 0; i < GetNQueueDiscClasses (); i++)
+    {
+      if ((item = GetQueueDiscClass (i)->GetQueueDisc ()->Dequeue ()) != 0)
+        {
+          NS_LOG_LOGIC ("Popped from class " << i << ": " << item);
+          return item;
+        }
+    }
+  return item;
 }
 
 Ptr<QueueDiscItem>
-P4QueueDisc::DoDequeue (void)
+P4QueueDisc::DequeueDrr (void)
 {
   NS_LOG_FUNCTION (this);
 
-  if (GetQueueDiscClass (0)->GetQueueDisc ()->GetNPackets() == 0)
+  // Modelled after the Linux drr_dequeue function (net/sched/sch_drr.c)
+  while (!m_drrActive.empty ())
     {
-      NS_LOG_LOGIC ("Queue empty");
-      m_idle = 1;
-      m_idleTime = Simulator::Now ();
+      uint32_t cls = m_drrActive.front ();
+      Ptr<QueueDisc> child = GetQueueDiscClass (cls)->GetQueueDisc ();
+      Ptr<const QueueDiscItem> head = child->Peek ();
 
+      if (head == 0)
+        {
+          // the child queue disc may have dropped its packets
+          NS_LOG_LOGIC ("Class " << cls << " is empty, removing it from the active list");
+          m_drrActive.pop_front ();
+          m_drrIsActive[cls] = false;
+          continue;
+        }
+
+      if (head->GetSize () <= m_deficits[cls])
+        {
+          Ptr<QueueDiscItem> item = child->Dequeue ();
+          NS_ASSERT (item != 0);
+          m_deficits[cls] -= item->GetSize ();
+          if (child->GetNPackets () == 0)
+            {
+              m_drrActive.pop_front ();
+              m_drrIsActive[cls] = false;
+            }
+          NS_LOG_LOGIC ("Popped from class " << cls << ": " << item);
+          return item;
+        }
+
+      m_deficits[cls] += m_quantum;
+      m_drrActive.pop_front ();
+      m_drrActive.push_back (cls);
+    }
+  return 0;
+}
+
+Ptr<QueueDiscItem>
+P4QueueDisc::DequeuePifo (void)
+{
+  NS_LOG_FUNCTION (this);
+
+  Ptr<QueueDisc> best;
+  uint64_t bestRank = 0;
+
+  for (uint32_t i = 0; i < GetNQueueDiscClasses (); i++)
+    {
+      Ptr<QueueDisc> child = GetQueueDiscClass (i)->GetQueueDisc ();
+      Ptr<const QueueDiscItem> head = child->Peek ();
+      if (head != 0 && (best == 0 || PifoRankBefore (head->GetRank (), bestRank)))
+        {
+          best = child;
+          bestRank = head->GetRank ();
+        }
+    }
+
+  if (best == 0)
+    {
       return 0;
     }
-  else
+  return best->Dequeue ();
+}
+
+uint32_t
+P4QueueDisc::GetClassesNBytes (void) const
+{
+  uint32_t nBytes = 0;
+  for (uint32_t i = 0; i < GetNQueueDiscClasses (); i++)
     {
-      Ptr<QueueDiscItem> item;
-      item = GetQueueDiscClass (0)->GetQueueDisc ()->Dequeue ();
+      nBytes += GetQueueDiscClass (i)->GetQueueDisc ()->GetNBytes ();
+    }
+  return nBytes;
+}
 
-      NS_LOG_LOGIC ("Popped from qdisc: " << item);
-      NS_LOG_LOGIC ("Number packets in qdisc: " << GetQueueDiscClass (0)->GetQueueDisc ()->GetNPackets ());
+Ptr<QueueDiscItem>
+P4QueueDisc::DoDequeue (void)
+{
+  NS_LOG_FUNCTION (this);
 
-      // NOTE: no need to call RunDeqEvent because CheckConfig connects it as a trace sink
+  Ptr<QueueDiscItem> item;
 
-      // update queue latency measurement
-      m_qLatency = Simulator::Now().GetNanoSeconds() - item->GetTimeStamp().GetNanoSeconds();
+  while (true)
+    {
+      switch (m_schedPolicy)
+        {
+        case DRR:
+          item = DequeueDrr ();
+          break;
+        case PIFO:
+          item = DequeuePifo ();
+          break;
+        case STRICT_PRIORITY:
+        default:
+          item = DequeueStrictPriority ();
+        }
 
-      /* NOTE: the code below is taken from pie-queue-disc.cc to compute dequeue rate measurements */
-      double now = Simulator::Now ().GetSeconds ();
-      uint32_t pktSize = item->GetSize ();
+      UpdatePortBacklog ();
 
-      // if not in a measurement cycle and the queue has built up to dq_threshold,
-      // start the measurement cycle
-    
-      if ( (GetQueueDiscClass (0)->GetQueueDisc ()->GetNBytes () >= m_dqThreshold) && (!m_inMeasurement) )
+      if (item == 0)
         {
-          m_dqStart = now;
-          m_dqCount = 0;
-          m_inMeasurement = true;
+          NS_LOG_LOGIC ("Queue empty");
+          m_idle = 1;
+          m_idleTime = Simulator::Now ();
+
+          return 0;
         }
-    
-      if (m_inMeasurement)
+
+      NS_LOG_LOGIC ("Number packets in classes: " << GetNPackets ());
+
+      // update queue latency measurement
+      if (m_enSojournEst)
         {
-          m_dqCount += pktSize;
-    
-          // done with a measurement cycle
-          if (m_dqCount >= m_dqThreshold)
-            {
-    
-              double tmp = now - m_dqStart;
-    
-              if (tmp > 0)
-                {
-                  if (m_avgDqRate == 0)
-                    {
-                      m_avgDqRate = m_dqCount / tmp;
-                    }
-                  else
-                    {
-                      m_avgDqRate = (0.5 * m_avgDqRate) + (0.5 * (m_dqCount / tmp));
-                    }
-                }
-    
-              // restart a measurement cycle if there is enough data
-              if (GetQueueDiscClass (0)->GetQueueDisc ()->GetNBytes () > m_dqThreshold)
-                {
-                  m_dqStart = now;
-                  m_dqCount = 0;
-                  m_inMeasurement = true;
-                }
-              else
-                {
-                  m_dqCount = 0;
-                  m_inMeasurement = false;
-                }
-            }
+          m_qLatency = m_sojournEst.Update (item->GetTimeStamp (), Simulator::Now ());
         }
 
-      return item;
+      if (!m_enEgress || RunEgress (item))
+        {
+          break;
+        }
+      // the P4 egress control dropped the packet, try with the next one
     }
+
+  // NOTE: no need to call RunDeqEvent because CheckConfig connects it as a trace sink
+
+  if (m_enDqRateEst)
+    {
+      m_avgDqRate = m_dqRateEst.Update (Simulator::Now (), item->GetSize (), GetClassesNBytes ());
+    }
+
+  return item;
 }
 
-Ptr<const QueueDiscItem>
-P4QueueDisc::DoPeek (void)
+uint32_t
+P4QueueDisc::DoDequeueBatch (uint32_t maxPackets, uint32_t maxBytes,
+                             std::vector<Ptr<QueueDiscItem> > &items)
 {
-  NS_LOG_FUNCTION (this);
+  NS_LOG_FUNCTION (this << maxPackets << maxBytes);
 
-  Ptr<const QueueDiscItem> item;
+  // the egress control sees the state of the queue disc as each packet
+  // leaves, and the DRR and PIFO policies pick a class for each packet,
+  // hence the packets are dequeued one at a time
+  if (m_enEgress || m_schedPolicy != STRICT_PRIORITY)
+    {
+      return QueueDisc::DoDequeueBatch (maxPackets, maxBytes, items);
+    }
 
-  if ((item = GetQueueDiscClass (0)->GetQueueDisc ()->Peek ()) != 0)
+  // drain the classes in order, with a batch from each class
+  std::size_t first = items.size ();
+  uint32_t n = 0;
+  uint32_t bytes = 0;
+  for (uint32_t i = 0; i < GetNQueueDiscClasses () && n < maxPackets && bytes < maxBytes; i++)
     {
-      NS_LOG_LOGIC ("Peeked from qdisc: " << item);
-      NS_LOG_LOGIC ("Number packets band: " << GetQueueDiscClass (0)->GetQueueDisc ()->GetNPackets ());
-      return item;
+      std::size_t start = items.size ();
+      n += GetQueueDiscClass (i)->GetQueueDisc ()->DequeueBatch (maxPackets - n, maxBytes - bytes, items);
+      for (std::size_t j = start; j < items.size (); j++)
+        {
+          bytes += items[j]->GetSize ();
+        }
     }
 
-  NS_LOG_LOGIC ("Queue empty");
-  return item;
+  UpdatePortBacklog ();
+
+  if (n == 0)
+    {
+      NS_LOG_LOGIC ("Queue empty");
+      m_idle = 1;
+      m_idleTime = Simulator::Now ();
+
+      return 0;
+    }
+
+  NS_LOG_LOGIC ("Popped " << n << " packets, number packets in classes: " << GetNPackets ());
+
+  // the estimators are updated as if the packets were dequeued one at a time
+  uint32_t backlog = GetClassesNBytes () + bytes;
+  for (std::size_t j = first; j < items.size (); j++)
+    {
+      backlog -= items[j]->GetSize ();
+      if (m_enSojournEst)
+        {
+          m_qLatency = m_sojournEst.Update (items[j]->GetTimeStamp (), Simulator::Now ());
+        }
+      if (m_enDqRateEst)
+        {
+          m_avgDqRate = m_dqRateEst.Update (Simulator::Now (), items[j]->GetSize (), backlog);
+        }
+    }
+  return n;
+}
+
+bool
+P4QueueDisc::RunEgress (Ptr<QueueDiscItem> item)
+{
+  NS_LOG_FUNCTION (this << item);
+
+  uint32_t nQueued = GetCurrentSize ().GetValue ();
+
+  //
+  // Initialize standard metadata
+  //
+  std_meta_t std_meta;
+  InitStdMeta (std_meta, TRIGGER_DEQ);
+  std_meta.qdepth = MapSize (nQueued);
+  std_meta.qdepth_bytes = GetNBytes ();
+  std_meta.avg_qdepth_bytes = m_qSizeEst.GetRoundedAverage ();
+  std_meta.avg_qdepth = MapSize (std_meta.avg_qdepth_bytes);
+  std_meta.timestamp = Simulator::Now ().GetNanoSeconds ();
+  std_meta.idle_time = m_idleTime.GetNanoSeconds ();
+  std_meta.qlatency = m_sojournEst.GetLatency ();
+  std_meta.avg_deq_rate_bytes = m_dqRateEst.GetRoundedRate ();
+  std_meta.pkt_len = MapSize (item->GetSize ());
+  std_meta.pkt_len_bytes = item->GetSize ();
+  std_meta.gso_segs = GetGsoSegs (item->GetSize ());
+  std_meta.l3_proto = item->GetProtocol ();
+  std_meta.flow_hash = item->Hash ();
+  // dequeue metadata
+  std_meta.deq_event.enq_timestamp = item->GetTimeStamp().GetNanoSeconds();
+  std_meta.deq_event.qdepth = std_meta.qdepth;
+  std_meta.deq_event.qdepth_bytes = std_meta.qdepth_bytes;
+  std_meta.deq_event.avg_qdepth = std_meta.avg_qdepth;
+  std_meta.deq_event.avg_qdepth_bytes = std_meta.avg_qdepth_bytes;
+  std_meta.deq_event.timestamp = std_meta.timestamp;
+  std_meta.deq_event.pkt_len = std_meta.pkt_len;
+  std_meta.deq_event.pkt_len_bytes = std_meta.pkt_len_bytes;
+  std_meta.deq_event.l3_proto = std_meta.l3_proto;
+  std_meta.deq_event.flow_hash = std_meta.flow_hash;
+
+  // perform P4 egress processing
+  Ptr<Packet> new_packet = m_p4Pipe->process_egress_pipeline(item->GetPacket(), std_meta);
+
+  // update trace variables
+  UpdateTraceVars (std_meta);
+
+  if (std_meta.drop)
+    {
+      // drop the original packet so that the dropped bytes match the
+      // bytes accounted for when the packet left its class
+      NS_LOG_DEBUG ("Dropping packet because P4 egress control said to");
+      DropAfterDequeue (item, P4_EGRESS_DROP);
+      return false;
+    }
+
+  // replace the QueueDiscItem's packet
+  item->SetPacket(new_packet);
+
+  if (std_meta.mark)
+    {
+      NS_LOG_DEBUG ("Marking packet because P4 egress control said to");
+      Mark (item, P4_EGRESS_MARK);
+    }
+  return true;
 }
 
 bool
@@ -691,11 +1266,6 @@ P4QueueDisc::CheckConfig (void)
       AddQueueDiscClass (c);
     }
 
-  if (GetNQueueDiscClasses () != 1)
-    {
-      NS_LOG_ERROR ("P4QueueDisc requires exactly 1 class");
-      return false;
-    }
 
   if (m_jsonFile == "")
     {
@@ -709,6 +1279,30 @@ P4QueueDisc::CheckConfig (void)
       return false;
     }
 
+  if (m_sharedPipeline && GetNetDevice () == 0)
+    {
+      NS_LOG_ERROR ("P4QueueDisc cannot share the P4 pipeline of the node without a device");
+      return false;
+    }
+
+  if (m_enVerdictCache && (m_verdictCacheSize & (m_verdictCacheSize - 1)) != 0)
+    {
+      NS_LOG_ERROR ("VerdictCacheSize must be a power of 2");
+      return false;
+    }
+
+  if (m_enVerdictCache && m_enP4Vars)
+    {
+      NS_LOG_ERROR ("The verdict cache requires EnableP4Vars to be false");
+      return false;
+    }
+
+  if (m_sharedPipeline && m_tracedFieldNames != "")
+    {
+      NS_LOG_ERROR ("P4QueueDisc does not support TracedFields with a shared P4 pipeline");
+      return false;
+    }
+
   // Check if timer events should be scheduled
   if (!m_timeReference.IsZero())
     {
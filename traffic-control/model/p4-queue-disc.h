@@ -25,8 +25,13 @@
 #include "ns3/nstime.h"
 #include "ns3/data-rate.h"
 #include "ns3/p4-pipeline.h"
+#include "queue-estimators.h"
+#include "columnar-dump-writer.h"
+#include "p4-node-pipeline.h"
 #include <array>
+#include <list>
 #include <string>
+#include <vector>
 
 namespace ns3 {
 
@@ -39,6 +44,59 @@ namespace ns3 {
  * intended to be the root qdisc that simply runs the user's P4 program
  * and then passes the modified packet to the appropriate qdisc class
  * (or drops the packet if the P4 program says to do so).
+ *
+ * The P4 program selects the class through the qid field of the standard
+ * metadata and may compute a rank in the rank field, which is stamped on
+ * the packet (see QueueDiscItem::SetRank, the priority of the packet is left
+ * untouched) so that PIFO classes can use it. If no class is provided, a
+ * single FIFO class is created. When there are multiple classes, the
+ * SchedulingPolicy attribute determines how the next packet to dequeue is
+ * chosen among them. The MaxSize limit applies to the whole queue disc,
+ * whatever the limits of the classes.
+ *
+ * If EnableEgress is set, every packet leaving a class is also run through
+ * the egress control of the P4 program, with the deq_* fields of the
+ * standard metadata (including the measured sojourn time in qlatency)
+ * populated. The egress control may rewrite, mark or drop the packet; a
+ * dropped packet is replaced by the next packet in the queue.
+ *
+ * Packets longer than MaxImportSize (jumbo frames, GSO super-packets) are
+ * processed header-only by the P4 pipeline. The gso_segs metadata field
+ * holds the number of GsoSegmentSize segments in the packet, so that the
+ * P4 program can account per segment.
+ *
+ * The register arrays listed in RegisterDumpNames can be sampled every
+ * RegisterDumpInterval and written to RegisterDumpFile (see
+ * ColumnarDumpWriter for the file format). The registers are read directly
+ * from the P4 pipeline, without invoking it.
+ *
+ * Besides the P4Var1..4 trace sources, which are fed by the trace_var1..4
+ * fields of the standard metadata, any PHV field or register cell listed in
+ * the TracedFields attribute can be traced by connecting a sink with
+ * TraceConnectField. A field is only read back from the pipeline while it
+ * has a sink, and its sinks are called once per invocation of the pipeline
+ * in which its value changed, after all the traced fields have been read.
+ *
+ * If SharedPipeline is set, the queue disc binds to the P4 pipeline shared
+ * by all such queue discs of its node (see P4SharedPipeline) instead of
+ * creating its own: register arrays are then shared by all the ports and
+ * the P4 program tells the ports apart through the egress_port field of the
+ * standard metadata. The pipeline is configured (MaxImportSize,
+ * EnableP4Vars) by the first queue disc bound to it, and the others must
+ * use the same settings or the simulation aborts. TracedFields is not
+ * supported in this mode.
+ *
+ * If EnableVerdictCache is set, the outputs of the ingress control (drop,
+ * mark, qid, rank) are memoized, keyed by the flow hash, the L3 protocol
+ * and the VerdictCacheQueueBits most significant bits of qdepth. Packets
+ * hitting a valid entry skip the P4 pipeline entirely; entries expire
+ * after VerdictCacheTtl and are invalidated by any table write. It is up
+ * to the user to choose VerdictCacheQueueBits so that the buckets resolve
+ * the qdepth thresholds of the program. Programs with state, random numbers,
+ * header rewrites or reading any other standard metadata input (pkt_len,
+ * avg_qdepth, timestamp, etc.) are rejected when the queue disc is
+ * initialized, and the cache requires EnableP4Vars to be unset since
+ * trace_var1..4 carry state as well.
  */
 class P4QueueDisc : public QueueDisc {
 public:
@@ -54,6 +112,16 @@ public:
 
   virtual ~P4QueueDisc();
 
+  /**
+   * \brief Policy used to choose the class to dequeue from
+   */
+  enum SchedulingPolicy
+  {
+    STRICT_PRIORITY,  //!< Dequeue from the non-empty class with the lowest index
+    DRR,              //!< Deficit round robin among the non-empty classes
+    PIFO              //!< Dequeue from the class whose head packet has the lowest rank
+  };
+
   /// Get the JSON source file
   std::string GetJsonFile (void) const;
 
@@ -66,24 +134,163 @@ public:
   /// Set the CLI commands file
   void SetCommandsFile (std::string commandsFile);
 
+  /**
+   * \brief Connect a sink to a field listed in the TracedFields attribute
+   * \param field the name of the field, as listed in TracedFields
+   * \param cb the sink, called with the old and the new value of the field
+   * \return false if the field is not listed in TracedFields
+   */
+  bool TraceConnectField (std::string field, Callback<void, uint64_t, uint64_t> cb);
+
+  /**
+   * \brief Disconnect a sink from a field listed in the TracedFields attribute
+   * \param field the name of the field, as listed in TracedFields
+   * \param cb the sink
+   * \return false if the field is not listed in TracedFields or has no sink
+   */
+  bool TraceDisconnectField (std::string field, Callback<void, uint64_t, uint64_t> cb);
+
   static constexpr const char* P4_DROP = "P4 drop";      //!< P4 program said to drop packet before enqueue
+  static constexpr const char* INVALID_QID_DROP = "P4 invalid qid";  //!< P4 program selected a class that does not exist
+  static constexpr const char* LIMIT_EXCEEDED_DROP = "Queue disc limit exceeded";  //!< Packet dropped due to queue disc limit exceeded
+  static constexpr const char* P4_EGRESS_DROP = "P4 egress drop";    //!< P4 egress control said to drop packet after dequeue
+  static constexpr const char* P4_EGRESS_MARK = "P4 egress mark";    //!< P4 egress control said to mark packet after dequeue
+
+protected:
+  /**
+   * \brief Dispose of the object, stopping the timer and register dump
+   *        events and closing the register dump file
+   */
+  virtual void DoDispose (void);
 
 private:
+  /**
+   * \brief A memoized verdict of the ingress control
+   */
+  struct VerdictCacheEntry
+  {
+    uint32_t flowHash;     //!< Flow hash of the key
+    uint32_t qBucket;      //!< Quantized qdepth of the key
+    uint16_t l3Proto;      //!< L3 protocol of the key
+    bool valid;            //!< Whether the entry holds a verdict
+    bool drop;             //!< Memoized drop output
+    bool mark;             //!< Memoized mark output
+    uint32_t qid;          //!< Memoized qid output
+    uint32_t rank;         //!< Memoized rank output
+    uint64_t generation;   //!< Table generation the verdict was computed with
+    int64_t expiry;        //!< Expiry time in ns
+  };
+
+  /**
+   * \brief A field listed in the TracedFields attribute
+   */
+  struct TracedField
+  {
+    std::string name;                          //!< Name of the field
+    TracedCallback<uint64_t, uint64_t> trace;  //!< Sinks of the field
+    uint64_t value;                            //!< Latest value of the field
+    uint32_t nSinks;                           //!< Number of connected sinks
+  };
+
   virtual bool DoEnqueue (Ptr<QueueDiscItem> item);
   virtual Ptr<QueueDiscItem> DoDequeue (void);
-  virtual Ptr<const QueueDiscItem> DoPeek (void);
+  virtual uint32_t DoDequeueBatch (uint32_t maxPackets, uint32_t maxBytes,
+                                   std::vector<Ptr<QueueDiscItem> > &items);
   virtual bool CheckConfig (void);
 
+  /**
+   * \brief Dequeue from the non-empty class with the lowest index
+   * \return the dequeued item, or 0 if all the classes are empty
+   */
+  Ptr<QueueDiscItem> DequeueStrictPriority (void);
+
+  /**
+   * \brief Dequeue according to deficit round robin among the active classes
+   * \return the dequeued item, or 0 if all the classes are empty
+   */
+  Ptr<QueueDiscItem> DequeueDrr (void);
+
+  /**
+   * \brief Dequeue from the class whose head packet has the lowest rank
+   * \return the dequeued item, or 0 if all the classes are empty
+   */
+  Ptr<QueueDiscItem> DequeuePifo (void);
+
+  /**
+   * \brief Run the P4 egress control on a packet that left its class
+   * \param item the dequeued item, whose packet is replaced by the one
+   *        produced by the deparser
+   * \return false if the P4 program dropped the packet
+   */
+  bool RunEgress (Ptr<QueueDiscItem> item);
+
+  /**
+   * \brief Get the amount of bytes stored by the classes
+   * \return the sum of the bytes stored by the child queue discs
+   */
+  uint32_t GetClassesNBytes (void) const;
+
+  /**
+   * \brief Look up the memoized verdict for the inputs in \p std_meta
+   * \param std_meta the standard metadata, whose outputs are set on a hit
+   * \param slot set to the cache slot of the key
+   * \return true on a hit
+   */
+  bool LookupVerdict (std_meta_t &std_meta, uint32_t &slot);
+
+  /**
+   * \brief Memoize the verdict computed by the ingress control
+   * \param std_meta the standard metadata returned by the pipeline
+   * \param slot the cache slot returned by LookupVerdict
+   */
+  void StoreVerdict (const std_meta_t &std_meta, uint32_t slot);
+
+  /**
+   * \brief Report the backlog of the queue disc to the shared P4 pipeline,
+   *        if any
+   */
+  void UpdatePortBacklog (void);
+
   /**
    * \brief Initialize \param std_meta with default values
+   * \param trigger the event that causes the P4 pipeline to be invoked
    */
-  void InitStdMeta (std_meta_t &std_meta);
+  void InitStdMeta (std_meta_t &std_meta, std_meta_trigger_t trigger);
+
+  /**
+   * \brief Update the trace sources after an invocation of the P4 pipeline
+   * \param std_meta the standard metadata returned by the pipeline
+   */
+  void UpdateTraceVars (const std_meta_t &std_meta);
+
+  /**
+   * \brief Find a field listed in the TracedFields attribute
+   * \param field the name of the field
+   * \return the field, or 0 if it is not listed
+   */
+  TracedField *GetTracedField (std::string field);
+
+  /**
+   * \brief Tell the P4 pipeline which fields have a connected sink
+   */
+  void SyncTracedFields (void);
 
   /**
    * \brief The function to execute when a timer event is triggered
    */
   void RunTimerEvent (void);
 
+  /**
+   * \brief Resolve the register arrays to sample, open the dump file and
+   *        schedule the first sample
+   */
+  void InitializeRegisterDump (void);
+
+  /**
+   * \brief Write a sample of the register arrays to the dump file
+   */
+  void RunRegisterDump (void);
+
   /**
    * \brief The function to execute when a drop before enqueue event occurs
    */
@@ -100,11 +307,18 @@ private:
   void RunDeqEvent (Ptr<const QueueDiscItem> item);
 
   /**
-   * \brief Map a double in the range [0, GetMaxSize()] to an integer
-   *  in the range [0, 2^m_qSizeBits - 1].
-   *  \param size a numeric (double) size value to convert
+   * \brief Map a size in the range [0, GetMaxSize()] to an integer
+   *  in the range [0, 2^m_qSizeBits - 1]. Larger sizes map to 2^m_qSizeBits - 1.
+   *  \param size the size value to convert
+   */
+  uint32_t MapSize (uint64_t size);
+
+  /**
+   * \brief Get the number of GSO segments of a packet
+   * \param size the size of the packet in bytes
+   * \return the number of segments of GsoSegmentSize bytes, at least 1
    */
-  uint32_t MapSize (double size);
+  uint32_t GetGsoSegs (uint32_t size) const;
 
   /**
    * \brief Initialize the queue disc parameters.
@@ -115,44 +329,64 @@ private:
    * and didn't seem worth the trouble...
    */
   virtual void InitializeParams (void);
-  /**
-   * \brief Compute the average queue size
-   * \param nQueued number of queued packets
-   * \param m simulated number of packets arrival during idle period
-   * \param qAvg average queue size
-   * \param qW queue weight given to cur q size sample
-   * \returns new average queue size
-   */
-  double Estimator (uint32_t nQueued, uint32_t m, double qAvg, double qW);
-
-  static const uint64_t DQCOUNT_INVALID = std::numeric_limits<uint64_t>::max(); //!< Invalid dqCount value
 
   // ** Variables supplied by user 
   std::string m_jsonFile;      //!< The bmv2 JSON file (generated by the p4c-bm backend)
   std::string m_commandsFile;  //!< The CLI commands file
   uint32_t m_qSizeBits;        //!< Number of bits to use to represent range of values for queue/pkt size (up to 32 bits)
   uint32_t m_meanPktSize;      //!< Avg pkt size
+  uint32_t m_maxImportSize;    //!< Number of leading packet bytes processed by the P4 pipeline
+  uint32_t m_gsoSegmentSize;   //!< Size of the segments of a GSO super-packet
   Time m_linkDelay;            //!< Link delay
   DataRate m_linkBandwidth;    //!< Link bandwidth
   double m_qW;                 //!< Queue weight given to cur queue size sample
   uint32_t m_dqThreshold;      //!< Minimum queue size in bytes before dequeue rate is measured
   Time m_timeReference;        //!< Desired time between timer event triggers
+  std::string m_regDumpFile;   //!< File the sampled register arrays are written to
+  std::string m_regDumpNames;  //!< Comma-separated names of the register arrays to sample
+  Time m_regDumpInterval;      //!< Time between register array samples
+  std::string m_tracedFieldNames;  //!< Comma-separated names of the traced fields
+  bool m_enP4Vars;             //!< Pass trace_var1..4 to and from the P4 program
+  bool m_sharedPipeline;       //!< Bind to the P4 pipeline shared by the queue discs of the node
+  std::string m_portQdepthRegName; //!< Register array the port backlogs are mirrored into
+  bool m_enVerdictCache;       //!< Memoize the verdicts of the ingress control
+  uint32_t m_verdictCacheSize; //!< Number of verdict cache slots (power of 2)
+  Time m_verdictCacheTtl;      //!< Lifetime of a memoized verdict
+  uint32_t m_verdictQueueBits; //!< Number of qdepth bits in the verdict cache key
   bool m_enDropEvents;         //!< Enable drop event triggers in P4 pipeline
   bool m_enEnqEvents;          //!< Enable enqueue event triggers in P4 pipeline
   bool m_enDeqEvents;          //!< Enable dequeue event triggers in P4 pipeline
+  bool m_enEgress;             //!< Run the P4 egress control on dequeued packets
+  bool m_enQueueSizeEst;       //!< Maintain the EWMA of the queue size
+  bool m_enDqRateEst;          //!< Measure the dequeue rate
+  bool m_enSojournEst;         //!< Measure the sojourn time
+  SchedulingPolicy m_schedPolicy;  //!< Policy used to choose the class to dequeue from
+  uint32_t m_quantum;          //!< DRR quantum in bytes
 
   // ** Variables maintained by the queue disc
   SimpleP4Pipe *m_p4Pipe;            //!< The P4 pipeline
+  Ptr<P4SharedPipeline> m_sharedPipe; //!< Owner of the P4 pipeline, if shared
+  uint32_t m_egressPort;             //!< Index of the device of the queue disc
   uint32_t m_idle;                   //!< 0/1 idle status
   double m_ptc;                      //!< packet time constant in packets/second
+  uint64_t m_mapScale;               //!< MapSize scale factor, 32 fractional bits
+  uint64_t m_mapMaxSize;             //!< Size MapSize saturates at
+  QueueSizeEstimator m_qSizeEst;     //!< EWMA of the queue size
+  DequeueRateEstimator m_dqRateEst;  //!< Dequeue rate meter
+  SojournTimeEstimator m_sojournEst; //!< Sojourn time tracker
   Time m_idleTime;                   //!< Start of current idle period
   TracedValue<double> m_qAvg;        //!< Average queue length
   TracedValue<double> m_avgDqRate;   //!< Time averaged dequeue rate
-  double m_dqStart;                  //!< Start timestamp of current measurement cycle
-  uint64_t m_dqCount;                //!< Number of bytes departed since current measurement cycle starts
-  bool m_inMeasurement;              //!< Indicates whether we are in a measurement cycle
   TracedValue<int64_t> m_qLatency;   //!< Instantaneous queue latency (ns)
   EventId m_timerEvent;              //!< The timer event ID
+  EventId m_regDumpEvent;            //!< The register dump event ID
+  std::vector<int> m_regDumpHandles; //!< Handles of the sampled register arrays
+  std::vector<uint64_t> m_regDumpValues; //!< Scratch buffer for register reads
+  ColumnarDumpWriter m_regDumpWriter;    //!< Writer of the register dump file
+  std::vector<VerdictCacheEntry> m_verdictCache; //!< Direct-mapped verdict cache
+  std::list<uint32_t> m_drrActive;   //!< DRR list of active classes
+  std::vector<bool> m_drrIsActive;   //!< Whether each class is in the DRR active list
+  std::vector<uint32_t> m_deficits;  //!< DRR deficit of each class
   static Ptr<Packet> default_packet; //!< default packet to use for timer events
 
   TracedValue<uint32_t> m_p4Var1; //!< 1st traced P4 variable
@@ -160,6 +394,10 @@ private:
   TracedValue<uint32_t> m_p4Var3; //!< 3rd traced P4 variable
   TracedValue<uint32_t> m_p4Var4; //!< 4th traced P4 variable
 
+  std::vector<TracedField> m_tracedFields;        //!< Fields listed in TracedFields
+  std::vector<uint32_t> m_activeTracedFields;     //!< Indices of the fields with a sink
+  std::vector<std::pair<uint32_t, uint64_t> > m_changedFields; //!< Scratch list of (field, old value)
+
 };
 
 } // namespace ns3
@@ -0,0 +1,226 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Copyright (c) 2018 Stanford University
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Author: Stephen Ibanez <sibanez@stanford.edu>
+ */
+
+#include "ns3/log.h"
+#include "ns3/object-factory.h"
+#include "ns3/pieo-queue.h"
+#include "ns3/simulator.h"
+#include "pieo-queue-disc.h"
+
+namespace ns3 {
+
+NS_LOG_COMPONENT_DEFINE ("PieoQueueDisc");
+
+NS_OBJECT_ENSURE_REGISTERED (PieoQueueDisc);
+
+TypeId PieoQueueDisc::GetTypeId (void)
+{
+  static TypeId tid = TypeId ("ns3::PieoQueueDisc")
+    .SetParent<QueueDisc> ()
+    .SetGroupName ("TrafficControl")
+    .AddConstructor<PieoQueueDisc> ()
+    .AddAttribute ("MaxSize",
+                   "The maximum number of packets or bytes accepted by this queue disc.",
+                   QueueSizeValue (QueueSize ("1000p")),
+                   MakeQueueSizeAccessor (&QueueDisc::SetMaxSize,
+                                          &QueueDisc::GetMaxSize),
+                   MakeQueueSizeChecker ())
+  ;
+  return tid;
+}
+
+PieoQueueDisc::PieoQueueDisc ()
+  : QueueDisc (QueueDiscSizePolicy::SINGLE_INTERNAL_QUEUE)
+{
+  NS_LOG_FUNCTION (this);
+}
+
+PieoQueueDisc::~PieoQueueDisc ()
+{
+  NS_LOG_FUNCTION (this);
+}
+
+void
+PieoQueueDisc::DoDispose (void)
+{
+  NS_LOG_FUNCTION (this);
+  Simulator::Cancel (m_wakeUpEvent);
+  m_eligibility = MakeNullCallback<Time, Ptr<const QueueDiscItem> > ();
+  QueueDisc::DoDispose ();
+}
+
+void
+PieoQueueDisc::SetEligibilityCallback (EligibilityCallback eligibility)
+{
+  NS_LOG_FUNCTION (this);
+  m_eligibility = eligibility;
+}
+
+bool
+PieoQueueDisc::DoEnqueue (Ptr<QueueDiscItem> item)
+{
+  NS_LOG_FUNCTION (this << item);
+
+  if (GetCurrentSize () + item > GetMaxSize ())
+    {
+      NS_LOG_LOGIC ("Queue disc limit exceeded -- dropping packet");
+      DropBeforeEnqueue (item, LIMIT_EXCEEDED_DROP);
+      return false;
+    }
+
+  // Without a packet filter, the rank already stamped on the packet
+  // (e.g., by a parent P4QueueDisc) is used
+  if (GetNPacketFilters () > 0)
+    {
+      int32_t ret = Classify (item);
+      uint64_t rank = 0; // default rank
+
+      if (ret == PacketFilter::PF_NO_MATCH)
+        {
+          NS_LOG_DEBUG ("No filter has been able to classify this packet, using rank 0.");
+        }
+      else
+        {
+          NS_LOG_DEBUG ("Packet filter returned " << ret);
+          // sign extend, so that negative ranks order before 0
+          rank = static_cast<uint64_t> (static_cast<int64_t> (ret));
+        }
+
+      item->SetRank (rank);
+    }
+
+  Time eligible = (m_eligibility.IsNull () ? Simulator::Now () : m_eligibility (item));
+  NS_LOG_DEBUG ("Packet of rank " << item->GetRank () << " eligible at " << eligible);
+
+  bool retval = StaticCast<PieoQueue<QueueDiscItem> > (GetInternalQueue (0))->Enqueue (item, eligible);
+
+  // If PieoQueue::Enqueue fails, QueueDisc::DropBeforeEnqueue is called by the
+  // internal queue because QueueDisc::AddInternalQueue sets the trace callback
+
+  if (!retval)
+    {
+      NS_LOG_WARN ("Packet enqueue failed. Check the size of the internal queue");
+    }
+
+  return retval;
+}
+
+Ptr<QueueDiscItem>
+PieoQueueDisc::DoDequeue (void)
+{
+  NS_LOG_FUNCTION (this);
+
+  Ptr<QueueDiscItem> item = GetInternalQueue (0)->Dequeue ();
+
+  if (item == 0 && !GetInternalQueue (0)->IsEmpty ())
+    {
+      NS_LOG_LOGIC ("No eligible packet");
+      ScheduleWakeUp ();
+    }
+
+  return item;
+}
+
+Ptr<const QueueDiscItem>
+PieoQueueDisc::DoPeek (void)
+{
+  NS_LOG_FUNCTION (this);
+
+  Ptr<const QueueDiscItem> item = GetInternalQueue (0)->Peek ();
+
+  // a parent queue disc may only peek before deciding to dequeue
+  if (item == 0 && !GetInternalQueue (0)->IsEmpty ())
+    {
+      NS_LOG_LOGIC ("No eligible packet");
+      ScheduleWakeUp ();
+    }
+
+  return item;
+}
+
+void
+PieoQueueDisc::ScheduleWakeUp (void)
+{
+  NS_LOG_FUNCTION (this);
+
+  Time next = StaticCast<PieoQueue<QueueDiscItem> > (GetInternalQueue (0))->GetNextEligibleTime ();
+  Time delay = next - Simulator::Now ();
+
+  if (m_wakeUpEvent.IsRunning () && Simulator::GetDelayLeft (m_wakeUpEvent) <= delay)
+    {
+      return;
+    }
+
+  NS_LOG_LOGIC ("Waking up at " << next);
+  Simulator::Cancel (m_wakeUpEvent);
+  m_wakeUpEvent = Simulator::Schedule (delay, &PieoQueueDisc::WakeUp, this);
+}
+
+void
+PieoQueueDisc::WakeUp (void)
+{
+  NS_LOG_FUNCTION (this);
+
+  // the eligible packets may be sent now
+  RunRoot ();
+}
+
+bool
+PieoQueueDisc::CheckConfig (void)
+{
+  NS_LOG_FUNCTION (this);
+  if (GetNQueueDiscClasses () > 0)
+    {
+      NS_LOG_ERROR ("PieoQueueDisc cannot have classes");
+      return false;
+    }
+
+  if (GetNPacketFilters () > 1)
+    {
+      NS_LOG_ERROR ("PieoQueueDisc needs at most one packet filter");
+      return false;
+    }
+
+  if (GetNInternalQueues () == 0)
+    {
+      // create one PieoQueue with GetMaxSize() packets or bytes
+      ObjectFactory factory;
+      factory.SetTypeId ("ns3::PieoQueue<QueueDiscItem>");
+      factory.Set ("MaxSize", QueueSizeValue (GetMaxSize ()));
+      AddInternalQueue (factory.Create<InternalQueue> ());
+    }
+
+  if (GetNInternalQueues () != 1
+      || DynamicCast<PieoQueue<QueueDiscItem> > (GetInternalQueue (0)) == 0)
+    {
+      NS_LOG_ERROR ("PieoQueueDisc needs 1 internal PIEO queue");
+      return false;
+    }
+
+  return true;
+}
+
+void
+PieoQueueDisc::InitializeParams (void)
+{
+  NS_LOG_FUNCTION (this);
+}
+
+} // namespace ns3
@@ -0,0 +1,105 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Copyright (c) 2018 Stanford University
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Author: Stephen Ibanez <sibanez@stanford.edu>
+ */
+
+#ifndef PIEO_H
+#define PIEO_H
+
+#include "ns3/queue-disc.h"
+#include "ns3/nstime.h"
+#include "ns3/event-id.h"
+
+namespace ns3 {
+
+/**
+ * \ingroup traffic-control
+ *
+ * A push-in, extract-out (PIEO) queue disc. Like a PIFO, every packet is
+ * given a rank by the packet filter of the queue disc (or, without filter,
+ * the priority already stamped on the packet is used). Every packet is also
+ * given an eligibility time by the eligibility callback, and the packet
+ * dequeued is the one with the lowest rank among the packets whose
+ * eligibility time has passed, which expresses shaping and pacing policies
+ * along with the scheduling policy. Without eligibility callback, packets
+ * are eligible on arrival and the queue disc behaves as a PIFO.
+ *
+ * The queue disc is non work-conserving: when it holds packets but none of
+ * them is eligible, a wake-up is scheduled at the earliest eligibility time,
+ * which restarts the queue disc if it is installed on a device.
+ *
+ * Uses one internal PieoQueue (see PieoEngine).
+ */
+class PieoQueueDisc : public QueueDisc {
+public:
+  /**
+   * \brief Get the type ID.
+   * \return the object TypeId
+   */
+  static TypeId GetTypeId (void);
+  /**
+   * \brief PieoQueueDisc constructor
+   *
+   * Creates a PIEO queue with a depth of 1000 packets by default
+   */
+  PieoQueueDisc ();
+
+  virtual ~PieoQueueDisc();
+
+  /**
+   * \brief Callback returning the time from which a packet may be dequeued
+   */
+  typedef Callback<Time, Ptr<const QueueDiscItem> > EligibilityCallback;
+
+  /**
+   * \brief Set the callback computing the eligibility time of the packets
+   * \param eligibility the callback
+   */
+  void SetEligibilityCallback (EligibilityCallback eligibility);
+
+  // Reasons for dropping packets
+  static constexpr const char* LIMIT_EXCEEDED_DROP = "Queue disc limit exceeded";  //!< Packet dropped due to queue disc limit exceeded
+
+protected:
+  virtual void DoDispose (void);
+
+private:
+  virtual bool DoEnqueue (Ptr<QueueDiscItem> item);
+  virtual Ptr<QueueDiscItem> DoDequeue (void);
+  virtual Ptr<const QueueDiscItem> DoPeek (void);
+  virtual bool CheckConfig (void);
+  virtual void InitializeParams (void);
+
+  /**
+   * \brief Schedule a wake-up at the earliest eligibility time, unless one
+   *        is already scheduled by then
+   */
+  void ScheduleWakeUp (void);
+
+  /**
+   * \brief Restart the root queue disc once a packet has become eligible
+   */
+  void WakeUp (void);
+
+  EligibilityCallback m_eligibility;  //!< Computes the eligibility time of the packets
+  EventId m_wakeUpEvent;              //!< Restart of the queue disc at the next eligibility time
+};
+
+} // namespace ns3
+
+#endif /* PIEO_H */
@@ -19,12 +19,22 @@
  */
 
 #include "ns3/log.h"
+#include "ns3/abort.h"
+#include "ns3/enum.h"
+#include "ns3/uinteger.h"
+#include "ns3/double.h"
+#include "ns3/boolean.h"
+#include "ns3/string.h"
+#include "ns3/simulator.h"
 #include "ns3/object-factory.h"
 #include "ns3/queue.h"
 #include "ns3/prio-queue.h"
 #include "ns3/net-device-queue-interface.h"
 #include "ns3/socket.h"
 #include "pifo-queue-disc.h"
+#include "rank-filter.h"
+#include <algorithm>
+#include <vector>
 
 namespace ns3 {
 
@@ -39,17 +49,99 @@ TypeId PifoQueueDisc::GetTypeId (void)
     .SetGroupName ("TrafficControl")
     .AddConstructor<PifoQueueDisc> ()
     .AddAttribute ("MaxSize",
-                   "The maximum number of packets accepted by this queue disc.",
+                   "The maximum number of packets or bytes accepted by this queue disc.",
                    QueueSizeValue (QueueSize ("1000p")),
                    MakeQueueSizeAccessor (&QueueDisc::SetMaxSize,
                                           &QueueDisc::GetMaxSize),
                    MakeQueueSizeChecker ())
+    .AddAttribute ("Engine",
+                   "The data structure of the internal priority queue",
+                   EnumValue (DARY_HEAP_ENGINE),
+                   MakeEnumAccessor (&PifoQueueDisc::m_engineType),
+                   MakeEnumChecker (DARY_HEAP_ENGINE, "DaryHeap",
+                                    HEAP_ENGINE, "Heap",
+                                    MIN_MAX_HEAP_ENGINE, "MinMaxHeap",
+                                    SORTED_ARRAY_ENGINE, "SortedArray",
+                                    CALENDAR_ENGINE, "Calendar",
+                                    SP_PIFO_ENGINE, "SpPifo",
+                                    AIFO_ENGINE, "Aifo",
+                                    FLOW_ENGINE, "Flow",
+                                    INDEXED_ENGINE, "Indexed"))
+    .AddAttribute ("CalendarBuckets",
+                   "The number of buckets of the calendar engine (rounded up to a power of 2)",
+                   UintegerValue (4096),
+                   MakeUintegerAccessor (&PifoQueueDisc::m_calendarBuckets),
+                   MakeUintegerChecker<uint32_t> (1))
+    .AddAttribute ("CalendarGranularity",
+                   "The number of consecutive ranks sharing a bucket of the calendar engine",
+                   UintegerValue (1),
+                   MakeUintegerAccessor (&PifoQueueDisc::m_calendarGranularity),
+                   MakeUintegerChecker<uint32_t> (1))
+    .AddAttribute ("SpPifoQueues",
+                   "The number of strict-priority FIFOs of the SP-PIFO engine",
+                   UintegerValue (8),
+                   MakeUintegerAccessor (&PifoQueueDisc::m_spPifoQueues),
+                   MakeUintegerChecker<uint32_t> (1, 64))
+    .AddAttribute ("AifoWindow",
+                   "The number of recent ranks the AIFO engine compares the arriving rank with",
+                   UintegerValue (64),
+                   MakeUintegerAccessor (&PifoQueueDisc::m_aifoWindow),
+                   MakeUintegerChecker<uint32_t> (1))
+    .AddAttribute ("AifoHeadroom",
+                   "The burst headroom of the AIFO engine",
+                   DoubleValue (0.1),
+                   MakeDoubleAccessor (&PifoQueueDisc::m_aifoHeadroom),
+                   MakeDoubleChecker<double> (0, 0.99))
+    .AddAttribute ("OverflowPolicy",
+                   "The policy applied to the packets arriving at a full queue disc",
+                   EnumValue (DROP_ARRIVAL),
+                   MakeEnumAccessor (&PifoQueueDisc::m_overflowPolicy),
+                   MakeEnumChecker (DROP_ARRIVAL, "DropArrival",
+                                    DROP_WORST, "DropWorst"))
+    .AddAttribute ("EnableRankMonitor",
+                   "Whether to monitor the ranks of the packets",
+                   BooleanValue (false),
+                   MakeBooleanAccessor (&PifoQueueDisc::m_enableRankMonitor),
+                   MakeBooleanChecker ())
+    .AddAttribute ("RankBands",
+                   "The number of rank bands the occupancy is monitored for",
+                   UintegerValue (8),
+                   MakeUintegerAccessor (&PifoQueueDisc::m_rankBands),
+                   MakeUintegerChecker<uint32_t> (1))
+    .AddAttribute ("RankBandWidth",
+                   "The number of consecutive ranks in a rank band",
+                   UintegerValue (1),
+                   MakeUintegerAccessor (&PifoQueueDisc::m_rankBandWidth),
+                   MakeUintegerChecker<uint64_t> (1))
+    .AddAttribute ("RankSampleInterval",
+                   "The time between rank samples",
+                   TimeValue (MilliSeconds (0)), // default disabled
+                   MakeTimeAccessor (&PifoQueueDisc::m_rankSampleInterval),
+                   MakeTimeChecker ())
+    .AddAttribute ("RankDumpFile",
+                   "The file the rank samples are written to",
+                   StringValue (""),
+                   MakeStringAccessor (&PifoQueueDisc::m_rankDumpFile),
+                   MakeStringChecker ())
+    .AddTraceSource ("RankInversion",
+                     "A dequeued packet ranked after a queued packet",
+                     MakeTraceSourceAccessor (&PifoQueueDisc::m_rankInversionTrace),
+                     "ns3::PifoQueueDisc::RankInversionTracedCallback")
+    .AddTraceSource ("RankViolation",
+                     "An enqueued packet ranked lower than the previous packet of its flow "
+                     "with the Flow engine",
+                     MakeTraceSourceAccessor (&PifoQueueDisc::m_rankViolationTrace),
+                     "ns3::QueueDiscItem::TracedCallback")
+    .AddTraceSource ("RankSample",
+                     "The rank statistics, sampled every RankSampleInterval",
+                     MakeTraceSourceAccessor (&PifoQueueDisc::m_rankSampleTrace),
+                     "ns3::PifoQueueDisc::RankSampleTracedCallback")
   ;
   return tid;
 }
 
 PifoQueueDisc::PifoQueueDisc ()
-  : QueueDisc (QueueDiscSizePolicy::SINGLE_INTERNAL_PRIO_QUEUE, QueueSizeUnit::PACKETS)
+  : QueueDisc (QueueDiscSizePolicy::SINGLE_INTERNAL_PRIO_QUEUE)
 {
   NS_LOG_FUNCTION (this);
 }
@@ -59,42 +151,217 @@ PifoQueueDisc::~PifoQueueDisc ()
   NS_LOG_FUNCTION (this);
 }
 
+void
+PifoQueueDisc::DoDispose (void)
+{
+  NS_LOG_FUNCTION (this);
+  Simulator::Cancel (m_rankSampleEvent);
+  m_rankDumpWriter.Close ();
+  m_rankMonitor.reset ();
+  m_rankFilter = 0;
+  QueueDisc::DoDispose ();
+}
+
+uint64_t
+PifoQueueDisc::GetNRankInversions (void) const
+{
+  return GetInternalPrioQueue (0)->GetNRankInversions ();
+}
+
+uint64_t
+PifoQueueDisc::GetRankInversionMagnitude (void) const
+{
+  return GetInternalPrioQueue (0)->GetRankInversionMagnitude ();
+}
+
+uint64_t
+PifoQueueDisc::GetNRankViolations (void) const
+{
+  return GetInternalPrioQueue (0)->GetNRankViolations ();
+}
+
+bool
+PifoQueueDisc::DropFlowHead (uint32_t flowHash)
+{
+  NS_LOG_FUNCTION (this << flowHash);
+  NS_ABORT_MSG_UNLESS (GetInternalPrioQueue (0)->HasFlows (), "DropFlowHead needs the Indexed engine");
+
+  Ptr<QueueDiscItem> item = GetInternalPrioQueue (0)->DequeueFlowHead (flowHash);
+  if (item == 0)
+    {
+      return false;
+    }
+  if (m_rankMonitor)
+    {
+      m_rankMonitor->NotifyRemove (item->GetRank (), item->GetSize ());
+    }
+  DropAfterDequeue (item, FLOW_HEAD_DROP);
+  return true;
+}
+
+uint32_t
+PifoQueueDisc::DropFlow (uint32_t flowHash)
+{
+  NS_LOG_FUNCTION (this << flowHash);
+  NS_ABORT_MSG_UNLESS (GetInternalPrioQueue (0)->HasFlows (), "DropFlow needs the Indexed engine");
+
+  std::vector<Ptr<QueueDiscItem> > removed;
+  uint32_t count = GetInternalPrioQueue (0)->DequeueFlow (flowHash, removed);
+  for (Ptr<QueueDiscItem> item : removed)
+    {
+      if (m_rankMonitor)
+        {
+          m_rankMonitor->NotifyRemove (item->GetRank (), item->GetSize ());
+        }
+      DropAfterDequeue (item, FLOW_DROP);
+    }
+  return count;
+}
+
+uint32_t
+PifoQueueDisc::DropAbove (uint64_t rank)
+{
+  NS_LOG_FUNCTION (this << rank);
+  NS_ABORT_MSG_UNLESS (GetInternalPrioQueue (0)->HasWorst (),
+                       "DropAbove needs the MinMaxHeap, SortedArray or Indexed engine");
+
+  std::vector<Ptr<QueueDiscItem> > removed;
+  uint32_t count = GetInternalPrioQueue (0)->DequeueAbove (rank, removed);
+  for (Ptr<QueueDiscItem> item : removed)
+    {
+      if (m_rankMonitor)
+        {
+          m_rankMonitor->NotifyRemove (item->GetRank (), item->GetSize ());
+        }
+      DropAfterDequeue (item, RANK_THRESHOLD_DROP);
+    }
+  return count;
+}
+
+const RankMonitor *
+PifoQueueDisc::GetRankMonitor (void) const
+{
+  return m_rankMonitor.get ();
+}
+
 bool
 PifoQueueDisc::DoEnqueue (Ptr<QueueDiscItem> item)
 {
   NS_LOG_FUNCTION (this << item);
 
-  if (GetCurrentSize () >= GetMaxSize ())
+  bool full = (GetCurrentSize () + item > GetMaxSize ());
+  bool ranked = false;
+
+  if (full && m_overflowPolicy == DROP_ARRIVAL)
     {
       NS_LOG_LOGIC ("Queue disc limit exceeded -- dropping packet");
       DropBeforeEnqueue (item, LIMIT_EXCEEDED_DROP);
       return false;
     }
 
-  // Make sure to compute rank after making the drop decision otherwise
-  // the state in the rank computation can become out of sync
-  int32_t ret = Classify (item);
-  int32_t rank = 0; // default rank
+  // Without a packet filter, the rank already stamped on the packet
+  // (e.g., by a parent P4QueueDisc) is used
+  if (GetNPacketFilters () > 0)
+    {
+      // Make sure to compute rank after making the drop decision otherwise
+      // the state in the rank computation can become out of sync (the
+      // DropWorst policy needs the rank of the arriving packet, though, so
+      // the state of the rank filter is rolled back if the packet is dropped
+      // afterwards)
+      uint64_t rank = 0; // default rank
+
+      if (m_rankFilter != 0 && m_rankFilter->ClassifyRank (item, rank))
+        {
+          NS_LOG_DEBUG ("Rank filter returned " << rank);
+          ranked = true;
+        }
+      else
+        {
+          int32_t ret = Classify (item);
+
+          if (ret == PacketFilter::PF_NO_MATCH)
+            {
+              NS_LOG_DEBUG ("No filter has been able to classify this packet, using rank 0.");
+            }
+          else
+            {
+              NS_LOG_DEBUG ("Packet filter returned " << ret);
+              // sign extend, so that negative ranks order before 0
+              rank = static_cast<uint64_t> (static_cast<int64_t> (ret));
+            }
+        }
+
+      item->SetRank (rank);
+    }
 
-  if (ret == PacketFilter::PF_NO_MATCH)
+  if (!GetInternalPrioQueue (0)->Admit (item))
     {
-      NS_LOG_DEBUG ("No filter has been able to classify this packet, using priority 0.");
+      NS_LOG_LOGIC ("Rejected by the engine admission control -- dropping packet");
+      if (ranked)
+        {
+          m_rankFilter->Rollback ();
+        }
+      DropBeforeEnqueue (item, ADMISSION_DROP);
+      return false;
     }
-  else
+
+  if (full)
     {
-      NS_LOG_DEBUG ("Packet filter returned " << ret);
-      rank = ret;
+      // Evict the packets to dequeue last until the arriving packet fits,
+      // provided that it ranks before all of them. Among packets of equal
+      // rank, the arriving packet ranks last. The packets peeked or
+      // requeued count against the limit but are out of the internal queue
+      Ptr<InternalPrioQueue> queue = GetInternalPrioQueue (0);
+      uint32_t outside = (GetMaxSize ().GetUnit () == QueueSizeUnit::BYTES
+                          ? GetNBytes () - queue->GetNBytes ()
+                          : GetNPackets () - queue->GetNPackets ());
+      QueueSize limit (GetMaxSize ().GetUnit (),
+                       GetMaxSize ().GetValue () - std::min (outside, GetMaxSize ().GetValue ()));
+      std::vector<Ptr<QueueDiscItem> > evicted;
+      if (!queue->MakeRoom (item, limit, evicted))
+        {
+          NS_LOG_LOGIC ("Queue disc limit exceeded -- dropping packet");
+          if (ranked)
+            {
+              m_rankFilter->Rollback ();
+            }
+          DropBeforeEnqueue (item, LIMIT_EXCEEDED_DROP);
+          return false;
+        }
+      for (Ptr<QueueDiscItem> worst : evicted)
+        {
+          NS_LOG_LOGIC ("Queue disc limit exceeded -- evicting packet of rank " << worst->GetRank ());
+          if (m_rankMonitor)
+            {
+              m_rankMonitor->NotifyRemove (worst->GetRank (), worst->GetSize ());
+            }
+          DropAfterDequeue (worst, EVICTED_DROP);
+        }
     }
 
-  item->SetPriority(rank);
+  uint64_t nViolations = GetInternalPrioQueue (0)->GetNRankViolations ();
   bool retval = GetInternalPrioQueue (0)->Enqueue (item);
 
+  if (GetInternalPrioQueue (0)->GetNRankViolations () != nViolations)
+    {
+      NS_LOG_LOGIC ("Rank " << item->GetRank () << " is lower than the previous rank of the flow");
+      m_rankViolationTrace (item);
+    }
+
   // If PrioQueue::Enqueue fails, QueueDisc::DropBeforeEnqueue is called by the
   // internal prio queue because QueueDisc::AddInternalPrioQueue sets the trace callback
 
   if (!retval)
     {
       NS_LOG_WARN ("Packet enqueue failed. Check the size of the internal priority queue");
+      if (ranked)
+        {
+          m_rankFilter->Rollback ();
+        }
+    }
+  else if (m_rankMonitor)
+    {
+      m_rankMonitor->NotifyEnqueue (item->GetRank (), item->GetSize ());
     }
 
   NS_LOG_LOGIC ("Number packets in priority queue::" << GetInternalPrioQueue (0)->GetNPackets ());
@@ -113,6 +380,18 @@ PifoQueueDisc::DoDequeue (void)
     {
       NS_LOG_LOGIC ("Popped from priority queue: " << item);
       NS_LOG_LOGIC ("Number packets priority queue: " << GetInternalPrioQueue (0)->GetNPackets ());
+      if (m_rankFilter != 0)
+        {
+          m_rankFilter->NotifyDequeue (item);
+        }
+      if (m_rankMonitor)
+        {
+          uint64_t magnitude = m_rankMonitor->NotifyDequeue (item->GetRank (), item->GetSize ());
+          if (magnitude != 0)
+            {
+              m_rankInversionTrace (item, magnitude);
+            }
+        }
       return item;
     }
   
@@ -120,6 +399,39 @@ PifoQueueDisc::DoDequeue (void)
   return item;
 }
 
+uint32_t
+PifoQueueDisc::DoDequeueBatch (uint32_t maxPackets, uint32_t maxBytes,
+                               std::vector<Ptr<QueueDiscItem> > &items)
+{
+  NS_LOG_FUNCTION (this << maxPackets << maxBytes);
+
+  std::size_t first = items.size ();
+  uint32_t n = GetInternalPrioQueue (0)->DequeueBatch (maxPackets, maxBytes, items);
+
+  NS_LOG_LOGIC ("Popped " << n << " packets from priority queue");
+  NS_LOG_LOGIC ("Number packets priority queue: " << GetInternalPrioQueue (0)->GetNPackets ());
+
+  if (m_rankFilter != 0)
+    {
+      for (std::size_t i = first; i < items.size (); i++)
+        {
+          m_rankFilter->NotifyDequeue (items[i]);
+        }
+    }
+  if (m_rankMonitor)
+    {
+      for (std::size_t i = first; i < items.size (); i++)
+        {
+          uint64_t magnitude = m_rankMonitor->NotifyDequeue (items[i]->GetRank (), items[i]->GetSize ());
+          if (magnitude != 0)
+            {
+              m_rankInversionTrace (items[i], magnitude);
+            }
+        }
+    }
+  return n;
+}
+
 Ptr<const QueueDiscItem>
 PifoQueueDisc::DoPeek (void)
 {
@@ -148,18 +460,24 @@ PifoQueueDisc::CheckConfig (void)
       return false;
     }
 
-  if (GetNPacketFilters () != 1)
+  if (GetNPacketFilters () > 1)
     {
-      NS_LOG_ERROR ("PifoQueueDisc needs one packet filter");
+      NS_LOG_ERROR ("PifoQueueDisc needs at most one packet filter");
       return false;
     }
 
   if (GetNInternalPrioQueues () == 0)
     {
-      // create one PrioQueue with GetMaxSize() packets
+      // create one PrioQueue with GetMaxSize() packets or bytes
       ObjectFactory factory;
       factory.SetTypeId ("ns3::PrioQueue<QueueDiscItem>");
       factory.Set ("MaxSize", QueueSizeValue (GetMaxSize ()));
+      factory.Set ("Engine", EnumValue (m_engineType));
+      factory.Set ("CalendarBuckets", UintegerValue (m_calendarBuckets));
+      factory.Set ("CalendarGranularity", UintegerValue (m_calendarGranularity));
+      factory.Set ("SpPifoQueues", UintegerValue (m_spPifoQueues));
+      factory.Set ("AifoWindow", UintegerValue (m_aifoWindow));
+      factory.Set ("AifoHeadroom", DoubleValue (m_aifoHeadroom));
       AddInternalPrioQueue (factory.Create<InternalPrioQueue> ());
     }
 
@@ -169,15 +487,15 @@ PifoQueueDisc::CheckConfig (void)
       return false;
     }
 
-  if (GetInternalPrioQueue (0)-> GetMaxSize ().GetUnit () != QueueSizeUnit::PACKETS)
+  if (GetInternalPrioQueue (0)->GetMaxSize () < GetMaxSize ())
     {
-      NS_LOG_ERROR ("PifoQueueDisc needs 1 internal priority queue operating in packet mode");
+      NS_LOG_ERROR ("The capacity of the internal priority queue is less than the queue disc capacity");
       return false;
     }
 
-  if (GetInternalPrioQueue (0)->GetMaxSize () < GetMaxSize ())
+  if (m_overflowPolicy == DROP_WORST && !GetInternalPrioQueue (0)->HasWorst ())
     {
-      NS_LOG_ERROR ("The capacity of the internal priority queue is less than the queue disc capacity");
+      NS_LOG_ERROR ("The DropWorst overflow policy needs the MinMaxHeap, SortedArray or Indexed engine");
       return false;
     }
 
@@ -188,6 +506,52 @@ void
 PifoQueueDisc::InitializeParams (void)
 {
   NS_LOG_FUNCTION (this);
+
+  // fair queueing rank filters track the rank of the dequeued packets;
+  // they are notified by DoDequeue rather than through the Dequeue trace
+  // source, which also fires for the evicted and removed packets
+  m_rankFilter = (GetNPacketFilters () ? DynamicCast<RankFilter> (GetPacketFilter (0)) : 0);
+
+  if (m_enableRankMonitor && !m_rankMonitor)
+    {
+      m_rankMonitor.reset (new RankMonitor (m_rankBands, m_rankBandWidth));
+
+      if (m_rankDumpFile != "" && !m_rankSampleInterval.IsZero ())
+        {
+          m_rankDumpWriter.AddColumn ("rank_histogram", RankMonitor::N_BUCKETS);
+          m_rankDumpWriter.AddColumn ("rank_inversions", 2);
+          m_rankDumpWriter.AddColumn ("band_packets", m_rankBands);
+          m_rankDumpWriter.AddColumn ("band_bytes", m_rankBands);
+          if (!m_rankDumpWriter.Open (m_rankDumpFile))
+            {
+              NS_FATAL_ERROR ("Cannot open the rank dump file " << m_rankDumpFile);
+            }
+        }
+      if (!m_rankSampleInterval.IsZero ())
+        {
+          m_rankSampleEvent = Simulator::Schedule (m_rankSampleInterval, &PifoQueueDisc::SampleRanks, this);
+        }
+    }
+}
+
+void
+PifoQueueDisc::SampleRanks (void)
+{
+  NS_LOG_FUNCTION (this);
+
+  m_rankSampleTrace (*m_rankMonitor);
+
+  if (m_rankDumpWriter.IsOpen ())
+    {
+      m_rankDumpWriter.BeginSample (Simulator::Now ());
+      m_rankDumpWriter.WriteColumn (m_rankMonitor->GetHistogram ());
+      m_rankDumpValues.assign ({m_rankMonitor->GetNInversions (), m_rankMonitor->GetInversionMagnitude ()});
+      m_rankDumpWriter.WriteColumn (m_rankDumpValues);
+      m_rankDumpWriter.WriteColumn (m_rankMonitor->GetBandPackets ());
+      m_rankDumpWriter.WriteColumn (m_rankMonitor->GetBandBytes ());
+    }
+
+  m_rankSampleEvent = Simulator::Schedule (m_rankSampleInterval, &PifoQueueDisc::SampleRanks, this);
 }
 
 } // namespace ns3
@@ -22,17 +22,77 @@
 #define PIFO_H
 
 #include "ns3/queue-disc.h"
+#include "ns3/pifo-engine.h"
+#include "ns3/traced-callback.h"
+#include "ns3/event-id.h"
+#include "rank-monitor.h"
+#include "columnar-dump-writer.h"
+#include <memory>
 
 namespace ns3 {
 
+class RankFilter;
+
 /**
  * \ingroup traffic-control
  *
  * A single PIFO queue disc. Has one associated filter which assigns a
  * rank to each packet. The rank determines the packet's priority (lower
- * rank = higher priority).
+ * rank = higher priority). If no filter is provided, the rank already
+ * stamped on the packet is used, which allows a parent queue disc (e.g.,
+ * P4QueueDisc) to compute the rank. The rank filters (see RankFilter)
+ * implement common scheduling policies; the queue disc reads their 64-bit
+ * ranks through RankFilter::ClassifyRank and feeds them the packets it
+ * dequeues. The classification result of other filters is sign extended,
+ * so that negative ranks order before 0. Ranks are compared with serial
+ * number arithmetic (see QueueDiscItem::GetRank).
+ *
+ * Uses one internal priority queue, built on the PIFO engine selected by
+ * the Engine attribute. The SP-PIFO and AIFO engines trade exactness for
+ * O(1) cost per packet; the rank inversions they cause are counted (see
+ * GetNRankInversions). The AIFO engine also decides which packets to admit,
+ * after their rank is computed; rejected packets are dropped as
+ * ADMISSION_DROP.
+ *
+ * The Flow engine keeps a FIFO per active flow (told apart by the flow hash
+ * of the packets) and only heaps the flow heads, which is exact when the
+ * ranks do not decrease within a flow, as with the fair queueing rank
+ * filters, and costs O(log n) in the number n of active flows. A packet
+ * ranked lower than the previous packet of its flow is reported through
+ * the RankViolation trace source and counted (see GetNRankViolations); it
+ * is still served after that packet, and the resulting rank inversions are
+ * counted too.
+ *
+ * The MaxSize attribute limits the queue disc in packets or in bytes; in
+ * byte mode, the occupancy is the exact sum of the sizes of the queued
+ * packets, which the internal priority queue accounts for.
+ *
+ * When the queue disc is full, the OverflowPolicy attribute selects whether
+ * the arriving packet is dropped (the default) or the packets with the
+ * highest ranks are evicted until the arriving packet fits (several small
+ * packets may be evicted for a large one in byte mode), provided that the
+ * arriving packet has a lower rank than all of them; otherwise, no packet
+ * is evicted and the arriving packet is dropped. Evicted packets are
+ * reported as dropped after dequeue. Eviction needs an engine giving access to the worst rank
+ * (MinMaxHeap, SortedArray or Indexed), and the rank of the arriving packet
+ * is computed before the admission decision.
+ *
+ * The Indexed engine also keeps the queued packets of each flow in a list
+ * and the position of each packet in a min-heap and a max-heap, so that the
+ * oldest packet of a flow, all the packets of a flow or all the packets
+ * ranking after a threshold can be dropped at O(log n) cost per packet (see
+ * DropFlowHead, DropFlow and DropAbove). These packets are reported as
+ * dropped after dequeue, with the FLOW_HEAD_DROP, FLOW_DROP and
+ * RANK_THRESHOLD_DROP reasons.
  *
- * Uses one internal priority queue.
+ * If EnableRankMonitor is set, the ranks of the packets are monitored (see
+ * RankMonitor): the dequeue inversions with respect to an ideal PIFO are
+ * reported through the RankInversion trace source and, every
+ * RankSampleInterval, the rank histogram and the occupancy of the
+ * RankBands bands of RankBandWidth ranks are reported through the
+ * RankSample trace source and written to RankDumpFile, if set (see
+ * ColumnarDumpWriter for the file format). Monitoring is off by default,
+ * in which case it costs a null pointer check per packet.
  *
  */
 class PifoQueueDisc : public QueueDisc {
@@ -51,15 +111,129 @@ public:
 
   virtual ~PifoQueueDisc();
 
+  /**
+   * \brief Get the number of packets dequeued while a packet of lower rank
+   *        was queued, which only approximate engines cause
+   * \return the number of rank inversions
+   */
+  uint64_t GetNRankInversions (void) const;
+
+  /**
+   * \brief Get the sum, over the rank inversions, of the difference between
+   *        the rank of the dequeued packet and the lowest queued rank
+   * \return the total magnitude of the rank inversions
+   */
+  uint64_t GetRankInversionMagnitude (void) const;
+
+  /**
+   * \brief Get the number of packets ranked lower than the previous packet
+   *        of their flow while the Flow engine assumes that ranks do not
+   *        decrease within a flow. Always zero with the other engines
+   * \return the number of rank violations
+   */
+  uint64_t GetNRankViolations (void) const;
+
+  /**
+   * \brief Drop the oldest queued packet of a flow. Needs the Indexed engine
+   * \param flowHash the flow hash of the packet (see QueueDiscItem::GetFlowHash)
+   * \return false if no packet of the flow is queued
+   */
+  bool DropFlowHead (uint32_t flowHash);
+
+  /**
+   * \brief Drop all the queued packets of a flow. Needs the Indexed engine
+   * \param flowHash the flow hash of the packets
+   * \return the number of dropped packets
+   */
+  uint32_t DropFlow (uint32_t flowHash);
+
+  /**
+   * \brief Drop all the queued packets ranking after a given rank. Needs an
+   *        engine giving access to the worst rank (MinMaxHeap, SortedArray
+   *        or Indexed)
+   * \param rank the rank
+   * \return the number of dropped packets
+   */
+  uint32_t DropAbove (uint64_t rank);
+
+  /// Policy applied to the packets arriving at a full queue disc
+  enum OverflowPolicy
+  {
+    DROP_ARRIVAL,  /**< Drop the arriving packet */
+    DROP_WORST     /**< Evict the packets with the highest ranks if they rank after the arriving packet */
+  };
+
+  /**
+   * \brief Get the rank monitor
+   * \return the rank monitor, or a null pointer if monitoring is disabled
+   */
+  const RankMonitor *GetRankMonitor (void) const;
+
+  /**
+   * TracedCallback signature for rank inversions
+   *
+   * \param [in] item the dequeued packet
+   * \param [in] magnitude the difference between its rank and the lowest queued rank
+   */
+  typedef void (* RankInversionTracedCallback) (Ptr<const QueueDiscItem> item, uint64_t magnitude);
+
+  /**
+   * TracedCallback signature for rank samples
+   *
+   * \param [in] monitor the rank monitor
+   */
+  typedef void (* RankSampleTracedCallback) (const RankMonitor &monitor);
+
   // Reasons for dropping packets
   static constexpr const char* LIMIT_EXCEEDED_DROP = "Queue disc limit exceeded";  //!< Packet dropped due to queue disc limit exceeded
+  static constexpr const char* EVICTED_DROP = "Evicted by a packet of lower rank";  //!< Packet evicted to admit a packet of lower rank
+  static constexpr const char* ADMISSION_DROP = "Rejected by the engine admission control";  //!< Packet rejected by an approximate engine (AIFO)
+  static constexpr const char* FLOW_HEAD_DROP = "Oldest packet of its flow";  //!< Packet dropped by DropFlowHead
+  static constexpr const char* FLOW_DROP = "Flow flushed";  //!< Packet dropped by DropFlow
+  static constexpr const char* RANK_THRESHOLD_DROP = "Rank above threshold";  //!< Packet dropped by DropAbove
+
+protected:
+  virtual void DoDispose (void);
 
 private:
   virtual bool DoEnqueue (Ptr<QueueDiscItem> item);
   virtual Ptr<QueueDiscItem> DoDequeue (void);
+  virtual uint32_t DoDequeueBatch (uint32_t maxPackets, uint32_t maxBytes,
+                                   std::vector<Ptr<QueueDiscItem> > &items);
   virtual Ptr<const QueueDiscItem> DoPeek (void);
   virtual bool CheckConfig (void);
   virtual void InitializeParams (void);
+
+  /**
+   * \brief Report the rank statistics and schedule the next sample
+   */
+  void SampleRanks (void);
+
+  PifoEngineType m_engineType;      //!< Engine of the internal priority queue
+  uint32_t m_calendarBuckets;       //!< Number of buckets of the calendar engine
+  uint32_t m_calendarGranularity;   //!< Number of ranks per bucket of the calendar engine
+  uint32_t m_spPifoQueues;          //!< Number of FIFOs of the SP-PIFO engine
+  uint32_t m_aifoWindow;            //!< Number of ranks in the window of the AIFO engine
+  double m_aifoHeadroom;            //!< Burst headroom of the AIFO engine
+  OverflowPolicy m_overflowPolicy;  //!< Policy applied to the packets arriving at a full queue disc
+  Ptr<RankFilter> m_rankFilter;     //!< The first packet filter, if it is a RankFilter
+
+  bool m_enableRankMonitor;                    //!< Whether the ranks are monitored
+  uint32_t m_rankBands;                        //!< Number of rank bands
+  uint64_t m_rankBandWidth;                    //!< Number of ranks per band
+  Time m_rankSampleInterval;                   //!< Time between rank samples
+  std::string m_rankDumpFile;                  //!< File the rank samples are written to
+  std::unique_ptr<RankMonitor> m_rankMonitor;  //!< Rank monitor, null if disabled
+  EventId m_rankSampleEvent;                   //!< Next rank sample
+  ColumnarDumpWriter m_rankDumpWriter;         //!< Writer of the rank dump file
+  std::vector<uint64_t> m_rankDumpValues;      //!< Scratch buffer for the rank dump
+
+  /// Traced callback: fired when a dequeue is a rank inversion
+  TracedCallback<Ptr<const QueueDiscItem>, uint64_t> m_rankInversionTrace;
+  /// Traced callback: fired when an enqueued packet violates the assumption of the engine on ranks
+  TracedCallback<Ptr<const QueueDiscItem> > m_rankViolationTrace;
+  /// Traced callback: fired at each rank sample
+  TracedCallback<const RankMonitor &> m_rankSampleTrace;
 };
 
 } // namespace ns3
@@ -1,7 +1,6 @@
 /* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
 /*
- * Copyright (c) 2007, 2014 University of Washington
- *               2015 Universita' degli Studi di Napoli Federico II
+ * Copyright (c) 2018 Stanford University
  *
  * This program is free software; you can redistribute it and/or modify
  * it under the terms of the GNU General Public License version 2 as
@@ -16,176 +15,383 @@
  * along with this program; if not, write to the Free Software
  * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
  *
- * Authors:  Stefano Avallone <stavallo@unina.it>
- *           Tom Henderson <tomhend@u.washington.edu>
+ * Author: Stephen Ibanez <sibanez@stanford.edu>
  */
 
 #include "ns3/log.h"
+#include "ns3/abort.h"
+#include "ns3/enum.h"
+#include "ns3/uinteger.h"
 #include "ns3/object-factory.h"
-#include "ns3/queue.h"
-#include "ns3/net-device-queue-interface.h"
-#include "ns3/socket.h"
-#include "pfifo-fast-queue-disc.h"
+#include "ns3/prio-queue.h"
+#include "ns3/simulator.h"
+#include "pifo-tree-queue-disc.h"
+#include "rank-filter.h"
 
 namespace ns3 {
 
-NS_LOG_COMPONENT_DEFINE ("PfifoFastQueueDisc");
+NS_LOG_COMPONENT_DEFINE ("PifoTreeQueueDisc");
 
-NS_OBJECT_ENSURE_REGISTERED (PfifoFastQueueDisc);
+NS_OBJECT_ENSURE_REGISTERED (PifoTreeQueueDisc);
 
-TypeId PfifoFastQueueDisc::GetTypeId (void)
+TypeId PifoTreeQueueDisc::GetTypeId (void)
 {
-  static TypeId tid = TypeId ("ns3::PfifoFastQueueDisc")
+  static TypeId tid = TypeId ("ns3::PifoTreeQueueDisc")
     .SetParent<QueueDisc> ()
     .SetGroupName ("TrafficControl")
-    .AddConstructor<PfifoFastQueueDisc> ()
+    .AddConstructor<PifoTreeQueueDisc> ()
     .AddAttribute ("MaxSize",
-                   "The maximum number of packets accepted by this queue disc.",
+                   "The maximum number of packets or bytes accepted by this queue disc.",
                    QueueSizeValue (QueueSize ("1000p")),
                    MakeQueueSizeAccessor (&QueueDisc::SetMaxSize,
                                           &QueueDisc::GetMaxSize),
                    MakeQueueSizeChecker ())
+    .AddAttribute ("Engine",
+                   "The data structure of the PIFOs of the tree",
+                   EnumValue (DARY_HEAP_ENGINE),
+                   MakeEnumAccessor (&PifoTreeQueueDisc::m_engineType),
+                   MakeEnumChecker (DARY_HEAP_ENGINE, "DaryHeap",
+                                    HEAP_ENGINE, "Heap",
+                                    MIN_MAX_HEAP_ENGINE, "MinMaxHeap",
+                                    SORTED_ARRAY_ENGINE, "SortedArray",
+                                    CALENDAR_ENGINE, "Calendar"))
+    .AddAttribute ("CalendarBuckets",
+                   "The number of buckets of the calendar engine (rounded up to a power of 2)",
+                   UintegerValue (4096),
+                   MakeUintegerAccessor (&PifoTreeQueueDisc::m_calendarBuckets),
+                   MakeUintegerChecker<uint32_t> (1))
+    .AddAttribute ("CalendarGranularity",
+                   "The number of consecutive ranks sharing a bucket of the calendar engine",
+                   UintegerValue (1),
+                   MakeUintegerAccessor (&PifoTreeQueueDisc::m_calendarGranularity),
+                   MakeUintegerChecker<uint32_t> (1))
   ;
   return tid;
 }
 
-PfifoFastQueueDisc::PfifoFastQueueDisc ()
-  : QueueDisc (QueueDiscSizePolicy::MULTIPLE_QUEUES, QueueSizeUnit::PACKETS)
+PifoTreeQueueDisc::PifoTreeQueueDisc ()
+  : QueueDisc (QueueDiscSizePolicy::MULTIPLE_QUEUES),
+    m_parent (1, ROOT),
+    m_nChildren (1, 0),
+    m_leafQueue (1, NO_LEAF_QUEUE),
+    m_rankFilters (1),
+    m_wideRankFilters (1),
+    m_shapers (1),
+    m_seq (0)
 {
   NS_LOG_FUNCTION (this);
 }
 
-PfifoFastQueueDisc::~PfifoFastQueueDisc ()
+PifoTreeQueueDisc::~PifoTreeQueueDisc ()
 {
   NS_LOG_FUNCTION (this);
 }
 
-const uint32_t PfifoFastQueueDisc::prio2band[16] = {1, 2, 2, 2, 1, 2, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1};
+void
+PifoTreeQueueDisc::DoDispose (void)
+{
+  NS_LOG_FUNCTION (this);
+  Simulator::Cancel (m_releaseEvent);
+  while (!m_shaped.empty ())
+    {
+      m_shaped.pop ();
+    }
+  m_rankFilters.clear ();
+  m_wideRankFilters.clear ();
+  m_shapers.clear ();
+  m_engines.clear ();
+  QueueDisc::DoDispose ();
+}
+
+uint32_t
+PifoTreeQueueDisc::AddNode (uint32_t parent)
+{
+  NS_LOG_FUNCTION (this << parent);
+  NS_ABORT_MSG_IF (parent >= m_parent.size (), "Node " << parent << " does not exist");
+  NS_ABORT_MSG_IF (!m_engines.empty (), "Cannot add nodes after the queue disc is initialized");
+
+  m_parent.push_back (parent);
+  m_nChildren.push_back (0);
+  m_leafQueue.push_back (NO_LEAF_QUEUE);
+  m_rankFilters.push_back (0);
+  m_wideRankFilters.push_back (0);
+  m_shapers.push_back (ShapingCallback ());
+  m_nChildren[parent]++;
+  return m_parent.size () - 1;
+}
+
+uint32_t
+PifoTreeQueueDisc::GetNNodes (void) const
+{
+  return m_parent.size ();
+}
+
+void
+PifoTreeQueueDisc::SetRankFilter (uint32_t node, Ptr<PacketFilter> filter)
+{
+  NS_LOG_FUNCTION (this << node << filter);
+  NS_ABORT_MSG_IF (node >= m_parent.size (), "Node " << node << " does not exist");
+  m_rankFilters[node] = filter;
+  m_wideRankFilters[node] = DynamicCast<RankFilter> (filter);
+}
+
+void
+PifoTreeQueueDisc::SetShaper (uint32_t node, ShapingCallback shaper)
+{
+  NS_LOG_FUNCTION (this << node);
+  NS_ABORT_MSG_IF (node >= m_parent.size (), "Node " << node << " does not exist");
+  NS_ABORT_MSG_IF (node == ROOT, "The root cannot be shaped");
+  m_shapers[node] = shaper;
+}
+
+uint64_t
+PifoTreeQueueDisc::ComputeRank (uint32_t node, Ptr<QueueDiscItem> item) const
+{
+  if (m_rankFilters[node] == 0)
+    {
+      // leaves use the stamped rank, interior nodes serve their children in
+      // FIFO order
+      return (m_leafQueue[node] != NO_LEAF_QUEUE ? item->GetRank () : 0);
+    }
+
+  uint64_t rank;
+  if (m_wideRankFilters[node] != 0 && m_wideRankFilters[node]->ClassifyRank (item, rank))
+    {
+      return rank;
+    }
+
+  int32_t ret = m_rankFilters[node]->Classify (item);
+  if (ret == PacketFilter::PF_NO_MATCH)
+    {
+      NS_LOG_DEBUG ("The rank filter of node " << node << " did not classify the packet, using rank 0");
+      return 0;
+    }
+  // sign extend, so that negative ranks order before 0
+  return static_cast<uint64_t> (static_cast<int64_t> (ret));
+}
 
 bool
-PfifoFastQueueDisc::DoEnqueue (Ptr<QueueDiscItem> item)
+PifoTreeQueueDisc::DoEnqueue (Ptr<QueueDiscItem> item)
 {
   NS_LOG_FUNCTION (this << item);
 
-  if (GetCurrentSize () >= GetMaxSize ())
+  if (GetCurrentSize () + item > GetMaxSize ())
     {
       NS_LOG_LOGIC ("Queue disc limit exceeded -- dropping packet");
       DropBeforeEnqueue (item, LIMIT_EXCEEDED_DROP);
       return false;
     }
 
-  uint8_t priority = 0;
-  SocketPriorityTag priorityTag;
-  if (item->GetPacket ()->PeekPacketTag (priorityTag))
+  int32_t leaf = ROOT;
+  if (GetNPacketFilters () > 0)
     {
-      priority = priorityTag.GetPriority ();
+      leaf = Classify (item);
+    }
+  if (leaf < 0 || static_cast<uint32_t> (leaf) >= m_parent.size ()
+      || m_leafQueue[leaf] == NO_LEAF_QUEUE)
+    {
+      NS_LOG_LOGIC ("No leaf for the packet -- dropping packet");
+      DropBeforeEnqueue (item, UNCLASSIFIED_DROP);
+      return false;
     }
 
-  uint32_t band = prio2band[priority & 0x0f];
-
-  bool retval = GetInternalQueue (band)->Enqueue (item);
+  item->SetRank (ComputeRank (leaf, item));
+  bool retval = GetInternalPrioQueue (m_leafQueue[leaf])->Enqueue (item);
 
-  // If Queue::Enqueue fails, QueueDisc::DropBeforeEnqueue is called by the
-  // internal queue because QueueDisc::AddInternalQueue sets the trace callback
+  // If PrioQueue::Enqueue fails, QueueDisc::DropBeforeEnqueue is called by the
+  // internal prio queue because QueueDisc::AddInternalPrioQueue sets the trace callback
 
   if (!retval)
     {
-      NS_LOG_WARN ("Packet enqueue failed. Check the size of the internal queues");
+      NS_LOG_WARN ("Packet enqueue failed. Check the size of the internal priority queues");
+      return false;
     }
 
-  NS_LOG_LOGIC ("Number packets band " << band << ": " << GetInternalQueue (band)->GetNPackets ());
-
-  return retval;
+  PushUp (leaf, item, true);
+  return true;
 }
 
-Ptr<QueueDiscItem>
-PfifoFastQueueDisc::DoDequeue (void)
+void
+PifoTreeQueueDisc::PushUp (uint32_t node, Ptr<QueueDiscItem> item, bool shape)
 {
-  NS_LOG_FUNCTION (this);
-
-  Ptr<QueueDiscItem> item;
+  NS_LOG_FUNCTION (this << node << item << shape);
 
-  for (uint32_t i = 0; i < GetNInternalQueues (); i++)
+  while (node != ROOT)
     {
-      if ((item = GetInternalQueue (i)->Dequeue ()) != 0)
+      if (shape && !m_shapers[node].IsNull ())
         {
-          NS_LOG_LOGIC ("Popped from band " << i << ": " << item);
-          NS_LOG_LOGIC ("Number packets band " << i << ": " << GetInternalQueue (i)->GetNPackets ());
-          return item;
+          Time release = m_shapers[node] (item);
+          if (release > Simulator::Now ())
+            {
+              NS_LOG_LOGIC ("Node " << node << " holds the packet until " << release);
+              if (m_shaped.empty () || release < m_shaped.top ().release)
+                {
+                  Simulator::Cancel (m_releaseEvent);
+                  m_releaseEvent = Simulator::Schedule (release - Simulator::Now (),
+                                                        &PifoTreeQueueDisc::Release, this);
+                }
+              m_shaped.push ({release, m_seq++, node, item});
+              return;
+            }
         }
+      shape = true;
+
+      uint32_t parent = m_parent[node];
+      m_engines[parent]->Push ({ComputeRank (parent, item), m_seq++, node});
+      node = parent;
     }
-  
-  NS_LOG_LOGIC ("Queue empty");
-  return item;
 }
 
-Ptr<const QueueDiscItem>
-PfifoFastQueueDisc::DoPeek (void)
+void
+PifoTreeQueueDisc::Release (void)
 {
   NS_LOG_FUNCTION (this);
 
-  Ptr<const QueueDiscItem> item;
+  while (!m_shaped.empty () && m_shaped.top ().release <= Simulator::Now ())
+    {
+      ShapedEntry entry = m_shaped.top ();
+      m_shaped.pop ();
+      PushUp (entry.node, entry.item, false);
+    }
+
+  // a shaper further up the path may have rescheduled the event already
+  Simulator::Cancel (m_releaseEvent);
+  if (!m_shaped.empty ())
+    {
+      m_releaseEvent = Simulator::Schedule (m_shaped.top ().release - Simulator::Now (),
+                                            &PifoTreeQueueDisc::Release, this);
+    }
+
+  // the released packets may be sent now
+  RunRoot ();
+}
 
-  for (uint32_t i = 0; i < GetNInternalQueues (); i++)
+uint32_t
+PifoTreeQueueDisc::WalkDown (bool pop)
+{
+  uint32_t node = ROOT;
+  while (m_leafQueue[node] == NO_LEAF_QUEUE)
     {
-      if ((item = GetInternalQueue (i)->Peek ()) != 0)
+      NodeEngine *engine = m_engines[node].get ();
+      if (engine->Empty ())
+        {
+          return NO_LEAF_QUEUE;
+        }
+      uint32_t child = engine->Top ().item;
+      if (pop)
         {
-          NS_LOG_LOGIC ("Peeked from band " << i << ": " << item);
-          NS_LOG_LOGIC ("Number packets band " << i << ": " << GetInternalQueue (i)->GetNPackets ());
-          return item;
+          // the fair queueing filters track the rank of the entries popped
+          if (m_wideRankFilters[node] != 0)
+            {
+              m_wideRankFilters[node]->NotifyDequeue (engine->Top ().rank);
+            }
+          engine->Pop ();
         }
+      node = child;
+    }
+  return node;
+}
+
+Ptr<QueueDiscItem>
+PifoTreeQueueDisc::DoDequeue (void)
+{
+  NS_LOG_FUNCTION (this);
+
+  uint32_t leaf = WalkDown (true);
+  if (leaf == NO_LEAF_QUEUE)
+    {
+      NS_LOG_LOGIC ("No eligible packet");
+      return 0;
     }
 
-  NS_LOG_LOGIC ("Queue empty");
+  Ptr<QueueDiscItem> item = GetInternalPrioQueue (m_leafQueue[leaf])->Dequeue ();
+  NS_ASSERT_MSG (item != 0, "The references in the tree do not match the packets in leaf " << leaf);
+  if (m_wideRankFilters[leaf] != 0)
+    {
+      m_wideRankFilters[leaf]->NotifyDequeue (item);
+    }
+  NS_LOG_LOGIC ("Popped from leaf " << leaf << ": " << item);
   return item;
 }
 
+Ptr<const QueueDiscItem>
+PifoTreeQueueDisc::DoPeek (void)
+{
+  NS_LOG_FUNCTION (this);
+
+  uint32_t leaf = WalkDown (false);
+  if (leaf == NO_LEAF_QUEUE)
+    {
+      NS_LOG_LOGIC ("No eligible packet");
+      return 0;
+    }
+  return GetInternalPrioQueue (m_leafQueue[leaf])->Peek ();
+}
+
 bool
-PfifoFastQueueDisc::CheckConfig (void)
+PifoTreeQueueDisc::CheckConfig (void)
 {
   NS_LOG_FUNCTION (this);
   if (GetNQueueDiscClasses () > 0)
     {
-      NS_LOG_ERROR ("PfifoFastQueueDisc cannot have classes");
+      NS_LOG_ERROR ("PifoTreeQueueDisc cannot have classes");
       return false;
     }
 
-  if (GetNPacketFilters () != 0)
+  if (GetNInternalQueues () > 0)
     {
-      NS_LOG_ERROR ("PfifoFastQueueDisc needs no packet filter");
+      NS_LOG_ERROR ("PifoTreeQueueDisc cannot have internal queues");
       return false;
     }
 
-  if (GetNInternalQueues () == 0)
+  if (GetNPacketFilters () == 0 && m_parent.size () > 1)
     {
-      // create 3 DropTail queues with GetLimit() packets each
-      ObjectFactory factory;
-      factory.SetTypeId ("ns3::DropTailQueue<QueueDiscItem>");
-      factory.Set ("MaxSize", QueueSizeValue (GetMaxSize ()));
-      AddInternalQueue (factory.Create<InternalQueue> ());
-      AddInternalQueue (factory.Create<InternalQueue> ());
-      AddInternalQueue (factory.Create<InternalQueue> ());
+      NS_LOG_ERROR ("PifoTreeQueueDisc needs a packet filter to select the leaf of the packets");
+      return false;
     }
 
-  if (GetNInternalQueues () != 3)
+  uint32_t nLeaves = 0;
+  for (uint32_t node = 0; node < m_parent.size (); node++)
     {
-      NS_LOG_ERROR ("PfifoFastQueueDisc needs 3 internal queues");
-      return false;
+      if (m_nChildren[node] == 0)
+        {
+          m_leafQueue[node] = nLeaves++;
+        }
     }
 
-  if (GetInternalQueue (0)-> GetMaxSize ().GetUnit () != QueueSizeUnit::PACKETS ||
-      GetInternalQueue (1)-> GetMaxSize ().GetUnit () != QueueSizeUnit::PACKETS ||
-      GetInternalQueue (2)-> GetMaxSize ().GetUnit () != QueueSizeUnit::PACKETS)
+  if (GetNInternalPrioQueues () == 0)
     {
-      NS_LOG_ERROR ("PfifoFastQueueDisc needs 3 internal queues operating in packet mode");
+      // create one PrioQueue with GetMaxSize() packets or bytes per leaf
+      ObjectFactory factory;
+      factory.SetTypeId ("ns3::PrioQueue<QueueDiscItem>");
+      factory.Set ("MaxSize", QueueSizeValue (GetMaxSize ()));
+      factory.Set ("Engine", EnumValue (m_engineType));
+      factory.Set ("CalendarBuckets", UintegerValue (m_calendarBuckets));
+      factory.Set ("CalendarGranularity", UintegerValue (m_calendarGranularity));
+      if (GetMaxSize ().GetUnit () == QueueSizeUnit::PACKETS)
+        {
+          // the packets are spread across the leaves, whose engines grow on demand
+          factory.Set ("ReservedItems", UintegerValue ((GetMaxSize ().GetValue () + nLeaves - 1) / nLeaves));
+        }
+      for (uint32_t i = 0; i < nLeaves; i++)
+        {
+          AddInternalPrioQueue (factory.Create<InternalPrioQueue> ());
+        }
+    }
+
+  if (GetNInternalPrioQueues () != nLeaves)
+    {
+      NS_LOG_ERROR ("PifoTreeQueueDisc needs 1 internal priority queue per leaf");
       return false;
     }
 
-  for (uint8_t i = 0; i < 2; i++)
+  for (uint32_t i = 0; i < nLeaves; i++)
     {
-      if (GetInternalQueue (i)->GetMaxSize () < GetMaxSize ())
+      if (GetInternalPrioQueue (i)->GetMaxSize ().GetUnit () != GetMaxSize ().GetUnit ()
+          || GetInternalPrioQueue (i)->GetMaxSize () < GetMaxSize ())
         {
-          NS_LOG_ERROR ("The capacity of some internal queue(s) is less than the queue disc capacity");
+          NS_LOG_ERROR ("The internal priority queues must operate in the mode of the queue disc"
+                        " and hold at least the queue disc capacity");
           return false;
         }
     }
@@ -194,9 +400,24 @@ PfifoFastQueueDisc::CheckConfig (void)
 }
 
 void
-PfifoFastQueueDisc::InitializeParams (void)
+PifoTreeQueueDisc::InitializeParams (void)
 {
   NS_LOG_FUNCTION (this);
+
+  m_engines.resize (m_parent.size ());
+  for (uint32_t node = 0; node < m_parent.size (); node++)
+    {
+      if (m_leafQueue[node] == NO_LEAF_QUEUE)
+        {
+          // an interior node holds a reference per queued packet of its
+          // subtree, reserve one per child and let the engine grow on demand
+          PifoEngineParams params;
+          params.calendarBuckets = m_calendarBuckets;
+          params.calendarGranularity = m_calendarGranularity;
+          m_engines[node].reset (CreatePifoEngine<uint32_t> (m_engineType, params));
+          m_engines[node]->Reserve (m_nChildren[node]);
+        }
+    }
 }
 
 } // namespace ns3
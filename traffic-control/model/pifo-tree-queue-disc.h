@@ -15,39 +15,65 @@
  * along with this program; if not, write to the Free Software
  * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
  *
- * Author:  Stpehen Ibanez <sibanez@stanford.edu>
+ * Author: Stephen Ibanez <sibanez@stanford.edu>
  */
 
 #ifndef PIFO_TREE_H
 #define PIFO_TREE_H
 
 #include "ns3/queue-disc.h"
+#include "ns3/packet-filter.h"
+#include "ns3/pifo-engine.h"
+#include "ns3/nstime.h"
+#include "ns3/event-id.h"
+#include <memory>
+#include <queue>
+#include <vector>
 
 namespace ns3 {
 
+class RankFilter;
+
 /**
  * \ingroup traffic-control
  *
- * TODO (sibanez): detailed description ...
- * Scheduling is performed using a tree of PIFO queue discs. 
-
- * Linux pfifo_fast is the default priority queue enabled on Linux
- * systems. Packets are enqueued in three FIFO droptail queues according
- * to three priority bands based on the packet priority.
+ * A tree of PIFOs (Sivaraman et al., "Programmable Packet Scheduling at
+ * Line Rate", SIGCOMM 2016). Every node of the tree is a PIFO: a leaf
+ * PIFO holds packets, an interior PIFO holds references to its children.
+ * Dequeuing pops the root, which names the child to dequeue from, and so
+ * on down to a leaf, which returns its top packet.
+ *
+ * The tree is built with AddNode before the queue disc is initialized;
+ * node 0 is the root and exists from the start. The packet filters of the
+ * queue disc return the node id of the leaf a packet is enqueued in.
  *
- * The system behaves similar to three ns3::DropTail queues operating
- * together, in which packets from higher priority bands are always
- * dequeued before a packet from a lower priority band is dequeued.
+ * Every node may have a rank filter (SetRankFilter), a packet filter which
+ * returns the rank of the entries pushed into the PIFO of the node, i.e.,
+ * the scheduling transaction of the node (the 64-bit rank of a RankFilter,
+ * see RankFilter::ClassifyRank). A leaf without rank filter uses the rank
+ * stamped on the packet, an interior node without rank filter serves its
+ * children in FIFO order. A packet is first pushed into its leaf, then a
+ * reference to each node on its path is pushed into the parent of the
+ * node. Ranks are computed lazily, only for the nodes on
+ * the path of the packet and only once the packet has been admitted. When
+ * a packet is dequeued, the RankFilter of each node on its path is
+ * notified of the rank popped from the node, so that fair queueing filters
+ * track the virtual time of their node.
  *
- * The queue disc capacity, i.e., the maximum number of packets that can
- * be enqueued in the queue disc, is set through the limit attribute, which
- * plays the same role as txqueuelen in Linux. If no internal queue is
- * provided, three DropTail queues having each a capacity equal to limit are
- * created by default. User is allowed to provide queues, but they must be
- * three, operate in packet mode and each have a capacity not less
- * than limit. No packet filter can be provided.
+ * Every node but the root may also have a shaper (SetShaper), a callback
+ * returning the time at which the packet becomes eligible for scheduling
+ * at the parent of the node, i.e., the shaping transaction of the node.
+ * Until then, the references to the nodes above the shaped node are not
+ * pushed (nor their ranks computed), which makes the queue disc non
+ * work-conserving; once eligible, the references are pushed and the queue
+ * disc is restarted, if it is installed on a device.
+ *
+ * The nodes are stored in flat arrays indexed by node id. Leaf PIFOs are
+ * internal priority queues (one per leaf, in node id order), interior PIFOs
+ * are PIFO engines holding child node ids. All the PIFOs use the engine
+ * selected by the Engine attribute.
  */
-class PfifoFastQueueDisc : public QueueDisc {
+class PifoTreeQueueDisc : public QueueDisc {
 public:
   /**
    * \brief Get the type ID.
@@ -55,29 +81,143 @@ public:
    */
   static TypeId GetTypeId (void);
   /**
-   * \brief PfifoFastQueueDisc constructor
+   * \brief PifoTreeQueueDisc constructor
    *
-   * Creates a queue with a depth of 1000 packets per band by default
+   * Creates a tree made of the root only, with a depth of 1000 packets by
+   * default
+   */
+  PifoTreeQueueDisc ();
+
+  virtual ~PifoTreeQueueDisc();
+
+  /**
+   * \brief Callback returning the time at which a packet becomes eligible
+   *        for scheduling at the parent of a node
+   */
+  typedef Callback<Time, Ptr<const QueueDiscItem> > ShapingCallback;
+
+  /**
+   * \brief Add a node to the tree. Must be called before the queue disc is
+   *        initialized
+   * \param parent the id of the parent node
+   * \return the id of the new node
+   */
+  uint32_t AddNode (uint32_t parent);
+
+  /**
+   * \brief Get the number of nodes of the tree
+   * \return the number of nodes
+   */
+  uint32_t GetNNodes (void) const;
+
+  /**
+   * \brief Set the filter computing the rank of the entries pushed into the
+   *        PIFO of a node
+   * \param node the id of the node
+   * \param filter the rank filter
    */
-  PfifoFastQueueDisc ();
+  void SetRankFilter (uint32_t node, Ptr<PacketFilter> filter);
 
-  virtual ~PfifoFastQueueDisc();
+  /**
+   * \brief Set the shaper of a node
+   * \param node the id of the node (not the root)
+   * \param shaper the shaper
+   */
+  void SetShaper (uint32_t node, ShapingCallback shaper);
 
   // Reasons for dropping packets
   static constexpr const char* LIMIT_EXCEEDED_DROP = "Queue disc limit exceeded";  //!< Packet dropped due to queue disc limit exceeded
+  static constexpr const char* UNCLASSIFIED_DROP = "No leaf for the packet";       //!< No packet filter returned a leaf of the tree
+
+protected:
+  virtual void DoDispose (void);
 
 private:
-  /**
-   * Priority to band map. Values are taken from the prio2band array used by
-   * the Linux pfifo_fast queue disc.
-   */
-  static const uint32_t prio2band[16];
+  /// Id of the root node, also the parent of the root
+  static const uint32_t ROOT = 0;
+  /// Marks the nodes which are not leaves
+  static const uint32_t NO_LEAF_QUEUE = 0xffffffff;
+
+  /// Type of the PIFO of the interior nodes, holding child node ids
+  typedef PifoEngine<uint32_t> NodeEngine;
+
+  /// A packet waiting for a shaper to make it eligible at the parent of a node
+  struct ShapedEntry
+  {
+    Time release;               //!< the time at which the packet becomes eligible
+    uint64_t seq;               //!< the order of arrival, breaks ties
+    uint32_t node;              //!< the shaped node
+    Ptr<QueueDiscItem> item;    //!< the packet
+  };
+
+  /// Puts the entry to release first at the top of the heap
+  struct ShapedEntryComp
+  {
+    /**
+     * \param lhs the first entry
+     * \param rhs the second entry
+     * \return true if \p rhs must be released before \p lhs
+     */
+    bool operator() (const ShapedEntry &lhs, const ShapedEntry &rhs) const
+    {
+      return rhs.release < lhs.release || (rhs.release == lhs.release && rhs.seq < lhs.seq);
+    }
+  };
 
   virtual bool DoEnqueue (Ptr<QueueDiscItem> item);
   virtual Ptr<QueueDiscItem> DoDequeue (void);
   virtual Ptr<const QueueDiscItem> DoPeek (void);
   virtual bool CheckConfig (void);
   virtual void InitializeParams (void);
+
+  /**
+   * \brief Compute the rank of an entry pushed into the PIFO of a node
+   * \param node the id of the node
+   * \param item the packet on whose behalf the entry is pushed
+   * \return the rank
+   */
+  uint64_t ComputeRank (uint32_t node, Ptr<QueueDiscItem> item) const;
+
+  /**
+   * \brief Push the references to the nodes on the path of a packet, from a
+   *        node whose PIFO already holds the entry of the packet up to the
+   *        root, stopping at the first node whose shaper holds the packet
+   * \param node the id of the node
+   * \param item the packet
+   * \param shape whether to run the shaper of \p node
+   */
+  void PushUp (uint32_t node, Ptr<QueueDiscItem> item, bool shape);
+
+  /**
+   * \brief Push up the packets released by the shapers and restart the
+   *        root queue disc
+   */
+  void Release (void);
+
+  /**
+   * \brief Get the leaf the next dequeued packet comes from
+   * \param pop whether to pop the references along the path, notifying the
+   *        rank filters of the nodes of the ranks popped
+   * \return the id of the leaf, or NO_LEAF_QUEUE if no packet is eligible
+   */
+  uint32_t WalkDown (bool pop);
+
+  // Flat node storage, indexed by node id
+  std::vector<uint32_t> m_parent;                        //!< Parent of each node
+  std::vector<uint32_t> m_nChildren;                     //!< Number of children of each node
+  std::vector<uint32_t> m_leafQueue;                     //!< Internal priority queue of each leaf
+  std::vector<Ptr<PacketFilter> > m_rankFilters;         //!< Rank filter of each node
+  std::vector<Ptr<RankFilter> > m_wideRankFilters;       //!< Rank filter of each node, if it returns 64-bit ranks
+  std::vector<ShapingCallback> m_shapers;                //!< Shaper of each node
+  std::vector<std::unique_ptr<NodeEngine> > m_engines;   //!< PIFO of each interior node
+
+  uint64_t m_seq;                                        //!< Sequence number of the next pushed entry
+  std::priority_queue<ShapedEntry, std::vector<ShapedEntry>, ShapedEntryComp> m_shaped;  //!< Packets held by the shapers
+  EventId m_releaseEvent;                                //!< Release of the next shaped packet
+
+  PifoEngineType m_engineType;                           //!< Engine of the PIFOs
+  uint32_t m_calendarBuckets;                            //!< Number of buckets of the calendar engine
+  uint32_t m_calendarGranularity;                        //!< Number of ranks per bucket of the calendar engine
 };
 
 } // namespace ns3
@@ -30,6 +30,10 @@
 #include "ns3/drop-tail-queue.h"
 #include "ns3/prio-queue.h"
 #include "ns3/net-device-queue-interface.h"
+#include "ns3/node.h"
+#include "p4-node-pipeline.h"
+#include <algorithm>
+#include <limits>
 
 namespace ns3 {
 
@@ -275,6 +279,18 @@ TypeId QueueDisc::GetTypeId (void)
                    MakeUintegerAccessor (&QueueDisc::SetQuota,
                                          &QueueDisc::GetQuota),
                    MakeUintegerChecker<uint32_t> ())
+    .AddAttribute ("MaxBatch",
+                   "The maximum number of packets dequeued at once and sent to a single queue "
+                   "device in a burst in a qdisc run (1 to dequeue the packets one at a time)",
+                   UintegerValue (1),
+                   MakeUintegerAccessor (&QueueDisc::SetMaxBatch,
+                                         &QueueDisc::GetMaxBatch),
+                   MakeUintegerChecker<uint32_t> (1))
+    .AddAttribute ("MaxBatchBytes",
+                   "The number of bytes after which no more packet is added to a batch",
+                   UintegerValue (std::numeric_limits<uint32_t>::max ()),
+                   MakeUintegerAccessor (&QueueDisc::m_maxBatchBytes),
+                   MakeUintegerChecker<uint32_t> (1))
     .AddAttribute ("InternalQueueList", "The list of internal queues.",
                    ObjectVectorValue (),
                    MakeObjectVectorAccessor (&QueueDisc::m_queues),
@@ -332,6 +348,9 @@ QueueDisc::QueueDisc (QueueDiscSizePolicy policy)
   :  m_nPackets (0),
      m_nBytes (0),
      m_maxSize (QueueSize ("1p")),         // to avoid that setting the mode at construction time is ignored
+     m_maxBatch (1),
+     m_maxBatchBytes (std::numeric_limits<uint32_t>::max ()),
+     m_parent (0),
      m_running (false),
      m_peeked (false),
      m_sizePolicy (policy),
@@ -390,10 +409,21 @@ QueueDisc::DoDispose (void)
   m_queues.clear ();
   m_prio_queues.clear ();
   m_filters.clear ();
+  // the children may outlive this queue disc
+  for (auto& cl : m_classes)
+    {
+      if (cl->GetQueueDisc ())
+        {
+          cl->GetQueueDisc ()->m_parent = 0;
+        }
+    }
   m_classes.clear ();
   m_device = 0;
   m_devQueueIface = 0;
+  m_p4Egress = 0;
   m_requeued = 0;
+  m_batch.clear ();
+  m_unsent.clear ();
   Object::DoDispose ();
 }
 
@@ -406,6 +436,11 @@ QueueDisc::DoInitialize (void)
   if (m_device)
     {
       m_devQueueIface = m_device->GetObject<NetDeviceQueueInterface> ();
+      // look up the node-level P4 egress program once rather than per packet
+      if (m_device->GetNode ())
+        {
+          m_p4Egress = m_device->GetNode ()->GetObject<P4Egress> ();
+        }
     }
 
   // Check the configuration and initialize the parameters of this queue disc
@@ -436,9 +471,13 @@ QueueDisc::GetStats (void)
   // after a dequeue and then having to decrease it if the packet is dropped after
   // dequeue or requeued
   m_stats.nTotalSentPackets = m_stats.nTotalDequeuedPackets - (m_requeued ? 1 : 0)
-                              - m_stats.nTotalDroppedPacketsAfterDequeue;
+                              - m_unsent.size () - m_stats.nTotalDroppedPacketsAfterDequeue;
   m_stats.nTotalSentBytes = m_stats.nTotalDequeuedBytes - (m_requeued ? m_requeued->GetSize () : 0)
                             - m_stats.nTotalDroppedBytesAfterDequeue;
+  for (auto& item : m_unsent)
+    {
+      m_stats.nTotalSentBytes -= item->GetSize ();
+    }
 
   return m_stats;
 }
@@ -582,6 +621,20 @@ QueueDisc::GetQuota (void) const
   return m_quota;
 }
 
+void
+QueueDisc::SetMaxBatch (uint32_t maxBatch)
+{
+  NS_LOG_FUNCTION (this << maxBatch);
+  m_maxBatch = maxBatch;
+}
+
+uint32_t
+QueueDisc::GetMaxBatch (void) const
+{
+  NS_LOG_FUNCTION (this);
+  return m_maxBatch;
+}
+
 void
 QueueDisc::AddInternalQueue (Ptr<InternalQueue> queue)
 {
@@ -690,6 +743,7 @@ QueueDisc::AddQueueDiscClass (Ptr<QueueDiscClass> qdClass)
   qdClass->GetQueueDisc ()->TraceConnectWithoutContext ("DropAfterDequeue",
                                      MakeCallback (&ChildQueueDiscDropFunctor::operator(),
                                                    &m_childQueueDiscDadFunctor));
+  qdClass->GetQueueDisc ()->m_parent = this;
   m_classes.push_back (qdClass);
 }
 
@@ -939,7 +993,13 @@ QueueDisc::Dequeue (void)
 
   if (item)
     {
+      // the packets of a batch requeued behind this one, if any, move up
       m_requeued = 0;
+      if (!m_unsent.empty ())
+        {
+          m_requeued = m_unsent.front ();
+          m_unsent.pop_front ();
+        }
       if (m_peeked)
         {
           // If the packet was requeued because a peek operation was requested
@@ -961,6 +1021,54 @@ QueueDisc::Dequeue (void)
   return item;
 }
 
+uint32_t
+QueueDisc::DequeueBatch (uint32_t maxPackets, uint32_t maxBytes,
+                         std::vector<Ptr<QueueDiscItem> > &items)
+{
+  NS_LOG_FUNCTION (this << maxPackets << maxBytes);
+
+  uint32_t n = 0;
+  uint32_t bytes = 0;
+
+  // First extract the packet dequeued by Peek or requeued, if any
+  while (m_requeued && n < maxPackets && bytes < maxBytes)
+    {
+      Ptr<QueueDiscItem> item = Dequeue ();
+      bytes += item->GetSize ();
+      n++;
+      items.push_back (item);
+    }
+
+  if (n < maxPackets && bytes < maxBytes)
+    {
+      n += DoDequeueBatch (maxPackets - n, maxBytes - bytes, items);
+    }
+
+  NS_ASSERT (m_nPackets == m_stats.nTotalEnqueuedPackets - m_stats.nTotalDequeuedPackets);
+  NS_ASSERT (m_nBytes == m_stats.nTotalEnqueuedBytes - m_stats.nTotalDequeuedBytes);
+
+  return n;
+}
+
+uint32_t
+QueueDisc::DoDequeueBatch (uint32_t maxPackets, uint32_t maxBytes,
+                           std::vector<Ptr<QueueDiscItem> > &items)
+{
+  NS_LOG_FUNCTION (this << maxPackets << maxBytes);
+
+  uint32_t n = 0;
+  uint32_t bytes = 0;
+  Ptr<QueueDiscItem> item;
+
+  while (n < maxPackets && bytes < maxBytes && (item = DoDequeue ()) != 0)
+    {
+      bytes += item->GetSize ();
+      n++;
+      items.push_back (item);
+    }
+  return n;
+}
+
 Ptr<const QueueDiscItem>
 QueueDisc::Peek (void)
 {
@@ -994,9 +1102,10 @@ QueueDisc::Run (void)
   if (RunBegin ())
     {
       uint32_t quota = m_quota;
-      while (Restart ())
+      uint32_t nPackets;
+      while (Restart (quota, nPackets))
         {
-          quota -= 1;
+          quota -= nPackets;
           if (quota <= 0)
             {
               /// \todo netif_schedule (q);
@@ -1007,6 +1116,22 @@ QueueDisc::Run (void)
     }
 }
 
+void
+QueueDisc::RunRoot (void)
+{
+  NS_LOG_FUNCTION (this);
+
+  QueueDisc *root = this;
+  while (root->m_parent != 0)
+    {
+      root = root->m_parent;
+    }
+  if (root->m_device)
+    {
+      root->Run ();
+    }
+}
+
 bool
 QueueDisc::RunBegin (void)
 {
@@ -1028,9 +1153,19 @@ QueueDisc::RunEnd (void)
 }
 
 bool
-QueueDisc::Restart (void)
+QueueDisc::Restart (uint32_t maxPackets, uint32_t &nPackets)
 {
-  NS_LOG_FUNCTION (this);
+  NS_LOG_FUNCTION (this << maxPackets);
+  NS_ASSERT (m_devQueueIface);
+  nPackets = 0;
+
+  // Requeued packets are sent one at a time, as they may be destined to a
+  // stopped queue
+  if (m_maxBatch > 1 && m_requeued == 0 && m_devQueueIface->GetNTxQueues () == 1)
+    {
+      return TransmitBatch (std::min (m_maxBatch, maxPackets), nPackets);
+    }
+
   Ptr<QueueDiscItem> item = DequeuePacket();
   if (item == 0)
     {
@@ -1038,6 +1173,7 @@ QueueDisc::Restart (void)
       return false;
     }
 
+  nPackets = 1;
   return Transmit (item);
 }
 
@@ -1057,7 +1193,13 @@ QueueDisc::DequeuePacket ()
         if (!m_devQueueIface->GetTxQueue (m_requeued->GetTxQueueIndex ())->IsStopped ())
           {
             item = m_requeued;
+            // the packets of a batch requeued behind this one, if any, move up
             m_requeued = 0;
+            if (!m_unsent.empty ())
+              {
+                m_requeued = m_unsent.front ();
+                m_unsent.pop_front ();
+              }
             if (m_peeked)
               {
                 // If the packet was requeued because a peek operation was requested
@@ -1093,7 +1235,15 @@ void
 QueueDisc::Requeue (Ptr<QueueDiscItem> item)
 {
   NS_LOG_FUNCTION (this << item);
-  m_requeued = item;
+  if (m_requeued == 0)
+    {
+      m_requeued = item;
+    }
+  else
+    {
+      // a previous packet of the same batch was requeued
+      m_unsent.push_back (item);
+    }
   /// \todo netif_schedule (q);
 
   m_stats.nTotalRequeuedPackets++;
@@ -1125,8 +1275,31 @@ QueueDisc::Transmit (Ptr<QueueDiscItem> item)
       item->GetPacket ()->RemovePacketTag (priorityTag);
     }
 
-  // TODO(sibanez): if (m_node->GetObject<P4Egress>()) -> apply p4egress
-  m_device->Send (item->GetPacket (), item->GetAddress (), item->GetProtocol ());
+  // run the node-level P4 egress program, if any
+  bool dropped = false;
+  if (m_p4Egress != 0)
+    {
+      Ptr<Packet> packet = item->GetPacket ();
+      bool mark = false;
+      if (m_p4Egress->Process (m_device, packet, item->GetProtocol (), GetNBytes (), mark))
+        {
+          item->SetPacket (packet);
+          if (mark)
+            {
+              Mark (item, P4Egress::P4_NODE_EGRESS_MARK);
+            }
+        }
+      else
+        {
+          DropAfterDequeue (item, P4Egress::P4_NODE_EGRESS_DROP);
+          dropped = true;
+        }
+    }
+
+  if (!dropped)
+    {
+      m_device->Send (item->GetPacket (), item->GetAddress (), item->GetProtocol ());
+    }
 
   // the behavior here slightly diverges from Linux. In Linux, it is advised that
   // the function called when a packet needs to be transmitted (ndo_start_xmit)
@@ -1142,9 +1315,11 @@ QueueDisc::Transmit (Ptr<QueueDiscItem> item)
   // of the value returned by NetDevice::Send does not match that of the value
   // returned by ndo_start_xmit.
 
-  // if the queue disc is empty or the device queue is now stopped, return false so
-  // that the Run method does not attempt to dequeue other packets and exits
-  if (GetNPackets () == 0 || m_devQueueIface->GetTxQueue (item->GetTxQueueIndex ())->IsStopped ())
+  // if the queue disc is empty and no packet of a batch is waiting to be sent, or
+  // the device queue is now stopped, return false so that the Run method does not
+  // attempt to dequeue other packets and exits
+  if ((GetNPackets () == 0 && m_requeued == 0)
+      || m_devQueueIface->GetTxQueue (item->GetTxQueueIndex ())->IsStopped ())
     {
       return false;
     }
@@ -1152,4 +1327,40 @@ QueueDisc::Transmit (Ptr<QueueDiscItem> item)
   return true;
 }
 
+bool
+QueueDisc::TransmitBatch (uint32_t maxPackets, uint32_t &nPackets)
+{
+  NS_LOG_FUNCTION (this << maxPackets);
+  NS_ASSERT (m_devQueueIface && m_devQueueIface->GetNTxQueues () == 1);
+
+  nPackets = 0;
+  if (m_devQueueIface->GetTxQueue (0)->IsStopped ())
+    {
+      return false;
+    }
+
+  m_batch.clear ();
+  nPackets = DequeueBatch (maxPackets, m_maxBatchBytes, m_batch);
+  if (nPackets == 0)
+    {
+      NS_LOG_LOGIC ("No packet to send");
+      return false;
+    }
+
+  NS_LOG_LOGIC ("Sending a batch of " << nPackets << " packets");
+
+  // the packets are handed to the device one after the other, with no event
+  // in between. If the device queue gets stopped, Transmit requeues the
+  // packets left, in order
+  bool retval = true;
+  for (auto& item : m_batch)
+    {
+      item->AddHeader ();
+      retval = Transmit (item);
+    }
+  m_batch.clear ();
+
+  return retval;
+}
+
 } // namespace ns3
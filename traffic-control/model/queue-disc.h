@@ -28,6 +28,7 @@
 #include "ns3/queue-item.h"
 #include "ns3/queue-size.h"
 #include <vector>
+#include <deque>
 #include <map>
 #include <functional>
 #include <string>
@@ -39,6 +40,7 @@ class QueueDisc;
 template <typename Item> class Queue;
 template <typename Item> class PrioQueue;
 class NetDeviceQueueInterface;
+class P4Egress;
 
 /**
  * \ingroup traffic-control
@@ -371,6 +373,21 @@ public:
    */
   virtual uint32_t GetQuota (void) const;
 
+  /**
+   * \brief Set the maximum number of packets Run dequeues at once and hands
+   *        to the device in a burst
+   * \param maxBatch the maximum number of packets of a burst (1 to dequeue
+   *        the packets one at a time)
+   */
+  void SetMaxBatch (uint32_t maxBatch);
+
+  /**
+   * \brief Get the maximum number of packets Run dequeues at once and hands
+   *        to the device in a burst
+   * \return the maximum number of packets of a burst
+   */
+  uint32_t GetMaxBatch (void) const;
+
   /**
    * Pass a packet to store to the queue discipline. This function only updates
    * the statistics and calls the (private) DoEnqueue function, which must be
@@ -389,6 +406,22 @@ public:
    */
   Ptr<QueueDiscItem> Dequeue (void);
 
+  /**
+   * Extract multiple packets from the queue disc, until either the given
+   * number of packets or at least the given number of bytes have been
+   * extracted or the queue disc is empty. The packets dequeued by calling
+   * Peek, if any, are extracted first, then the private DoDequeueBatch method
+   * is called. Each packet is counted and traced as if it were extracted by
+   * Dequeue.
+   *
+   * \param maxPackets the maximum number of packets to extract
+   * \param maxBytes the number of bytes after which no more packet is extracted
+   * \param items the vector the extracted packets are appended to, in order
+   * \return the number of packets extracted
+   */
+  uint32_t DequeueBatch (uint32_t maxPackets, uint32_t maxBytes,
+                         std::vector<Ptr<QueueDiscItem> > &items);
+
   /**
    * Get a copy of the next packet the queue discipline will extract. This
    * function only calls the (private) DoPeek function. This base class provides
@@ -401,7 +434,9 @@ public:
   /**
    * Modelled after the Linux function __qdisc_run (net/sched/sch_generic.c)
    * Dequeues multiple packets, until a quota is exceeded or sending a packet
-   * to the device failed.
+   * to the device failed. If MaxBatch is larger than 1 and the device has a
+   * single queue, the packets are dequeued in batches (see DequeueBatch) and
+   * handed to the device in bursts, as Linux does with xmit_more.
    */
   void Run (void);
 
@@ -569,6 +604,16 @@ protected:
    */
   bool Mark (Ptr<QueueDiscItem> item, const char* reason);
 
+  /**
+   * \brief Run the root queue disc of the hierarchy this queue disc belongs
+   *        to, if the root is installed on a device
+   *
+   * Queue discs that hold packets back until some time (e.g., shapers) call
+   * this method when the packets become available, whether they are a root
+   * queue disc or a child one.
+   */
+  void RunRoot (void);
+
 private:
   /**
    * \brief Copy constructor
@@ -600,6 +645,18 @@ private:
    */
   virtual Ptr<QueueDiscItem> DoDequeue (void) = 0;
 
+  /**
+   * This function actually extracts multiple packets from the queue disc, in
+   * the order DoDequeue would. The default implementation calls DoDequeue
+   * until it fails or a limit is reached.
+   * \param maxPackets the maximum number of packets to extract, at least 1
+   * \param maxBytes the number of bytes after which no more packet is extracted
+   * \param items the vector the extracted packets are appended to, in order
+   * \return the number of packets extracted
+   */
+  virtual uint32_t DoDequeueBatch (uint32_t maxPackets, uint32_t maxBytes,
+                                   std::vector<Ptr<QueueDiscItem> > &items);
+
   /**
    * \brief Return a copy of the next packet the queue disc will extract.
    *
@@ -648,10 +705,14 @@ private:
 
   /**
    * Modelled after the Linux function qdisc_restart (net/sched/sch_generic.c)
-   * Dequeue a packet (by calling DequeuePacket) and send it to the device (by calling Transmit).
-   * \return true if a packet is successfully sent to the device.
+   * Dequeue a packet (by calling DequeuePacket) and send it to the device (by calling Transmit),
+   * or, if batching is enabled, dequeue a batch of packets and send them to the device in a burst
+   * (by calling TransmitBatch).
+   * \param maxPackets the maximum number of packets to dequeue
+   * \param nPackets set to the number of packets dequeued
+   * \return true if the packets are successfully sent to the device.
    */
-  bool Restart (void);
+  bool Restart (uint32_t maxPackets, uint32_t &nPackets);
 
   /**
    * Modelled after the Linux function dequeue_skb (net/sched/sch_generic.c)
@@ -661,7 +722,8 @@ private:
 
   /**
    * Modelled after the Linux function dev_requeue_skb (net/sched/sch_generic.c)
-   * Requeues a packet whose transmission failed.
+   * Requeues a packet whose transmission failed. The packets of a batch
+   * requeued after the first one are kept in order behind it.
    * \param item the packet to requeue
    */
   void Requeue (Ptr<QueueDiscItem> item);
@@ -675,6 +737,17 @@ private:
    */
   bool Transmit (Ptr<QueueDiscItem> item);
 
+  /**
+   * Modelled after the Linux functions try_bulk_dequeue_skb and sch_direct_xmit
+   * (net/sched/sch_generic.c). Dequeues a batch of packets (by calling DequeueBatch)
+   * and sends them to the (single queue) device. If the device queue is stopped
+   * before the whole batch is sent, the packets left are requeued.
+   * \param maxPackets the maximum number of packets to dequeue
+   * \param nPackets set to the number of packets dequeued
+   * \return true if the device queue is not stopped and the queue disc is not empty
+   */
+  bool TransmitBatch (uint32_t maxPackets, uint32_t &nPackets);
+
   /**
    *  \brief Perform the actions required when the queue disc is notified of
    *         a packet enqueue
@@ -703,11 +776,17 @@ private:
 
   Stats m_stats;                    //!< The collected statistics
   uint32_t m_quota;                 //!< Maximum number of packets dequeued in a qdisc run
+  uint32_t m_maxBatch;              //!< Maximum number of packets dequeued at once in a qdisc run
+  uint32_t m_maxBatchBytes;         //!< Number of bytes after which a batch is complete
   Ptr<NetDevice> m_device;          //!< The NetDevice on which this queue discipline is installed
+  QueueDisc *m_parent;              //!< The queue disc this one is a child of, if any
   Ptr<NetDeviceQueueInterface> m_devQueueIface;   //!< NetDevice queue interface
+  Ptr<P4Egress> m_p4Egress;         //!< The node-level P4 egress program of the node of the device, if any
   bool m_running;                   //!< The queue disc is performing multiple dequeue operations
   Ptr<QueueDiscItem> m_requeued;    //!< The last packet that failed to be transmitted
   bool m_peeked;                    //!< A packet was dequeued because Peek was called
+  std::vector<Ptr<QueueDiscItem> > m_batch;     //!< The batch being sent to the device
+  std::deque<Ptr<QueueDiscItem> > m_unsent;     //!< Packets of a batch requeued after the requeued packet
   std::string m_childQueueDiscDropMsg;  //!< Reason why a packet was dropped by a child queue disc
   QueueDiscSizePolicy m_sizePolicy;     //!< The queue disc size policy
   bool m_prohibitChangeMode;            //!< True if changing mode is prohibited
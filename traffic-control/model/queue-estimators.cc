@@ -0,0 +1,258 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Copyright (c) 2018 Stanford University
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Author: Stephen Ibanez <sibanez@stanford.edu>
+ */
+
+#include "ns3/log.h"
+#include "queue-estimators.h"
+#include <cmath>
+
+namespace ns3 {
+
+NS_LOG_COMPONENT_DEFINE ("QueueEstimators");
+
+static const double Q32_ONE = 4294967296.0;  //!< 1.0 with 32 fractional bits
+
+QueueSizeEstimator::QueueSizeEstimator ()
+  : m_floatingPoint (false),
+    m_qW (0.0),
+    m_avgFp (0.0),
+    m_weight (0),
+    m_avg (0)
+{
+  NS_LOG_FUNCTION (this);
+  SetWeight (0.0);
+}
+
+void
+QueueSizeEstimator::SetWeight (double qW)
+{
+  NS_LOG_FUNCTION (this << qW);
+  NS_ASSERT_MSG (qW >= 0.0 && qW <= 1.0, "Invalid queue weight " << qW);
+
+  m_qW = qW;
+  m_weight = (uint64_t) std::round (qW * Q32_ONE);
+
+  for (uint32_t m = 0; m < DIRECT_DECAY_SIZE; m++)
+    {
+      m_decay[m] = (uint64_t) std::round (std::pow (1.0 - qW, m) * Q32_ONE);
+    }
+  for (uint32_t k = 0; k < m_decayPow2.size (); k++)
+    {
+      m_decayPow2[k] = (uint64_t) std::round (std::pow (1.0 - qW, std::ldexp (1.0, k)) * Q32_ONE);
+    }
+}
+
+double
+QueueSizeEstimator::GetWeight (void) const
+{
+  return m_qW;
+}
+
+void
+QueueSizeEstimator::SetFloatingPoint (bool floatingPoint)
+{
+  NS_LOG_FUNCTION (this << floatingPoint);
+  m_floatingPoint = floatingPoint;
+  Reset ();
+}
+
+void
+QueueSizeEstimator::Reset (void)
+{
+  NS_LOG_FUNCTION (this);
+  m_avg = 0;
+  m_avgFp = 0.0;
+}
+
+uint64_t
+QueueSizeEstimator::Decay (uint32_t m) const
+{
+  if (m < DIRECT_DECAY_SIZE)
+    {
+      return m_decay[m];
+    }
+
+  uint64_t decay = (uint64_t) 1 << 32;
+  for (uint32_t k = 0; m != 0 && decay != 0; k++, m >>= 1)
+    {
+      if (m & 1)
+        {
+          decay = MulQ32 (decay, m_decayPow2[k]);
+        }
+    }
+  return decay;
+}
+
+double
+QueueSizeEstimator::Update (uint32_t nQueued, uint32_t m)
+{
+  NS_LOG_FUNCTION (this << nQueued << m);
+
+  if (m_floatingPoint)
+    {
+      m_avgFp = m_avgFp * std::pow (1.0 - m_qW, m);
+      m_avgFp += m_qW * nQueued;
+      return m_avgFp;
+    }
+
+  m_avg = MulQ32 (m_avg, Decay (m))
+          + MulQ32 ((uint64_t) nQueued << AVG_FRAC_BITS, m_weight);
+
+  return GetAverage ();
+}
+
+double
+QueueSizeEstimator::GetAverage (void) const
+{
+  if (m_floatingPoint)
+    {
+      return m_avgFp;
+    }
+  return std::ldexp ((double) m_avg, -(int) AVG_FRAC_BITS);
+}
+
+uint32_t
+QueueSizeEstimator::GetRoundedAverage (void) const
+{
+  if (m_floatingPoint)
+    {
+      return (uint32_t) std::round (m_avgFp);
+    }
+  return (uint32_t) ((m_avg + ((uint64_t) 1 << (AVG_FRAC_BITS - 1))) >> AVG_FRAC_BITS);
+}
+
+DequeueRateEstimator::DequeueRateEstimator ()
+  : m_dqThreshold (0)
+{
+  NS_LOG_FUNCTION (this);
+  Reset ();
+}
+
+void
+DequeueRateEstimator::SetThreshold (uint32_t dqThreshold)
+{
+  NS_LOG_FUNCTION (this << dqThreshold);
+  m_dqThreshold = dqThreshold;
+}
+
+void
+DequeueRateEstimator::Reset (void)
+{
+  NS_LOG_FUNCTION (this);
+  m_avgDqRate = 0.0;
+  m_dqStart = Seconds (0);
+  m_dqCount = 0;
+  m_inMeasurement = false;
+}
+
+double
+DequeueRateEstimator::Update (Time now, uint32_t pktSize, uint32_t backlog)
+{
+  NS_LOG_FUNCTION (this << now << pktSize << backlog);
+
+  /* NOTE: the code below is taken from pie-queue-disc.cc to compute dequeue rate measurements */
+
+  // if not in a measurement cycle and the queue has built up to dq_threshold,
+  // start the measurement cycle
+  if ( (backlog >= m_dqThreshold) && (!m_inMeasurement) )
+    {
+      m_dqStart = now;
+      m_dqCount = 0;
+      m_inMeasurement = true;
+    }
+
+  if (m_inMeasurement)
+    {
+      m_dqCount += pktSize;
+
+      // done with a measurement cycle
+      if (m_dqCount >= m_dqThreshold)
+        {
+          double tmp = (now - m_dqStart).GetSeconds ();
+
+          if (tmp > 0)
+            {
+              if (m_avgDqRate == 0)
+                {
+                  m_avgDqRate = m_dqCount / tmp;
+                }
+              else
+                {
+                  m_avgDqRate = (0.5 * m_avgDqRate) + (0.5 * (m_dqCount / tmp));
+                }
+            }
+
+          // restart a measurement cycle if there is enough data
+          if (backlog > m_dqThreshold)
+            {
+              m_dqStart = now;
+              m_dqCount = 0;
+              m_inMeasurement = true;
+            }
+          else
+            {
+              m_dqCount = 0;
+              m_inMeasurement = false;
+            }
+        }
+    }
+
+  return m_avgDqRate;
+}
+
+double
+DequeueRateEstimator::GetRate (void) const
+{
+  return m_avgDqRate;
+}
+
+uint32_t
+DequeueRateEstimator::GetRoundedRate (void) const
+{
+  return (uint32_t) std::round (m_avgDqRate);
+}
+
+SojournTimeEstimator::SojournTimeEstimator ()
+  : m_latency (0)
+{
+  NS_LOG_FUNCTION (this);
+}
+
+void
+SojournTimeEstimator::Reset (void)
+{
+  NS_LOG_FUNCTION (this);
+  m_latency = 0;
+}
+
+int64_t
+SojournTimeEstimator::Update (Time enqueueTime, Time now)
+{
+  NS_LOG_FUNCTION (this << enqueueTime << now);
+  m_latency = now.GetNanoSeconds () - enqueueTime.GetNanoSeconds ();
+  return m_latency;
+}
+
+int64_t
+SojournTimeEstimator::GetLatency (void) const
+{
+  return m_latency;
+}
+
+} // namespace ns3
@@ -0,0 +1,232 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Copyright (c) 2018 Stanford University
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Author: Stephen Ibanez <sibanez@stanford.edu>
+ */
+
+#ifndef QUEUE_ESTIMATORS_H
+#define QUEUE_ESTIMATORS_H
+
+#include "ns3/nstime.h"
+#include <array>
+#include <stdint.h>
+
+namespace ns3 {
+
+/**
+ * \ingroup traffic-control
+ *
+ * \brief Multiply two unsigned fixed-point numbers, the second of which has
+ *        32 fractional bits
+ *
+ * The 128-bit intermediate product is computed from 32-bit halves, so the
+ * only requirement is that the (rounded) result fits in 64 bits.
+ *
+ * \param a the first operand
+ * \param b the second operand, with 32 fractional bits
+ * \return a * b / 2^32, rounded to the nearest integer
+ */
+inline uint64_t
+MulQ32 (uint64_t a, uint64_t b)
+{
+  uint64_t ah = a >> 32;
+  uint64_t al = a & 0xffffffff;
+  uint64_t bh = b >> 32;
+  uint64_t bl = b & 0xffffffff;
+  uint64_t lo = al * bl;
+  return ((ah * bh) << 32) + ah * bl + al * bh + (lo >> 32) + ((lo >> 31) & 1);
+}
+
+/**
+ * \ingroup traffic-control
+ *
+ * \brief EWMA of the queue size, as computed by RED
+ *
+ * The average is updated as avg = avg * (1 - qW)^m + qW * nQueued, where m
+ * accounts for the packets that could have been transmitted while the queue
+ * was idle. The computation is carried out in integer fixed-point
+ * arithmetic: the average has 16 fractional bits, the weight and the decay
+ * factors have 32. The decay factors (1 - qW)^m are precomputed when the
+ * weight is set, directly for small values of m and as powers of two
+ * (1 - qW)^(2^k) for the larger ones, so that no std::pow is needed on the
+ * enqueue path.
+ *
+ * In floating point mode, the average is instead computed with doubles and
+ * std::pow, exactly as RedQueueDisc always did, so that the results of RED
+ * are unchanged.
+ */
+class QueueSizeEstimator
+{
+public:
+  QueueSizeEstimator ();
+
+  /**
+   * \brief Set the weight given to the current queue size sample and
+   *        precompute the decay tables
+   * \param qW the weight, in the range [0, 1]
+   */
+  void SetWeight (double qW);
+
+  /**
+   * \brief Get the weight given to the current queue size sample
+   * \return the weight
+   */
+  double GetWeight (void) const;
+
+  /**
+   * \brief Select the floating point computation of the average
+   * \param floatingPoint true to compute the average with doubles, false
+   *        (the default) for the fixed-point computation
+   */
+  void SetFloatingPoint (bool floatingPoint);
+
+  /**
+   * \brief Reset the average to zero
+   */
+  void Reset (void);
+
+  /**
+   * \brief Update the average with a new queue size sample
+   * \param nQueued the current queue size
+   * \param m the number of decay steps to apply to the old average
+   * \return the new average
+   */
+  double Update (uint32_t nQueued, uint32_t m);
+
+  /**
+   * \brief Get the average queue size
+   * \return the average
+   */
+  double GetAverage (void) const;
+
+  /**
+   * \brief Get the average queue size rounded to the nearest integer
+   * \return the rounded average
+   */
+  uint32_t GetRoundedAverage (void) const;
+
+private:
+  /**
+   * \brief Compute (1 - qW)^m
+   * \param m the exponent
+   * \return the decay factor, with 32 fractional bits
+   */
+  uint64_t Decay (uint32_t m) const;
+
+  static const uint32_t AVG_FRAC_BITS = 16;     //!< Fractional bits of the average
+  static const uint32_t DIRECT_DECAY_SIZE = 64; //!< Number of directly tabulated decay factors
+
+  bool m_floatingPoint;                               //!< Whether the average is computed with doubles
+  double m_qW;                                        //!< Weight given to the current sample
+  double m_avgFp;                                     //!< Average, in floating point mode
+  uint64_t m_weight;                                  //!< Weight, 32 fractional bits
+  uint64_t m_avg;                                     //!< Average, AVG_FRAC_BITS fractional bits
+  std::array<uint64_t, DIRECT_DECAY_SIZE> m_decay;    //!< (1 - qW)^m for m < DIRECT_DECAY_SIZE
+  std::array<uint64_t, 32> m_decayPow2;               //!< (1 - qW)^(2^k)
+};
+
+/**
+ * \ingroup traffic-control
+ *
+ * \brief Windowed dequeue rate meter, as in PIE
+ *
+ * A measurement cycle starts when the backlog reaches the threshold and ends
+ * once a threshold worth of bytes has departed. The rate measured over the
+ * cycle is averaged with the previous estimate.
+ */
+class DequeueRateEstimator
+{
+public:
+  DequeueRateEstimator ();
+
+  /**
+   * \brief Set the minimum backlog (and the amount of departed bytes) in
+   *        bytes of a measurement cycle
+   * \param dqThreshold the threshold
+   */
+  void SetThreshold (uint32_t dqThreshold);
+
+  /**
+   * \brief Reset the estimate and stop the current measurement cycle
+   */
+  void Reset (void);
+
+  /**
+   * \brief Account for a departing packet
+   * \param now the current time
+   * \param pktSize the size of the departing packet in bytes
+   * \param backlog the bytes still queued after the departure
+   * \return the rate estimate, in bytes/sec
+   */
+  double Update (Time now, uint32_t pktSize, uint32_t backlog);
+
+  /**
+   * \brief Get the dequeue rate estimate
+   * \return the rate, in bytes/sec
+   */
+  double GetRate (void) const;
+
+  /**
+   * \brief Get the dequeue rate estimate rounded to the nearest integer
+   * \return the rounded rate, in bytes/sec
+   */
+  uint32_t GetRoundedRate (void) const;
+
+private:
+  uint32_t m_dqThreshold;  //!< Minimum queue size in bytes before dequeue rate is measured
+  double m_avgDqRate;      //!< Time averaged dequeue rate
+  Time m_dqStart;          //!< Start timestamp of current measurement cycle
+  uint64_t m_dqCount;      //!< Number of bytes departed since current measurement cycle starts
+  bool m_inMeasurement;    //!< Indicates whether we are in a measurement cycle
+};
+
+/**
+ * \ingroup traffic-control
+ *
+ * \brief Tracker of the sojourn time of the departing packets
+ */
+class SojournTimeEstimator
+{
+public:
+  SojournTimeEstimator ();
+
+  /**
+   * \brief Reset the latest sample to zero
+   */
+  void Reset (void);
+
+  /**
+   * \brief Account for a departing packet
+   * \param enqueueTime the time the packet was enqueued
+   * \param now the current time
+   * \return the sojourn time of the packet, in nanoseconds
+   */
+  int64_t Update (Time enqueueTime, Time now);
+
+  /**
+   * \brief Get the sojourn time of the latest departing packet
+   * \return the sojourn time, in nanoseconds
+   */
+  int64_t GetLatency (void) const;
+
+private:
+  int64_t m_latency;  //!< Latest sojourn time sample (ns)
+};
+
+} // namespace ns3
+
+#endif /* QUEUE_ESTIMATORS_H */
@@ -0,0 +1,473 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Copyright (c) 2018 Stanford University
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Author: Stephen Ibanez <sibanez@stanford.edu>
+ */
+
+#include "ns3/log.h"
+#include "ns3/abort.h"
+#include "ns3/uinteger.h"
+#include "ns3/double.h"
+#include "ns3/simulator.h"
+#include "ns3/queue-item.h"
+#include "ns3/pifo-engine.h"
+#include "rank-filter.h"
+#include <algorithm>
+#include <limits>
+
+namespace ns3 {
+
+NS_LOG_COMPONENT_DEFINE ("RankFilter");
+
+NS_OBJECT_ENSURE_REGISTERED (RankFilter);
+NS_OBJECT_ENSURE_REGISTERED (StfqRankFilter);
+NS_OBJECT_ENSURE_REGISTERED (WfqRankFilter);
+NS_OBJECT_ENSURE_REGISTERED (EdfRankFilter);
+NS_OBJECT_ENSURE_REGISTERED (LstfRankFilter);
+
+/**
+ * \param lhs a rank
+ * \param rhs a rank
+ * \return the later of the two ranks, in serial number arithmetic
+ */
+static uint64_t
+LaterRank (uint64_t lhs, uint64_t rhs)
+{
+  return (PifoRankBefore (lhs, rhs) ? rhs : lhs);
+}
+
+RankFlowTable::RankFlowTable ()
+  : m_shift (32),
+    m_used (0),
+    m_timeout (0)
+{
+}
+
+void
+RankFlowTable::Reserve (uint32_t nFlows)
+{
+  // keep the table at most half full
+  uint32_t log2 = 1;
+  while ((1u << log2) < 2 * static_cast<uint64_t> (nFlows) && log2 < 31)
+    {
+      log2++;
+    }
+  if ((1u << log2) > m_slots.size ())
+    {
+      Rehash (log2);
+    }
+}
+
+void
+RankFlowTable::Rehash (uint32_t log2)
+{
+  std::vector<Flow> slots (1u << log2);
+  for (Flow &slot : slots)
+    {
+      slot.used = false;
+    }
+  m_slots.swap (slots);
+  m_shift = 32 - log2;
+  m_used = 0;
+
+  uint32_t mask = m_slots.size () - 1;
+  for (const Flow &flow : slots)
+    {
+      if (flow.used)
+        {
+          uint32_t i = Slot (flow.hash);
+          while (m_slots[i].used)
+            {
+              i = (i + 1) & mask;
+            }
+          m_slots[i] = flow;
+          m_used++;
+        }
+    }
+}
+
+void
+RankFlowTable::SetTimeout (int64_t timeout)
+{
+  m_timeout = timeout;
+}
+
+uint32_t
+RankFlowTable::Slot (uint32_t hash) const
+{
+  // Fibonacci hashing, the flow hash may be weak in its low bits
+  return static_cast<uint32_t> (hash * 2654435769u) >> m_shift;
+}
+
+bool
+RankFlowTable::IsStale (const Flow &flow, int64_t now) const
+{
+  return m_timeout > 0 && now - flow.lastSeen > m_timeout;
+}
+
+RankFlowTable::Flow *
+RankFlowTable::Lookup (uint32_t hash, int64_t now, bool &created)
+{
+  if (m_slots.empty ())
+    {
+      Reserve (1);
+    }
+
+  uint32_t mask = m_slots.size () - 1;
+  uint32_t i = Slot (hash);
+  Flow *reuse = 0;
+
+  // the flow may follow stale slots, hence probe up to the first free slot
+  for (; m_slots[i].used; i = (i + 1) & mask)
+    {
+      Flow &flow = m_slots[i];
+      bool stale = IsStale (flow, now);
+      if (flow.hash == hash)
+        {
+          created = stale;
+          flow.lastSeen = now;
+          return &flow;
+        }
+      if (stale && reuse == 0)
+        {
+          reuse = &flow;
+        }
+    }
+
+  if (reuse == 0)
+    {
+      if (2 * (m_used + 1) > m_slots.size ())
+        {
+          Grow (now);
+          return Lookup (hash, now, created);
+        }
+      reuse = &m_slots[i];
+      reuse->used = true;
+      m_used++;
+    }
+
+  created = true;
+  reuse->hash = hash;
+  reuse->lastSeen = now;
+  return reuse;
+}
+
+void
+RankFlowTable::Grow (int64_t now)
+{
+  // drop the stale flows, and double the table unless that freed enough slots
+  uint32_t live = 0;
+  for (Flow &flow : m_slots)
+    {
+      if (flow.used && IsStale (flow, now))
+        {
+          flow.used = false;
+        }
+      live += flow.used;
+    }
+  uint32_t log2 = 32 - m_shift;
+  if (4 * (live + 1) > m_slots.size () && log2 < 31)
+    {
+      log2++;
+    }
+  Rehash (log2);
+}
+
+uint32_t
+RankFlowTable::GetNFlows (void) const
+{
+  return m_used;
+}
+
+TypeId
+RankFilter::GetTypeId (void)
+{
+  static TypeId tid = TypeId ("ns3::RankFilter")
+    .SetParent<PacketFilter> ()
+    .SetGroupName ("TrafficControl")
+    .AddAttribute ("MaxFlows",
+                   "The number of flows to preallocate state for",
+                   UintegerValue (1024),
+                   MakeUintegerAccessor (&RankFilter::m_maxFlows),
+                   MakeUintegerChecker<uint32_t> (1))
+    .AddAttribute ("FlowTimeout",
+                   "The idle time after which the state of a flow is reset (0 to keep it forever)",
+                   TimeValue (Seconds (1)),
+                   MakeTimeAccessor (&RankFilter::m_flowTimeout),
+                   MakeTimeChecker (Time (0)))
+    .AddAttribute ("DefaultWeight",
+                   "The weight of the flows without configured weight",
+                   DoubleValue (1.0),
+                   MakeDoubleAccessor (&RankFilter::m_defaultWeight),
+                   MakeDoubleChecker<double> (std::numeric_limits<double>::min ()))
+  ;
+  return tid;
+}
+
+RankFilter::RankFilter ()
+  : m_virtualTime (0),
+    m_flowsReady (false),
+    m_lastFlow (0)
+{
+  NS_LOG_FUNCTION (this);
+}
+
+RankFilter::~RankFilter ()
+{
+  NS_LOG_FUNCTION (this);
+}
+
+void
+RankFilter::SetFlowWeight (uint32_t flowHash, double weight)
+{
+  NS_LOG_FUNCTION (this << flowHash << weight);
+  NS_ABORT_MSG_IF (weight <= 0, "The weight of a flow must be positive");
+  m_weights[flowHash] = weight;
+}
+
+void
+RankFilter::NotifyDequeue (Ptr<const QueueDiscItem> item)
+{
+  NS_LOG_FUNCTION (this << item);
+  m_virtualTime = LaterRank (m_virtualTime, item->GetRank ());
+}
+
+void
+RankFilter::NotifyDequeue (uint64_t rank)
+{
+  NS_LOG_FUNCTION (this << rank);
+  m_virtualTime = LaterRank (m_virtualTime, rank);
+}
+
+void
+RankFilter::Rollback (void)
+{
+  NS_LOG_FUNCTION (this);
+  NS_ASSERT_MSG (m_lastFlow != 0, "No packet to roll back the classification of");
+  *m_lastFlow = m_lastState;
+  m_lastFlow = 0;
+}
+
+uint32_t
+RankFilter::GetNFlows (void) const
+{
+  return m_flows.GetNFlows ();
+}
+
+void
+RankFilter::InitFlow (Flow &flow) const
+{
+  auto it = m_weights.find (flow.hash);
+  flow.invWeight = 1.0 / (it != m_weights.end () ? it->second : m_defaultWeight);
+  flow.finish = 0;
+  flow.deadline = 0;
+}
+
+bool
+RankFilter::CheckProtocol (Ptr<QueueDiscItem> item) const
+{
+  return true;
+}
+
+bool
+RankFilter::ClassifyRank (Ptr<QueueDiscItem> item, uint64_t &rank) const
+{
+  NS_LOG_FUNCTION (this << item);
+
+  if (!CheckProtocol (item))
+    {
+      NS_LOG_LOGIC ("Unable to classify packets of this protocol");
+      return false;
+    }
+
+  if (!m_flowsReady)
+    {
+      m_flows.Reserve (m_maxFlows);
+      m_flows.SetTimeout (m_flowTimeout.GetNanoSeconds ());
+      m_flowsReady = true;
+    }
+
+  int64_t now = Simulator::Now ().GetNanoSeconds ();
+  bool created;
+  Flow *flow = m_flows.Lookup (item->GetFlowHash (), now, created);
+  if (created)
+    {
+      NS_LOG_LOGIC ("New state for flow " << flow->hash);
+      InitFlow (*flow);
+    }
+
+  m_lastFlow = flow;
+  m_lastState = *flow;
+  rank = ComputeRank (*flow, item, now);
+  NS_LOG_LOGIC ("Rank " << rank << " for flow " << flow->hash);
+  return true;
+}
+
+int32_t
+RankFilter::DoClassify (Ptr<QueueDiscItem> item) const
+{
+  NS_LOG_FUNCTION (this << item);
+
+  uint64_t rank = 0;
+  ClassifyRank (item, rank);
+  return static_cast<int32_t> (rank & 0x7fffffff);
+}
+
+TypeId
+StfqRankFilter::GetTypeId (void)
+{
+  static TypeId tid = TypeId ("ns3::StfqRankFilter")
+    .SetParent<RankFilter> ()
+    .SetGroupName ("TrafficControl")
+    .AddConstructor<StfqRankFilter> ()
+  ;
+  return tid;
+}
+
+StfqRankFilter::StfqRankFilter ()
+{
+  NS_LOG_FUNCTION (this);
+}
+
+StfqRankFilter::~StfqRankFilter ()
+{
+  NS_LOG_FUNCTION (this);
+}
+
+uint64_t
+StfqRankFilter::ComputeRank (Flow &flow, Ptr<QueueDiscItem> item, int64_t now) const
+{
+  uint64_t start = LaterRank (m_virtualTime, flow.finish);
+  flow.finish = start + static_cast<uint64_t> (item->GetSize () * flow.invWeight + 0.5);
+  return start;
+}
+
+TypeId
+WfqRankFilter::GetTypeId (void)
+{
+  static TypeId tid = TypeId ("ns3::WfqRankFilter")
+    .SetParent<RankFilter> ()
+    .SetGroupName ("TrafficControl")
+    .AddConstructor<WfqRankFilter> ()
+  ;
+  return tid;
+}
+
+WfqRankFilter::WfqRankFilter ()
+{
+  NS_LOG_FUNCTION (this);
+}
+
+WfqRankFilter::~WfqRankFilter ()
+{
+  NS_LOG_FUNCTION (this);
+}
+
+uint64_t
+WfqRankFilter::ComputeRank (Flow &flow, Ptr<QueueDiscItem> item, int64_t now) const
+{
+  flow.finish = LaterRank (m_virtualTime, flow.finish)
+    + static_cast<uint64_t> (item->GetSize () * flow.invWeight + 0.5);
+  return flow.finish;
+}
+
+TypeId
+EdfRankFilter::GetTypeId (void)
+{
+  static TypeId tid = TypeId ("ns3::EdfRankFilter")
+    .SetParent<RankFilter> ()
+    .SetGroupName ("TrafficControl")
+    .AddConstructor<EdfRankFilter> ()
+    .AddAttribute ("Deadline",
+                   "The delay budget of the flows without configured budget",
+                   TimeValue (MilliSeconds (1)),
+                   MakeTimeAccessor (&EdfRankFilter::m_deadline),
+                   MakeTimeChecker (Time (0)))
+    .AddAttribute ("TimeUnit",
+                   "The duration of a rank unit",
+                   TimeValue (MicroSeconds (1)),
+                   MakeTimeAccessor (&EdfRankFilter::m_timeUnit),
+                   MakeTimeChecker (NanoSeconds (1)))
+  ;
+  return tid;
+}
+
+EdfRankFilter::EdfRankFilter ()
+{
+  NS_LOG_FUNCTION (this);
+}
+
+EdfRankFilter::~EdfRankFilter ()
+{
+  NS_LOG_FUNCTION (this);
+}
+
+void
+EdfRankFilter::SetFlowDeadline (uint32_t flowHash, Time deadline)
+{
+  NS_LOG_FUNCTION (this << flowHash << deadline);
+  m_deadlines[flowHash] = deadline.GetNanoSeconds ();
+}
+
+void
+EdfRankFilter::InitFlow (Flow &flow) const
+{
+  RankFilter::InitFlow (flow);
+  auto it = m_deadlines.find (flow.hash);
+  flow.deadline = (it != m_deadlines.end () ? it->second : m_deadline.GetNanoSeconds ());
+}
+
+uint64_t
+EdfRankFilter::ComputeRank (Flow &flow, Ptr<QueueDiscItem> item, int64_t now) const
+{
+  return (now + flow.deadline) / m_timeUnit.GetNanoSeconds ();
+}
+
+TypeId
+LstfRankFilter::GetTypeId (void)
+{
+  static TypeId tid = TypeId ("ns3::LstfRankFilter")
+    .SetParent<EdfRankFilter> ()
+    .SetGroupName ("TrafficControl")
+    .AddConstructor<LstfRankFilter> ()
+    .AddAttribute ("LinkRate",
+                   "The rate the transmission time of the packets is computed at",
+                   DataRateValue (DataRate ("10Gbps")),
+                   MakeDataRateAccessor (&LstfRankFilter::m_linkRate),
+                   MakeDataRateChecker ())
+  ;
+  return tid;
+}
+
+LstfRankFilter::LstfRankFilter ()
+{
+  NS_LOG_FUNCTION (this);
+}
+
+LstfRankFilter::~LstfRankFilter ()
+{
+  NS_LOG_FUNCTION (this);
+}
+
+uint64_t
+LstfRankFilter::ComputeRank (Flow &flow, Ptr<QueueDiscItem> item, int64_t now) const
+{
+  int64_t latest = now + flow.deadline - m_linkRate.CalculateBytesTxTime (item->GetSize ()).GetNanoSeconds ();
+  return std::max<int64_t> (latest, 0) / m_timeUnit.GetNanoSeconds ();
+}
+
+} // namespace ns3
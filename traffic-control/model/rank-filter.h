@@ -0,0 +1,349 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Copyright (c) 2018 Stanford University
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Author: Stephen Ibanez <sibanez@stanford.edu>
+ */
+
+#ifndef RANK_FILTER_H
+#define RANK_FILTER_H
+
+#include "ns3/packet-filter.h"
+#include "ns3/nstime.h"
+#include "ns3/data-rate.h"
+#include <unordered_map>
+#include <vector>
+
+namespace ns3 {
+
+/**
+ * \ingroup traffic-control
+ *
+ * Per-flow state of the rank filters, in an open-addressing hash table
+ * with linear probing keyed by the flow hash of the packets (see
+ * QueueDiscItem::GetFlowHash). The slots are preallocated for a given
+ * number of flows and the table doubles when it gets half full.
+ *
+ * A flow not seen for longer than the timeout is stale: its slot may be
+ * reused by another flow, and its state is reset if it shows up again, so
+ * that the table only holds the recently active flows.
+ */
+class RankFlowTable
+{
+public:
+  /// State of a flow
+  struct Flow
+  {
+    uint32_t hash;       //!< Flow hash
+    bool used;           //!< Whether the slot holds a flow, possibly stale
+    int64_t lastSeen;    //!< Time of the last packet of the flow, in ns
+    uint64_t finish;     //!< Virtual finish time of the last packet of the flow
+    double invWeight;    //!< Inverse of the weight of the flow
+    int64_t deadline;    //!< Delay budget of the flow, in ns
+  };
+
+  RankFlowTable ();
+
+  /**
+   * \brief Preallocate the slots for a number of flows
+   * \param nFlows the number of flows
+   */
+  void Reserve (uint32_t nFlows);
+
+  /**
+   * \brief Set the time after which an idle flow is stale
+   * \param timeout the timeout in ns, 0 to never age the flows
+   */
+  void SetTimeout (int64_t timeout);
+
+  /**
+   * \brief Find the state of a flow, creating it if needed
+   * \param hash the flow hash
+   * \param now the current time, in ns
+   * \param created set to true if the state was created or reset, and must
+   *        be initialized by the caller
+   * \return the state of the flow
+   */
+  Flow *Lookup (uint32_t hash, int64_t now, bool &created);
+
+  /**
+   * \brief Get the number of occupied slots, including stale flows
+   * \return the number of occupied slots
+   */
+  uint32_t GetNFlows (void) const;
+
+private:
+  /**
+   * \param hash a flow hash
+   * \return the first slot probed for the flow
+   */
+  uint32_t Slot (uint32_t hash) const;
+
+  /**
+   * \param flow an occupied slot
+   * \param now the current time, in ns
+   * \return true if the flow is stale
+   */
+  bool IsStale (const Flow &flow, int64_t now) const;
+
+  /**
+   * \brief Move the flows into a table of a given size
+   * \param log2 the log2 of the number of slots
+   */
+  void Rehash (uint32_t log2);
+
+  /**
+   * \brief Free the slots of the stale flows, then rehash the flows into a
+   *        table twice as large unless it is less than a quarter full
+   * \param now the current time, in ns
+   */
+  void Grow (int64_t now);
+
+  std::vector<Flow> m_slots;  //!< The slots, a power of 2
+  uint32_t m_shift;           //!< 32 minus the log2 of the number of slots
+  uint32_t m_used;            //!< Number of occupied slots
+  int64_t m_timeout;          //!< Idle time after which a flow is stale, in ns
+};
+
+/**
+ * \ingroup traffic-control
+ *
+ * Base class of the packet filters computing the rank of the packets from
+ * per-flow state, to be used as the filter of a PifoQueueDisc. The state
+ * of the flows is kept in a RankFlowTable preallocated for MaxFlows flows
+ * and aged after FlowTimeout. The weight of a flow is DefaultWeight unless
+ * set with SetFlowWeight.
+ *
+ * Fair queueing filters need the virtual time of the scheduler, i.e., the
+ * rank of the last packet dequeued, which is fed to NotifyDequeue. A
+ * PifoQueueDisc whose filter is a RankFilter notifies it of the packets it
+ * dequeues for transmission, but not of the packets it evicts or drops. A
+ * PifoTreeQueueDisc notifies the rank filter of every node on the path of
+ * the packets it dequeues.
+ *
+ * Classify returns the ranks modulo 2^31, as the classification result of
+ * a packet filter; ClassifyRank returns the full 64-bit rank, which the
+ * PIFO engines compare with serial number arithmetic (see PifoRankBefore),
+ * so that the virtual time may wrap around.
+ */
+class RankFilter : public PacketFilter
+{
+public:
+  /**
+   * \brief Get the type ID.
+   * \return the object TypeId
+   */
+  static TypeId GetTypeId (void);
+
+  RankFilter ();
+  virtual ~RankFilter ();
+
+  /**
+   * \brief Set the weight of a flow. Takes effect when the state of the
+   *        flow is created
+   * \param flowHash the flow hash
+   * \param weight the weight
+   */
+  void SetFlowWeight (uint32_t flowHash, double weight);
+
+  /**
+   * \brief Compute the rank of a packet, without reducing it to a
+   *        classification result
+   * \param item the packet
+   * \param rank set to the rank of the packet
+   * \return false if the filter does not handle the protocol of the packet
+   */
+  bool ClassifyRank (Ptr<QueueDiscItem> item, uint64_t &rank) const;
+
+  /**
+   * \brief Undo the update of the state of the flow of the last classified
+   *        packet, e.g., because the queue disc dropped it after computing
+   *        its rank. No other packet may be classified in between
+   */
+  void Rollback (void);
+
+  /**
+   * \brief Advance the virtual time to the rank of a dequeued packet
+   * \param item the dequeued packet
+   */
+  void NotifyDequeue (Ptr<const QueueDiscItem> item);
+
+  /**
+   * \brief Advance the virtual time to the rank of a dequeued entry, e.g.,
+   *        the reference to a child popped from an interior node of a
+   *        PifoTreeQueueDisc
+   * \param rank the rank of the entry, as computed by this filter
+   */
+  void NotifyDequeue (uint64_t rank);
+
+  /**
+   * \brief Get the number of flows the filter holds state for, including
+   *        the stale flows
+   * \return the number of flows
+   */
+  uint32_t GetNFlows (void) const;
+
+protected:
+  /// State of a flow
+  typedef RankFlowTable::Flow Flow;
+
+  /**
+   * \brief Initialize the state of a new flow
+   * \param flow the state, whose hash is set
+   */
+  virtual void InitFlow (Flow &flow) const;
+
+  /**
+   * \brief Compute the rank of a packet and update the state of its flow
+   * \param flow the state of the flow of the packet
+   * \param item the packet
+   * \param now the current time, in ns
+   * \return the rank
+   */
+  virtual uint64_t ComputeRank (Flow &flow, Ptr<QueueDiscItem> item, int64_t now) const = 0;
+
+  uint64_t m_virtualTime;  //!< Rank of the last dequeued packet
+
+private:
+  virtual bool CheckProtocol (Ptr<QueueDiscItem> item) const;
+  virtual int32_t DoClassify (Ptr<QueueDiscItem> item) const;
+
+  uint32_t m_maxFlows;                               //!< Number of flows to preallocate state for
+  Time m_flowTimeout;                                //!< Idle time after which the state of a flow is reset
+  double m_defaultWeight;                            //!< Weight of the flows without configured weight
+  std::unordered_map<uint32_t, double> m_weights;    //!< Configured weights
+  mutable RankFlowTable m_flows;                     //!< State of the flows
+  mutable bool m_flowsReady;                         //!< Whether the table is set up according to the attributes
+  mutable Flow *m_lastFlow;                          //!< State of the flow of the last classified packet
+  mutable Flow m_lastState;                          //!< State of that flow before the packet was classified
+};
+
+/**
+ * \ingroup traffic-control
+ *
+ * Start-time fair queueing (Goyal et al., 1996): the rank of a packet is
+ * its virtual start time, the maximum of the virtual time and the virtual
+ * finish time of the previous packet of its flow, which is advanced by the
+ * size of the packet divided by the weight of the flow.
+ */
+class StfqRankFilter : public RankFilter
+{
+public:
+  /**
+   * \brief Get the type ID.
+   * \return the object TypeId
+   */
+  static TypeId GetTypeId (void);
+
+  StfqRankFilter ();
+  virtual ~StfqRankFilter ();
+
+private:
+  virtual uint64_t ComputeRank (Flow &flow, Ptr<QueueDiscItem> item, int64_t now) const;
+};
+
+/**
+ * \ingroup traffic-control
+ *
+ * Weighted fair queueing, in its self-clocked form (Golestani, 1994): the
+ * rank of a packet is its virtual finish time, computed as in
+ * StfqRankFilter, and the virtual time is the finish time of the last
+ * dequeued packet.
+ */
+class WfqRankFilter : public RankFilter
+{
+public:
+  /**
+   * \brief Get the type ID.
+   * \return the object TypeId
+   */
+  static TypeId GetTypeId (void);
+
+  WfqRankFilter ();
+  virtual ~WfqRankFilter ();
+
+private:
+  virtual uint64_t ComputeRank (Flow &flow, Ptr<QueueDiscItem> item, int64_t now) const;
+};
+
+/**
+ * \ingroup traffic-control
+ *
+ * Earliest deadline first: the rank of a packet is its deadline, i.e., its
+ * arrival time plus the delay budget of its flow (Deadline unless set with
+ * SetFlowDeadline), in units of TimeUnit.
+ */
+class EdfRankFilter : public RankFilter
+{
+public:
+  /**
+   * \brief Get the type ID.
+   * \return the object TypeId
+   */
+  static TypeId GetTypeId (void);
+
+  EdfRankFilter ();
+  virtual ~EdfRankFilter ();
+
+  /**
+   * \brief Set the delay budget of a flow. Takes effect when the state of
+   *        the flow is created
+   * \param flowHash the flow hash
+   * \param deadline the delay budget
+   */
+  void SetFlowDeadline (uint32_t flowHash, Time deadline);
+
+protected:
+  virtual void InitFlow (Flow &flow) const;
+  virtual uint64_t ComputeRank (Flow &flow, Ptr<QueueDiscItem> item, int64_t now) const;
+
+  Time m_timeUnit;  //!< Duration of a rank unit
+
+private:
+  Time m_deadline;                                    //!< Delay budget of the flows without configured budget
+  std::unordered_map<uint32_t, int64_t> m_deadlines;  //!< Configured delay budgets, in ns
+};
+
+/**
+ * \ingroup traffic-control
+ *
+ * Least slack time first: the slack of a packet is the time left before
+ * its deadline (see EdfRankFilter) minus its transmission time at
+ * LinkRate. Since the slack of all the queued packets decreases at the
+ * same pace, the rank of a packet is its deadline minus its transmission
+ * time, in units of TimeUnit.
+ */
+class LstfRankFilter : public EdfRankFilter
+{
+public:
+  /**
+   * \brief Get the type ID.
+   * \return the object TypeId
+   */
+  static TypeId GetTypeId (void);
+
+  LstfRankFilter ();
+  virtual ~LstfRankFilter ();
+
+private:
+  virtual uint64_t ComputeRank (Flow &flow, Ptr<QueueDiscItem> item, int64_t now) const;
+
+  DataRate m_linkRate;  //!< Rate the transmission time is computed at
+};
+
+} // namespace ns3
+
+#endif /* RANK_FILTER_H */
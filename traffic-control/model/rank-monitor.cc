@@ -0,0 +1,146 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Copyright (c) 2018 Stanford University
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Author: Stephen Ibanez <sibanez@stanford.edu>
+ */
+
+#include "ns3/assert.h"
+#include "rank-monitor.h"
+#include <algorithm>
+
+namespace ns3 {
+
+const uint32_t RankMonitor::SUB_BUCKET_BITS;
+const uint32_t RankMonitor::N_SUB_BUCKETS;
+const uint32_t RankMonitor::N_BUCKETS;
+
+RankMonitor::RankMonitor (uint32_t nBands, uint64_t bandWidth)
+  : m_bandWidth (std::max<uint64_t> (bandWidth, 1)),
+    m_histogram (N_BUCKETS, 0),
+    m_nInversions (0),
+    m_inversionMagnitude (0),
+    m_bandPackets (std::max<uint32_t> (nBands, 1), 0),
+    m_bandBytes (std::max<uint32_t> (nBands, 1), 0)
+{
+}
+
+uint32_t
+RankMonitor::GetBucket (uint64_t rank)
+{
+  if (rank < N_SUB_BUCKETS)
+    {
+      return rank;
+    }
+  // the bits below the leading one and the next SUB_BUCKET_BITS ones select
+  // the bucket within the power of two
+  uint32_t msb = 63 - __builtin_clzll (rank);
+  uint32_t shift = msb - SUB_BUCKET_BITS;
+  return (shift + 1) * N_SUB_BUCKETS + ((rank >> shift) & (N_SUB_BUCKETS - 1));
+}
+
+uint64_t
+RankMonitor::GetBucketLowerBound (uint32_t bucket)
+{
+  NS_ASSERT (bucket < N_BUCKETS);
+  if (bucket < N_SUB_BUCKETS)
+    {
+      return bucket;
+    }
+  uint32_t shift = bucket / N_SUB_BUCKETS - 1;
+  return static_cast<uint64_t> (N_SUB_BUCKETS + bucket % N_SUB_BUCKETS) << shift;
+}
+
+uint32_t
+RankMonitor::GetBand (uint64_t rank) const
+{
+  return std::min<uint64_t> (rank / m_bandWidth, m_bandPackets.size () - 1);
+}
+
+void
+RankMonitor::NotifyEnqueue (uint64_t rank, uint32_t size)
+{
+  m_histogram[GetBucket (rank)]++;
+  uint32_t band = GetBand (rank);
+  m_bandPackets[band]++;
+  m_bandBytes[band] += size;
+  m_queued.insert (rank);
+}
+
+uint64_t
+RankMonitor::NotifyDequeue (uint64_t rank, uint32_t size)
+{
+  NS_ASSERT (!m_queued.empty ());
+  // the dequeued rank is queued, hence the lowest rank does not rank after it
+  uint64_t magnitude = rank - *m_queued.begin ();
+  if (magnitude != 0)
+    {
+      m_nInversions++;
+      m_inversionMagnitude += magnitude;
+    }
+  Erase (rank, size);
+  return magnitude;
+}
+
+void
+RankMonitor::NotifyRemove (uint64_t rank, uint32_t size)
+{
+  Erase (rank, size);
+}
+
+void
+RankMonitor::Erase (uint64_t rank, uint32_t size)
+{
+  auto it = m_queued.find (rank);
+  NS_ASSERT (it != m_queued.end ());
+  m_queued.erase (it);
+  uint32_t band = GetBand (rank);
+  NS_ASSERT (m_bandPackets[band] > 0 && m_bandBytes[band] >= size);
+  m_bandPackets[band]--;
+  m_bandBytes[band] -= size;
+}
+
+const std::vector<uint64_t> &
+RankMonitor::GetHistogram (void) const
+{
+  return m_histogram;
+}
+
+uint64_t
+RankMonitor::GetNInversions (void) const
+{
+  return m_nInversions;
+}
+
+uint64_t
+RankMonitor::GetInversionMagnitude (void) const
+{
+  return m_inversionMagnitude;
+}
+
+const std::vector<uint64_t> &
+RankMonitor::GetBandPackets (void) const
+{
+  return m_bandPackets;
+}
+
+const std::vector<uint64_t> &
+RankMonitor::GetBandBytes (void) const
+{
+  return m_bandBytes;
+}
+
+} // namespace ns3
@@ -0,0 +1,168 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Copyright (c) 2018 Stanford University
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Author: Stephen Ibanez <sibanez@stanford.edu>
+ */
+
+#ifndef RANK_MONITOR_H
+#define RANK_MONITOR_H
+
+#include "ns3/pifo-engine.h"
+#include <set>
+#include <vector>
+#include <stdint.h>
+
+namespace ns3 {
+
+/**
+ * \ingroup traffic-control
+ *
+ * \brief Statistics on the ranks of the packets going through a PIFO
+ *
+ * Keeps three kinds of statistics, fed by the queue disc on enqueue,
+ * dequeue and removal (e.g., eviction) of its packets:
+ *
+ * - a streaming log-linear histogram of the enqueued ranks: ranks below 16
+ *   have their own bucket, and every power of two above is split into 8
+ *   buckets of equal width, so that the relative width of a bucket is at
+ *   most 1/8 over the whole 64-bit range, with 496 buckets;
+ * - the dequeue inversions with respect to an ideal PIFO: a dequeue is an
+ *   inversion if a queued packet has a lower rank than the dequeued one,
+ *   and its magnitude is the difference between the two ranks. Only
+ *   approximate engines (e.g., SP-PIFO) cause inversions;
+ * - the number of packets and bytes queued in each rank band: band i holds
+ *   the ranks in [i * width, (i + 1) * width), and the last band also
+ *   holds all the higher ranks.
+ *
+ * The queued ranks are kept in an ordered multiset to find the lowest one,
+ * which costs O(log n) per packet; the statistics are thus only maintained
+ * when monitoring is enabled.
+ */
+class RankMonitor
+{
+public:
+  static const uint32_t SUB_BUCKET_BITS = 3;                                 //!< Log2 of the number of buckets per power of two
+  static const uint32_t N_SUB_BUCKETS = 1 << SUB_BUCKET_BITS;                //!< Number of buckets per power of two
+  static const uint32_t N_BUCKETS = (65 - SUB_BUCKET_BITS) * N_SUB_BUCKETS;  //!< Number of buckets of the histogram
+
+  /**
+   * \brief Constructor
+   * \param nBands the number of rank bands
+   * \param bandWidth the number of ranks per band
+   */
+  RankMonitor (uint32_t nBands, uint64_t bandWidth);
+
+  /**
+   * \param rank a rank
+   * \return the index of the histogram bucket of the rank
+   */
+  static uint32_t GetBucket (uint64_t rank);
+
+  /**
+   * \param bucket the index of a histogram bucket
+   * \return the lowest rank of the bucket
+   */
+  static uint64_t GetBucketLowerBound (uint32_t bucket);
+
+  /**
+   * \param rank a rank
+   * \return the index of the band of the rank
+   */
+  uint32_t GetBand (uint64_t rank) const;
+
+  /**
+   * \brief Record an enqueued packet
+   * \param rank the rank of the packet
+   * \param size the size of the packet
+   */
+  void NotifyEnqueue (uint64_t rank, uint32_t size);
+
+  /**
+   * \brief Record a dequeued packet
+   * \param rank the rank of the packet
+   * \param size the size of the packet
+   * \return the magnitude of the inversion, 0 if the dequeue is in order
+   */
+  uint64_t NotifyDequeue (uint64_t rank, uint32_t size);
+
+  /**
+   * \brief Record a packet removed from the queue other than by a dequeue
+   *        (e.g., evicted), which is not checked for inversions
+   * \param rank the rank of the packet
+   * \param size the size of the packet
+   */
+  void NotifyRemove (uint64_t rank, uint32_t size);
+
+  /**
+   * \return the number of enqueued packets in each bucket of the histogram
+   */
+  const std::vector<uint64_t> &GetHistogram (void) const;
+
+  /**
+   * \return the number of dequeues that were inversions
+   */
+  uint64_t GetNInversions (void) const;
+
+  /**
+   * \return the sum of the magnitudes of the inversions
+   */
+  uint64_t GetInversionMagnitude (void) const;
+
+  /**
+   * \return the number of packets queued in each band
+   */
+  const std::vector<uint64_t> &GetBandPackets (void) const;
+
+  /**
+   * \return the number of bytes queued in each band
+   */
+  const std::vector<uint64_t> &GetBandBytes (void) const;
+
+private:
+  /// Order of the ranks, in serial number arithmetic
+  struct RankBefore
+  {
+    /**
+     * \param lhs a rank
+     * \param rhs a rank
+     * \return true if \p lhs ranks before \p rhs
+     */
+    bool operator() (uint64_t lhs, uint64_t rhs) const
+    {
+      return PifoRankBefore (lhs, rhs);
+    }
+  };
+
+  /**
+   * \brief Remove a packet from the queued ranks and its band
+   * \param rank the rank of the packet
+   * \param size the size of the packet
+   */
+  void Erase (uint64_t rank, uint32_t size);
+
+  uint64_t m_bandWidth;                          //!< Number of ranks per band
+  std::vector<uint64_t> m_histogram;             //!< Enqueued packets per bucket
+  uint64_t m_nInversions;                        //!< Number of inversions
+  uint64_t m_inversionMagnitude;                 //!< Sum of the magnitudes of the inversions
+  std::vector<uint64_t> m_bandPackets;           //!< Queued packets per band
+  std::vector<uint64_t> m_bandBytes;             //!< Queued bytes per band
+  std::multiset<uint64_t, RankBefore> m_queued;  //!< Queued ranks
+};
+
+} // namespace ns3
+
+#endif /* RANK_MONITOR_H */
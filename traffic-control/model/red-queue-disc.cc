@@ -233,6 +233,7 @@ RedQueueDisc::RedQueueDisc () :
 {
   NS_LOG_FUNCTION (this);
   m_uv = CreateObject<UniformRandomVariable> ();
+  m_qSizeEst.SetFloatingPoint (true);
 }
 
 RedQueueDisc::~RedQueueDisc ()
@@ -369,7 +370,7 @@ RedQueueDisc::DoEnqueue (Ptr<QueueDiscItem> item)
       m_idle = 0;
     }
 
-  m_qAvg = Estimator (nQueued, m + 1, m_qAvg, m_qW);
+  m_qAvg = Estimator (nQueued, m + 1);
 
   NS_LOG_DEBUG ("\t bytesInQueue  " << GetInternalQueue (0)->GetNBytes () << "\tQavg " << m_qAvg);
   NS_LOG_DEBUG ("\t packetsInQueue  " << GetInternalQueue (0)->GetNPackets () << "\tQavg " << m_qAvg);
@@ -556,6 +557,9 @@ RedQueueDisc::InitializeParams (void)
       m_qW = 1.0 - std::exp (-10.0 / m_ptc);
     }
 
+  m_qSizeEst.SetWeight (m_qW);
+  m_qSizeEst.Reset ();
+
   if (m_bottom == 0)
     {
       m_bottom = 0.01;
@@ -632,12 +636,11 @@ RedQueueDisc::UpdateMaxP (double newAve)
 
 // Compute the average queue size
 double
-RedQueueDisc::Estimator (uint32_t nQueued, uint32_t m, double qAvg, double qW)
+RedQueueDisc::Estimator (uint32_t nQueued, uint32_t m)
 {
-  NS_LOG_FUNCTION (this << nQueued << m << qAvg << qW);
+  NS_LOG_FUNCTION (this << nQueued << m);
 
-  double newAve = qAvg * std::pow (1.0 - qW, m);
-  newAve += qW * nQueued;
+  double newAve = m_qSizeEst.Update (nQueued, m);
 
   Time now = Simulator::Now ();
   if (m_isAdaptMaxP && now > m_lastSet + m_interval)
@@ -66,6 +66,7 @@
 #include "ns3/boolean.h"
 #include "ns3/data-rate.h"
 #include "ns3/random-variable-stream.h"
+#include "queue-estimators.h"
 
 namespace ns3 {
 
@@ -224,11 +225,9 @@ private:
    * \brief Compute the average queue size
    * \param nQueued number of queued packets
    * \param m simulated number of packets arrival during idle period
-   * \param qAvg average queue size
-   * \param qW queue weight given to cur q size sample
    * \returns new average queue size
    */
-  double Estimator (uint32_t nQueued, uint32_t m, double qAvg, double qW);
+  double Estimator (uint32_t nQueued, uint32_t m);
    /**
     * \brief Update m_curMaxP
     * \param newAve new average queue length
@@ -300,6 +299,7 @@ private:
   uint32_t m_idle;             //!< 0/1 idle status
   double m_ptc;                //!< packet time constant in packets/second
   TracedValue<double> m_qAvg;  //!< Average queue length
+  QueueSizeEstimator m_qSizeEst; //!< EWMA of the queue length, in floating point mode
   uint32_t m_count;            //!< Number of packets since last random number generation
   FengStatus m_fengStatus;     //!< For use in Feng's Adaptive RED
   /**
@@ -24,6 +24,7 @@
 #include "ns3/packet.h"
 #include "ns3/socket.h"
 #include "ns3/queue-disc.h"
+#include "p4-node-pipeline.h"
 #include <tuple>
 
 namespace ns3 {
@@ -285,6 +286,20 @@ TrafficControlLayer::Receive (Ptr<NetDevice> device, Ptr<const Packet> p,
 {
   NS_LOG_FUNCTION (this << device << p << protocol << from << to << packetType);
 
+  // run the node-level P4 ingress program, if any
+  Ptr<P4Ingress> p4Ingress = m_node->GetObject<P4Ingress> ();
+  if (p4Ingress != 0)
+    {
+      Ptr<Packet> packet = p->Copy ();
+      Ptr<QueueDisc> qDisc = GetRootQueueDiscOnDevice (device);
+      bool mark = false;
+      if (!p4Ingress->Process (device, packet, protocol, qDisc ? qDisc->GetNBytes () : 0, mark))
+        {
+          return;
+        }
+      p = packet;
+    }
+
   bool found = false;
 
   for (ProtocolHandlerList::iterator i = m_handlers.begin ();
@@ -343,7 +358,23 @@ TrafficControlLayer::Send (Ptr<NetDevice> device, Ptr<QueueDiscItem> item)
 
   NS_ASSERT (txq < devQueueIface->GetNTxQueues ());
 
-  // TODO(sibanez): if (m_node->GetObject<P4Midgress>()) -> apply p4midgress
+  // run the node-level P4 midgress program, if any
+  Ptr<P4Midgress> p4Midgress = m_node->GetObject<P4Midgress> ();
+  if (p4Midgress != 0)
+    {
+      Ptr<Packet> packet = item->GetPacket ();
+      Ptr<QueueDisc> qDisc = ndi->second.m_rootQueueDisc;
+      bool mark = false;
+      if (!p4Midgress->Process (device, packet, item->GetProtocol (), qDisc ? qDisc->GetNBytes () : 0, mark))
+        {
+          return;
+        }
+      item->SetPacket (packet);
+      if (mark)
+        {
+          item->Mark ();
+        }
+    }
 
   if (ndi->second.m_rootQueueDisc == 0)
     {
@@ -358,7 +389,22 @@ TrafficControlLayer::Send (Ptr<NetDevice> device, Ptr<QueueDiscItem> item)
               SocketPriorityTag priorityTag;
               item->GetPacket ()->RemovePacketTag (priorityTag);
             }
-          // TODO(sibanez): if (m_node->GetObject<P4Egress>()) -> apply p4egress
+          // run the node-level P4 egress program, if any
+          Ptr<P4Egress> p4Egress = m_node->GetObject<P4Egress> ();
+          if (p4Egress != 0)
+            {
+              Ptr<Packet> packet = item->GetPacket ();
+              bool mark = false;
+              if (!p4Egress->Process (device, packet, item->GetProtocol (), 0, mark))
+                {
+                  return;
+                }
+              item->SetPacket (packet);
+              if (mark)
+                {
+                  item->Mark ();
+                }
+            }
           device->Send (item->GetPacket (), item->GetAddress (), item->GetProtocol ());
         }
     }
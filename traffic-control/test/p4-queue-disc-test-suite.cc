@@ -0,0 +1,857 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Copyright (c) 2018 Stanford University
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Author: Stephen Ibanez <sibanez@stanford.edu>
+ */
+
+#include "ns3/test.h"
+#include "ns3/p4-queue-disc.h"
+#include "ns3/p4-pipeline.h"
+#include "ns3/p4-node-pipeline.h"
+#include "ns3/pifo-queue-disc.h"
+#include "ns3/fifo-queue-disc.h"
+#include "ns3/node.h"
+#include "ns3/simple-net-device.h"
+#include "ns3/simple-channel.h"
+#include "ns3/net-device-queue-interface.h"
+#include "ns3/packet.h"
+#include "ns3/boolean.h"
+#include "ns3/string.h"
+#include "ns3/uinteger.h"
+#include "ns3/simulator.h"
+#include "ns3/callback.h"
+#include <fstream>
+#include <sstream>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace ns3;
+
+/**
+ * \ingroup traffic-control-test
+ * \ingroup tests
+ *
+ * \brief P4 Queue Disc Test Item
+ */
+class P4TestItem : public QueueDiscItem
+{
+public:
+  /**
+   * Constructor
+   *
+   * \param p the packet
+   * \param protocol the L3 protocol of the packet
+   * \param flow the flow hash of the packet
+   */
+  P4TestItem (Ptr<Packet> p, uint16_t protocol, uint32_t flow);
+  virtual ~P4TestItem ();
+  virtual void AddHeader (void);
+  virtual bool Mark (void);
+  virtual uint32_t Hash (uint32_t perturbation) const;
+
+  uint32_t m_flow;  //!< the flow hash of the packet
+};
+
+P4TestItem::P4TestItem (Ptr<Packet> p, uint16_t protocol, uint32_t flow)
+  : QueueDiscItem (p, Address (), protocol),
+    m_flow (flow)
+{
+}
+
+P4TestItem::~P4TestItem ()
+{
+}
+
+void
+P4TestItem::AddHeader (void)
+{
+}
+
+bool
+P4TestItem::Mark (void)
+{
+  return true;
+}
+
+uint32_t
+P4TestItem::Hash (uint32_t perturbation) const
+{
+  return m_flow;
+}
+
+/**
+ * \brief Write the bmv2 JSON of a P4 program whose ingress or egress control
+ *        runs a single action
+ *
+ * The program has no packet headers, unless a condition is given: the
+ * parser then extracts a 2-byte "ipv4" header with the diffserv and ttl
+ * fields, and the action only runs if the condition holds.
+ *
+ * \param file the file to write
+ * \param primitives the JSON array of the primitives of the action
+ * \param egress whether the egress control, rather than the ingress one, runs the action
+ * \param registerArrays the JSON array of the register arrays of the program
+ * \param condition the JSON expression the action is conditioned on, if any
+ */
+static void
+WriteP4Program (std::string file, std::string primitives, bool egress = false,
+                std::string registerArrays = "[]", std::string condition = "")
+{
+  static const char *const fields[] = {
+    "qdepth", "qdepth_bytes", "avg_qdepth", "avg_qdepth_bytes", "timestamp",
+    "idle_time", "qlatency", "avg_deq_rate_bytes", "pkt_len", "pkt_len_bytes",
+    "gso_segs", "egress_port", "shared_qdepth_bytes", "l3_proto", "flow_hash",
+    "ingress_trigger", "timer_trigger",
+    "drop_trigger", "drop_timestamp", "drop_qdepth", "drop_qdepth_bytes",
+    "drop_avg_qdepth", "drop_avg_qdepth_bytes", "drop_pkt_len", "drop_pkt_len_bytes",
+    "drop_l3_proto", "drop_flow_hash",
+    "enq_trigger", "enq_timestamp", "enq_qdepth", "enq_qdepth_bytes",
+    "enq_avg_qdepth", "enq_avg_qdepth_bytes", "enq_pkt_len", "enq_pkt_len_bytes",
+    "enq_l3_proto", "enq_flow_hash",
+    "deq_trigger", "deq_enq_timestamp", "deq_qdepth", "deq_qdepth_bytes",
+    "deq_avg_qdepth", "deq_avg_qdepth_bytes", "deq_timestamp", "deq_pkt_len",
+    "deq_pkt_len_bytes", "deq_l3_proto", "deq_flow_hash",
+    "drop", "mark", "qid", "rank",
+    "trace_var1", "trace_var2", "trace_var3", "trace_var4"
+  };
+
+  std::ofstream json (file.c_str ());
+  json << "{\"header_types\": [{\"name\": \"standard_metadata_t\", \"id\": 0, \"fields\": [";
+  for (uint32_t i = 0; i < sizeof (fields) / sizeof (fields[0]); i++)
+    {
+      json << (i > 0 ? ", " : "") << "[\"" << fields[i] << "\", 64, false]";
+    }
+  json << "]}";
+  bool ipv4 = (condition != "");
+  if (ipv4)
+    {
+      json << ", {\"name\": \"ipv4_t\", \"id\": 1, \"fields\": [[\"diffserv\", 8, false], [\"ttl\", 8, false]]}";
+    }
+  json << "],"
+       << "\"headers\": [{\"name\": \"standard_metadata\", \"id\": 0,"
+       << " \"header_type\": \"standard_metadata_t\", \"metadata\": true}";
+  if (ipv4)
+    {
+      json << ", {\"name\": \"ipv4\", \"id\": 1, \"header_type\": \"ipv4_t\", \"metadata\": false}";
+    }
+  json << "],"
+       << "\"header_stacks\": [],"
+       << "\"parsers\": [{\"name\": \"parser\", \"id\": 0, \"init_state\": \"start\","
+       << " \"parse_states\": [{\"name\": \"start\", \"id\": 0, \"parser_ops\": ["
+       << (ipv4 ? "{\"op\": \"extract\", \"parameters\": [{\"type\": \"regular\", \"value\": \"ipv4\"}]}" : "")
+       << "], \"transition_key\": [], \"transitions\": [{\"value\": \"default\", \"mask\": null,"
+       << " \"next_state\": null}]}]}],"
+       << "\"deparsers\": [{\"name\": \"deparser\", \"id\": 0, \"order\": ["
+       << (ipv4 ? "\"ipv4\"" : "") << "]}],"
+       << "\"meter_arrays\": [], \"counter_arrays\": [], \"register_arrays\": " << registerArrays << ","
+       << "\"calculations\": [], \"learn_lists\": [], \"checksums\": [], \"force_arith\": [],"
+       << "\"actions\": [{\"name\": \"verdict\", \"id\": 0, \"runtime_data\": [],"
+       << " \"primitives\": " << primitives << "}],"
+       << "\"pipelines\": [";
+  for (uint32_t id = 0; id < 2; id++)
+    {
+      json << (id > 0 ? ", " : "") << "{\"name\": \"" << (id == 0 ? "ingress" : "egress") << "\","
+           << " \"id\": " << id;
+      if ((id == 1) == egress)
+        {
+          json << ", \"init_table\": \"" << (ipv4 ? "verdict_condition" : "verdict_table") << "\","
+               << " \"tables\": [{\"name\": \"verdict_table\", \"id\": 0, \"match_type\": \"exact\","
+               << " \"type\": \"simple\", \"max_size\": 1, \"with_counters\": false,"
+               << " \"support_timeout\": false, \"direct_meters\": null, \"action_ids\": [0],"
+               << " \"actions\": [\"verdict\"], \"base_default_next\": null,"
+               << " \"next_tables\": {\"verdict\": null}, \"default_entry\": {\"action_id\": 0,"
+               << " \"action_const\": true, \"action_data\": [], \"action_entry_const\": true},"
+               << " \"key\": []}],";
+        }
+      else
+        {
+          json << ", \"init_table\": null, \"tables\": [],";
+        }
+      json << " \"action_profiles\": [], \"conditionals\": [";
+      if (ipv4 && (id == 1) == egress)
+        {
+          json << "{\"name\": \"verdict_condition\", \"id\": 0, \"expression\": " << condition << ","
+               << " \"true_next\": \"verdict_table\", \"false_next\": null}";
+        }
+      json << "]}";
+    }
+  json << "]}" << std::endl;
+}
+
+/**
+ * \brief Get the JSON of a primitive adding two standard metadata fields
+ *
+ * \param dst the destination field
+ * \param lhs the first operand
+ * \param rhs the second operand
+ * \return the JSON of the primitive
+ */
+static std::string
+AddFields (std::string dst, std::string lhs, std::string rhs)
+{
+  return "{\"op\": \"add\", \"parameters\": ["
+         "{\"type\": \"field\", \"value\": [\"standard_metadata\", \"" + dst + "\"]}, "
+         "{\"type\": \"field\", \"value\": [\"standard_metadata\", \"" + lhs + "\"]}, "
+         "{\"type\": \"field\", \"value\": [\"standard_metadata\", \"" + rhs + "\"]}]}";
+}
+
+/**
+ * \brief Get the JSON of a primitive copying a standard metadata field
+ *
+ * \param dst the destination field
+ * \param src the source field
+ * \return the JSON of the primitive
+ */
+static std::string
+CopyField (std::string dst, std::string src)
+{
+  return "{\"op\": \"modify_field\", \"parameters\": ["
+         "{\"type\": \"field\", \"value\": [\"standard_metadata\", \"" + dst + "\"]}, "
+         "{\"type\": \"field\", \"value\": [\"standard_metadata\", \"" + src + "\"]}]}";
+}
+
+/**
+ * \brief Get the JSON of a primitive writing a standard metadata field to
+ *        a register cell
+ *
+ * \param reg the register array
+ * \param index the index of the cell
+ * \param src the source field
+ * \return the JSON of the primitive
+ */
+static std::string
+WriteRegister (std::string reg, uint32_t index, std::string src)
+{
+  std::ostringstream oss;
+  oss << "{\"op\": \"register_write\", \"parameters\": ["
+      << "{\"type\": \"register_array\", \"value\": \"" << reg << "\"}, "
+      << "{\"type\": \"hexstr\", \"value\": \"0x" << std::hex << index << "\"}, "
+      << "{\"type\": \"field\", \"value\": [\"standard_metadata\", \"" << src << "\"]}]}";
+  return oss.str ();
+}
+
+/**
+ * \ingroup traffic-control-test
+ * \ingroup tests
+ *
+ * \brief P4 Queue Disc Header-Only Import Test Case
+ *
+ * A packet larger than MaxImportSize is processed header-only: the P4
+ * program reads its full length, and the rest of its payload is appended
+ * back after the deparser
+ */
+class P4QueueDiscHeaderOnlyImportTestCase : public TestCase
+{
+public:
+  P4QueueDiscHeaderOnlyImportTestCase ();
+  virtual void DoRun (void);
+};
+
+P4QueueDiscHeaderOnlyImportTestCase::P4QueueDiscHeaderOnlyImportTestCase ()
+  : TestCase ("Check that the P4 program reads the full length of a header-only packet")
+{
+}
+
+void
+P4QueueDiscHeaderOnlyImportTestCase::DoRun (void)
+{
+  std::string commands = CreateTempDirFilename ("commands.txt");
+  std::ofstream (commands.c_str ()).close ();
+
+  // the rank is the length of the packet read by the program
+  std::string json = CreateTempDirFilename ("length.json");
+  WriteP4Program (json, "[" + CopyField ("rank", "pkt_len_bytes") + "]");
+
+  Ptr<P4QueueDisc> qdisc = CreateObject<P4QueueDisc> ();
+  qdisc->SetAttribute ("JsonFile", StringValue (json));
+  qdisc->SetAttribute ("CommandsFile", StringValue (commands));
+  qdisc->SetAttribute ("MaxImportSize", UintegerValue (64));
+  qdisc->Initialize ();
+
+  const uint32_t sizes[] = {40, 64, 3000, 65000};
+  for (uint32_t size : sizes)
+    {
+      Ptr<QueueDiscItem> item = Create<P4TestItem> (Create<Packet> (size), 0x0800, 1);
+      NS_TEST_EXPECT_MSG_EQ (qdisc->Enqueue (item), true, "The packet of " << size << " bytes should be enqueued");
+      NS_TEST_EXPECT_MSG_EQ (item->GetRank (), size, "The program should read the full length");
+      NS_TEST_EXPECT_MSG_EQ (item->GetSize (), size, "The payload should be appended back");
+      qdisc->Dequeue ();
+    }
+
+  qdisc->Dispose ();
+  Simulator::Destroy ();
+}
+
+/**
+ * \ingroup traffic-control-test
+ * \ingroup tests
+ *
+ * \brief P4 Queue Disc Limit Test Case
+ *
+ * The MaxSize limit of the queue disc is enforced whatever the limits of
+ * its classes, and the rank computed by the P4 program leaves the priority
+ * of the packets untouched
+ */
+class P4QueueDiscLimitTestCase : public TestCase
+{
+public:
+  P4QueueDiscLimitTestCase ();
+  virtual void DoRun (void);
+};
+
+P4QueueDiscLimitTestCase::P4QueueDiscLimitTestCase ()
+  : TestCase ("Check the limit of the P4 queue disc with user classes and the rank of the packets")
+{
+}
+
+void
+P4QueueDiscLimitTestCase::DoRun (void)
+{
+  std::string commands = CreateTempDirFilename ("commands.txt");
+  std::ofstream (commands.c_str ()).close ();
+
+  // every packet goes to the first class with its length as rank
+  std::string json = CreateTempDirFilename ("limit.json");
+  WriteP4Program (json, "[" + CopyField ("rank", "pkt_len_bytes") + "]");
+
+  Ptr<P4QueueDisc> qdisc = CreateObject<P4QueueDisc> ();
+  qdisc->SetAttribute ("JsonFile", StringValue (json));
+  qdisc->SetAttribute ("CommandsFile", StringValue (commands));
+  qdisc->SetAttribute ("MaxSize", QueueSizeValue (QueueSize ("1000B")));
+  // the class alone could hold many more packets
+  Ptr<QueueDisc> fifo = CreateObject<FifoQueueDisc> ();
+  fifo->SetAttribute ("MaxSize", QueueSizeValue (QueueSize ("100000B")));
+  fifo->Initialize ();
+  Ptr<QueueDiscClass> c = CreateObject<QueueDiscClass> ();
+  c->SetQueueDisc (fifo);
+  qdisc->AddQueueDiscClass (c);
+  qdisc->Initialize ();
+
+  for (uint32_t i = 0; i < 12; i++)
+    {
+      Ptr<QueueDiscItem> item = Create<P4TestItem> (Create<Packet> (100), 0x0800, 1);
+      item->SetPriority (5);
+      bool enqueued = qdisc->Enqueue (item);
+      NS_TEST_EXPECT_MSG_EQ (enqueued, (i < 10), "Unexpected outcome of the enqueue of packet " << i);
+      NS_TEST_EXPECT_MSG_EQ (item->GetRank (), 100, "The rank should be the one computed by the P4 program");
+      NS_TEST_EXPECT_MSG_EQ (item->GetPriority (), 5, "The priority should be left untouched");
+    }
+  NS_TEST_EXPECT_MSG_EQ (qdisc->GetNBytes (), 1000, "The queue disc should be full");
+  NS_TEST_EXPECT_MSG_EQ (qdisc->GetStats ().GetNDroppedPackets (P4QueueDisc::LIMIT_EXCEEDED_DROP), 2,
+                         "The packets beyond the limit of the queue disc should be dropped");
+
+  qdisc->Dispose ();
+  Simulator::Destroy ();
+}
+
+/**
+ * \ingroup traffic-control-test
+ * \ingroup tests
+ *
+ * \brief P4 Queue Disc Verdict Cache Test Case
+ *
+ * The programs reading a standard metadata field outside the key of the
+ * verdict cache are rejected, and the verdicts served from the cache match
+ * those of a queue disc running the pipeline on every packet
+ */
+class P4QueueDiscVerdictCacheTestCase : public TestCase
+{
+public:
+  P4QueueDiscVerdictCacheTestCase ();
+  virtual void DoRun (void);
+
+private:
+  /**
+   * Create a P4 queue disc running a program
+   *
+   * \param json the JSON file of the program
+   * \param commands the CLI commands file
+   * \param cache whether to enable the verdict cache
+   * \return the queue disc
+   */
+  static Ptr<P4QueueDisc> CreateQueueDisc (std::string json, std::string commands, bool cache);
+};
+
+P4QueueDiscVerdictCacheTestCase::P4QueueDiscVerdictCacheTestCase ()
+  : TestCase ("Check that the verdict cache of the P4 queue disc matches the pipeline")
+{
+}
+
+Ptr<P4QueueDisc>
+P4QueueDiscVerdictCacheTestCase::CreateQueueDisc (std::string json, std::string commands, bool cache)
+{
+  Ptr<P4QueueDisc> qdisc = CreateObject<P4QueueDisc> ();
+  qdisc->SetAttribute ("JsonFile", StringValue (json));
+  qdisc->SetAttribute ("CommandsFile", StringValue (commands));
+  qdisc->SetAttribute ("EnableP4Vars", BooleanValue (false));
+  qdisc->SetAttribute ("EnableVerdictCache", BooleanValue (cache));
+  qdisc->SetAttribute ("VerdictCacheQueueBits", UintegerValue (0));
+  qdisc->Initialize ();
+  return qdisc;
+}
+
+void
+P4QueueDiscVerdictCacheTestCase::DoRun (void)
+{
+  std::string commands = CreateTempDirFilename ("commands.txt");
+  std::ofstream (commands.c_str ()).close ();
+
+  // the rank depends on the key of the cache only
+  std::string keyed = CreateTempDirFilename ("keyed.json");
+  WriteP4Program (keyed, "[" + AddFields ("rank", "flow_hash", "l3_proto") + "]");
+  // the rank depends on the packet length as well
+  std::string unkeyed = CreateTempDirFilename ("unkeyed.json");
+  WriteP4Program (unkeyed, "[" + AddFields ("rank", "flow_hash", "pkt_len") + "]");
+  // the rank depends on the queue depth, which is only keyed with VerdictCacheQueueBits set
+  std::string qdepth = CreateTempDirFilename ("qdepth.json");
+  WriteP4Program (qdepth, "[" + AddFields ("rank", "flow_hash", "qdepth") + "]");
+
+  std::set<std::string> key = {"flow_hash", "l3_proto"};
+  std::string reason;
+  SimpleP4Pipe unkeyedPipe (unkeyed);
+  NS_TEST_EXPECT_MSG_EQ (unkeyedPipe.is_memoizable (key, reason), false,
+                         "A program reading pkt_len should not be memoizable");
+  NS_TEST_EXPECT_MSG_NE (reason.find ("pkt_len"), std::string::npos,
+                         "The reason should name the field, got: " << reason);
+  SimpleP4Pipe qdepthPipe (qdepth);
+  NS_TEST_EXPECT_MSG_EQ (qdepthPipe.is_memoizable (key, reason), false,
+                         "A program reading qdepth should not be memoizable without qdepth in the key");
+  key.insert ("qdepth");
+  NS_TEST_EXPECT_MSG_EQ (qdepthPipe.is_memoizable (key, reason), true,
+                         "A program reading qdepth should be memoizable with qdepth in the key");
+
+  // the rank is set for the packets with a given DSCP/ECN byte only, which is
+  // not covered by the flow hash
+  std::string branch = CreateTempDirFilename ("branch.json");
+  WriteP4Program (branch, "[" + AddFields ("rank", "flow_hash", "l3_proto") + "]", false, "[]",
+                  "{\"type\": \"expression\", \"value\": {\"op\": \"==\","
+                  " \"left\": {\"type\": \"field\", \"value\": [\"ipv4\", \"diffserv\"]},"
+                  " \"right\": {\"type\": \"hexstr\", \"value\": \"0x01\"}}}");
+  SimpleP4Pipe branchPipe (branch);
+  NS_TEST_EXPECT_MSG_EQ (branchPipe.is_memoizable (key, reason), false,
+                         "A program branching on a header field should not be memoizable");
+  NS_TEST_EXPECT_MSG_NE (reason.find ("ipv4.diffserv"), std::string::npos,
+                         "The reason should name the header field, got: " << reason);
+  // the action reads a header field, under a condition on the key only
+  std::string read = CreateTempDirFilename ("read.json");
+  WriteP4Program (read, "[" + AddFields ("rank", "flow_hash", "l3_proto") + ", "
+                  "{\"op\": \"modify_field\", \"parameters\": ["
+                  "{\"type\": \"field\", \"value\": [\"standard_metadata\", \"qid\"]}, "
+                  "{\"type\": \"field\", \"value\": [\"ipv4\", \"ttl\"]}]}]", false, "[]",
+                  "{\"type\": \"expression\", \"value\": {\"op\": \"==\","
+                  " \"left\": {\"type\": \"field\", \"value\": [\"standard_metadata\", \"l3_proto\"]},"
+                  " \"right\": {\"type\": \"hexstr\", \"value\": \"0x0800\"}}}");
+  SimpleP4Pipe readPipe (read);
+  NS_TEST_EXPECT_MSG_EQ (readPipe.is_memoizable (key, reason), false,
+                         "A program reading a header field in an action should not be memoizable");
+  NS_TEST_EXPECT_MSG_NE (reason.find ("ipv4.ttl"), std::string::npos,
+                         "The reason should name the header field, got: " << reason);
+  // a program parsing the header without reading it beyond the parser is fine
+  std::string parsed = CreateTempDirFilename ("parsed.json");
+  WriteP4Program (parsed, "[" + AddFields ("rank", "flow_hash", "l3_proto") + "]", false, "[]",
+                  "{\"type\": \"expression\", \"value\": {\"op\": \"==\","
+                  " \"left\": {\"type\": \"field\", \"value\": [\"standard_metadata\", \"l3_proto\"]},"
+                  " \"right\": {\"type\": \"hexstr\", \"value\": \"0x0800\"}}}");
+  SimpleP4Pipe parsedPipe (parsed);
+  NS_TEST_EXPECT_MSG_EQ (parsedPipe.is_memoizable (key, reason), true,
+                         "A program only parsing a header should be memoizable");
+
+  Ptr<P4QueueDisc> cached = CreateQueueDisc (keyed, commands, true);
+  Ptr<P4QueueDisc> fresh = CreateQueueDisc (keyed, commands, false);
+
+  // repeated flows hit the cache of the first queue disc
+  const uint16_t protocols[] = {0x0800, 0x86dd};
+  for (uint32_t i = 0; i < 40; i++)
+    {
+      uint32_t flow = 1000 + (i * 7) % 5;
+      uint16_t protocol = protocols[i % 2];
+      Ptr<QueueDiscItem> a = Create<P4TestItem> (Create<Packet> (100 + i), protocol, flow);
+      Ptr<QueueDiscItem> b = Create<P4TestItem> (Create<Packet> (100 + i), protocol, flow);
+      bool enqueuedA = cached->Enqueue (a);
+      bool enqueuedB = fresh->Enqueue (b);
+      NS_TEST_EXPECT_MSG_EQ (enqueuedA, enqueuedB, "The cached drop verdict differs for packet " << i);
+      NS_TEST_EXPECT_MSG_EQ (a->GetRank (), b->GetRank (), "The cached rank differs for packet " << i);
+      NS_TEST_EXPECT_MSG_EQ (a->GetRank (), flow + protocol, "Unexpected rank for packet " << i);
+      cached->Dequeue ();
+      fresh->Dequeue ();
+    }
+
+  cached->Dispose ();
+  fresh->Dispose ();
+  Simulator::Destroy ();
+}
+
+/**
+ * \ingroup traffic-control-test
+ * \ingroup tests
+ *
+ * \brief P4 Queue Disc Register Dump Test Case
+ *
+ * The register arrays are read through handles resolved once, and the
+ * register dump stops and its file is complete once the queue disc is
+ * disposed of
+ */
+class P4QueueDiscRegisterDumpTestCase : public TestCase
+{
+public:
+  P4QueueDiscRegisterDumpTestCase ();
+  virtual void DoRun (void);
+
+private:
+  /**
+   * Enqueue a packet
+   *
+   * \param qdisc the queue disc
+   * \param size the size of the packet
+   */
+  void Enqueue (Ptr<QueueDisc> qdisc, uint32_t size);
+};
+
+P4QueueDiscRegisterDumpTestCase::P4QueueDiscRegisterDumpTestCase ()
+  : TestCase ("Check the register reads and the register dump of the P4 queue disc")
+{
+}
+
+void
+P4QueueDiscRegisterDumpTestCase::Enqueue (Ptr<QueueDisc> qdisc, uint32_t size)
+{
+  qdisc->Enqueue (Create<P4TestItem> (Create<Packet> (size), 0x0800, 1));
+}
+
+void
+P4QueueDiscRegisterDumpTestCase::DoRun (void)
+{
+  std::string commands = CreateTempDirFilename ("commands.txt");
+  std::ofstream (commands.c_str ()).close ();
+
+  // the length of the latest packet is stored in the third cell of counts
+  std::string json = CreateTempDirFilename ("registers.json");
+  WriteP4Program (json, "[" + WriteRegister ("counts", 2, "pkt_len_bytes") + "]", false,
+                  "[{\"name\": \"counts\", \"id\": 0, \"size\": 4, \"bitwidth\": 32}]");
+
+  SimpleP4Pipe pipe (json);
+  NS_TEST_EXPECT_MSG_EQ (pipe.get_register_handle ("missing"), -1, "There should be no handle to a missing array");
+  int handle = pipe.get_register_handle ("counts");
+  NS_TEST_ASSERT_MSG_NE (handle, -1, "There should be a handle to counts");
+  NS_TEST_EXPECT_MSG_EQ (pipe.get_register_handle ("counts"), handle, "The handle should be reused");
+  NS_TEST_EXPECT_MSG_EQ (pipe.get_register_size (handle), 4, "Unexpected size of counts");
+  pipe.write_register (handle, 1, 7);
+  pipe.write_register (handle, 4, 9);
+  std::vector<uint64_t> values;
+  pipe.read_register (handle, values);
+  NS_TEST_ASSERT_MSG_EQ (values.size (), 4, "All the cells should be read");
+  for (uint32_t i = 0; i < 4; i++)
+    {
+      NS_TEST_EXPECT_MSG_EQ (values[i], (uint64_t) (i == 1 ? 7 : 0), "Unexpected value of cell " << i);
+    }
+
+  // samples at 10, 20 and 30 ms; the queue disc is disposed of at 35 ms
+  std::string dump = CreateTempDirFilename ("registers.dump");
+  Ptr<P4QueueDisc> qdisc = CreateObject<P4QueueDisc> ();
+  qdisc->SetAttribute ("JsonFile", StringValue (json));
+  qdisc->SetAttribute ("CommandsFile", StringValue (commands));
+  qdisc->SetAttribute ("RegisterDumpFile", StringValue (dump));
+  qdisc->SetAttribute ("RegisterDumpNames", StringValue ("counts"));
+  qdisc->SetAttribute ("RegisterDumpInterval", TimeValue (MilliSeconds (10)));
+  qdisc->Initialize ();
+
+  Simulator::Schedule (MilliSeconds (5), &P4QueueDiscRegisterDumpTestCase::Enqueue, this, qdisc, 100);
+  Simulator::Schedule (MilliSeconds (25), &P4QueueDiscRegisterDumpTestCase::Enqueue, this, qdisc, 300);
+  Simulator::Schedule (MilliSeconds (35), &P4QueueDisc::Dispose, qdisc);
+  // bound the simulation in case the register dump is not stopped
+  Simulator::Stop (Seconds (1));
+  Simulator::Run ();
+
+  std::ifstream in (dump.c_str (), std::ios::binary);
+  char magic[8];
+  uint32_t nColumns = 0, nameLen = 0, nCells = 0;
+  in.read (magic, sizeof (magic));
+  NS_TEST_EXPECT_MSG_EQ (std::string (magic, sizeof (magic)), "NS3COLS1", "Unexpected magic string");
+  in.read (reinterpret_cast<char *> (&nColumns), sizeof (nColumns));
+  NS_TEST_EXPECT_MSG_EQ (nColumns, 1, "There should be a single column");
+  in.read (reinterpret_cast<char *> (&nameLen), sizeof (nameLen));
+  std::string name (nameLen, ' ');
+  in.read (&name[0], nameLen);
+  NS_TEST_EXPECT_MSG_EQ (name, "counts", "Unexpected column name");
+  in.read (reinterpret_cast<char *> (&nCells), sizeof (nCells));
+  NS_TEST_EXPECT_MSG_EQ (nCells, 4, "Unexpected number of cells");
+
+  const uint64_t expected[] = {100, 100, 300};
+  uint32_t nSamples = 0;
+  int64_t ts;
+  while (in.read (reinterpret_cast<char *> (&ts), sizeof (ts)))
+    {
+      uint64_t cells[4];
+      in.read (reinterpret_cast<char *> (cells), sizeof (cells));
+      NS_TEST_ASSERT_MSG_EQ ((size_t) in.gcount (), sizeof (cells), "Sample " << nSamples << " is truncated");
+      NS_TEST_ASSERT_MSG_LT (nSamples, 3, "No sample should be taken after the queue disc is disposed of");
+      NS_TEST_EXPECT_MSG_EQ (ts, MilliSeconds (10 * (nSamples + 1)).GetNanoSeconds (), "Unexpected sample time");
+      NS_TEST_EXPECT_MSG_EQ (cells[2], expected[nSamples], "Unexpected value in sample " << nSamples);
+      nSamples++;
+    }
+  NS_TEST_EXPECT_MSG_EQ (nSamples, 3, "Three samples should be written");
+
+  Simulator::Destroy ();
+}
+
+/**
+ * \brief Record a change of a traced field
+ *
+ * \param changes the changes recorded so far
+ * \param oldValue the previous value of the field
+ * \param newValue the new value of the field
+ */
+static void
+RecordChange (std::vector<std::pair<uint64_t, uint64_t> > *changes, uint64_t oldValue, uint64_t newValue)
+{
+  changes->push_back (std::make_pair (oldValue, newValue));
+}
+
+/**
+ * \ingroup traffic-control-test
+ * \ingroup tests
+ *
+ * \brief P4 Queue Disc Traced Fields Test Case
+ *
+ * The register cells and PHV fields listed in TracedFields are resolved
+ * once and their changes are reported to the connected sinks
+ */
+class P4QueueDiscTracedFieldsTestCase : public TestCase
+{
+public:
+  P4QueueDiscTracedFieldsTestCase ();
+  virtual void DoRun (void);
+};
+
+P4QueueDiscTracedFieldsTestCase::P4QueueDiscTracedFieldsTestCase ()
+  : TestCase ("Check the register cells and PHV fields traced by the P4 queue disc")
+{
+}
+
+void
+P4QueueDiscTracedFieldsTestCase::DoRun (void)
+{
+  std::string commands = CreateTempDirFilename ("commands.txt");
+  std::ofstream (commands.c_str ()).close ();
+
+  // the length of the latest packet is stored in counts[2] and in the rank
+  std::string json = CreateTempDirFilename ("traced.json");
+  WriteP4Program (json, "[" + WriteRegister ("counts", 2, "pkt_len_bytes") + ", "
+                  + CopyField ("rank", "pkt_len_bytes") + "]", false,
+                  "[{\"name\": \"counts\", \"id\": 0, \"size\": 4, \"bitwidth\": 32}]");
+
+  SimpleP4Pipe pipe (json);
+  NS_TEST_EXPECT_MSG_EQ (pipe.set_traced_fields (std::vector<std::string> (1, "missing[0]")), false,
+                         "A cell of a missing register array should be rejected");
+  NS_TEST_EXPECT_MSG_EQ (pipe.set_traced_fields (std::vector<std::string> (1, "counts[4]")), false,
+                         "A cell past the end of the register array should be rejected");
+  std::vector<std::string> fields = {"counts[3]", "standard_metadata.rank", "meta.missing"};
+  NS_TEST_EXPECT_MSG_EQ (pipe.set_traced_fields (fields), true,
+                         "Existing register cells and PHV fields should be accepted");
+  NS_TEST_EXPECT_MSG_EQ (pipe.get_traced_values ().size (), 3, "There should be a value per traced field");
+
+  Ptr<P4QueueDisc> qdisc = CreateObject<P4QueueDisc> ();
+  qdisc->SetAttribute ("JsonFile", StringValue (json));
+  qdisc->SetAttribute ("CommandsFile", StringValue (commands));
+  qdisc->SetAttribute ("TracedFields", StringValue ("counts[2],standard_metadata.rank,meta.missing"));
+  qdisc->Initialize ();
+
+  std::vector<std::pair<uint64_t, uint64_t> > cell, rank, missing;
+  NS_TEST_EXPECT_MSG_EQ (qdisc->TraceConnectField ("counts[2]", MakeBoundCallback (&RecordChange, &cell)), true,
+                         "The sink of counts[2] should be connected");
+  NS_TEST_EXPECT_MSG_EQ (qdisc->TraceConnectField ("standard_metadata.rank", MakeBoundCallback (&RecordChange, &rank)),
+                         true, "The sink of the rank should be connected");
+  NS_TEST_EXPECT_MSG_EQ (qdisc->TraceConnectField ("meta.missing", MakeBoundCallback (&RecordChange, &missing)), true,
+                         "The sink of the missing field should be connected");
+
+  const uint32_t sizes[] = {100, 100, 300};
+  for (uint32_t size : sizes)
+    {
+      qdisc->Enqueue (Create<P4TestItem> (Create<Packet> (size), 0x0800, 1));
+      qdisc->Dequeue ();
+    }
+
+  // the second packet changes nothing
+  NS_TEST_ASSERT_MSG_EQ (cell.size (), 2, "Two changes of counts[2] should be reported");
+  NS_TEST_EXPECT_MSG_EQ (cell[0].first, 0, "Unexpected old value of counts[2]");
+  NS_TEST_EXPECT_MSG_EQ (cell[0].second, 100, "Unexpected new value of counts[2]");
+  NS_TEST_EXPECT_MSG_EQ (cell[1].first, 100, "Unexpected old value of counts[2]");
+  NS_TEST_EXPECT_MSG_EQ (cell[1].second, 300, "Unexpected new value of counts[2]");
+  NS_TEST_EXPECT_MSG_EQ ((rank == cell), true, "The rank should change along with counts[2]");
+  NS_TEST_EXPECT_MSG_EQ (missing.size (), 0, "A missing PHV field should read as 0");
+
+  qdisc->Dispose ();
+  Simulator::Destroy ();
+}
+
+/**
+ * \ingroup traffic-control-test
+ * \ingroup tests
+ *
+ * \brief P4 Node Egress Test Case
+ *
+ * The node-level P4 egress program is run on the packets a queue disc sends
+ * to its device, with the egress_port field set to the index of the device,
+ * and the packets it drops or marks are accounted for by the queue disc
+ */
+class P4NodeEgressTestCase : public TestCase
+{
+public:
+  P4NodeEgressTestCase ();
+  virtual void DoRun (void);
+};
+
+P4NodeEgressTestCase::P4NodeEgressTestCase ()
+  : TestCase ("Check the node-level P4 egress program run by the queue discs of a node")
+{
+}
+
+void
+P4NodeEgressTestCase::DoRun (void)
+{
+  std::string commands = CreateTempDirFilename ("commands.txt");
+  std::ofstream (commands.c_str ()).close ();
+
+  // the packets sent to the device of index 1 are dropped
+  std::string json = CreateTempDirFilename ("egress-port.json");
+  WriteP4Program (json, "[" + CopyField ("drop", "egress_port") + "]", true);
+
+  Ptr<Node> node = CreateObject<Node> ();
+  Ptr<P4Egress> p4Egress = CreateObject<P4Egress> ();
+  p4Egress->SetAttribute ("JsonFile", StringValue (json));
+  p4Egress->SetAttribute ("CommandsFile", StringValue (commands));
+  node->AggregateObject (p4Egress);
+
+  std::vector<Ptr<QueueDisc> > qdiscs;
+  for (uint32_t i = 0; i < 2; i++)
+    {
+      Ptr<SimpleNetDevice> device = CreateObject<SimpleNetDevice> ();
+      device->SetChannel (CreateObject<SimpleChannel> ());
+      node->AddDevice (device);
+      Ptr<NetDeviceQueueInterface> ndqi = CreateObject<NetDeviceQueueInterface> ();
+      ndqi->SetTxQueuesN (1);
+      ndqi->CreateTxQueues ();
+      device->AggregateObject (ndqi);
+
+      Ptr<QueueDisc> qdisc = CreateObject<PifoQueueDisc> ();
+      qdisc->SetNetDevice (device);
+      qdisc->Initialize ();
+      qdiscs.push_back (qdisc);
+    }
+
+  for (uint32_t i = 0; i < 2; i++)
+    {
+      for (uint32_t j = 0; j < 3; j++)
+        {
+          qdiscs[i]->Enqueue (Create<P4TestItem> (Create<Packet> (100), 0x0800, j));
+        }
+      qdiscs[i]->Run ();
+      NS_TEST_EXPECT_MSG_EQ (qdiscs[i]->GetNPackets (), 0, "All the packets should have left queue disc " << i);
+    }
+
+  QueueDisc::Stats stats0 = qdiscs[0]->GetStats ();
+  NS_TEST_EXPECT_MSG_EQ (stats0.GetNDroppedPackets (P4Egress::P4_NODE_EGRESS_DROP), 0,
+                         "No packet sent to the device of index 0 should be dropped");
+  NS_TEST_EXPECT_MSG_EQ (stats0.nTotalSentPackets, 3, "The packets should be sent to the device of index 0");
+  QueueDisc::Stats stats1 = qdiscs[1]->GetStats ();
+  NS_TEST_EXPECT_MSG_EQ (stats1.GetNDroppedPackets (P4Egress::P4_NODE_EGRESS_DROP), 3,
+                         "The packets sent to the device of index 1 should be dropped");
+  NS_TEST_EXPECT_MSG_EQ (stats1.nTotalSentPackets, 0, "The dropped packets should not be counted as sent");
+
+  // the device is passed to the program also when it is run directly
+  Ptr<Packet> packet = Create<Packet> (100);
+  bool mark = false;
+  NS_TEST_EXPECT_MSG_EQ (p4Egress->Process (node->GetDevice (0), packet, 0x0800, 0, mark), true,
+                         "The packet should pass on the device of index 0");
+  NS_TEST_EXPECT_MSG_EQ (p4Egress->Process (node->GetDevice (1), packet, 0x0800, 0, mark), false,
+                         "The packet should be dropped on the device of index 1");
+
+  // on another node, the packets sent to the device of index 1 are marked
+  std::string markJson = CreateTempDirFilename ("egress-mark.json");
+  WriteP4Program (markJson, "[" + CopyField ("mark", "egress_port") + "]", true);
+
+  Ptr<Node> markNode = CreateObject<Node> ();
+  Ptr<P4Egress> p4EgressMark = CreateObject<P4Egress> ();
+  p4EgressMark->SetAttribute ("JsonFile", StringValue (markJson));
+  p4EgressMark->SetAttribute ("CommandsFile", StringValue (commands));
+  markNode->AggregateObject (p4EgressMark);
+
+  for (uint32_t i = 0; i < 2; i++)
+    {
+      Ptr<SimpleNetDevice> device = CreateObject<SimpleNetDevice> ();
+      device->SetChannel (CreateObject<SimpleChannel> ());
+      markNode->AddDevice (device);
+      Ptr<NetDeviceQueueInterface> ndqi = CreateObject<NetDeviceQueueInterface> ();
+      ndqi->SetTxQueuesN (1);
+      ndqi->CreateTxQueues ();
+      device->AggregateObject (ndqi);
+
+      Ptr<QueueDisc> qdisc = CreateObject<PifoQueueDisc> ();
+      qdisc->SetNetDevice (device);
+      qdisc->Initialize ();
+      qdiscs.push_back (qdisc);
+    }
+
+  for (uint32_t i = 2; i < 4; i++)
+    {
+      for (uint32_t j = 0; j < 3; j++)
+        {
+          qdiscs[i]->Enqueue (Create<P4TestItem> (Create<Packet> (100), 0x0800, j));
+        }
+      qdiscs[i]->Run ();
+    }
+
+  QueueDisc::Stats stats2 = qdiscs[2]->GetStats ();
+  NS_TEST_EXPECT_MSG_EQ (stats2.GetNMarkedPackets (P4Egress::P4_NODE_EGRESS_MARK), 0,
+                         "No packet sent to the device of index 0 should be marked");
+  NS_TEST_EXPECT_MSG_EQ (stats2.nTotalSentPackets, 3, "The packets should be sent to the device of index 0");
+  QueueDisc::Stats stats3 = qdiscs[3]->GetStats ();
+  NS_TEST_EXPECT_MSG_EQ (stats3.GetNMarkedPackets (P4Egress::P4_NODE_EGRESS_MARK), 3,
+                         "The packets sent to the device of index 1 should be marked");
+  NS_TEST_EXPECT_MSG_EQ (stats3.nTotalSentPackets, 3, "The marked packets should still be sent");
+
+  for (uint32_t i = 0; i < qdiscs.size (); i++)
+    {
+      qdiscs[i]->Dispose ();
+    }
+  node->Dispose ();
+  markNode->Dispose ();
+  Simulator::Destroy ();
+}
+
+/**
+ * \ingroup traffic-control-test
+ * \ingroup tests
+ *
+ * \brief P4 Queue Disc Test Suite
+ */
+static class P4QueueDiscTestSuite : public TestSuite
+{
+public:
+  P4QueueDiscTestSuite ()
+    : TestSuite ("p4-queue-disc", UNIT)
+  {
+    AddTestCase (new P4QueueDiscHeaderOnlyImportTestCase (), TestCase::EXTENSIVE);
+    AddTestCase (new P4QueueDiscLimitTestCase (), TestCase::EXTENSIVE);
+    AddTestCase (new P4QueueDiscVerdictCacheTestCase (), TestCase::EXTENSIVE);
+    AddTestCase (new P4QueueDiscRegisterDumpTestCase (), TestCase::EXTENSIVE);
+    AddTestCase (new P4QueueDiscTracedFieldsTestCase (), TestCase::EXTENSIVE);
+    AddTestCase (new P4NodeEgressTestCase (), TestCase::EXTENSIVE);
+  }
+} g_p4QueueDiscTestSuite; ///< the test suite
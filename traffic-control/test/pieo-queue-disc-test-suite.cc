@@ -0,0 +1,369 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Copyright (c) 2018 Stanford University
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Authors: Stephen Ibanez <sibanez@stanford.edu>
+ *
+ */
+
+#include "ns3/test.h"
+#include "ns3/pieo-queue-disc.h"
+#include "ns3/pieo-engine.h"
+#include "ns3/packet.h"
+#include "ns3/simulator.h"
+#include <algorithm>
+#include <random>
+#include <vector>
+
+using namespace ns3;
+
+/**
+ * \ingroup traffic-control-test
+ * \ingroup tests
+ *
+ * \brief Pieo Queue Disc Test Item
+ */
+class PieoTestItem : public QueueDiscItem
+{
+public:
+  /**
+   * Constructor
+   *
+   * \param p the packet
+   * \param rank the rank of the packet
+   * \param eligible the eligibility time of the packet
+   */
+  PieoTestItem (Ptr<Packet> p, uint32_t rank, Time eligible);
+  virtual ~PieoTestItem ();
+  virtual void AddHeader (void);
+  virtual bool Mark (void);
+
+  Time m_eligible;  //!< the eligibility time of the packet
+};
+
+PieoTestItem::PieoTestItem (Ptr<Packet> p, uint32_t rank, Time eligible)
+  : QueueDiscItem (p, Address (), 0),
+    m_eligible (eligible)
+{
+  SetPriority (rank);
+}
+
+PieoTestItem::~PieoTestItem ()
+{
+}
+
+void
+PieoTestItem::AddHeader (void)
+{
+}
+
+bool
+PieoTestItem::Mark (void)
+{
+  return false;
+}
+
+/**
+ * \ingroup traffic-control-test
+ * \ingroup tests
+ *
+ * \brief Pieo Queue Disc Eligibility Test Case
+ *
+ * Packets are dequeued in rank order among the eligible packets only, and
+ * the queue disc schedules a wake-up at the next eligibility time when no
+ * packet is eligible
+ */
+class PieoQueueDiscEligibilityTestCase : public TestCase
+{
+public:
+  PieoQueueDiscEligibilityTestCase ();
+  virtual void DoRun (void);
+
+private:
+  /**
+   * Eligibility callback returning the time stored in a PieoTestItem
+   *
+   * \param item the packet
+   * \return the eligibility time
+   */
+  static Time Eligible (Ptr<const QueueDiscItem> item);
+
+  /**
+   * Dequeue a packet and check it
+   *
+   * \param qdisc the queue disc
+   * \param expected the expected packet, or 0 if no packet is expected
+   */
+  void Check (Ptr<PieoQueueDisc> qdisc, Ptr<QueueDiscItem> expected);
+};
+
+PieoQueueDiscEligibilityTestCase::PieoQueueDiscEligibilityTestCase ()
+  : TestCase ("Check that the pieo queue disc only dequeues eligible packets")
+{
+}
+
+Time
+PieoQueueDiscEligibilityTestCase::Eligible (Ptr<const QueueDiscItem> item)
+{
+  return DynamicCast<const PieoTestItem> (item)->m_eligible;
+}
+
+void
+PieoQueueDiscEligibilityTestCase::Check (Ptr<PieoQueueDisc> qdisc, Ptr<QueueDiscItem> expected)
+{
+  Ptr<const QueueDiscItem> peeked = qdisc->Peek ();
+  Ptr<QueueDiscItem> item = qdisc->Dequeue ();
+  NS_TEST_EXPECT_MSG_EQ (peeked, item, "Peek should return the packet to dequeue next");
+  NS_TEST_EXPECT_MSG_EQ (item, expected, "Unexpected packet dequeued at " << Simulator::Now ().GetSeconds () << "s");
+}
+
+void
+PieoQueueDiscEligibilityTestCase::DoRun (void)
+{
+  Ptr<PieoQueueDisc> qdisc = CreateObject<PieoQueueDisc> ();
+  qdisc->SetEligibilityCallback (MakeCallback (&PieoQueueDiscEligibilityTestCase::Eligible));
+  qdisc->Initialize ();
+
+  Ptr<QueueDiscItem> early = Create<PieoTestItem> (Create<Packet> (100), 0, Seconds (1));
+  Ptr<QueueDiscItem> late = Create<PieoTestItem> (Create<Packet> (100), 1, Seconds (2));
+  Ptr<QueueDiscItem> high = Create<PieoTestItem> (Create<Packet> (100), 5, Seconds (0));
+  Ptr<QueueDiscItem> low = Create<PieoTestItem> (Create<Packet> (100), 3, Seconds (0));
+  qdisc->Enqueue (late);
+  qdisc->Enqueue (early);
+  qdisc->Enqueue (high);
+  qdisc->Enqueue (low);
+  NS_TEST_EXPECT_MSG_EQ (qdisc->GetNPackets (), 4, "There should be 4 packets in the queue disc");
+
+  // the packets of lower rank are not eligible yet
+  Check (qdisc, low);
+  Check (qdisc, high);
+  Check (qdisc, 0);
+  NS_TEST_EXPECT_MSG_EQ (qdisc->GetNPackets (), 2, "The ineligible packets should still be queued");
+
+  Simulator::Schedule (Seconds (0.5), &PieoQueueDiscEligibilityTestCase::Check, this,
+                       qdisc, Ptr<QueueDiscItem> (0));
+  Simulator::Schedule (Seconds (2.5), &PieoQueueDiscEligibilityTestCase::Check, this,
+                       qdisc, early);
+  Simulator::Schedule (Seconds (2.5), &PieoQueueDiscEligibilityTestCase::Check, this,
+                       qdisc, late);
+  Simulator::Run ();
+
+  NS_TEST_EXPECT_MSG_EQ (qdisc->GetNPackets (), 0, "The queue disc should be empty");
+
+  Simulator::Destroy ();
+}
+
+/**
+ * \ingroup traffic-control-test
+ * \ingroup tests
+ *
+ * \brief Pieo Queue Disc Wake-Up Test Case
+ *
+ * A dequeue or a peek finding no eligible packet schedules a wake-up at the
+ * earliest eligibility time
+ */
+class PieoQueueDiscWakeUpTestCase : public TestCase
+{
+public:
+  PieoQueueDiscWakeUpTestCase ();
+  virtual void DoRun (void);
+
+private:
+  /**
+   * Eligibility callback delaying the packets by their rank, in seconds
+   *
+   * \param item the packet
+   * \return the eligibility time
+   */
+  static Time Eligible (Ptr<const QueueDiscItem> item);
+};
+
+PieoQueueDiscWakeUpTestCase::PieoQueueDiscWakeUpTestCase ()
+  : TestCase ("Check that the pieo queue disc wakes up at the next eligibility time")
+{
+}
+
+Time
+PieoQueueDiscWakeUpTestCase::Eligible (Ptr<const QueueDiscItem> item)
+{
+  return Simulator::Now () + Seconds (item->GetPriority ());
+}
+
+void
+PieoQueueDiscWakeUpTestCase::DoRun (void)
+{
+  Ptr<PieoQueueDisc> qdisc = CreateObject<PieoQueueDisc> ();
+  qdisc->SetEligibilityCallback (MakeCallback (&PieoQueueDiscWakeUpTestCase::Eligible));
+  qdisc->Initialize ();
+
+  qdisc->Enqueue (Create<PieoTestItem> (Create<Packet> (100), 3, Time (0)));
+  qdisc->Enqueue (Create<PieoTestItem> (Create<Packet> (100), 2, Time (0)));
+  NS_TEST_EXPECT_MSG_EQ (qdisc->Dequeue (), 0, "No packet should be eligible");
+
+  // the only event is the wake-up, which finds no device to restart
+  Simulator::Run ();
+  NS_TEST_EXPECT_MSG_EQ (Simulator::Now (), Seconds (2), "The wake-up should happen at the earliest eligibility time");
+  NS_TEST_EXPECT_MSG_EQ (qdisc->GetNPackets (), 2, "The packets should still be queued");
+
+  Simulator::Destroy ();
+
+  // a parent queue disc peeking its child must arm the wake-up as well
+  qdisc = CreateObject<PieoQueueDisc> ();
+  qdisc->SetEligibilityCallback (MakeCallback (&PieoQueueDiscWakeUpTestCase::Eligible));
+  qdisc->Initialize ();
+
+  qdisc->Enqueue (Create<PieoTestItem> (Create<Packet> (100), 1, Time (0)));
+  NS_TEST_EXPECT_MSG_EQ (qdisc->Peek (), 0, "No packet should be eligible");
+
+  Simulator::Run ();
+  NS_TEST_EXPECT_MSG_EQ (Simulator::Now (), Seconds (1), "The peek should schedule the wake-up");
+  NS_TEST_EXPECT_MSG_EQ (qdisc->GetNPackets (), 1, "The packet should still be queued");
+
+  Simulator::Destroy ();
+}
+
+/**
+ * \ingroup traffic-control-test
+ * \ingroup tests
+ *
+ * \brief Pieo Engine Random Test Case
+ *
+ * Random pushes and extractions, with a small block size so that blocks are
+ * split, merged and removed often, are checked against a linear scan of the
+ * entries
+ */
+class PieoEngineRandomTestCase : public TestCase
+{
+public:
+  PieoEngineRandomTestCase ();
+  virtual void DoRun (void);
+
+private:
+  /// Item type, the sequence number of the entry
+  typedef uint64_t Item;
+  /// Entry type
+  typedef PieoEngine<Item>::Entry Entry;
+
+  /**
+   * Find the entry to extract in the reference model
+   *
+   * \param entries the entries
+   * \param now the current time
+   * \param eligibleOnly whether to consider the eligible entries only
+   * \return the index of the entry, or -1 if none qualifies
+   */
+  static int Best (const std::vector<Entry> &entries, uint64_t now, bool eligibleOnly);
+};
+
+PieoEngineRandomTestCase::PieoEngineRandomTestCase ()
+  : TestCase ("Check the pieo engine against a reference model")
+{
+}
+
+int
+PieoEngineRandomTestCase::Best (const std::vector<Entry> &entries, uint64_t now, bool eligibleOnly)
+{
+  int best = -1;
+  for (uint32_t i = 0; i < entries.size (); i++)
+    {
+      if (eligibleOnly && entries[i].eligible > now)
+        {
+          continue;
+        }
+      if (best < 0 || entries[i].rank < entries[best].rank
+          || (entries[i].rank == entries[best].rank && entries[i].seq < entries[best].seq))
+        {
+          best = i;
+        }
+    }
+  return best;
+}
+
+void
+PieoEngineRandomTestCase::DoRun (void)
+{
+  std::mt19937 rng (1);
+  std::uniform_int_distribution<uint32_t> op (0, 9);
+  std::uniform_int_distribution<uint64_t> rank (0, 200);
+  std::uniform_int_distribution<uint64_t> delay (0, 100);
+  std::uniform_int_distribution<uint64_t> advance (0, 20);
+
+  PieoEngine<Item> engine (4);
+  std::vector<Entry> model;
+  uint64_t seq = 0;
+  uint64_t now = 0;
+
+  for (uint32_t i = 0; i < 100000; i++)
+    {
+      uint32_t c = op (rng);
+      if (c < 5 && model.size () < 4000)
+        {
+          Entry entry = {rank (rng), now + delay (rng), seq, seq};
+          seq++;
+          engine.Push (entry);
+          model.push_back (entry);
+        }
+      else if (c < 8)
+        {
+          int best = Best (model, now, true);
+          const Entry *peeked = engine.PeekEligible (now);
+          NS_TEST_ASSERT_MSG_EQ ((peeked == 0), (best < 0), "Unexpected eligibility at " << now);
+          if (best >= 0)
+            {
+              NS_TEST_ASSERT_MSG_EQ (peeked->item, model[best].item, "Unexpected eligible entry peeked");
+              NS_TEST_ASSERT_MSG_EQ (engine.PopEligible (now).item, model[best].item, "Unexpected eligible entry popped");
+              model.erase (model.begin () + best);
+            }
+        }
+      else if (c < 9 && !model.empty ())
+        {
+          int best = Best (model, now, false);
+          NS_TEST_ASSERT_MSG_EQ (engine.Top ().item, model[best].item, "Unexpected top entry");
+          NS_TEST_ASSERT_MSG_EQ (engine.Pop ().item, model[best].item, "Unexpected entry popped");
+          model.erase (model.begin () + best);
+        }
+      else
+        {
+          now += advance (rng);
+        }
+
+      uint64_t minEligible = PieoEngine<Item>::NEVER;
+      for (const Entry &entry : model)
+        {
+          minEligible = std::min (minEligible, entry.eligible);
+        }
+      NS_TEST_ASSERT_MSG_EQ (engine.Size (), model.size (), "Unexpected number of entries");
+      NS_TEST_ASSERT_MSG_EQ (engine.GetMinEligible (), minEligible, "Unexpected earliest eligibility time");
+    }
+}
+
+/**
+ * \ingroup traffic-control-test
+ * \ingroup tests
+ *
+ * \brief Pieo Queue Disc Test Suite
+ */
+static class PieoQueueDiscTestSuite : public TestSuite
+{
+public:
+  PieoQueueDiscTestSuite ()
+    : TestSuite ("pieo-queue-disc", UNIT)
+  {
+    AddTestCase (new PieoQueueDiscEligibilityTestCase (), TestCase::QUICK);
+    AddTestCase (new PieoQueueDiscWakeUpTestCase (), TestCase::QUICK);
+    AddTestCase (new PieoEngineRandomTestCase (), TestCase::QUICK);
+  }
+} g_pieoQueueDiscTestSuite; ///< the test suite
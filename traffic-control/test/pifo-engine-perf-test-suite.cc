@@ -0,0 +1,334 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Copyright (c) 2018 Stanford University
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Authors: Stephen Ibanez <sibanez@stanford.edu>
+ *
+ */
+
+#include "ns3/test.h"
+#include "ns3/pifo-engine.h"
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+using namespace ns3;
+
+/**
+ * \ingroup traffic-control-test
+ * \ingroup tests
+ *
+ * \brief PIFO engine hold benchmark
+ *
+ * Classic "hold" model: the engine is filled with a given number of entries,
+ * then every operation dequeues the entry with the lowest rank and enqueues
+ * a new entry whose rank is the dequeued rank plus a random increment, so
+ * that the occupancy stays constant and the ranks increase monotonically as
+ * virtual times do. The time per hold operation (one dequeue and one
+ * enqueue) is printed for each engine.
+ */
+class PifoEngineHoldTestCase : public TestCase
+{
+public:
+  /**
+   * Constructor
+   *
+   * \param nQueued the number of queued entries
+   */
+  PifoEngineHoldTestCase (uint32_t nQueued);
+  virtual void DoRun (void);
+
+private:
+  /// Item type, pointer-sized like the items of a PrioQueue
+  typedef uintptr_t Item;
+
+  /**
+   * Run the hold benchmark on an engine
+   *
+   * \param name the name of the engine
+   * \param engine the engine
+   * \param exact whether the engine must dequeue the ranks in order
+   */
+  void Hold (std::string name, PifoEngine<Item> *engine, bool exact = true);
+
+  uint32_t m_nQueued;  //!< number of queued entries
+  uint32_t m_nOps;     //!< number of hold operations
+};
+
+PifoEngineHoldTestCase::PifoEngineHoldTestCase (uint32_t nQueued)
+  : TestCase ("PIFO engine hold benchmark with " + std::to_string (nQueued) + " queued packets"),
+    m_nQueued (nQueued),
+    m_nOps (1000000)
+{
+}
+
+void
+PifoEngineHoldTestCase::Hold (std::string name, PifoEngine<Item> *engine, bool exact)
+{
+  // same rank sequence for all the engines
+  std::mt19937 rng (1);
+  std::uniform_int_distribution<uint32_t> increment (0, 1000);
+  uint64_t seq = 0;
+
+  engine->Reserve (m_nQueued + 1);
+  for (uint32_t i = 0; i < m_nQueued; i++)
+    {
+      engine->Push ({increment (rng), seq, (Item) seq});
+      seq++;
+    }
+
+  uint64_t lastRank = 0;
+  bool ordered = true;
+  auto start = std::chrono::steady_clock::now ();
+  for (uint32_t i = 0; i < m_nOps; i++)
+    {
+      uint64_t rank = engine->Top ().rank;
+      ordered &= (rank >= lastRank);
+      lastRank = rank;
+      engine->Pop ();
+      engine->Push ({rank + increment (rng), seq, (Item) seq});
+      seq++;
+    }
+  auto end = std::chrono::steady_clock::now ();
+
+  NS_TEST_EXPECT_MSG_EQ (ordered || !exact, true, name << " engine dequeued ranks out of order");
+  NS_TEST_EXPECT_MSG_EQ (engine->Size (), m_nQueued, name << " engine lost entries");
+
+  double ns = std::chrono::duration<double, std::nano> (end - start).count ();
+  std::cout << "PIFO engine " << name << ", " << m_nQueued << " queued: "
+            << ns / m_nOps << " ns per hold operation";
+  if (!exact)
+    {
+      std::cout << ", " << engine->GetNInversions () << " rank inversions (mean magnitude "
+                << (engine->GetNInversions () > 0 ?
+                    static_cast<double> (engine->GetInversionMagnitude ()) / engine->GetNInversions () : 0)
+                << ")";
+    }
+  std::cout << std::endl;
+}
+
+void
+PifoEngineHoldTestCase::DoRun (void)
+{
+  std::unique_ptr<PifoEngine<Item> > engine;
+
+  engine.reset (new HeapPifoEngine<Item> ());
+  Hold ("Heap", engine.get ());
+
+  engine.reset (new DaryHeapPifoEngine<Item> ());
+  Hold ("DaryHeap", engine.get ());
+
+  engine.reset (new MinMaxHeapPifoEngine<Item> ());
+  Hold ("MinMaxHeap", engine.get ());
+
+  // the increments span less than the calendar window, hence the calendar
+  // engine is exact
+  engine.reset (new CalendarPifoEngine<Item> (4096, 1));
+  Hold ("Calendar", engine.get ());
+
+  // approximate engines, AIFO without admission control
+  engine.reset (new SpPifoEngine<Item> (8));
+  Hold ("SpPifo", engine.get (), false);
+
+  engine.reset (new AifoEngine<Item> (64, 0.1));
+  Hold ("Aifo", engine.get (), false);
+
+  // insertion in a sorted array is linear, only run it at hardware sizes
+  if (m_nQueued <= 4096)
+    {
+      engine.reset (new SortedArrayPifoEngine<Item> ());
+      Hold ("SortedArray", engine.get ());
+    }
+}
+
+/**
+ * \ingroup traffic-control-test
+ * \ingroup tests
+ *
+ * \brief PIFO engine per-operation cost benchmark
+ *
+ * Runs the hold model with a number of queued entries in the range of
+ * hardware PIFO blocks and times every enqueue and every dequeue separately,
+ * in TSC cycles on x86 (nanoseconds elsewhere). The median and the 99th
+ * percentile of the cost of each operation are printed for each engine,
+ * including the sorted array engine with and without SIMD search.
+ */
+class PifoEngineCyclesTestCase : public TestCase
+{
+public:
+  /**
+   * Constructor
+   *
+   * \param nQueued the number of queued entries
+   */
+  PifoEngineCyclesTestCase (uint32_t nQueued);
+  virtual void DoRun (void);
+
+private:
+  /// Item type, pointer-sized like the items of a PrioQueue
+  typedef uintptr_t Item;
+
+  /**
+   * Read the timer
+   *
+   * \return the current value of the timer
+   */
+  static uint64_t Now (void);
+
+  /**
+   * Print the median and the 99th percentile of a set of samples
+   *
+   * \param name the name of the engine
+   * \param op the name of the operation
+   * \param samples the samples (reordered)
+   */
+  void Report (std::string name, std::string op, std::vector<uint64_t> &samples);
+
+  /**
+   * Run the benchmark on an engine
+   *
+   * \param name the name of the engine
+   * \param engine the engine
+   */
+  void Measure (std::string name, PifoEngine<Item> *engine);
+
+  uint32_t m_nQueued;  //!< number of queued entries
+  uint32_t m_nOps;     //!< number of hold operations
+};
+
+PifoEngineCyclesTestCase::PifoEngineCyclesTestCase (uint32_t nQueued)
+  : TestCase ("PIFO engine per-operation cost with " + std::to_string (nQueued) + " queued packets"),
+    m_nQueued (nQueued),
+    m_nOps (200000)
+{
+}
+
+uint64_t
+PifoEngineCyclesTestCase::Now (void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc ();
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>
+           (std::chrono::steady_clock::now ().time_since_epoch ()).count ();
+#endif
+}
+
+void
+PifoEngineCyclesTestCase::Report (std::string name, std::string op, std::vector<uint64_t> &samples)
+{
+  std::sort (samples.begin (), samples.end ());
+  std::cout << "PIFO engine " << name << ", " << m_nQueued << " queued: " << op
+#if defined(__x86_64__) || defined(__i386__)
+            << " cycles"
+#else
+            << " ns"
+#endif
+            << " median " << samples[samples.size () / 2]
+            << ", p99 " << samples[samples.size () * 99 / 100] << std::endl;
+}
+
+void
+PifoEngineCyclesTestCase::Measure (std::string name, PifoEngine<Item> *engine)
+{
+  std::mt19937 rng (1);
+  std::uniform_int_distribution<uint32_t> increment (0, 1000);
+  uint64_t seq = 0;
+  std::vector<uint64_t> push;
+  std::vector<uint64_t> pop;
+  push.reserve (m_nOps);
+  pop.reserve (m_nOps);
+
+  engine->Reserve (m_nQueued + 1);
+  for (uint32_t i = 0; i < m_nQueued; i++)
+    {
+      engine->Push ({increment (rng), seq, (Item) seq});
+      seq++;
+    }
+
+  uint64_t lastRank = 0;
+  bool ordered = true;
+  for (uint32_t i = 0; i < m_nOps; i++)
+    {
+      uint64_t t0 = Now ();
+      uint64_t rank = engine->Top ().rank;
+      engine->Pop ();
+      uint64_t t1 = Now ();
+      PifoEntry<Item> entry = {rank + increment (rng), seq, (Item) seq};
+      seq++;
+      uint64_t t2 = Now ();
+      engine->Push (entry);
+      uint64_t t3 = Now ();
+
+      ordered &= (rank >= lastRank);
+      lastRank = rank;
+      pop.push_back (t1 - t0);
+      push.push_back (t3 - t2);
+    }
+
+  NS_TEST_EXPECT_MSG_EQ (ordered, true, name << " engine dequeued ranks out of order");
+  NS_TEST_EXPECT_MSG_EQ (engine->Size (), m_nQueued, name << " engine lost entries");
+
+  Report (name, "enqueue", push);
+  Report (name, "dequeue", pop);
+}
+
+void
+PifoEngineCyclesTestCase::DoRun (void)
+{
+  std::unique_ptr<PifoEngine<Item> > engine;
+
+  engine.reset (new DaryHeapPifoEngine<Item> ());
+  Measure ("DaryHeap", engine.get ());
+
+  engine.reset (new CalendarPifoEngine<Item> (4096, 1));
+  Measure ("Calendar", engine.get ());
+
+  engine.reset (new SortedArrayPifoEngine<Item, true> ());
+  Measure ("SortedArray", engine.get ());
+
+  engine.reset (new SortedArrayPifoEngine<Item, false> ());
+  Measure ("SortedArray (scalar)", engine.get ());
+}
+
+/**
+ * \ingroup traffic-control-test
+ * \ingroup tests
+ *
+ * \brief PIFO engine performance test suite
+ */
+static class PifoEnginePerfTestSuite : public TestSuite
+{
+public:
+  PifoEnginePerfTestSuite ()
+    : TestSuite ("pifo-engine-perf", PERFORMANCE)
+  {
+    AddTestCase (new PifoEngineHoldTestCase (1000), TestCase::QUICK);
+    AddTestCase (new PifoEngineHoldTestCase (100000), TestCase::EXTENSIVE);
+    AddTestCase (new PifoEngineHoldTestCase (1000000), TestCase::EXTENSIVE);
+    AddTestCase (new PifoEngineCyclesTestCase (256), TestCase::QUICK);
+    AddTestCase (new PifoEngineCyclesTestCase (1024), TestCase::QUICK);
+    AddTestCase (new PifoEngineCyclesTestCase (2048), TestCase::QUICK);
+  }
+} g_pifoEnginePerfTestSuite; ///< the test suite
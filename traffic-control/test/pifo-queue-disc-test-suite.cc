@@ -26,10 +26,20 @@
 #include "ns3/packet.h"
 #include "ns3/socket.h"
 #include "ns3/string.h"
+#include "ns3/enum.h"
+#include "ns3/uinteger.h"
+#include "ns3/double.h"
 #include "ns3/log.h"
 #include "ns3/simulator.h"
+#include "ns3/object-factory.h"
+#include "ns3/prio-queue.h"
+#include "ns3/net-device-queue-interface.h"
+#include "ns3/node.h"
+#include <algorithm>
 #include <array>
+#include <limits>
 #include <queue>
+#include <vector>
 
 using namespace ns3;
 
@@ -47,15 +57,21 @@ public:
    *
    * \param p the packet
    * \param addr the address
+   * \param flow the flow hash
    */
-  PifoQueueDiscTestItem (Ptr<Packet> p, const Address & addr);
+  PifoQueueDiscTestItem (Ptr<Packet> p, const Address & addr, uint32_t flow = 0);
   virtual ~PifoQueueDiscTestItem ();
   virtual void AddHeader (void);
   virtual bool Mark (void);
+  virtual uint32_t Hash (uint32_t perturbation) const;
+
+private:
+  uint32_t m_flow;  //!< the flow hash
 };
 
-PifoQueueDiscTestItem::PifoQueueDiscTestItem (Ptr<Packet> p, const Address & addr)
-  : QueueDiscItem (p, addr, 0)
+PifoQueueDiscTestItem::PifoQueueDiscTestItem (Ptr<Packet> p, const Address & addr, uint32_t flow)
+  : QueueDiscItem (p, addr, 0),
+    m_flow (flow)
 {
 }
 
@@ -74,6 +90,12 @@ PifoQueueDiscTestItem::Mark (void)
   return false;
 }
 
+uint32_t
+PifoQueueDiscTestItem::Hash (uint32_t perturbation) const
+{
+  return m_flow;
+}
+
 
 /**
  * \ingroup traffic-control-test
@@ -225,6 +247,1273 @@ PifoQueueDiscTestCase::DoRun (void)
   Simulator::Destroy ();
 }
 
+/**
+ * \ingroup traffic-control-test
+ * \ingroup tests
+ *
+ * \brief Pifo Queue Disc No Filter Test Case
+ *
+ * Without a packet filter, the PIFO queue disc schedules packets according
+ * to the rank stamped on them before enqueue (e.g., by a P4QueueDisc parent)
+ */
+class PifoQueueDiscNoFilterTestCase : public TestCase
+{
+public:
+  PifoQueueDiscNoFilterTestCase ();
+  virtual void DoRun (void);
+};
+
+PifoQueueDiscNoFilterTestCase::PifoQueueDiscNoFilterTestCase ()
+  : TestCase ("Check that the pifo queue disc uses the stamped rank if no filter is provided")
+{
+}
+
+void
+PifoQueueDiscNoFilterTestCase::DoRun (void)
+{
+  Ptr<PifoQueueDisc> qdisc = CreateObject<PifoQueueDisc> ();
+  Ptr<QueueDiscItem> item;
+  Address dest;
+  MyPrioQueue uid_pifo;
+
+  qdisc->Initialize ();
+
+  uint32_t ranks[] = {30, 10, 20, 5, 40};
+  for (uint32_t rank : ranks)
+    {
+      item = Create<PifoQueueDiscTestItem> (Create<Packet> (100), dest);
+      item->SetPriority (rank);
+      qdisc->Enqueue (item);
+      uid_pifo.emplace (item->GetPacket ()->GetUid (), rank);
+    }
+
+  NS_TEST_EXPECT_MSG_EQ (qdisc->GetNPackets (), 5, "There should be 5 packets in the queue disc");
+
+  while ((item = qdisc->Dequeue ()))
+    {
+      NS_TEST_ASSERT_MSG_NE (uid_pifo.size (), 0, "The uid_pifo should not be empty yet");
+      NS_TEST_EXPECT_MSG_EQ (item->GetPacket ()->GetUid (), uid_pifo.top ().m_uid,
+                             "Packets should be dequeued in rank order");
+      uid_pifo.pop ();
+    }
+
+  Simulator::Destroy ();
+}
+
+/**
+ * \ingroup traffic-control-test
+ * \ingroup tests
+ *
+ * \brief Pifo Queue Disc FIFO Tie-Breaking Test Case
+ *
+ * Packets with the same rank must be dequeued in the order they were enqueued
+ */
+class PifoQueueDiscFifoTieTestCase : public TestCase
+{
+public:
+  /**
+   * Constructor
+   *
+   * \param engine the engine used by the pifo queue disc
+   * \param name the name of the engine
+   */
+  PifoQueueDiscFifoTieTestCase (PifoEngineType engine, std::string name);
+  virtual void DoRun (void);
+
+private:
+  PifoEngineType m_engine;  //!< the engine used by the pifo queue disc
+};
+
+PifoQueueDiscFifoTieTestCase::PifoQueueDiscFifoTieTestCase (PifoEngineType engine, std::string name)
+  : TestCase ("Check that the pifo queue disc (" + name + " engine) dequeues packets of equal rank in FIFO order"),
+    m_engine (engine)
+{
+}
+
+void
+PifoQueueDiscFifoTieTestCase::DoRun (void)
+{
+  Ptr<PifoQueueDisc> qdisc = CreateObject<PifoQueueDisc> ();
+  Ptr<QueueDiscItem> item;
+  Address dest;
+
+  qdisc->SetAttribute ("Engine", EnumValue (m_engine));
+  qdisc->Initialize ();
+
+  // interleave three ranks, enough packets to exercise the heap
+  std::array<std::vector<uint64_t>, 3> uids;
+  for (uint32_t i = 0; i < 300; i++)
+    {
+      uint32_t rank = (i * 7) % 3;
+      item = Create<PifoQueueDiscTestItem> (Create<Packet> (100), dest);
+      item->SetPriority (rank);
+      qdisc->Enqueue (item);
+      uids[rank].push_back (item->GetPacket ()->GetUid ());
+    }
+
+  NS_TEST_EXPECT_MSG_EQ (qdisc->GetNPackets (), 300, "There should be 300 packets in the queue disc");
+
+  // dequeue half of the rank 0 packets, then enqueue more packets of
+  // rank 0: they must follow the rank 0 packets already queued
+  uint32_t half = uids[0].size () / 2;
+  for (uint32_t i = 0; i < half; i++)
+    {
+      item = qdisc->Dequeue ();
+      NS_TEST_ASSERT_MSG_NE (item, 0, "The queue disc should not be empty");
+      NS_TEST_EXPECT_MSG_EQ (item->GetPriority (), 0, "Unexpected rank");
+      NS_TEST_EXPECT_MSG_EQ (item->GetPacket ()->GetUid (), uids[0][i],
+                             "Packets of rank 0 should be dequeued in FIFO order");
+    }
+  uids[0].erase (uids[0].begin (), uids[0].begin () + half);
+  for (uint32_t i = 0; i < 10; i++)
+    {
+      item = Create<PifoQueueDiscTestItem> (Create<Packet> (100), dest);
+      item->SetPriority (0);
+      qdisc->Enqueue (item);
+      uids[0].push_back (item->GetPacket ()->GetUid ());
+    }
+
+  for (uint32_t rank = 0; rank < 3; rank++)
+    {
+      for (uint64_t uid : uids[rank])
+        {
+          item = qdisc->Dequeue ();
+          NS_TEST_ASSERT_MSG_NE (item, 0, "The queue disc should not be empty");
+          NS_TEST_EXPECT_MSG_EQ (item->GetPriority (), rank, "Unexpected rank");
+          NS_TEST_EXPECT_MSG_EQ (item->GetPacket ()->GetUid (), uid,
+                                 "Packets of rank " << rank << " should be dequeued in FIFO order");
+        }
+    }
+  NS_TEST_EXPECT_MSG_EQ (qdisc->Dequeue (), 0, "The queue disc should be empty");
+
+  Simulator::Destroy ();
+}
+
+/**
+ * \ingroup traffic-control-test
+ * \ingroup tests
+ *
+ * \brief Pifo Queue Disc Calendar Engine Test Case
+ *
+ * With a granularity of 1 and ranks spanning less than the calendar window,
+ * the calendar engine must dequeue packets exactly as the heap engine does,
+ * including when the window wraps around
+ */
+class PifoQueueDiscCalendarTestCase : public TestCase
+{
+public:
+  PifoQueueDiscCalendarTestCase ();
+  virtual void DoRun (void);
+};
+
+PifoQueueDiscCalendarTestCase::PifoQueueDiscCalendarTestCase ()
+  : TestCase ("Check that the calendar engine of the pifo queue disc dequeues packets in rank order")
+{
+}
+
+void
+PifoQueueDiscCalendarTestCase::DoRun (void)
+{
+  Ptr<PifoQueueDisc> qdisc = CreateObject<PifoQueueDisc> ();
+  Ptr<QueueDiscItem> item;
+  Address dest;
+
+  qdisc->SetAttribute ("Engine", EnumValue (CALENDAR_ENGINE));
+  qdisc->SetAttribute ("CalendarBuckets", UintegerValue (64));
+  qdisc->Initialize ();
+
+  // (rank, uid) of the queued packets, sorted by rank then enqueue order
+  std::vector<std::pair<uint32_t, uint64_t> > expected;
+  uint32_t base = 0;
+  for (uint32_t round = 0; round < 20; round++)
+    {
+      for (uint32_t i = 0; i < 10; i++)
+        {
+          uint32_t rank = base + (i * 37 + round * 11) % 60;
+          item = Create<PifoQueueDiscTestItem> (Create<Packet> (100), dest);
+          item->SetPriority (rank);
+          qdisc->Enqueue (item);
+          expected.push_back (std::make_pair (rank, item->GetPacket ()->GetUid ()));
+        }
+      std::stable_sort (expected.begin (), expected.end (),
+                        [] (const std::pair<uint32_t, uint64_t> &a, const std::pair<uint32_t, uint64_t> &b)
+                        { return a.first < b.first; });
+
+      // dequeue half of the packets, the window moves forward
+      for (uint32_t i = 0; i < 5; i++)
+        {
+          item = qdisc->Dequeue ();
+          NS_TEST_ASSERT_MSG_NE (item, 0, "The queue disc should not be empty");
+          NS_TEST_EXPECT_MSG_EQ (item->GetPriority (), expected.front ().first, "Unexpected rank");
+          NS_TEST_EXPECT_MSG_EQ (item->GetPacket ()->GetUid (), expected.front ().second, "Unexpected packet");
+          base = expected.front ().first;
+          expected.erase (expected.begin ());
+        }
+    }
+
+  for (auto &e : expected)
+    {
+      item = qdisc->Dequeue ();
+      NS_TEST_ASSERT_MSG_NE (item, 0, "The queue disc should not be empty");
+      NS_TEST_EXPECT_MSG_EQ (item->GetPacket ()->GetUid (), e.second, "Unexpected packet");
+    }
+  NS_TEST_EXPECT_MSG_EQ (qdisc->Dequeue (), 0, "The queue disc should be empty");
+
+  Simulator::Destroy ();
+}
+
+/**
+ * \ingroup traffic-control-test
+ * \ingroup tests
+ *
+ * \brief Pifo Queue Disc Drop-Worst Overflow Policy Test Case
+ *
+ * When the queue disc is full, an arriving packet must evict the packet with
+ * the highest rank if it has a lower rank, and be dropped otherwise
+ */
+class PifoQueueDiscDropWorstTestCase : public TestCase
+{
+public:
+  /**
+   * Constructor
+   *
+   * \param engine the engine used by the pifo queue disc
+   * \param name the name of the engine
+   */
+  PifoQueueDiscDropWorstTestCase (PifoEngineType engine, std::string name);
+  virtual void DoRun (void);
+
+private:
+  /**
+   * Enqueue a packet
+   *
+   * \param qdisc the queue disc
+   * \param rank the rank of the packet
+   * \return the uid of the packet
+   */
+  uint64_t Enqueue (Ptr<PifoQueueDisc> qdisc, uint32_t rank);
+
+  PifoEngineType m_engine;  //!< the engine used by the pifo queue disc
+};
+
+PifoQueueDiscDropWorstTestCase::PifoQueueDiscDropWorstTestCase (PifoEngineType engine, std::string name)
+  : TestCase ("Check the DropWorst overflow policy of the pifo queue disc (" + name + " engine)"),
+    m_engine (engine)
+{
+}
+
+uint64_t
+PifoQueueDiscDropWorstTestCase::Enqueue (Ptr<PifoQueueDisc> qdisc, uint32_t rank)
+{
+  Address dest;
+  Ptr<QueueDiscItem> item = Create<PifoQueueDiscTestItem> (Create<Packet> (100), dest);
+  item->SetPriority (rank);
+  qdisc->Enqueue (item);
+  return item->GetPacket ()->GetUid ();
+}
+
+void
+PifoQueueDiscDropWorstTestCase::DoRun (void)
+{
+  Ptr<PifoQueueDisc> qdisc = CreateObject<PifoQueueDisc> ();
+  Ptr<QueueDiscItem> item;
+
+  qdisc->SetAttribute ("MaxSize", StringValue ("4p"));
+  qdisc->SetAttribute ("Engine", EnumValue (m_engine));
+  qdisc->SetAttribute ("OverflowPolicy", EnumValue (PifoQueueDisc::DROP_WORST));
+  qdisc->Initialize ();
+
+  uint64_t uid10 = Enqueue (qdisc, 10);
+  uint64_t uid20 = Enqueue (qdisc, 20);
+  Enqueue (qdisc, 30);
+  Enqueue (qdisc, 30);
+  NS_TEST_EXPECT_MSG_EQ (qdisc->GetNPackets (), 4, "There should be 4 packets in the queue disc");
+
+  // evicts the last packet of rank 30
+  uint64_t uid5 = Enqueue (qdisc, 5);
+  NS_TEST_EXPECT_MSG_EQ (qdisc->GetNPackets (), 4, "There should be 4 packets in the queue disc");
+  NS_TEST_EXPECT_MSG_EQ (qdisc->GetStats ().GetNDroppedPackets (PifoQueueDisc::EVICTED_DROP), 1,
+                         "One packet should have been evicted");
+
+  // does not outrank the worst packet, dropped
+  Enqueue (qdisc, 30);
+  Enqueue (qdisc, 40);
+  NS_TEST_EXPECT_MSG_EQ (qdisc->GetStats ().GetNDroppedPackets (PifoQueueDisc::LIMIT_EXCEEDED_DROP), 2,
+                         "Two arriving packets should have been dropped");
+
+  // evicts the first packet of rank 30
+  uint64_t uid25 = Enqueue (qdisc, 25);
+  NS_TEST_EXPECT_MSG_EQ (qdisc->GetStats ().GetNDroppedPackets (PifoQueueDisc::EVICTED_DROP), 2,
+                         "Two packets should have been evicted");
+  NS_TEST_EXPECT_MSG_EQ (qdisc->GetNPackets (), 4, "There should be 4 packets in the queue disc");
+
+  for (uint64_t uid : {uid5, uid10, uid20, uid25})
+    {
+      item = qdisc->Dequeue ();
+      NS_TEST_ASSERT_MSG_NE (item, 0, "The queue disc should not be empty");
+      NS_TEST_EXPECT_MSG_EQ (item->GetPacket ()->GetUid (), uid, "Packets should be dequeued in rank order");
+    }
+  NS_TEST_EXPECT_MSG_EQ (qdisc->Dequeue (), 0, "The queue disc should be empty");
+
+  // the limit of the queue disc applies even if the internal priority
+  // queue is larger
+  qdisc = CreateObject<PifoQueueDisc> ();
+  qdisc->SetAttribute ("MaxSize", StringValue ("2p"));
+  qdisc->SetAttribute ("OverflowPolicy", EnumValue (PifoQueueDisc::DROP_WORST));
+  ObjectFactory factory;
+  factory.SetTypeId ("ns3::PrioQueue<QueueDiscItem>");
+  factory.Set ("MaxSize", StringValue ("10p"));
+  factory.Set ("Engine", EnumValue (m_engine));
+  qdisc->AddInternalPrioQueue (factory.Create<QueueDisc::InternalPrioQueue> ());
+  qdisc->Initialize ();
+
+  Enqueue (qdisc, 30);
+  Enqueue (qdisc, 20);
+  Enqueue (qdisc, 10);
+  NS_TEST_EXPECT_MSG_EQ (qdisc->GetNPackets (), 2, "There should be 2 packets in the queue disc");
+  NS_TEST_EXPECT_MSG_EQ (qdisc->GetStats ().GetNDroppedPackets (PifoQueueDisc::EVICTED_DROP), 1,
+                         "The packet of rank 30 should have been evicted");
+
+  Simulator::Destroy ();
+}
+
+/**
+ * \ingroup traffic-control-test
+ * \ingroup tests
+ *
+ * \brief Pifo Queue Disc Byte Mode Test Case
+ *
+ * In byte mode, the limit applies to the sum of the sizes of the queued
+ * packets, and the DropWorst policy evicts as many packets as needed to
+ * admit the arriving packet, or none
+ */
+class PifoQueueDiscByteModeTestCase : public TestCase
+{
+public:
+  /**
+   * Constructor
+   *
+   * \param engine the engine of the pifo queue disc
+   * \param name the name of the engine
+   */
+  PifoQueueDiscByteModeTestCase (PifoEngineType engine, std::string name);
+  virtual void DoRun (void);
+
+private:
+  /**
+   * Enqueue a packet
+   *
+   * \param qdisc the queue disc
+   * \param rank the rank of the packet
+   * \param size the size of the packet
+   * \return the uid of the packet
+   */
+  uint64_t Enqueue (Ptr<PifoQueueDisc> qdisc, uint64_t rank, uint32_t size);
+
+  PifoEngineType m_engine;  //!< the engine used by the pifo queue disc
+};
+
+PifoQueueDiscByteModeTestCase::PifoQueueDiscByteModeTestCase (PifoEngineType engine, std::string name)
+  : TestCase ("Check the byte mode of the pifo queue disc (" + name + " engine)"),
+    m_engine (engine)
+{
+}
+
+uint64_t
+PifoQueueDiscByteModeTestCase::Enqueue (Ptr<PifoQueueDisc> qdisc, uint64_t rank, uint32_t size)
+{
+  Address dest;
+  Ptr<QueueDiscItem> item = Create<PifoQueueDiscTestItem> (Create<Packet> (size), dest);
+  item->SetRank (rank);
+  qdisc->Enqueue (item);
+  return item->GetPacket ()->GetUid ();
+}
+
+void
+PifoQueueDiscByteModeTestCase::DoRun (void)
+{
+  // the arriving packet is dropped if its bytes do not fit
+  Ptr<PifoQueueDisc> qdisc = CreateObject<PifoQueueDisc> ();
+  qdisc->SetAttribute ("MaxSize", StringValue ("1000B"));
+  qdisc->SetAttribute ("Engine", EnumValue (m_engine));
+  qdisc->Initialize ();
+
+  for (uint32_t i = 0; i < 16; i++)
+    {
+      Enqueue (qdisc, i, 64);
+    }
+  NS_TEST_EXPECT_MSG_EQ (qdisc->GetNPackets (), 15, "There should be 15 packets in the queue disc");
+  NS_TEST_EXPECT_MSG_EQ (qdisc->GetNBytes (), 960, "There should be 960 bytes in the queue disc");
+  NS_TEST_EXPECT_MSG_EQ (qdisc->GetStats ().GetNDroppedPackets (PifoQueueDisc::LIMIT_EXCEEDED_DROP), 1,
+                         "The 16th packet should have been dropped");
+
+  // the DropWorst policy evicts enough bytes for the arriving packet
+  qdisc = CreateObject<PifoQueueDisc> ();
+  qdisc->SetAttribute ("MaxSize", StringValue ("3000B"));
+  qdisc->SetAttribute ("Engine", EnumValue (m_engine));
+  qdisc->SetAttribute ("OverflowPolicy", EnumValue (PifoQueueDisc::DROP_WORST));
+  qdisc->Initialize ();
+
+  uint64_t uid10 = Enqueue (qdisc, 10, 1500);
+  Enqueue (qdisc, 20, 500);
+  Enqueue (qdisc, 30, 500);
+  Enqueue (qdisc, 40, 500);
+  NS_TEST_EXPECT_MSG_EQ (qdisc->GetNBytes (), 3000, "There should be 3000 bytes in the queue disc");
+
+  // evicts the packets of rank 40 and 30
+  uint64_t uid5 = Enqueue (qdisc, 5, 1000);
+  NS_TEST_EXPECT_MSG_EQ (qdisc->GetStats ().GetNDroppedPackets (PifoQueueDisc::EVICTED_DROP), 2,
+                         "Two packets should have been evicted");
+  NS_TEST_EXPECT_MSG_EQ (qdisc->GetNPackets (), 3, "There should be 3 packets in the queue disc");
+  NS_TEST_EXPECT_MSG_EQ (qdisc->GetNBytes (), 3000, "There should be 3000 bytes in the queue disc");
+
+  // evicting the packet of rank 20 is not enough, and the arriving packet
+  // does not outrank the packet of rank 10: nothing is evicted
+  Enqueue (qdisc, 15, 1500);
+  NS_TEST_EXPECT_MSG_EQ (qdisc->GetStats ().GetNDroppedPackets (PifoQueueDisc::LIMIT_EXCEEDED_DROP), 1,
+                         "The arriving packet should have been dropped");
+  NS_TEST_EXPECT_MSG_EQ (qdisc->GetStats ().GetNDroppedPackets (PifoQueueDisc::EVICTED_DROP), 2,
+                         "No packet should have been evicted");
+  NS_TEST_EXPECT_MSG_EQ (qdisc->GetNBytes (), 3000, "There should be 3000 bytes in the queue disc");
+
+  // evicts the packet of rank 20 only
+  uint64_t uid1 = Enqueue (qdisc, 1, 64);
+  NS_TEST_EXPECT_MSG_EQ (qdisc->GetStats ().GetNDroppedPackets (PifoQueueDisc::EVICTED_DROP), 3,
+                         "Three packets should have been evicted");
+  NS_TEST_EXPECT_MSG_EQ (qdisc->GetNBytes (), 2564, "There should be 2564 bytes in the queue disc");
+
+  for (uint64_t uid : {uid1, uid5, uid10})
+    {
+      Ptr<QueueDiscItem> item = qdisc->Dequeue ();
+      NS_TEST_ASSERT_MSG_NE (item, 0, "The queue disc should not be empty");
+      NS_TEST_EXPECT_MSG_EQ (item->GetPacket ()->GetUid (), uid, "Packets should be dequeued in rank order");
+    }
+  NS_TEST_EXPECT_MSG_EQ (qdisc->Dequeue (), 0, "The queue disc should be empty");
+  NS_TEST_EXPECT_MSG_EQ (qdisc->GetNBytes (), 0, "There should be no byte in the queue disc");
+
+  Simulator::Destroy ();
+}
+
+/**
+ * \ingroup traffic-control-test
+ * \ingroup tests
+ *
+ * \brief Pifo Queue Disc Rank Wraparound Test Case
+ *
+ * Ranks are compared with serial number arithmetic, hence ranks that wrap
+ * around 2^64 keep their order, and negative classification results order
+ * before 0
+ */
+class PifoQueueDiscWrapTestCase : public TestCase
+{
+public:
+  /**
+   * Constructor
+   *
+   * \param engine the engine of the pifo queue disc
+   * \param name the name of the engine
+   */
+  PifoQueueDiscWrapTestCase (PifoEngineType engine, std::string name);
+  virtual void DoRun (void);
+
+private:
+  PifoEngineType m_engine;  //!< the engine used by the pifo queue disc
+};
+
+PifoQueueDiscWrapTestCase::PifoQueueDiscWrapTestCase (PifoEngineType engine, std::string name)
+  : TestCase ("Check that the pifo queue disc orders ranks across the wraparound (" + name + " engine)"),
+    m_engine (engine)
+{
+}
+
+void
+PifoQueueDiscWrapTestCase::DoRun (void)
+{
+  Ptr<PifoQueueDisc> qdisc = CreateObject<PifoQueueDisc> ();
+  Ptr<QueueDiscItem> item;
+  Address dest;
+
+  qdisc->SetAttribute ("Engine", EnumValue (m_engine));
+  qdisc->Initialize ();
+
+  const uint64_t max = std::numeric_limits<uint64_t>::max ();
+  uint64_t ranks[] = {1, max - 1, 0, max, 2, max - 2};
+  for (uint64_t rank : ranks)
+    {
+      item = Create<PifoQueueDiscTestItem> (Create<Packet> (100), dest);
+      item->SetRank (rank);
+      qdisc->Enqueue (item);
+    }
+
+  for (uint64_t rank : {max - 2, max - 1, max, (uint64_t) 0, (uint64_t) 1, (uint64_t) 2})
+    {
+      item = qdisc->Dequeue ();
+      NS_TEST_ASSERT_MSG_NE (item, 0, "The queue disc should not be empty");
+      NS_TEST_EXPECT_MSG_EQ (item->GetRank (), rank, "Ranks should be dequeued in serial order");
+    }
+  NS_TEST_EXPECT_MSG_EQ (qdisc->Dequeue (), 0, "The queue disc should be empty");
+
+  // negative classification results are sign extended
+  qdisc = CreateObject<PifoQueueDisc> ();
+  Ptr<PifoQueueDiscTestFilter> filter = CreateObject<PifoQueueDiscTestFilter> (true);
+  qdisc->AddPacketFilter (filter);
+  qdisc->SetAttribute ("Engine", EnumValue (m_engine));
+  qdisc->Initialize ();
+
+  for (int32_t ret : {3, -5, 0})
+    {
+      filter->SetReturnValue (ret);
+      qdisc->Enqueue (Create<PifoQueueDiscTestItem> (Create<Packet> (100), dest));
+    }
+
+  for (int32_t ret : {-5, 0, 3})
+    {
+      item = qdisc->Dequeue ();
+      NS_TEST_ASSERT_MSG_NE (item, 0, "The queue disc should not be empty");
+      NS_TEST_EXPECT_MSG_EQ (static_cast<int64_t> (item->GetRank ()), ret,
+                             "Negative ranks should be dequeued before 0");
+    }
+
+  Simulator::Destroy ();
+}
+
+/**
+ * \ingroup traffic-control-test
+ * \ingroup tests
+ *
+ * \brief Pifo Queue Disc Approximate Engines Test Case
+ *
+ * SP-PIFO with a single FIFO serves packets in arrival order and counts the
+ * rank inversions; AIFO rejects the packets whose rank is high with respect
+ * to the recent ranks when the queue is nearly full
+ */
+class PifoQueueDiscApproximateTestCase : public TestCase
+{
+public:
+  PifoQueueDiscApproximateTestCase ();
+  virtual void DoRun (void);
+};
+
+PifoQueueDiscApproximateTestCase::PifoQueueDiscApproximateTestCase ()
+  : TestCase ("Check the SP-PIFO and AIFO engines of the pifo queue disc")
+{
+}
+
+void
+PifoQueueDiscApproximateTestCase::DoRun (void)
+{
+  Ptr<QueueDiscItem> item;
+  Address dest;
+
+  Ptr<PifoQueueDisc> spPifo = CreateObject<PifoQueueDisc> ();
+  spPifo->SetAttribute ("Engine", EnumValue (SP_PIFO_ENGINE));
+  spPifo->SetAttribute ("SpPifoQueues", UintegerValue (1));
+  spPifo->Initialize ();
+
+  uint32_t ranks[] = {30, 10, 20};
+  for (uint32_t rank : ranks)
+    {
+      item = Create<PifoQueueDiscTestItem> (Create<Packet> (100), dest);
+      item->SetPriority (rank);
+      spPifo->Enqueue (item);
+    }
+  for (uint32_t rank : ranks)
+    {
+      item = spPifo->Dequeue ();
+      NS_TEST_ASSERT_MSG_NE (item, 0, "The queue disc should not be empty");
+      NS_TEST_EXPECT_MSG_EQ (item->GetPriority (), rank, "A single FIFO should serve packets in arrival order");
+    }
+  // rank 30 was dequeued while rank 10 was queued
+  NS_TEST_EXPECT_MSG_EQ (spPifo->GetNRankInversions (), 1, "There should be 1 rank inversion");
+  NS_TEST_EXPECT_MSG_EQ (spPifo->GetRankInversionMagnitude (), 20, "The rank inversion should have magnitude 20");
+
+  Ptr<PifoQueueDisc> aifo = CreateObject<PifoQueueDisc> ();
+  aifo->SetAttribute ("MaxSize", StringValue ("10p"));
+  aifo->SetAttribute ("Engine", EnumValue (AIFO_ENGINE));
+  aifo->SetAttribute ("AifoHeadroom", DoubleValue (0.1));
+  aifo->Initialize ();
+
+  for (uint32_t i = 0; i < 9; i++)
+    {
+      item = Create<PifoQueueDiscTestItem> (Create<Packet> (100), dest);
+      item->SetPriority (0);
+      NS_TEST_EXPECT_MSG_EQ (aifo->Enqueue (item), true, "Packets of the lowest rank should be admitted");
+    }
+
+  // 1 free slot out of 10: only the lowest 1/9 of the recent ranks get in
+  item = Create<PifoQueueDiscTestItem> (Create<Packet> (100), dest);
+  item->SetPriority (100);
+  NS_TEST_EXPECT_MSG_EQ (aifo->Enqueue (item), false, "A packet of high rank should be rejected");
+  NS_TEST_EXPECT_MSG_EQ (aifo->GetStats ().GetNDroppedPackets (PifoQueueDisc::ADMISSION_DROP), 1,
+                         "The packet should be dropped by the admission control");
+
+  item = Create<PifoQueueDiscTestItem> (Create<Packet> (100), dest);
+  item->SetPriority (0);
+  NS_TEST_EXPECT_MSG_EQ (aifo->Enqueue (item), true, "A packet of the lowest rank should be admitted");
+  NS_TEST_EXPECT_MSG_EQ (aifo->GetNPackets (), 10, "There should be 10 packets in the queue disc");
+
+  Simulator::Destroy ();
+}
+
+/**
+ * \ingroup traffic-control-test
+ * \ingroup tests
+ *
+ * \brief Pifo Queue Disc Batch Dequeue Test Case
+ *
+ * A batch stops at the packet or byte limit, holds the packets in rank
+ * order and fires the dequeue trace once per packet
+ */
+class PifoQueueDiscBatchTestCase : public TestCase
+{
+public:
+  PifoQueueDiscBatchTestCase ();
+  virtual void DoRun (void);
+
+private:
+  /**
+   * Record the rank of a dequeued packet
+   *
+   * \param item the dequeued packet
+   */
+  void Dequeued (Ptr<const QueueDiscItem> item);
+
+  std::vector<uint64_t> m_traced;  //!< the ranks of the dequeued packets
+};
+
+PifoQueueDiscBatchTestCase::PifoQueueDiscBatchTestCase ()
+  : TestCase ("Check the batch dequeue of the pifo queue disc")
+{
+}
+
+void
+PifoQueueDiscBatchTestCase::Dequeued (Ptr<const QueueDiscItem> item)
+{
+  m_traced.push_back (item->GetRank ());
+}
+
+void
+PifoQueueDiscBatchTestCase::DoRun (void)
+{
+  Address dest;
+
+  Ptr<PifoQueueDisc> qdisc = CreateObject<PifoQueueDisc> ();
+  qdisc->SetAttribute ("MaxSize", StringValue ("100p"));
+  qdisc->Initialize ();
+  qdisc->TraceConnectWithoutContext ("Dequeue", MakeCallback (&PifoQueueDiscBatchTestCase::Dequeued, this));
+
+  for (uint64_t rank = 10; rank > 0; rank--)
+    {
+      Ptr<QueueDiscItem> item = Create<PifoQueueDiscTestItem> (Create<Packet> (100), dest);
+      item->SetRank (rank);
+      qdisc->Enqueue (item);
+    }
+
+  std::vector<Ptr<QueueDiscItem> > items;
+  uint32_t n = qdisc->DequeueBatch (4, std::numeric_limits<uint32_t>::max (), items);
+  NS_TEST_EXPECT_MSG_EQ (n, 4, "The batch should stop at 4 packets");
+
+  // stops once at least 250 bytes are dequeued
+  n = qdisc->DequeueBatch (10, 250, items);
+  NS_TEST_EXPECT_MSG_EQ (n, 3, "The batch should stop at 300 bytes");
+  NS_TEST_EXPECT_MSG_EQ (qdisc->GetNPackets (), 3, "There should be 3 packets in the queue disc");
+  NS_TEST_EXPECT_MSG_EQ (qdisc->GetNBytes (), 300, "There should be 300 bytes in the queue disc");
+
+  n = qdisc->DequeueBatch (10, std::numeric_limits<uint32_t>::max (), items);
+  NS_TEST_EXPECT_MSG_EQ (n, 3, "The batch should hold the packets left");
+  NS_TEST_EXPECT_MSG_EQ (qdisc->DequeueBatch (10, std::numeric_limits<uint32_t>::max (), items), 0,
+                         "The queue disc should be empty");
+
+  NS_TEST_ASSERT_MSG_EQ (items.size (), 10, "10 packets should have been dequeued");
+  NS_TEST_ASSERT_MSG_EQ (m_traced.size (), 10, "The dequeue trace should fire once per packet");
+  for (uint32_t i = 0; i < 10; i++)
+    {
+      NS_TEST_EXPECT_MSG_EQ (items[i]->GetRank (), i + 1, "Packets should be dequeued in rank order");
+      NS_TEST_EXPECT_MSG_EQ (m_traced[i], i + 1, "Packets should be traced in dequeue order");
+    }
+  NS_TEST_EXPECT_MSG_EQ (qdisc->GetStats ().nTotalDequeuedPackets, 10, "10 packets should be counted as dequeued");
+  NS_TEST_EXPECT_MSG_EQ (qdisc->GetStats ().nTotalDequeuedBytes, 1000, "1000 bytes should be counted as dequeued");
+
+  Simulator::Destroy ();
+}
+
+/**
+ * \ingroup traffic-control-test
+ * \ingroup tests
+ *
+ * \brief Single queue device that records the packets it sends and stops
+ *        its transmission queue after a given number of packets
+ */
+class BatchTestDevice : public NetDevice
+{
+public:
+  BatchTestDevice ();
+  virtual ~BatchTestDevice ();
+
+  /**
+   * Stop the transmission queue once a number of packets have been sent
+   *
+   * \param nPackets the number of packets, counted from now
+   */
+  void StopAfter (uint32_t nPackets);
+
+  virtual void SetIfIndex (const uint32_t index);
+  virtual uint32_t GetIfIndex (void) const;
+  virtual Ptr<Channel> GetChannel (void) const;
+  virtual void SetAddress (Address address);
+  virtual Address GetAddress (void) const;
+  virtual bool SetMtu (const uint16_t mtu);
+  virtual uint16_t GetMtu (void) const;
+  virtual bool IsLinkUp (void) const;
+  virtual void AddLinkChangeCallback (Callback<void> callback);
+  virtual bool IsBroadcast (void) const;
+  virtual Address GetBroadcast (void) const;
+  virtual bool IsMulticast (void) const;
+  virtual Address GetMulticast (Ipv4Address multicastGroup) const;
+  virtual Address GetMulticast (Ipv6Address addr) const;
+  virtual bool IsBridge (void) const;
+  virtual bool IsPointToPoint (void) const;
+  virtual bool Send (Ptr<Packet> packet, const Address& dest, uint16_t protocolNumber);
+  virtual bool SendFrom (Ptr<Packet> packet, const Address& source, const Address& dest,
+                         uint16_t protocolNumber);
+  virtual Ptr<Node> GetNode (void) const;
+  virtual void SetNode (Ptr<Node> node);
+  virtual bool NeedsArp (void) const;
+  virtual void SetReceiveCallback (NetDevice::ReceiveCallback cb);
+  virtual void SetPromiscReceiveCallback (PromiscReceiveCallback cb);
+  virtual bool SupportsSendFrom (void) const;
+
+  std::vector<uint32_t> m_sent;  //!< the sizes of the packets sent
+
+private:
+  Ptr<Node> m_node;       //!< the node of the device
+  uint32_t m_ifIndex;     //!< the interface index
+  uint32_t m_stopAfter;   //!< the number of packets to send before stopping the queue
+};
+
+BatchTestDevice::BatchTestDevice ()
+  : m_ifIndex (0),
+    m_stopAfter (std::numeric_limits<uint32_t>::max ())
+{
+}
+
+BatchTestDevice::~BatchTestDevice ()
+{
+}
+
+void
+BatchTestDevice::StopAfter (uint32_t nPackets)
+{
+  m_stopAfter = nPackets;
+}
+
+void
+BatchTestDevice::SetIfIndex (const uint32_t index)
+{
+  m_ifIndex = index;
+}
+
+uint32_t
+BatchTestDevice::GetIfIndex (void) const
+{
+  return m_ifIndex;
+}
+
+Ptr<Channel>
+BatchTestDevice::GetChannel (void) const
+{
+  return 0;
+}
+
+void
+BatchTestDevice::SetAddress (Address address)
+{
+}
+
+Address
+BatchTestDevice::GetAddress (void) const
+{
+  return Address ();
+}
+
+bool
+BatchTestDevice::SetMtu (const uint16_t mtu)
+{
+  return false;
+}
+
+uint16_t
+BatchTestDevice::GetMtu (void) const
+{
+  return 1500;
+}
+
+bool
+BatchTestDevice::IsLinkUp (void) const
+{
+  return true;
+}
+
+void
+BatchTestDevice::AddLinkChangeCallback (Callback<void> callback)
+{
+}
+
+bool
+BatchTestDevice::IsBroadcast (void) const
+{
+  return false;
+}
+
+Address
+BatchTestDevice::GetBroadcast (void) const
+{
+  return Address ();
+}
+
+bool
+BatchTestDevice::IsMulticast (void) const
+{
+  return false;
+}
+
+Address
+BatchTestDevice::GetMulticast (Ipv4Address multicastGroup) const
+{
+  return Address ();
+}
+
+Address
+BatchTestDevice::GetMulticast (Ipv6Address addr) const
+{
+  return Address ();
+}
+
+bool
+BatchTestDevice::IsBridge (void) const
+{
+  return false;
+}
+
+bool
+BatchTestDevice::IsPointToPoint (void) const
+{
+  return true;
+}
+
+bool
+BatchTestDevice::Send (Ptr<Packet> packet, const Address& dest, uint16_t protocolNumber)
+{
+  m_sent.push_back (packet->GetSize ());
+  if (m_stopAfter > 0 && --m_stopAfter == 0)
+    {
+      GetObject<NetDeviceQueueInterface> ()->GetTxQueue (0)->Stop ();
+    }
+  return true;
+}
+
+bool
+BatchTestDevice::SendFrom (Ptr<Packet> packet, const Address& source, const Address& dest,
+                           uint16_t protocolNumber)
+{
+  return Send (packet, dest, protocolNumber);
+}
+
+Ptr<Node>
+BatchTestDevice::GetNode (void) const
+{
+  return m_node;
+}
+
+void
+BatchTestDevice::SetNode (Ptr<Node> node)
+{
+  m_node = node;
+}
+
+bool
+BatchTestDevice::NeedsArp (void) const
+{
+  return false;
+}
+
+void
+BatchTestDevice::SetReceiveCallback (NetDevice::ReceiveCallback cb)
+{
+}
+
+void
+BatchTestDevice::SetPromiscReceiveCallback (PromiscReceiveCallback cb)
+{
+}
+
+bool
+BatchTestDevice::SupportsSendFrom (void) const
+{
+  return false;
+}
+
+/**
+ * \ingroup traffic-control-test
+ * \ingroup tests
+ *
+ * \brief Pifo Queue Disc Batch Transmission Test Case
+ *
+ * With MaxBatch above 1, Run hands batches of packets to the device. When
+ * the device queue stops in the middle of a batch, the packets left are
+ * requeued in order, are not counted as sent, and are the first to be sent
+ * once the device queue restarts
+ */
+class PifoQueueDiscBatchRunTestCase : public TestCase
+{
+public:
+  PifoQueueDiscBatchRunTestCase ();
+  virtual void DoRun (void);
+};
+
+PifoQueueDiscBatchRunTestCase::PifoQueueDiscBatchRunTestCase ()
+  : TestCase ("Check the batch transmission of the pifo queue disc to a stopped device")
+{
+}
+
+void
+PifoQueueDiscBatchRunTestCase::DoRun (void)
+{
+  Address dest;
+
+  Ptr<Node> node = CreateObject<Node> ();
+  Ptr<BatchTestDevice> device = CreateObject<BatchTestDevice> ();
+  device->SetNode (node);
+  Ptr<NetDeviceQueueInterface> ndqi = CreateObject<NetDeviceQueueInterface> ();
+  ndqi->SetTxQueuesN (1);
+  ndqi->CreateTxQueues ();
+  device->AggregateObject (ndqi);
+
+  Ptr<PifoQueueDisc> qdisc = CreateObject<PifoQueueDisc> ();
+  qdisc->SetAttribute ("MaxSize", StringValue ("100p"));
+  qdisc->SetAttribute ("MaxBatch", UintegerValue (4));
+  qdisc->SetNetDevice (device);
+  qdisc->Initialize ();
+
+  // packet i has rank i and a size of 100 + i bytes
+  for (uint32_t rank = 10; rank > 0; rank--)
+    {
+      Ptr<QueueDiscItem> item = Create<PifoQueueDiscTestItem> (Create<Packet> (100 + rank), dest);
+      item->SetRank (rank);
+      qdisc->Enqueue (item);
+    }
+
+  // the device queue stops after the second packet of the second batch
+  device->StopAfter (6);
+  qdisc->Run ();
+
+  NS_TEST_ASSERT_MSG_EQ (device->m_sent.size (), 6, "6 packets should have been sent");
+  for (uint32_t i = 0; i < 6; i++)
+    {
+      NS_TEST_EXPECT_MSG_EQ (device->m_sent[i], 101 + i, "Packets should be sent in rank order");
+    }
+  QueueDisc::Stats stats = qdisc->GetStats ();
+  NS_TEST_EXPECT_MSG_EQ (stats.nTotalDequeuedPackets, 8, "Two batches of 4 packets should have been dequeued");
+  NS_TEST_EXPECT_MSG_EQ (stats.nTotalRequeuedPackets, 2, "The last 2 packets of the batch should be requeued");
+  NS_TEST_EXPECT_MSG_EQ (stats.nTotalRequeuedBytes, 107 + 108, "Unexpected requeued bytes");
+  NS_TEST_EXPECT_MSG_EQ (stats.nTotalSentPackets, 6, "The requeued packets should not be counted as sent");
+  NS_TEST_EXPECT_MSG_EQ (stats.nTotalSentBytes, 101 + 102 + 103 + 104 + 105 + 106,
+                         "The requeued bytes should not be counted as sent");
+
+  // running again while the device queue is stopped sends nothing
+  qdisc->Run ();
+  NS_TEST_EXPECT_MSG_EQ (device->m_sent.size (), 6, "No packet should be sent to a stopped device queue");
+
+  // the requeued packets go first, then the rest in batches
+  device->StopAfter (std::numeric_limits<uint32_t>::max ());
+  ndqi->GetTxQueue (0)->Start ();
+  qdisc->Run ();
+
+  NS_TEST_ASSERT_MSG_EQ (device->m_sent.size (), 10, "All the packets should have been sent");
+  for (uint32_t i = 6; i < 10; i++)
+    {
+      NS_TEST_EXPECT_MSG_EQ (device->m_sent[i], 101 + i, "Packets should be sent in rank order");
+    }
+  stats = qdisc->GetStats ();
+  NS_TEST_EXPECT_MSG_EQ (stats.nTotalDequeuedPackets, 10, "Requeued packets should not be counted twice");
+  NS_TEST_EXPECT_MSG_EQ (stats.nTotalSentPackets, 10, "All the packets should be counted as sent");
+  NS_TEST_EXPECT_MSG_EQ (stats.nTotalSentBytes, 1055, "All the bytes should be counted as sent");
+  NS_TEST_EXPECT_MSG_EQ (qdisc->GetNPackets (), 0, "The queue disc should be empty");
+
+  qdisc->Dispose ();
+  device->Dispose ();
+  Simulator::Destroy ();
+}
+
+/**
+ * \ingroup traffic-control-test
+ * \ingroup tests
+ *
+ * \brief Pifo Queue Disc Batch Drain Test Case
+ *
+ * When a batch empties the queue disc and the device queue stops in the
+ * middle of it, all the requeued packets are sent by the next Run once the
+ * device queue restarts
+ */
+class PifoQueueDiscBatchDrainTestCase : public TestCase
+{
+public:
+  PifoQueueDiscBatchDrainTestCase ();
+  virtual void DoRun (void);
+};
+
+PifoQueueDiscBatchDrainTestCase::PifoQueueDiscBatchDrainTestCase ()
+  : TestCase ("Check that the packets of a batch emptying the pifo queue disc are not stranded")
+{
+}
+
+void
+PifoQueueDiscBatchDrainTestCase::DoRun (void)
+{
+  Address dest;
+
+  Ptr<Node> node = CreateObject<Node> ();
+  Ptr<BatchTestDevice> device = CreateObject<BatchTestDevice> ();
+  device->SetNode (node);
+  Ptr<NetDeviceQueueInterface> ndqi = CreateObject<NetDeviceQueueInterface> ();
+  ndqi->SetTxQueuesN (1);
+  ndqi->CreateTxQueues ();
+  device->AggregateObject (ndqi);
+
+  Ptr<PifoQueueDisc> qdisc = CreateObject<PifoQueueDisc> ();
+  qdisc->SetAttribute ("MaxSize", StringValue ("100p"));
+  qdisc->SetAttribute ("MaxBatch", UintegerValue (4));
+  qdisc->SetNetDevice (device);
+  qdisc->Initialize ();
+
+  // packet i has rank i and a size of 100 + i bytes
+  for (uint32_t rank = 4; rank > 0; rank--)
+    {
+      Ptr<QueueDiscItem> item = Create<PifoQueueDiscTestItem> (Create<Packet> (100 + rank), dest);
+      item->SetRank (rank);
+      qdisc->Enqueue (item);
+    }
+
+  // the single batch empties the queue disc and the device queue stops after
+  // its first packet
+  device->StopAfter (1);
+  qdisc->Run ();
+
+  NS_TEST_ASSERT_MSG_EQ (device->m_sent.size (), 1, "1 packet should have been sent");
+  NS_TEST_EXPECT_MSG_EQ (qdisc->GetNPackets (), 0, "The batch should have emptied the queue disc");
+  NS_TEST_EXPECT_MSG_EQ (qdisc->GetStats ().nTotalRequeuedPackets, 3, "The last 3 packets of the batch should be requeued");
+
+  // a single Run sends all the requeued packets
+  device->StopAfter (std::numeric_limits<uint32_t>::max ());
+  ndqi->GetTxQueue (0)->Start ();
+  qdisc->Run ();
+
+  NS_TEST_ASSERT_MSG_EQ (device->m_sent.size (), 4, "All the requeued packets should have been sent");
+  for (uint32_t i = 0; i < 4; i++)
+    {
+      NS_TEST_EXPECT_MSG_EQ (device->m_sent[i], 101 + i, "Packets should be sent in rank order");
+    }
+  QueueDisc::Stats stats = qdisc->GetStats ();
+  NS_TEST_EXPECT_MSG_EQ (stats.nTotalSentPackets, 4, "All the packets should be counted as sent");
+  NS_TEST_EXPECT_MSG_EQ (stats.nTotalSentBytes, 101 + 102 + 103 + 104, "All the bytes should be counted as sent");
+
+  qdisc->Dispose ();
+  device->Dispose ();
+  Simulator::Destroy ();
+}
+
+/**
+ * \ingroup traffic-control-test
+ * \ingroup tests
+ *
+ * \brief Pifo Queue Disc Flow Engine Test Case
+ *
+ * The flow engine serves the packets in rank order when ranks increase
+ * within flows, and reports the packets breaking that assumption
+ */
+class PifoQueueDiscFlowEngineTestCase : public TestCase
+{
+public:
+  PifoQueueDiscFlowEngineTestCase ();
+  virtual void DoRun (void);
+
+private:
+  /**
+   * Enqueue a packet
+   *
+   * \param qdisc the queue disc
+   * \param flow the flow hash of the packet
+   * \param rank the rank of the packet
+   */
+  void Enqueue (Ptr<PifoQueueDisc> qdisc, uint32_t flow, uint64_t rank);
+
+  /**
+   * Count a rank violation
+   *
+   * \param item the packet
+   */
+  void Violation (Ptr<const QueueDiscItem> item);
+
+  uint32_t m_nViolations;  //!< the number of rank violations traced
+};
+
+PifoQueueDiscFlowEngineTestCase::PifoQueueDiscFlowEngineTestCase ()
+  : TestCase ("Check the flow engine of the pifo queue disc"),
+    m_nViolations (0)
+{
+}
+
+void
+PifoQueueDiscFlowEngineTestCase::Enqueue (Ptr<PifoQueueDisc> qdisc, uint32_t flow, uint64_t rank)
+{
+  Address dest;
+  Ptr<QueueDiscItem> item = Create<PifoQueueDiscTestItem> (Create<Packet> (100), dest, flow);
+  item->SetRank (rank);
+  qdisc->Enqueue (item);
+}
+
+void
+PifoQueueDiscFlowEngineTestCase::Violation (Ptr<const QueueDiscItem> item)
+{
+  m_nViolations++;
+}
+
+void
+PifoQueueDiscFlowEngineTestCase::DoRun (void)
+{
+  Ptr<PifoQueueDisc> qdisc = CreateObject<PifoQueueDisc> ();
+  qdisc->SetAttribute ("Engine", EnumValue (FLOW_ENGINE));
+  qdisc->Initialize ();
+  qdisc->TraceConnectWithoutContext ("RankViolation",
+                                     MakeCallback (&PifoQueueDiscFlowEngineTestCase::Violation, this));
+
+  Enqueue (qdisc, 1, 10);
+  Enqueue (qdisc, 2, 20);
+  Enqueue (qdisc, 1, 30);
+  Enqueue (qdisc, 3, 5);
+  Enqueue (qdisc, 2, 40);
+  Enqueue (qdisc, 1, 50);
+
+  for (uint64_t rank : {5, 10, 20, 30, 40, 50})
+    {
+      Ptr<QueueDiscItem> item = qdisc->Dequeue ();
+      NS_TEST_ASSERT_MSG_NE (item, 0, "The queue disc should not be empty");
+      NS_TEST_EXPECT_MSG_EQ (item->GetRank (), rank, "Packets should be dequeued in rank order");
+    }
+  NS_TEST_EXPECT_MSG_EQ (qdisc->GetNRankViolations (), 0, "There should be no rank violation");
+  NS_TEST_EXPECT_MSG_EQ (qdisc->GetNRankInversions (), 0, "There should be no rank inversion");
+
+  // the rank of flow 1 decreases: the packet of rank 60 is served after
+  // the packet of rank 100 of its flow
+  Enqueue (qdisc, 1, 100);
+  Enqueue (qdisc, 1, 60);
+  Enqueue (qdisc, 2, 80);
+  NS_TEST_EXPECT_MSG_EQ (qdisc->GetNRankViolations (), 1, "There should be 1 rank violation");
+  NS_TEST_EXPECT_MSG_EQ (m_nViolations, 1, "The rank violation should have been traced");
+
+  for (uint64_t rank : {80, 100, 60})
+    {
+      Ptr<QueueDiscItem> item = qdisc->Dequeue ();
+      NS_TEST_ASSERT_MSG_NE (item, 0, "The queue disc should not be empty");
+      NS_TEST_EXPECT_MSG_EQ (item->GetRank (), rank, "Packets should be dequeued in flow order");
+    }
+  // 80 and 100 were dequeued while 60 was queued
+  NS_TEST_EXPECT_MSG_EQ (qdisc->GetNRankInversions (), 2, "There should be 2 rank inversions");
+  NS_TEST_EXPECT_MSG_EQ (qdisc->GetRankInversionMagnitude (), 60, "The rank inversions should have magnitude 60");
+
+  Simulator::Destroy ();
+}
+
+/**
+ * \ingroup traffic-control-test
+ * \ingroup tests
+ *
+ * \brief Pifo Queue Disc Removal Test Case
+ *
+ * The indexed engine drops the oldest packet of a flow, all the packets of
+ * a flow and the packets ranking after a threshold, and keeps serving the
+ * other packets in rank order
+ */
+class PifoQueueDiscRemovalTestCase : public TestCase
+{
+public:
+  PifoQueueDiscRemovalTestCase ();
+  virtual void DoRun (void);
+
+private:
+  /**
+   * Enqueue a packet
+   *
+   * \param qdisc the queue disc
+   * \param flow the flow hash of the packet
+   * \param rank the rank of the packet
+   */
+  void Enqueue (Ptr<PifoQueueDisc> qdisc, uint32_t flow, uint64_t rank);
+};
+
+PifoQueueDiscRemovalTestCase::PifoQueueDiscRemovalTestCase ()
+  : TestCase ("Check the removal of packets by flow and by rank from the pifo queue disc")
+{
+}
+
+void
+PifoQueueDiscRemovalTestCase::Enqueue (Ptr<PifoQueueDisc> qdisc, uint32_t flow, uint64_t rank)
+{
+  Address dest;
+  Ptr<QueueDiscItem> item = Create<PifoQueueDiscTestItem> (Create<Packet> (100), dest, flow);
+  item->SetRank (rank);
+  qdisc->Enqueue (item);
+}
+
+void
+PifoQueueDiscRemovalTestCase::DoRun (void)
+{
+  Ptr<PifoQueueDisc> qdisc = CreateObject<PifoQueueDisc> ();
+  qdisc->SetAttribute ("Engine", EnumValue (INDEXED_ENGINE));
+  qdisc->Initialize ();
+
+  Enqueue (qdisc, 1, 30);
+  Enqueue (qdisc, 2, 10);
+  Enqueue (qdisc, 1, 20);
+  Enqueue (qdisc, 3, 70);
+  Enqueue (qdisc, 2, 60);
+  Enqueue (qdisc, 1, 50);
+  Enqueue (qdisc, 3, 40);
+  Enqueue (qdisc, 2, 80);
+
+  // the oldest packet of flow 1 is the one of rank 30, not its lowest rank
+  NS_TEST_EXPECT_MSG_EQ (qdisc->DropFlowHead (1), true, "Flow 1 should have a packet");
+  NS_TEST_EXPECT_MSG_EQ (qdisc->DropFlowHead (4), false, "Flow 4 should have no packet");
+  NS_TEST_EXPECT_MSG_EQ (qdisc->GetStats ().GetNDroppedPackets (PifoQueueDisc::FLOW_HEAD_DROP), 1,
+                         "1 packet should have been dropped as the head of its flow");
+  NS_TEST_EXPECT_MSG_EQ (qdisc->GetNPackets (), 7, "There should be 7 queued packets");
+
+  NS_TEST_EXPECT_MSG_EQ (qdisc->DropFlow (3), 2, "Flow 3 should have 2 packets");
+  NS_TEST_EXPECT_MSG_EQ (qdisc->DropFlow (3), 0, "Flow 3 should have no packet left");
+  NS_TEST_EXPECT_MSG_EQ (qdisc->GetStats ().GetNDroppedPackets (PifoQueueDisc::FLOW_DROP), 2,
+                         "2 packets should have been dropped with their flow");
+
+  NS_TEST_EXPECT_MSG_EQ (qdisc->DropAbove (50), 2, "2 packets should rank after 50");
+  NS_TEST_EXPECT_MSG_EQ (qdisc->GetStats ().GetNDroppedPackets (PifoQueueDisc::RANK_THRESHOLD_DROP), 2,
+                         "2 packets should have been dropped above the rank threshold");
+  NS_TEST_EXPECT_MSG_EQ (qdisc->GetNPackets (), 3, "There should be 3 queued packets");
+  NS_TEST_EXPECT_MSG_EQ (qdisc->GetNBytes (), 300, "There should be 300 queued bytes");
+
+  // a flow keeps its order after the removals
+  Enqueue (qdisc, 1, 5);
+  NS_TEST_EXPECT_MSG_EQ (qdisc->DropFlowHead (1), true, "Flow 1 should have a packet");
+
+  for (uint64_t rank : {5, 10, 50})
+    {
+      Ptr<QueueDiscItem> item = qdisc->Dequeue ();
+      NS_TEST_ASSERT_MSG_NE (item, 0, "The queue disc should not be empty");
+      NS_TEST_EXPECT_MSG_EQ (item->GetRank (), rank, "Packets should be dequeued in rank order");
+    }
+  NS_TEST_EXPECT_MSG_EQ (qdisc->Dequeue (), 0, "The queue disc should be empty");
+
+  Simulator::Destroy ();
+}
+
 /**
  * \ingroup traffic-control-test
  * \ingroup tests
@@ -238,5 +1527,25 @@ public:
     : TestSuite ("pifo-queue-disc", UNIT)
   {
     AddTestCase (new PifoQueueDiscTestCase (), TestCase::QUICK);
+    AddTestCase (new PifoQueueDiscNoFilterTestCase (), TestCase::QUICK);
+    AddTestCase (new PifoQueueDiscFifoTieTestCase (DARY_HEAP_ENGINE, "DaryHeap"), TestCase::QUICK);
+    AddTestCase (new PifoQueueDiscFifoTieTestCase (HEAP_ENGINE, "Heap"), TestCase::QUICK);
+    AddTestCase (new PifoQueueDiscFifoTieTestCase (MIN_MAX_HEAP_ENGINE, "MinMaxHeap"), TestCase::QUICK);
+    AddTestCase (new PifoQueueDiscFifoTieTestCase (SORTED_ARRAY_ENGINE, "SortedArray"), TestCase::QUICK);
+    AddTestCase (new PifoQueueDiscCalendarTestCase (), TestCase::QUICK);
+    AddTestCase (new PifoQueueDiscDropWorstTestCase (MIN_MAX_HEAP_ENGINE, "MinMaxHeap"), TestCase::QUICK);
+    AddTestCase (new PifoQueueDiscDropWorstTestCase (SORTED_ARRAY_ENGINE, "SortedArray"), TestCase::QUICK);
+    AddTestCase (new PifoQueueDiscByteModeTestCase (MIN_MAX_HEAP_ENGINE, "MinMaxHeap"), TestCase::QUICK);
+    AddTestCase (new PifoQueueDiscByteModeTestCase (SORTED_ARRAY_ENGINE, "SortedArray"), TestCase::QUICK);
+    AddTestCase (new PifoQueueDiscWrapTestCase (DARY_HEAP_ENGINE, "DaryHeap"), TestCase::QUICK);
+    AddTestCase (new PifoQueueDiscWrapTestCase (MIN_MAX_HEAP_ENGINE, "MinMaxHeap"), TestCase::QUICK);
+    AddTestCase (new PifoQueueDiscWrapTestCase (SORTED_ARRAY_ENGINE, "SortedArray"), TestCase::QUICK);
+    AddTestCase (new PifoQueueDiscApproximateTestCase (), TestCase::QUICK);
+    AddTestCase (new PifoQueueDiscBatchTestCase (), TestCase::QUICK);
+    AddTestCase (new PifoQueueDiscBatchRunTestCase (), TestCase::QUICK);
+    AddTestCase (new PifoQueueDiscBatchDrainTestCase (), TestCase::QUICK);
+    AddTestCase (new PifoQueueDiscFlowEngineTestCase (), TestCase::QUICK);
+    AddTestCase (new PifoQueueDiscDropWorstTestCase (INDEXED_ENGINE, "Indexed"), TestCase::QUICK);
+    AddTestCase (new PifoQueueDiscRemovalTestCase (), TestCase::QUICK);
   }
 } g_pifoQueueTestSuite; ///< the test suite
@@ -0,0 +1,416 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Copyright (c) 2018 Stanford University
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Authors: Stephen Ibanez <sibanez@stanford.edu>
+ *
+ */
+
+#include "ns3/test.h"
+#include "ns3/pifo-tree-queue-disc.h"
+#include "ns3/rank-filter.h"
+#include "ns3/packet-filter.h"
+#include "ns3/packet.h"
+#include "ns3/simulator.h"
+#include <map>
+#include <vector>
+
+using namespace ns3;
+
+/**
+ * \ingroup traffic-control-test
+ * \ingroup tests
+ *
+ * \brief Pifo Tree Queue Disc Test Item
+ */
+class PifoTreeTestItem : public QueueDiscItem
+{
+public:
+  /**
+   * Constructor
+   *
+   * \param p the packet
+   * \param leaf the leaf the packet is enqueued in
+   * \param rank the rank of the packet in its leaf
+   */
+  PifoTreeTestItem (Ptr<Packet> p, uint32_t leaf, uint32_t rank);
+  virtual ~PifoTreeTestItem ();
+  virtual void AddHeader (void);
+  virtual bool Mark (void);
+  virtual uint32_t Hash (uint32_t perturbation) const;
+
+  uint32_t m_leaf;  //!< the leaf the packet is enqueued in, also its flow hash
+};
+
+PifoTreeTestItem::PifoTreeTestItem (Ptr<Packet> p, uint32_t leaf, uint32_t rank)
+  : QueueDiscItem (p, Address (), 0),
+    m_leaf (leaf)
+{
+  SetPriority (rank);
+}
+
+PifoTreeTestItem::~PifoTreeTestItem ()
+{
+}
+
+void
+PifoTreeTestItem::AddHeader (void)
+{
+}
+
+bool
+PifoTreeTestItem::Mark (void)
+{
+  return false;
+}
+
+uint32_t
+PifoTreeTestItem::Hash (uint32_t perturbation) const
+{
+  return m_leaf;
+}
+
+/**
+ * \ingroup traffic-control-test
+ * \ingroup tests
+ *
+ * \brief Pifo Tree Queue Disc Test Packet Filter
+ *
+ * Returns the leaf of a PifoTreeTestItem, or the rank mapped to its leaf
+ */
+class PifoTreeTestFilter : public PacketFilter
+{
+public:
+  /**
+   * Constructor
+   *
+   * \param ranks the rank of the packets of each leaf, empty to return the leaf
+   */
+  PifoTreeTestFilter (std::map<uint32_t, int32_t> ranks);
+  virtual ~PifoTreeTestFilter ();
+
+private:
+  virtual bool CheckProtocol (Ptr<QueueDiscItem> item) const;
+  virtual int32_t DoClassify (Ptr<QueueDiscItem> item) const;
+
+  std::map<uint32_t, int32_t> m_ranks;  //!< the rank of the packets of each leaf
+};
+
+PifoTreeTestFilter::PifoTreeTestFilter (std::map<uint32_t, int32_t> ranks)
+  : m_ranks (ranks)
+{
+}
+
+PifoTreeTestFilter::~PifoTreeTestFilter ()
+{
+}
+
+bool
+PifoTreeTestFilter::CheckProtocol (Ptr<QueueDiscItem> item) const
+{
+  return (DynamicCast<PifoTreeTestItem> (item) != 0);
+}
+
+int32_t
+PifoTreeTestFilter::DoClassify (Ptr<QueueDiscItem> item) const
+{
+  uint32_t leaf = DynamicCast<PifoTreeTestItem> (item)->m_leaf;
+  if (m_ranks.empty ())
+    {
+      return leaf;
+    }
+  auto it = m_ranks.find (leaf);
+  return (it != m_ranks.end () ? it->second : PacketFilter::PF_NO_MATCH);
+}
+
+/**
+ * \ingroup traffic-control-test
+ * \ingroup tests
+ *
+ * \brief Pifo Tree Queue Disc Hierarchy Test Case
+ *
+ * A FIFO root with a leaf C and an interior node A giving strict priority to
+ * its leaf A2 over its leaf A1: the root picks the subtree in arrival order,
+ * then A picks its leaf by priority, then the leaf picks its packet by rank
+ */
+class PifoTreeQueueDiscHierarchyTestCase : public TestCase
+{
+public:
+  PifoTreeQueueDiscHierarchyTestCase ();
+  virtual void DoRun (void);
+};
+
+PifoTreeQueueDiscHierarchyTestCase::PifoTreeQueueDiscHierarchyTestCase ()
+  : TestCase ("Check that the pifo tree queue disc schedules packets hierarchically")
+{
+}
+
+void
+PifoTreeQueueDiscHierarchyTestCase::DoRun (void)
+{
+  Ptr<PifoTreeQueueDisc> qdisc = CreateObject<PifoTreeQueueDisc> ();
+  uint32_t a = qdisc->AddNode (0);
+  uint32_t c = qdisc->AddNode (0);
+  uint32_t a1 = qdisc->AddNode (a);
+  uint32_t a2 = qdisc->AddNode (a);
+  NS_TEST_EXPECT_MSG_EQ (qdisc->GetNNodes (), 5, "The tree should have 5 nodes");
+
+  qdisc->AddPacketFilter (CreateObject<PifoTreeTestFilter> (std::map<uint32_t, int32_t> ()));
+  qdisc->SetRankFilter (a, CreateObject<PifoTreeTestFilter> (std::map<uint32_t, int32_t> {{a1, 1}, {a2, 0}}));
+  qdisc->Initialize ();
+
+  // (leaf, rank) of the packets, in arrival order
+  std::vector<std::pair<uint32_t, uint32_t> > arrivals = {{a1, 0}, {a2, 5}, {c, 0}, {a2, 3}, {a1, 7}};
+  std::vector<uint64_t> uids;
+  for (auto &arrival : arrivals)
+    {
+      Ptr<QueueDiscItem> item = Create<PifoTreeTestItem> (Create<Packet> (100), arrival.first, arrival.second);
+      NS_TEST_EXPECT_MSG_EQ (qdisc->Enqueue (item), true, "The packet should be enqueued");
+      uids.push_back (item->GetPacket ()->GetUid ());
+    }
+  NS_TEST_EXPECT_MSG_EQ (qdisc->GetNPackets (), 5, "There should be 5 packets in the queue disc");
+
+  // root: A A C A A; A: A2 A2 A1 A1; A2: ranks 3 5; A1: ranks 0 7
+  std::vector<uint64_t> expected = {uids[3], uids[1], uids[2], uids[0], uids[4]};
+  for (uint64_t uid : expected)
+    {
+      Ptr<const QueueDiscItem> peeked = qdisc->Peek ();
+      Ptr<QueueDiscItem> item = qdisc->Dequeue ();
+      NS_TEST_ASSERT_MSG_NE (item, 0, "The queue disc should not be empty");
+      NS_TEST_EXPECT_MSG_EQ (peeked, item, "Peek should return the packet to dequeue next");
+      NS_TEST_EXPECT_MSG_EQ (item->GetPacket ()->GetUid (), uid, "Unexpected packet");
+    }
+  NS_TEST_EXPECT_MSG_EQ (qdisc->Dequeue (), 0, "The queue disc should be empty");
+
+  // packets which no filter maps to a leaf are dropped
+  Ptr<QueueDiscItem> item = Create<PifoTreeTestItem> (Create<Packet> (100), a, 0);
+  NS_TEST_EXPECT_MSG_EQ (qdisc->Enqueue (item), false, "The packet should be dropped");
+  NS_TEST_EXPECT_MSG_EQ (qdisc->GetStats ().GetNDroppedPackets (PifoTreeQueueDisc::UNCLASSIFIED_DROP), 1,
+                         "The packet should be dropped as unclassified");
+
+  Simulator::Destroy ();
+}
+
+/**
+ * \ingroup traffic-control-test
+ * \ingroup tests
+ *
+ * \brief Pifo Tree Queue Disc Shaping Test Case
+ *
+ * A packet held by the shaper of its leaf must not be dequeued before the
+ * shaper releases it, while the packets of other leaves are
+ */
+class PifoTreeQueueDiscShapingTestCase : public TestCase
+{
+public:
+  PifoTreeQueueDiscShapingTestCase ();
+  virtual void DoRun (void);
+
+private:
+  /**
+   * Shaper releasing the packets one second after their arrival
+   *
+   * \param item the packet
+   * \return the release time
+   */
+  static Time Delay (Ptr<const QueueDiscItem> item);
+
+  /**
+   * Dequeue a packet and check it
+   *
+   * \param qdisc the queue disc
+   * \param expected the expected packet, or 0 if no packet is expected
+   */
+  void Check (Ptr<PifoTreeQueueDisc> qdisc, Ptr<QueueDiscItem> expected);
+};
+
+PifoTreeQueueDiscShapingTestCase::PifoTreeQueueDiscShapingTestCase ()
+  : TestCase ("Check that the pifo tree queue disc holds shaped packets")
+{
+}
+
+Time
+PifoTreeQueueDiscShapingTestCase::Delay (Ptr<const QueueDiscItem> item)
+{
+  return Simulator::Now () + Seconds (1);
+}
+
+void
+PifoTreeQueueDiscShapingTestCase::Check (Ptr<PifoTreeQueueDisc> qdisc, Ptr<QueueDiscItem> expected)
+{
+  Ptr<QueueDiscItem> item = qdisc->Dequeue ();
+  NS_TEST_EXPECT_MSG_EQ (item, expected, "Unexpected packet dequeued at " << Simulator::Now ().GetSeconds () << "s");
+}
+
+void
+PifoTreeQueueDiscShapingTestCase::DoRun (void)
+{
+  Ptr<PifoTreeQueueDisc> qdisc = CreateObject<PifoTreeQueueDisc> ();
+  uint32_t shaped = qdisc->AddNode (0);
+  uint32_t unshaped = qdisc->AddNode (0);
+  qdisc->AddPacketFilter (CreateObject<PifoTreeTestFilter> (std::map<uint32_t, int32_t> ()));
+  qdisc->SetShaper (shaped, MakeCallback (&PifoTreeQueueDiscShapingTestCase::Delay));
+  qdisc->Initialize ();
+
+  Ptr<QueueDiscItem> shapedItem = Create<PifoTreeTestItem> (Create<Packet> (100), shaped, 0);
+  qdisc->Enqueue (shapedItem);
+  Ptr<QueueDiscItem> unshapedItem = Create<PifoTreeTestItem> (Create<Packet> (100), unshaped, 0);
+  qdisc->Enqueue (unshapedItem);
+
+  // the packet of the shaped leaf is held for one second
+  Check (qdisc, unshapedItem);
+  Check (qdisc, 0);
+  NS_TEST_EXPECT_MSG_EQ (qdisc->GetNPackets (), 1, "The shaped packet should still be queued");
+
+  Simulator::Schedule (Seconds (0.5), &PifoTreeQueueDiscShapingTestCase::Check, this,
+                       qdisc, Ptr<QueueDiscItem> (0));
+  Simulator::Schedule (Seconds (1.5), &PifoTreeQueueDiscShapingTestCase::Check, this,
+                       qdisc, shapedItem);
+  Simulator::Run ();
+
+  NS_TEST_EXPECT_MSG_EQ (qdisc->GetNPackets (), 0, "The queue disc should be empty");
+
+  Simulator::Destroy ();
+}
+
+/**
+ * \ingroup traffic-control-test
+ * \ingroup tests
+ *
+ * \brief Pifo Tree Queue Disc Fair Queueing Test Case
+ *
+ * A STFQ root over two leaves: the virtual time of the root advances as
+ * packets are dequeued, hence a leaf coming back after being idle starts
+ * at the virtual time rather than at its stale finish time
+ */
+class PifoTreeQueueDiscFairQueueingTestCase : public TestCase
+{
+public:
+  PifoTreeQueueDiscFairQueueingTestCase ();
+  virtual void DoRun (void);
+};
+
+PifoTreeQueueDiscFairQueueingTestCase::PifoTreeQueueDiscFairQueueingTestCase ()
+  : TestCase ("Check that the pifo tree queue disc advances the virtual time of its rank filters")
+{
+}
+
+void
+PifoTreeQueueDiscFairQueueingTestCase::DoRun (void)
+{
+  Ptr<PifoTreeQueueDisc> qdisc = CreateObject<PifoTreeQueueDisc> ();
+  uint32_t a = qdisc->AddNode (0);
+  uint32_t b = qdisc->AddNode (0);
+  qdisc->AddPacketFilter (CreateObject<PifoTreeTestFilter> (std::map<uint32_t, int32_t> ()));
+  qdisc->SetRankFilter (0, CreateObject<StfqRankFilter> ());
+  qdisc->Initialize ();
+
+  // start times: A at 0, 1000, 2000 and 3000, B at 0
+  for (uint32_t i = 0; i < 4; i++)
+    {
+      qdisc->Enqueue (Create<PifoTreeTestItem> (Create<Packet> (1000), a, 0));
+    }
+  qdisc->Enqueue (Create<PifoTreeTestItem> (Create<Packet> (1000), b, 0));
+  while (qdisc->Dequeue () != 0)
+    {
+    }
+
+  // the virtual time is 3000: B, idle, starts there rather than at its
+  // finish time 1000 (start times: A at 4000 and 5000, B at 3000, 4000 and
+  // 5000)
+  for (uint32_t i = 0; i < 2; i++)
+    {
+      qdisc->Enqueue (Create<PifoTreeTestItem> (Create<Packet> (1000), a, 0));
+    }
+  for (uint32_t i = 0; i < 3; i++)
+    {
+      qdisc->Enqueue (Create<PifoTreeTestItem> (Create<Packet> (1000), b, 0));
+    }
+
+  for (uint32_t leaf : {b, a, b, a, b})
+    {
+      Ptr<QueueDiscItem> item = qdisc->Dequeue ();
+      NS_TEST_ASSERT_MSG_NE (item, 0, "The queue disc should not be empty");
+      NS_TEST_EXPECT_MSG_EQ (item->GetFlowHash (), leaf, "Unexpected leaf served");
+    }
+
+  Simulator::Destroy ();
+}
+
+/**
+ * \ingroup traffic-control-test
+ * \ingroup tests
+ *
+ * \brief Pifo Tree Queue Disc Byte Mode Test Case
+ *
+ * In byte mode, the limit applies to the sum of the sizes of the packets
+ * queued in all the leaves
+ */
+class PifoTreeQueueDiscByteModeTestCase : public TestCase
+{
+public:
+  PifoTreeQueueDiscByteModeTestCase ();
+  virtual void DoRun (void);
+};
+
+PifoTreeQueueDiscByteModeTestCase::PifoTreeQueueDiscByteModeTestCase ()
+  : TestCase ("Check the byte mode of the pifo tree queue disc")
+{
+}
+
+void
+PifoTreeQueueDiscByteModeTestCase::DoRun (void)
+{
+  Ptr<PifoTreeQueueDisc> qdisc = CreateObject<PifoTreeQueueDisc> ();
+  uint32_t a = qdisc->AddNode (0);
+  uint32_t b = qdisc->AddNode (0);
+  qdisc->SetAttribute ("MaxSize", QueueSizeValue (QueueSize ("250B")));
+  qdisc->AddPacketFilter (CreateObject<PifoTreeTestFilter> (std::map<uint32_t, int32_t> ()));
+  qdisc->Initialize ();
+
+  NS_TEST_EXPECT_MSG_EQ (qdisc->Enqueue (Create<PifoTreeTestItem> (Create<Packet> (100), a, 0)), true,
+                         "The packet should be enqueued");
+  NS_TEST_EXPECT_MSG_EQ (qdisc->Enqueue (Create<PifoTreeTestItem> (Create<Packet> (100), b, 0)), true,
+                         "The packet should be enqueued");
+  NS_TEST_EXPECT_MSG_EQ (qdisc->Enqueue (Create<PifoTreeTestItem> (Create<Packet> (100), a, 1)), false,
+                         "The packet should not fit");
+  NS_TEST_EXPECT_MSG_EQ (qdisc->Enqueue (Create<PifoTreeTestItem> (Create<Packet> (50), b, 1)), true,
+                         "The packet should fit");
+  NS_TEST_EXPECT_MSG_EQ (qdisc->GetNBytes (), 250, "There should be 250 bytes in the queue disc");
+  NS_TEST_EXPECT_MSG_EQ (qdisc->GetStats ().GetNDroppedPackets (PifoTreeQueueDisc::LIMIT_EXCEEDED_DROP), 1,
+                         "1 packet should have been dropped");
+
+  Simulator::Destroy ();
+}
+
+/**
+ * \ingroup traffic-control-test
+ * \ingroup tests
+ *
+ * \brief Pifo Tree Queue Disc Test Suite
+ */
+static class PifoTreeQueueDiscTestSuite : public TestSuite
+{
+public:
+  PifoTreeQueueDiscTestSuite ()
+    : TestSuite ("pifo-tree-queue-disc", UNIT)
+  {
+    AddTestCase (new PifoTreeQueueDiscHierarchyTestCase (), TestCase::QUICK);
+    AddTestCase (new PifoTreeQueueDiscShapingTestCase (), TestCase::QUICK);
+    AddTestCase (new PifoTreeQueueDiscFairQueueingTestCase (), TestCase::QUICK);
+    AddTestCase (new PifoTreeQueueDiscByteModeTestCase (), TestCase::QUICK);
+  }
+} g_pifoTreeQueueDiscTestSuite; ///< the test suite
@@ -0,0 +1,249 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Copyright (c) 2018 Stanford University
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Author: Stephen Ibanez <sibanez@stanford.edu>
+ */
+
+#include "ns3/test.h"
+#include "ns3/queue-estimators.h"
+#include <cmath>
+#include <random>
+
+using namespace ns3;
+
+/**
+ * \ingroup traffic-control-test
+ * \ingroup tests
+ *
+ * \brief Fixed-point multiplication test
+ */
+class MulQ32TestCase : public TestCase
+{
+public:
+  MulQ32TestCase ();
+  virtual void DoRun (void);
+};
+
+MulQ32TestCase::MulQ32TestCase ()
+  : TestCase ("Check the fixed-point multiplication with 32 fractional bits")
+{
+}
+
+void
+MulQ32TestCase::DoRun (void)
+{
+  const uint64_t one = (uint64_t) 1 << 32;
+  NS_TEST_EXPECT_MSG_EQ (MulQ32 (12345, one), 12345, "Multiplying by 1 should not change the value");
+  NS_TEST_EXPECT_MSG_EQ (MulQ32 (0, 0xffffffffffffffff), 0, "Multiplying 0 should give 0");
+  NS_TEST_EXPECT_MSG_EQ (MulQ32 (3, one / 2), 2, "1.5 should be rounded to 2");
+  NS_TEST_EXPECT_MSG_EQ (MulQ32 (5, one / 4), 1, "1.25 should be rounded to 1");
+  NS_TEST_EXPECT_MSG_EQ (MulQ32 ((uint64_t) 1 << 40, (uint64_t) 1 << 40), (uint64_t) 1 << 48,
+                         "The upper halves of the operands should be accounted for");
+  // the largest scale of P4QueueDisc::MapSize, (2^32 - 1) / 1 with 32 fractional bits
+  NS_TEST_EXPECT_MSG_EQ (MulQ32 (1, 0xffffffff00000000), 0xffffffff, "Unexpected product of the largest scale");
+}
+
+/**
+ * \ingroup traffic-control-test
+ * \ingroup tests
+ *
+ * \brief Queue size estimator test
+ *
+ * The fixed-point EWMA follows the floating point computation of RED,
+ * including the decay over long idle periods
+ */
+class QueueSizeEstimatorTestCase : public TestCase
+{
+public:
+  QueueSizeEstimatorTestCase ();
+  virtual void DoRun (void);
+};
+
+QueueSizeEstimatorTestCase::QueueSizeEstimatorTestCase ()
+  : TestCase ("Check the queue size estimator against the floating point EWMA")
+{
+}
+
+void
+QueueSizeEstimatorTestCase::DoRun (void)
+{
+  std::mt19937 rng (1);
+  std::uniform_int_distribution<uint32_t> queued (0, 100000);
+  std::uniform_int_distribution<uint32_t> steps (1, 4);
+  const uint32_t idleSteps[] = {10, 63, 64, 100, 1000, 100000};
+
+  const double weights[] = {0.002, 0.05, 0.5, 1.0};
+  for (double qW : weights)
+    {
+      QueueSizeEstimator est;
+      est.SetWeight (qW);
+      NS_TEST_EXPECT_MSG_EQ (est.GetWeight (), qW, "Unexpected weight");
+      NS_TEST_EXPECT_MSG_EQ (est.GetAverage (), 0, "The average should start at 0");
+
+      double ref = 0;
+      for (uint32_t i = 0; i < 10000; i++)
+        {
+          uint32_t nQueued = queued (rng);
+          // an idle period now and then
+          uint32_t m = (i % 1000 == 999 ? idleSteps[(i / 1000) % 6] : steps (rng));
+          ref = ref * std::pow (1.0 - qW, m) + qW * nQueued;
+          double avg = est.Update (nQueued, m);
+          NS_TEST_ASSERT_MSG_EQ_TOL (avg, ref, 1e-3 + ref * 1e-6,
+                                     "The average diverged at sample " << i << " with weight " << qW);
+        }
+      NS_TEST_EXPECT_MSG_EQ (est.GetRoundedAverage (), (uint32_t) std::round (est.GetAverage ()),
+                             "Unexpected rounded average");
+
+      est.Reset ();
+      NS_TEST_EXPECT_MSG_EQ (est.GetAverage (), 0, "The average should be 0 after a reset");
+    }
+}
+
+/**
+ * \ingroup traffic-control-test
+ * \ingroup tests
+ *
+ * \brief Floating point queue size estimator test
+ *
+ * In floating point mode, the EWMA used by RED must be bit-exact with the
+ * computation RED carried out before it used the shared estimator
+ */
+class QueueSizeEstimatorFloatingPointTestCase : public TestCase
+{
+public:
+  QueueSizeEstimatorFloatingPointTestCase ();
+  virtual void DoRun (void);
+};
+
+QueueSizeEstimatorFloatingPointTestCase::QueueSizeEstimatorFloatingPointTestCase ()
+  : TestCase ("Check the floating point queue size estimator against the RED EWMA")
+{
+}
+
+void
+QueueSizeEstimatorFloatingPointTestCase::DoRun (void)
+{
+  std::mt19937 rng (2);
+  std::uniform_int_distribution<uint32_t> queued (0, 100000);
+  std::uniform_int_distribution<uint32_t> steps (1, 4);
+  const uint32_t idleSteps[] = {10, 63, 64, 100, 1000, 100000};
+
+  // the default weight of RED, and the ones of its -1 and -2 modes for a
+  // 10 Mbps link with 500-byte packets
+  const double weights[] = {0.002, 1.0 - std::exp (-1.0 / 2500.0), 1.0 - std::exp (-10.0 / 2500.0), 1.0};
+  for (double qW : weights)
+    {
+      QueueSizeEstimator est;
+      est.SetFloatingPoint (true);
+      est.SetWeight (qW);
+      est.Reset ();
+
+      double qAvg = 0.0;
+      for (uint32_t i = 0; i < 10000; i++)
+        {
+          uint32_t nQueued = queued (rng);
+          uint32_t m = (i % 1000 == 999 ? idleSteps[(i / 1000) % 6] : steps (rng));
+          // RedQueueDisc::Estimator
+          double newAve = qAvg * std::pow (1.0 - qW, m);
+          newAve += qW * nQueued;
+          qAvg = newAve;
+          NS_TEST_ASSERT_MSG_EQ (est.Update (nQueued, m), qAvg,
+                                 "The average differs at sample " << i << " with weight " << qW);
+        }
+      NS_TEST_EXPECT_MSG_EQ (est.GetAverage (), qAvg, "Unexpected average");
+      NS_TEST_EXPECT_MSG_EQ (est.GetRoundedAverage (), (uint32_t) std::round (qAvg),
+                             "Unexpected rounded average");
+
+      est.Reset ();
+      NS_TEST_EXPECT_MSG_EQ (est.GetAverage (), 0, "The average should be 0 after a reset");
+    }
+
+  // the average reaches the fractional values RED compares with its thresholds
+  QueueSizeEstimator est;
+  est.SetFloatingPoint (true);
+  est.SetWeight (0.5);
+  NS_TEST_EXPECT_MSG_EQ (est.Update (5, 1), 2.5, "Unexpected average");
+  NS_TEST_EXPECT_MSG_EQ (est.Update (0, 2), 0.625, "Unexpected average");
+}
+
+/**
+ * \ingroup traffic-control-test
+ * \ingroup tests
+ *
+ * \brief Dequeue rate and sojourn time estimators test
+ */
+class DequeueEstimatorsTestCase : public TestCase
+{
+public:
+  DequeueEstimatorsTestCase ();
+  virtual void DoRun (void);
+};
+
+DequeueEstimatorsTestCase::DequeueEstimatorsTestCase ()
+  : TestCase ("Check the dequeue rate and sojourn time estimators")
+{
+}
+
+void
+DequeueEstimatorsTestCase::DoRun (void)
+{
+  DequeueRateEstimator rate;
+  rate.SetThreshold (1000);
+
+  // no measurement cycle starts below the threshold
+  NS_TEST_EXPECT_MSG_EQ (rate.Update (MilliSeconds (0), 500, 800), 0, "No cycle should have started");
+
+  // 500 bytes every ms with a large backlog: a cycle ends every 2 ms
+  rate.Update (MilliSeconds (1), 500, 5000);
+  NS_TEST_EXPECT_MSG_EQ_TOL (rate.Update (MilliSeconds (2), 500, 4500), 1e6, 1,
+                             "The first cycle should measure 1000 bytes in 1 ms");
+  NS_TEST_EXPECT_MSG_EQ_TOL (rate.GetRate (), 1e6, 1, "Unexpected rate");
+  rate.Update (MilliSeconds (3), 500, 4000);
+  rate.Update (MilliSeconds (6), 500, 3500);
+  // the 1000 bytes of the second cycle took 4 ms, averaged with the first cycle
+  NS_TEST_EXPECT_MSG_EQ_TOL (rate.GetRate (), 0.5 * 1e6 + 0.5 * 2.5e5, 1, "The cycles should be averaged");
+  NS_TEST_EXPECT_MSG_EQ (rate.GetRoundedRate (), 625000, "Unexpected rounded rate");
+
+  rate.Reset ();
+  NS_TEST_EXPECT_MSG_EQ (rate.GetRate (), 0, "The rate should be 0 after a reset");
+
+  SojournTimeEstimator sojourn;
+  NS_TEST_EXPECT_MSG_EQ (sojourn.GetLatency (), 0, "The latency should start at 0");
+  NS_TEST_EXPECT_MSG_EQ (sojourn.Update (Seconds (1), Seconds (1.5)), 500000000, "Unexpected sojourn time");
+  NS_TEST_EXPECT_MSG_EQ (sojourn.GetLatency (), 500000000, "The latest sojourn time should be kept");
+  sojourn.Reset ();
+  NS_TEST_EXPECT_MSG_EQ (sojourn.GetLatency (), 0, "The latency should be 0 after a reset");
+}
+
+/**
+ * \ingroup traffic-control-test
+ * \ingroup tests
+ *
+ * \brief Queue estimators test suite
+ */
+static class QueueEstimatorsTestSuite : public TestSuite
+{
+public:
+  QueueEstimatorsTestSuite ()
+    : TestSuite ("queue-estimators", UNIT)
+  {
+    AddTestCase (new MulQ32TestCase (), TestCase::QUICK);
+    AddTestCase (new QueueSizeEstimatorTestCase (), TestCase::QUICK);
+    AddTestCase (new QueueSizeEstimatorFloatingPointTestCase (), TestCase::QUICK);
+    AddTestCase (new DequeueEstimatorsTestCase (), TestCase::QUICK);
+  }
+} g_queueEstimatorsTestSuite; ///< the test suite
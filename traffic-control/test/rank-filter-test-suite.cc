@@ -0,0 +1,363 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Copyright (c) 2018 Stanford University
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Authors: Stephen Ibanez <sibanez@stanford.edu>
+ *
+ */
+
+#include "ns3/test.h"
+#include "ns3/rank-filter.h"
+#include "ns3/pifo-queue-disc.h"
+#include "ns3/packet.h"
+#include "ns3/simulator.h"
+#include "ns3/uinteger.h"
+#include "ns3/enum.h"
+#include "ns3/data-rate.h"
+#include <vector>
+
+using namespace ns3;
+
+/**
+ * \ingroup traffic-control-test
+ * \ingroup tests
+ *
+ * \brief Rank Filter Test Item
+ */
+class RankFilterTestItem : public QueueDiscItem
+{
+public:
+  /**
+   * Constructor
+   *
+   * \param p the packet
+   * \param flow the flow hash of the packet
+   */
+  RankFilterTestItem (Ptr<Packet> p, uint32_t flow);
+  virtual ~RankFilterTestItem ();
+  virtual void AddHeader (void);
+  virtual bool Mark (void);
+  virtual uint32_t Hash (uint32_t perturbation) const;
+
+private:
+  uint32_t m_flow;  //!< the flow hash of the packet
+};
+
+RankFilterTestItem::RankFilterTestItem (Ptr<Packet> p, uint32_t flow)
+  : QueueDiscItem (p, Address (), 0),
+    m_flow (flow)
+{
+}
+
+RankFilterTestItem::~RankFilterTestItem ()
+{
+}
+
+void
+RankFilterTestItem::AddHeader (void)
+{
+}
+
+bool
+RankFilterTestItem::Mark (void)
+{
+  return false;
+}
+
+uint32_t
+RankFilterTestItem::Hash (uint32_t perturbation) const
+{
+  return m_flow;
+}
+
+/**
+ * \ingroup traffic-control-test
+ * \ingroup tests
+ *
+ * \brief Rank Filter Fair Queueing Test Case
+ *
+ * A PifoQueueDisc with a STFQ filter serves a flow of weight 2 twice as
+ * fast as a flow of weight 1
+ */
+class RankFilterFairQueueingTestCase : public TestCase
+{
+public:
+  RankFilterFairQueueingTestCase ();
+  virtual void DoRun (void);
+};
+
+RankFilterFairQueueingTestCase::RankFilterFairQueueingTestCase ()
+  : TestCase ("Check that the STFQ rank filter shares the link according to the weights")
+{
+}
+
+void
+RankFilterFairQueueingTestCase::DoRun (void)
+{
+  Ptr<StfqRankFilter> filter = CreateObject<StfqRankFilter> ();
+  filter->SetFlowWeight (2, 2.0);
+  Ptr<PifoQueueDisc> qdisc = CreateObject<PifoQueueDisc> ();
+  qdisc->AddPacketFilter (filter);
+  qdisc->Initialize ();
+
+  // the flow of weight 1 arrives first, ties are broken in arrival order
+  for (uint32_t flow = 1; flow <= 2; flow++)
+    {
+      for (uint32_t i = 0; i < 4; i++)
+        {
+          qdisc->Enqueue (Create<RankFilterTestItem> (Create<Packet> (1000), flow));
+        }
+    }
+  NS_TEST_EXPECT_MSG_EQ (filter->GetNFlows (), 2, "The filter should hold the state of 2 flows");
+
+  // start times: flow 1 at 0, 1000, 2000, 3000; flow 2 at 0, 500, 1000, 1500
+  std::vector<uint32_t> expected = {1, 2, 2, 1, 2, 2, 1, 1};
+  for (uint32_t flow : expected)
+    {
+      Ptr<QueueDiscItem> item = qdisc->Dequeue ();
+      NS_TEST_ASSERT_MSG_NE (item, 0, "The queue disc should not be empty");
+      NS_TEST_EXPECT_MSG_EQ (item->GetFlowHash (), flow, "Unexpected flow served");
+    }
+
+  // the virtual time has reached the start time of the last packet, hence
+  // a new flow starts there rather than at 0
+  Ptr<QueueDiscItem> item = Create<RankFilterTestItem> (Create<Packet> (1000), 3);
+  qdisc->Enqueue (item);
+  NS_TEST_EXPECT_MSG_EQ (item->GetRank (), 3000, "A new flow should start at the virtual time");
+
+  Simulator::Destroy ();
+}
+
+/**
+ * \ingroup traffic-control-test
+ * \ingroup tests
+ *
+ * \brief Rank Filter Eviction Test Case
+ *
+ * The packets a PifoQueueDisc evicts are not dequeued for transmission,
+ * hence they do not advance the virtual time of a STFQ filter, and the
+ * packets it drops after computing their rank do not advance their flow
+ */
+class RankFilterEvictionTestCase : public TestCase
+{
+public:
+  RankFilterEvictionTestCase ();
+  virtual void DoRun (void);
+};
+
+RankFilterEvictionTestCase::RankFilterEvictionTestCase ()
+  : TestCase ("Check that evicted and dropped packets do not advance the state of the STFQ rank filter")
+{
+}
+
+void
+RankFilterEvictionTestCase::DoRun (void)
+{
+  Ptr<StfqRankFilter> filter = CreateObject<StfqRankFilter> ();
+  Ptr<PifoQueueDisc> qdisc = CreateObject<PifoQueueDisc> ();
+  qdisc->SetAttribute ("MaxSize", QueueSizeValue (QueueSize ("3p")));
+  qdisc->SetAttribute ("Engine", EnumValue (MIN_MAX_HEAP_ENGINE));
+  qdisc->SetAttribute ("OverflowPolicy", EnumValue (PifoQueueDisc::DROP_WORST));
+  qdisc->AddPacketFilter (filter);
+  qdisc->Initialize ();
+
+  // start times 0, 1000 and 2000
+  for (uint32_t i = 0; i < 3; i++)
+    {
+      qdisc->Enqueue (Create<RankFilterTestItem> (Create<Packet> (1000), 1));
+    }
+
+  // a new flow starts at the virtual time and evicts the packet of rank 2000
+  Ptr<QueueDiscItem> item = Create<RankFilterTestItem> (Create<Packet> (1000), 2);
+  qdisc->Enqueue (item);
+  NS_TEST_EXPECT_MSG_EQ (item->GetRank (), 0, "A new flow should start at the virtual time");
+  NS_TEST_EXPECT_MSG_EQ (qdisc->GetStats ().GetNDroppedPackets (PifoQueueDisc::EVICTED_DROP), 1,
+                         "The packet of rank 2000 should have been evicted");
+
+  // the eviction did not advance the virtual time
+  item = Create<RankFilterTestItem> (Create<Packet> (1000), 3);
+  qdisc->Enqueue (item);
+  NS_TEST_EXPECT_MSG_EQ (item->GetRank (), 0, "The eviction should not advance the virtual time");
+  NS_TEST_EXPECT_MSG_EQ (qdisc->GetStats ().GetNDroppedPackets (PifoQueueDisc::EVICTED_DROP), 2,
+                         "The packet of rank 1000 should have been evicted");
+
+  for (uint32_t flow : {1, 2, 3})
+    {
+      item = qdisc->Dequeue ();
+      NS_TEST_ASSERT_MSG_NE (item, 0, "The queue disc should not be empty");
+      NS_TEST_EXPECT_MSG_EQ (item->GetFlowHash (), flow, "Unexpected flow served");
+    }
+
+  // a packet dropped after its rank was computed leaves the state of its
+  // flow unchanged
+  filter = CreateObject<StfqRankFilter> ();
+  qdisc = CreateObject<PifoQueueDisc> ();
+  qdisc->SetAttribute ("MaxSize", QueueSizeValue (QueueSize ("3p")));
+  qdisc->SetAttribute ("Engine", EnumValue (MIN_MAX_HEAP_ENGINE));
+  qdisc->SetAttribute ("OverflowPolicy", EnumValue (PifoQueueDisc::DROP_WORST));
+  qdisc->AddPacketFilter (filter);
+  qdisc->Initialize ();
+
+  // start times: flow 2 at 0, flow 1 at 0 and 100
+  qdisc->Enqueue (Create<RankFilterTestItem> (Create<Packet> (1000), 2));
+  qdisc->Enqueue (Create<RankFilterTestItem> (Create<Packet> (100), 1));
+  qdisc->Enqueue (Create<RankFilterTestItem> (Create<Packet> (100), 1));
+
+  // starts at 1000, after all the queued packets
+  qdisc->Enqueue (Create<RankFilterTestItem> (Create<Packet> (1000), 2));
+  NS_TEST_EXPECT_MSG_EQ (qdisc->GetStats ().GetNDroppedPackets (PifoQueueDisc::LIMIT_EXCEEDED_DROP), 1,
+                         "The second packet of flow 2 should have been dropped");
+
+  qdisc->Dequeue ();
+  item = Create<RankFilterTestItem> (Create<Packet> (1000), 2);
+  qdisc->Enqueue (item);
+  NS_TEST_EXPECT_MSG_EQ (item->GetRank (), 1000, "The dropped packet should not advance its flow");
+
+  Simulator::Destroy ();
+}
+
+/**
+ * \ingroup traffic-control-test
+ * \ingroup tests
+ *
+ * \brief Rank Filter Deadline Test Case
+ *
+ * The EDF filter ranks the packets by deadline, the LSTF filter by deadline
+ * minus transmission time
+ */
+class RankFilterDeadlineTestCase : public TestCase
+{
+public:
+  RankFilterDeadlineTestCase ();
+  virtual void DoRun (void);
+};
+
+RankFilterDeadlineTestCase::RankFilterDeadlineTestCase ()
+  : TestCase ("Check the ranks computed by the EDF and LSTF rank filters")
+{
+}
+
+void
+RankFilterDeadlineTestCase::DoRun (void)
+{
+  Ptr<EdfRankFilter> edf = CreateObject<EdfRankFilter> ();
+  edf->SetAttribute ("Deadline", TimeValue (MilliSeconds (5)));
+  edf->SetFlowDeadline (2, MilliSeconds (1));
+
+  int32_t rank1 = edf->Classify (Create<RankFilterTestItem> (Create<Packet> (100), 1));
+  int32_t rank2 = edf->Classify (Create<RankFilterTestItem> (Create<Packet> (100), 2));
+  NS_TEST_EXPECT_MSG_EQ (rank1, 5000, "The default deadline should be 5 ms, in us");
+  NS_TEST_EXPECT_MSG_EQ (rank2, 1000, "The deadline of flow 2 should be 1 ms, in us");
+
+  // ranks beyond 2^31 are only returned in full by ClassifyRank
+  edf->SetAttribute ("TimeUnit", TimeValue (NanoSeconds (1)));
+  uint64_t rank = 0;
+  bool classified = edf->ClassifyRank (Create<RankFilterTestItem> (Create<Packet> (100), 3), rank);
+  NS_TEST_EXPECT_MSG_EQ (classified, true, "The EDF filter should classify the packet");
+  NS_TEST_EXPECT_MSG_EQ (rank, 5000000, "The default deadline should be 5 ms, in ns");
+  edf->SetAttribute ("Deadline", TimeValue (Seconds (5)));
+  edf->ClassifyRank (Create<RankFilterTestItem> (Create<Packet> (100), 4), rank);
+  NS_TEST_EXPECT_MSG_EQ (rank, 5000000000ULL, "The rank should not be truncated to 31 bits");
+
+  Ptr<LstfRankFilter> lstf = CreateObject<LstfRankFilter> ();
+  lstf->SetAttribute ("Deadline", TimeValue (MilliSeconds (5)));
+  lstf->SetAttribute ("LinkRate", DataRateValue (DataRate ("8Mbps")));
+
+  // 1 us per byte at 8 Mbps
+  int32_t small = lstf->Classify (Create<RankFilterTestItem> (Create<Packet> (100), 1));
+  int32_t large = lstf->Classify (Create<RankFilterTestItem> (Create<Packet> (1000), 1));
+  NS_TEST_EXPECT_MSG_EQ (small, 4900, "Unexpected slack of the small packet");
+  NS_TEST_EXPECT_MSG_EQ (large, 4000, "Unexpected slack of the large packet");
+
+  Simulator::Destroy ();
+}
+
+/**
+ * \ingroup traffic-control-test
+ * \ingroup tests
+ *
+ * \brief Rank Filter Aging Test Case
+ *
+ * The state of a flow idle for longer than the flow timeout is reset
+ */
+class RankFilterAgingTestCase : public TestCase
+{
+public:
+  RankFilterAgingTestCase ();
+  virtual void DoRun (void);
+
+private:
+  /**
+   * Classify a packet of flow 1 and check its rank
+   *
+   * \param filter the filter
+   * \param expected the expected rank
+   */
+  void Check (Ptr<RankFilter> filter, int32_t expected);
+};
+
+RankFilterAgingTestCase::RankFilterAgingTestCase ()
+  : TestCase ("Check that the rank filters reset the state of idle flows")
+{
+}
+
+void
+RankFilterAgingTestCase::Check (Ptr<RankFilter> filter, int32_t expected)
+{
+  int32_t rank = filter->Classify (Create<RankFilterTestItem> (Create<Packet> (1000), 1));
+  NS_TEST_EXPECT_MSG_EQ (rank, expected, "Unexpected rank at " << Simulator::Now ().GetSeconds () << "s");
+}
+
+void
+RankFilterAgingTestCase::DoRun (void)
+{
+  Ptr<WfqRankFilter> filter = CreateObject<WfqRankFilter> ();
+  filter->SetAttribute ("FlowTimeout", TimeValue (MilliSeconds (1)));
+  filter->SetAttribute ("MaxFlows", UintegerValue (4));
+
+  Check (filter, 1000);
+  Simulator::Schedule (MicroSeconds (500), &RankFilterAgingTestCase::Check, this, filter, 2000);
+  Simulator::Schedule (MilliSeconds (2), &RankFilterAgingTestCase::Check, this, filter, 1000);
+  Simulator::Run ();
+
+  // the table grows past MaxFlows to hold the active flows
+  for (uint32_t flow = 0; flow < 100; flow++)
+    {
+      filter->Classify (Create<RankFilterTestItem> (Create<Packet> (1000), flow));
+    }
+  NS_TEST_EXPECT_MSG_EQ (filter->GetNFlows (), 100, "The table should grow to hold 100 active flows");
+
+  Simulator::Destroy ();
+}
+
+/**
+ * \ingroup traffic-control-test
+ * \ingroup tests
+ *
+ * \brief Rank Filter Test Suite
+ */
+static class RankFilterTestSuite : public TestSuite
+{
+public:
+  RankFilterTestSuite ()
+    : TestSuite ("rank-filter", UNIT)
+  {
+    AddTestCase (new RankFilterFairQueueingTestCase (), TestCase::QUICK);
+    AddTestCase (new RankFilterEvictionTestCase (), TestCase::QUICK);
+    AddTestCase (new RankFilterDeadlineTestCase (), TestCase::QUICK);
+    AddTestCase (new RankFilterAgingTestCase (), TestCase::QUICK);
+  }
+} g_rankFilterTestSuite; ///< the test suite
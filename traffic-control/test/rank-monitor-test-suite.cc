@@ -0,0 +1,245 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Copyright (c) 2018 Stanford University
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Authors: Stephen Ibanez <sibanez@stanford.edu>
+ *
+ */
+
+#include "ns3/test.h"
+#include "ns3/rank-monitor.h"
+#include "ns3/pifo-queue-disc.h"
+#include "ns3/packet.h"
+#include "ns3/simulator.h"
+#include "ns3/uinteger.h"
+#include "ns3/boolean.h"
+#include "ns3/enum.h"
+#include <limits>
+
+using namespace ns3;
+
+/**
+ * \ingroup traffic-control-test
+ * \ingroup tests
+ *
+ * \brief Rank Monitor Test Item
+ */
+class RankMonitorTestItem : public QueueDiscItem
+{
+public:
+  /**
+   * Constructor
+   *
+   * \param p the packet
+   * \param rank the rank of the packet
+   */
+  RankMonitorTestItem (Ptr<Packet> p, uint64_t rank);
+  virtual ~RankMonitorTestItem ();
+  virtual void AddHeader (void);
+  virtual bool Mark (void);
+};
+
+RankMonitorTestItem::RankMonitorTestItem (Ptr<Packet> p, uint64_t rank)
+  : QueueDiscItem (p, Address (), 0)
+{
+  SetRank (rank);
+}
+
+RankMonitorTestItem::~RankMonitorTestItem ()
+{
+}
+
+void
+RankMonitorTestItem::AddHeader (void)
+{
+}
+
+bool
+RankMonitorTestItem::Mark (void)
+{
+  return false;
+}
+
+/**
+ * \ingroup traffic-control-test
+ * \ingroup tests
+ *
+ * \brief Rank Monitor Histogram Test Case
+ *
+ * The buckets of the log-linear histogram are exact below 16 and split every
+ * power of two into 8 buckets above
+ */
+class RankMonitorHistogramTestCase : public TestCase
+{
+public:
+  RankMonitorHistogramTestCase ();
+  virtual void DoRun (void);
+};
+
+RankMonitorHistogramTestCase::RankMonitorHistogramTestCase ()
+  : TestCase ("Check the buckets of the rank histogram")
+{
+}
+
+void
+RankMonitorHistogramTestCase::DoRun (void)
+{
+  for (uint64_t rank = 0; rank < 16; rank++)
+    {
+      NS_TEST_EXPECT_MSG_EQ (RankMonitor::GetBucket (rank), rank, "Ranks below 16 should have their own bucket");
+    }
+  NS_TEST_EXPECT_MSG_EQ (RankMonitor::GetBucket (16), RankMonitor::GetBucket (17), "16 and 17 should share a bucket");
+  NS_TEST_EXPECT_MSG_EQ (RankMonitor::GetBucket (std::numeric_limits<uint64_t>::max ()), RankMonitor::N_BUCKETS - 1,
+                         "The highest rank should be in the last bucket");
+
+  for (uint32_t bucket = 1; bucket < RankMonitor::N_BUCKETS; bucket++)
+    {
+      uint64_t low = RankMonitor::GetBucketLowerBound (bucket);
+      NS_TEST_EXPECT_MSG_EQ (RankMonitor::GetBucket (low), bucket, "The lower bound should be in its bucket");
+      NS_TEST_EXPECT_MSG_EQ (RankMonitor::GetBucket (low - 1), bucket - 1, "The rank below should be in the previous bucket");
+    }
+
+  RankMonitor monitor (4, 10);
+  monitor.NotifyEnqueue (1000, 100);
+  monitor.NotifyEnqueue (1023, 100);
+  monitor.NotifyEnqueue (1024, 100);
+  NS_TEST_EXPECT_MSG_EQ (monitor.GetHistogram ()[RankMonitor::GetBucket (1000)], 2,
+                         "1000 and 1023 should share a bucket");
+  NS_TEST_EXPECT_MSG_EQ (monitor.GetBandPackets ()[3], 3, "High ranks should be in the last band");
+  NS_TEST_EXPECT_MSG_EQ (monitor.GetBandBytes ()[3], 300, "High ranks should be in the last band");
+}
+
+/**
+ * \ingroup traffic-control-test
+ * \ingroup tests
+ *
+ * \brief Rank Monitor Queue Disc Test Case
+ *
+ * A PIFO queue disc built on a single SP-PIFO FIFO serves packets in arrival
+ * order: its rank monitor reports the inversions with respect to an ideal
+ * PIFO, the occupancy of the rank bands and periodic samples
+ */
+class RankMonitorQueueDiscTestCase : public TestCase
+{
+public:
+  RankMonitorQueueDiscTestCase ();
+  virtual void DoRun (void);
+
+private:
+  /**
+   * Record a rank inversion
+   * \param item the dequeued packet
+   * \param magnitude the magnitude of the inversion
+   */
+  void Inversion (Ptr<const QueueDiscItem> item, uint64_t magnitude);
+  /**
+   * Record a rank sample
+   * \param monitor the rank monitor
+   */
+  void Sample (const RankMonitor &monitor);
+
+  uint64_t m_magnitude;  //!< sum of the traced inversion magnitudes
+  uint32_t m_nSamples;   //!< number of traced samples
+};
+
+RankMonitorQueueDiscTestCase::RankMonitorQueueDiscTestCase ()
+  : TestCase ("Check the rank monitor of the pifo queue disc"),
+    m_magnitude (0),
+    m_nSamples (0)
+{
+}
+
+void
+RankMonitorQueueDiscTestCase::Inversion (Ptr<const QueueDiscItem> item, uint64_t magnitude)
+{
+  m_magnitude += magnitude;
+}
+
+void
+RankMonitorQueueDiscTestCase::Sample (const RankMonitor &monitor)
+{
+  m_nSamples++;
+}
+
+void
+RankMonitorQueueDiscTestCase::DoRun (void)
+{
+  Ptr<PifoQueueDisc> qdisc = CreateObject<PifoQueueDisc> ();
+  qdisc->SetAttribute ("Engine", EnumValue (SP_PIFO_ENGINE));
+  qdisc->SetAttribute ("SpPifoQueues", UintegerValue (1));
+  qdisc->SetAttribute ("EnableRankMonitor", BooleanValue (true));
+  qdisc->SetAttribute ("RankBands", UintegerValue (4));
+  qdisc->SetAttribute ("RankBandWidth", UintegerValue (10));
+  qdisc->SetAttribute ("RankSampleInterval", TimeValue (MilliSeconds (1)));
+  qdisc->TraceConnectWithoutContext ("RankInversion",
+                                     MakeCallback (&RankMonitorQueueDiscTestCase::Inversion, this));
+  qdisc->TraceConnectWithoutContext ("RankSample",
+                                     MakeCallback (&RankMonitorQueueDiscTestCase::Sample, this));
+  qdisc->Initialize ();
+
+  const RankMonitor *monitor = qdisc->GetRankMonitor ();
+  NS_TEST_ASSERT_MSG_NE (monitor, 0, "The rank monitor should be enabled");
+
+  for (uint64_t rank : {30, 10, 20, 5})
+    {
+      qdisc->Enqueue (Create<RankMonitorTestItem> (Create<Packet> (100), rank));
+    }
+  for (uint32_t band = 0; band < 4; band++)
+    {
+      NS_TEST_EXPECT_MSG_EQ (monitor->GetBandPackets ()[band], 1, "There should be 1 packet in band " << band);
+      NS_TEST_EXPECT_MSG_EQ (monitor->GetBandBytes ()[band], 100, "There should be 100 bytes in band " << band);
+    }
+
+  // served in arrival order while the packet of rank 5 is queued
+  for (uint64_t rank : {30, 10, 20, 5})
+    {
+      Ptr<QueueDiscItem> item = qdisc->Dequeue ();
+      NS_TEST_ASSERT_MSG_NE (item, 0, "The queue disc should not be empty");
+      NS_TEST_EXPECT_MSG_EQ (item->GetRank (), rank, "A single FIFO should serve packets in arrival order");
+    }
+  NS_TEST_EXPECT_MSG_EQ (monitor->GetNInversions (), 3, "Three dequeues should be inversions");
+  NS_TEST_EXPECT_MSG_EQ (monitor->GetInversionMagnitude (), 45, "Unexpected total inversion magnitude");
+  NS_TEST_EXPECT_MSG_EQ (m_magnitude, 45, "The inversions should be traced");
+  NS_TEST_EXPECT_MSG_EQ (monitor->GetNInversions (), qdisc->GetNRankInversions (),
+                         "The monitor should agree with the engine");
+  for (uint32_t band = 0; band < 4; band++)
+    {
+      NS_TEST_EXPECT_MSG_EQ (monitor->GetBandPackets ()[band], 0, "Band " << band << " should be empty");
+    }
+
+  Simulator::Stop (MicroSeconds (2500));
+  Simulator::Run ();
+  NS_TEST_EXPECT_MSG_EQ (m_nSamples, 2, "The statistics should be sampled every millisecond");
+
+  Simulator::Destroy ();
+}
+
+/**
+ * \ingroup traffic-control-test
+ * \ingroup tests
+ *
+ * \brief Rank Monitor Test Suite
+ */
+static class RankMonitorTestSuite : public TestSuite
+{
+public:
+  RankMonitorTestSuite ()
+    : TestSuite ("rank-monitor", UNIT)
+  {
+    AddTestCase (new RankMonitorHistogramTestCase (), TestCase::QUICK);
+    AddTestCase (new RankMonitorQueueDiscTestCase (), TestCase::QUICK);
+  }
+} g_rankMonitorTestSuite; ///< the test suite